@@ -170,3 +170,125 @@ void ICalFormatTest::testAlarm()
     Alarm::Ptr alarm2 = event2->alarms()[0];
     QCOMPARE(*alarm, *alarm2);
 }
+
+void ICalFormatTest::testStringInterning()
+{
+    MemoryCalendar::Ptr calendar(new MemoryCalendar(QTimeZone::utc()));
+    for (int i = 0; i < 2; ++i) {
+        Event::Ptr event(new Event);
+        event->setUid(QStringLiteral("event%1").arg(i));
+        event->setDtStart(QDateTime(QDate(2019, 6, 3), QTime(10 + i, 0), Qt::UTC));
+        event->setOrganizer(Person(QStringLiteral("Organizer"), QStringLiteral("organizer@example.com")));
+        event->addAttendee(Attendee(QStringLiteral("Attendee"), QStringLiteral("attendee@example.com")));
+        event->setCategories(QStringList() << QStringLiteral("Work") << QStringLiteral("Meeting %1").arg(i));
+        event->setNonKDECustomProperty("X-TEAM", QStringLiteral("Calendaring"));
+        calendar->addEvent(event);
+    }
+
+    ICalFormat format;
+    const QString serialized = format.toString(calendar);
+
+    // Strings which repeat across incidences share their data after loading
+    MemoryCalendar::Ptr loaded(new MemoryCalendar(QTimeZone::utc()));
+    QVERIFY(format.fromString(loaded, serialized));
+    const Incidence::Ptr event0 = loaded->incidence(QStringLiteral("event0"));
+    const Incidence::Ptr event1 = loaded->incidence(QStringLiteral("event1"));
+    QVERIFY(event0 && event1);
+
+    QCOMPARE(event0->organizer().email(), QStringLiteral("organizer@example.com"));
+    QCOMPARE(event0->organizer().email().constData(), event1->organizer().email().constData());
+    QCOMPARE(event0->organizer().name().constData(), event1->organizer().name().constData());
+    QCOMPARE(event0->attendees().at(0).email().constData(), event1->attendees().at(0).email().constData());
+    QCOMPARE(event0->categories().at(0), QStringLiteral("Work"));
+    QCOMPARE(event0->categories().at(0).constData(), event1->categories().at(0).constData());
+    QVERIFY(event0->categories().at(1).constData() != event1->categories().at(1).constData());
+    QCOMPARE(event0->nonKDECustomProperty("X-TEAM"), QStringLiteral("Calendaring"));
+    QCOMPARE(event0->nonKDECustomProperty("X-TEAM").constData(),
+             event1->nonKDECustomProperty("X-TEAM").constData());
+}
+
+void ICalFormatTest::testBulkLoading()
+{
+    // Records how many incidences the calendar holds when it announces each
+    class Observer : public Calendar::CalendarObserver
+    {
+    public:
+        explicit Observer(Calendar *calendar)
+            : mCalendar(calendar)
+        {
+        }
+
+        void calendarIncidenceAdded(const Incidence::Ptr &) override
+        {
+            counts.append(mCalendar->rawIncidences().count());
+        }
+
+        QList<int> counts;
+
+    private:
+        Calendar *mCalendar;
+    };
+
+    // Subclasses keep seeing every new incidence through the add functions
+    class CountingCalendar : public MemoryCalendar
+    {
+    public:
+        CountingCalendar()
+            : MemoryCalendar(QTimeZone::utc())
+        {
+        }
+
+        bool addEvent(const Event::Ptr &event) override
+        {
+            added.append(event->uid());
+            return MemoryCalendar::addEvent(event);
+        }
+
+        bool addTodo(const Todo::Ptr &todo) override
+        {
+            added.append(todo->uid());
+            return MemoryCalendar::addTodo(todo);
+        }
+
+        QStringList added;
+    };
+
+    const QString serialized = QStringLiteral(
+                                   "BEGIN:VCALENDAR\n"
+                                   "PRODID:-//K Desktop Environment//NONSGML libkcal 3.2//EN\n"
+                                   "VERSION:2.0\n"
+                                   "BEGIN:VTODO\nUID:child\nRELATED-TO:parent\nSUMMARY:Child\nEND:VTODO\n"
+                                   "BEGIN:VTODO\nUID:parent\nSUMMARY:Parent\nEND:VTODO\n"
+                                   "BEGIN:VEVENT\nUID:event\nSEQUENCE:0\nSUMMARY:Old\n"
+                                   "DTSTART:20190603T100000Z\nDTEND:20190603T110000Z\nEND:VEVENT\n"
+                                   "BEGIN:VEVENT\nUID:event\nSEQUENCE:1\nSUMMARY:New\n"
+                                   "DTSTART:20190603T100000Z\nDTEND:20190603T110000Z\nEND:VEVENT\n"
+                                   "BEGIN:VEVENT\nUID:other\nSUMMARY:Other\n"
+                                   "DTSTART:20190604T100000Z\nDTEND:20190604T110000Z\nEND:VEVENT\n"
+                                   "END:VCALENDAR\n");
+
+    MemoryCalendar::Ptr calendar(new MemoryCalendar(QTimeZone::utc()));
+    Observer observer(calendar.data());
+    calendar->registerObserver(&observer);
+    ICalFormat format;
+    QVERIFY(format.fromString(calendar, serialized));
+
+    // The incidences are added in batches, all of a batch before the first
+    // is announced. The second revision of the event replaces the first one,
+    // which is only in the calendar once the incidences before it are.
+    QCOMPARE(observer.counts, QList<int>() << 3 << 3 << 3 << 3 << 4);
+    QCOMPARE(calendar->rawEvents().count(), 2);
+    QCOMPARE(calendar->event(QStringLiteral("event"))->summary(), QStringLiteral("New"));
+    QCOMPARE(calendar->rawTodos().count(), 2);
+    QCOMPARE(calendar->relations(QStringLiteral("parent")),
+             Incidence::List() << calendar->incidence(QStringLiteral("child")));
+    calendar->unregisterObserver(&observer);
+
+    QSharedPointer<CountingCalendar> counting(new CountingCalendar);
+    QVERIFY(format.fromString(counting, serialized));
+    QCOMPARE(counting->added, QStringList() << QStringLiteral("child") << QStringLiteral("parent")
+             << QStringLiteral("event") << QStringLiteral("event") << QStringLiteral("other"));
+    QCOMPARE(counting->event(QStringLiteral("event"))->summary(), QStringLiteral("New"));
+    QCOMPARE(counting->relations(QStringLiteral("parent")),
+             Incidence::List() << counting->incidence(QStringLiteral("child")));
+}
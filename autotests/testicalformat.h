@@ -33,6 +33,8 @@ private Q_SLOTS:
     void testVolatileProperties();
     void testCuType();
     void testAlarm();
+    void testStringInterning();
+    void testBulkLoading();
 };
 
 #endif
@@ -21,6 +21,7 @@
 #include "testincidence.h"
 #include "event.h"
 
+#include <QDataStream>
 #include <QTest>
 
 QTEST_MAIN(IncidenceTest)
@@ -281,3 +282,162 @@ void IncidenceTest::testRecurrenceYearlyMonth()
     r->setYearlyMonth(QList<int>() << 3 << 1);
     QCOMPARE(inc.dirtyFields(), QSet<IncidenceBase::Field>() << IncidenceBase::FieldRecurrence);
 }
+
+void IncidenceTest::testDirtyFields()
+{
+    Event inc;
+    inc.resetDirtyFields();
+    QVERIFY(inc.dirtyFields().isEmpty());
+
+    const QSet<IncidenceBase::Field> fields = QSet<IncidenceBase::Field>()
+            << IncidenceBase::FieldDtStart << IncidenceBase::FieldUid << IncidenceBase::FieldUrl;
+    inc.setDirtyFields(fields);
+    QCOMPARE(inc.dirtyFields(), fields);
+
+    inc.setUrl(QUrl(QStringLiteral("https://example.com")));
+    inc.addComment(QStringLiteral("comment"));
+    QCOMPARE(inc.dirtyFields(), fields + (QSet<IncidenceBase::Field>() << IncidenceBase::FieldComment));
+
+    Event copy;
+    IncidenceBase &base = copy;
+    base = inc;
+    QVERIFY(copy.dirtyFields().contains(IncidenceBase::FieldUnknown));
+}
+
+void IncidenceTest::testRarelyUsedProperties()
+{
+    Event::Ptr inc(new Event);
+    QVERIFY(inc->comments().isEmpty());
+    QVERIFY(inc->contacts().isEmpty());
+    QVERIFY(inc->url().isEmpty());
+    QVERIFY(!inc->removeComment(QStringLiteral("comment")));
+    QVERIFY(inc->organizer().isEmpty());
+    QVERIFY(inc->duration().isNull());
+
+    inc->addComment(QStringLiteral("comment"));
+    inc->addContact(QStringLiteral("contact"));
+    inc->setUrl(QUrl(QStringLiteral("https://example.com")));
+    inc->setDuration(Duration(3, Duration::Days));
+    inc->setRelatedTo(QStringLiteral("parent"));
+    inc->setRelatedTo(QStringLiteral("sibling"), Incidence::RelTypeSibling);
+    QCOMPARE(inc->relatedTo(), QStringLiteral("parent"));
+    QCOMPARE(inc->relatedTo(Incidence::RelTypeSibling), QStringLiteral("sibling"));
+    QVERIFY(inc->relatedTo(Incidence::RelTypeChild).isEmpty());
+
+    const Event::Ptr copy(inc->clone());
+    QCOMPARE(copy->comments(), QStringList() << QStringLiteral("comment"));
+    QCOMPARE(copy->contacts(), QStringList() << QStringLiteral("contact"));
+    QCOMPARE(copy->url(), inc->url());
+    QVERIFY(copy->duration().isDaily());
+    QCOMPARE(copy->duration().asDays(), 3);
+    QCOMPARE(copy->relatedTo(Incidence::RelTypeSibling), QStringLiteral("sibling"));
+
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out << IncidenceBase::Ptr(inc);
+    }
+    IncidenceBase::Ptr streamed(new Event);
+    QDataStream in(data);
+    in >> streamed;
+    QCOMPARE(*streamed, *inc);
+
+    QVERIFY(inc->removeComment(QStringLiteral("comment")));
+    QVERIFY(inc->comments().isEmpty());
+    inc->setRelatedTo(QString(), Incidence::RelTypeSibling);
+    QVERIFY(inc->relatedTo(Incidence::RelTypeSibling).isEmpty());
+    QCOMPARE(copy->comments().count(), 1);
+}
+
+void IncidenceTest::testMemoryUsage_data()
+{
+    QTest::addColumn<bool>("typical");
+
+    QTest::newRow("bare event") << false;
+    QTest::newRow("typical event") << true;
+}
+
+// Reports the bytes taken per incidence, for keeping an eye on the layout
+void IncidenceTest::testMemoryUsage()
+{
+    QFETCH(bool, typical);
+
+    Event event;
+    if (typical) {
+        const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), Qt::UTC);
+        event.setDtStart(start);
+        event.setDtEnd(start.addSecs(1800));
+        event.setSummary(QStringLiteral("Event"));
+        event.setOrganizer(Person(QStringLiteral("Organizer"), QStringLiteral("organizer@example.com")));
+        event.setCategories(QStringLiteral("Work"));
+        event.resetDirtyFields();
+    }
+    const qint64 size = event.approximateMemoryUsage();
+    QVERIFY(size > 0);
+    QTest::setBenchmarkResult(size, QTest::BytesAllocated);
+}
+
+// The rarely used properties only take memory once they are set
+void IncidenceTest::testLazyMemoryUsage()
+{
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), Qt::UTC);
+    Event event;
+    event.setDtStart(start);
+    event.setDtEnd(start.addSecs(1800));
+    event.setSummary(QStringLiteral("Event"));
+    const qint64 size = event.approximateMemoryUsage();
+
+    // Comments, contacts and the url only take room once one of them is set
+    event.setUrl(QUrl(QStringLiteral("https://example.com")));
+    const qint64 urlSize = event.approximateMemoryUsage();
+    QVERIFY(urlSize >= size + qint64(2 * sizeof(QStringList) + sizeof(QUrl)));
+    event.addComment(QStringLiteral("comment"));
+    event.addContact(QStringLiteral("contact"));
+    QVERIFY(event.approximateMemoryUsage() > urlSize);
+
+    // Incidences without an organizer share an empty one
+    const qint64 commentSize = event.approximateMemoryUsage();
+    event.setOrganizer(Person(QStringLiteral("Organizer"), QStringLiteral("organizer@example.com")));
+    QVERIFY(event.approximateMemoryUsage() > commentSize);
+}
+
+void IncidenceTest::testAttendeeByMail()
+{
+    // Below and above the number of attendees from which they are hashed by email
+    for (int count : {3, 2000}) {
+        Event::Ptr event(new Event);
+        Attendee::List attendees;
+        for (int i = 0; i < count; ++i) {
+            attendees.append(Attendee(QStringLiteral("Attendee %1").arg(i), QStringLiteral("a%1@example.com").arg(i)));
+        }
+        event->setAttendees(attendees);
+        // A second attendee with the same email doesn't hide the first one
+        event->addAttendee(Attendee(QStringLiteral("Twin"), QStringLiteral("a1@example.com")));
+
+        QCOMPARE(event->attendeeByMail(QStringLiteral("a0@example.com")).name(), QStringLiteral("Attendee 0"));
+        QCOMPARE(event->attendeeByMail(QStringLiteral("a1@example.com")).name(), QStringLiteral("Attendee 1"));
+        QCOMPARE(event->attendeeByMail(QStringLiteral("a%1@example.com").arg(count - 1)).name(), QStringLiteral("Attendee %1").arg(count - 1));
+        QVERIFY(event->attendeeByMail(QStringLiteral("nobody@example.com")).isNull());
+        QCOMPARE(event->attendeeByMails(QStringList() << QStringLiteral("nobody@example.com") << QStringLiteral("a2@example.com"),
+                                       QStringLiteral("a1@example.com")).name(), QStringLiteral("Attendee 1"));
+        QVERIFY(event->attendeeByMails(QStringList() << QStringLiteral("nobody@example.com")).isNull());
+
+        // Copies and streamed incidences find their attendees too
+        Event::Ptr copy(event->clone());
+        QCOMPARE(copy->attendeeByMail(QStringLiteral("a2@example.com")).name(), QStringLiteral("Attendee 2"));
+        QByteArray data;
+        {
+            QDataStream out(&data, QIODevice::WriteOnly);
+            out << IncidenceBase::Ptr(event);
+        }
+        IncidenceBase::Ptr streamed(new Event);
+        QDataStream in(data);
+        in >> streamed;
+        QCOMPARE(streamed->attendeeByMail(QStringLiteral("a2@example.com")).name(), QStringLiteral("Attendee 2"));
+
+        event->clearAttendees();
+        QVERIFY(event->attendeeByMail(QStringLiteral("a0@example.com")).isNull());
+        event->addAttendee(Attendee(QStringLiteral("New"), QStringLiteral("a0@example.com")));
+        QCOMPARE(event->attendeeByMail(QStringLiteral("a0@example.com")).name(), QStringLiteral("New"));
+    }
+}
@@ -41,6 +41,13 @@ private Q_SLOTS:
     void testRecurrenceMonthlyDate();
     void testRecurrenceYearlyDay();
     void testRecurrenceYearlyMonth();
+
+    void testDirtyFields();
+    void testRarelyUsedProperties();
+    void testMemoryUsage_data();
+    void testMemoryUsage();
+    void testLazyMemoryUsage();
+    void testAttendeeByMail();
 };
 
 #endif
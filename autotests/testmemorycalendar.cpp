@@ -20,17 +20,39 @@
 */
 
 #include "testmemorycalendar.h"
+#include "calendarquery.h"
+#include "calfilter.h"
 #include "filestorage.h"
 #include "memorycalendar.h"
 
+#include <QBitArray>
 #include <QDebug>
 
 #include <QTest>
+#include <QThread>
 #include <QTimeZone>
+
+#include <algorithm>
 QTEST_MAIN(MemoryCalendarTest)
 
 using namespace KCalendarCore;
 
+namespace {
+// Calendar::setDeletionTracking() is protected
+class TrackingCalendar : public MemoryCalendar
+{
+public:
+    typedef QSharedPointer<TrackingCalendar> Ptr;
+
+    explicit TrackingCalendar(const QTimeZone &timeZone)
+        : MemoryCalendar(timeZone)
+    {
+    }
+
+    using Calendar::setDeletionTracking;
+};
+}
+
 void MemoryCalendarTest::testValidity()
 {
     MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
@@ -272,3 +294,1292 @@ void MemoryCalendarTest::testChangeRecurId()
     QVERIFY(exception->summary() == QLatin1String("exception"));
     QVERIFY(main->summary() == event1->summary());
 }
+
+void MemoryCalendarTest::testRawEventsInRange()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), QTimeZone::utc());
+
+    Event::Ptr single = Event::Ptr(new Event());
+    single->setUid(QStringLiteral("single"));
+    single->setDtStart(start);
+    single->setDtEnd(start.addSecs(3600));
+    QVERIFY(cal->addEvent(single));
+
+    Event::Ptr finite = Event::Ptr(new Event());
+    finite->setUid(QStringLiteral("finite"));
+    finite->setDtStart(start.addDays(10));
+    finite->setDtEnd(start.addDays(10).addSecs(3600));
+    finite->recurrence()->setDaily(1);
+    finite->recurrence()->setDuration(5);
+    QVERIFY(cal->addEvent(finite));
+
+    Event::Ptr infinite = Event::Ptr(new Event());
+    infinite->setUid(QStringLiteral("infinite"));
+    infinite->setDtStart(start.addDays(20));
+    infinite->setDtEnd(start.addDays(20).addSecs(3600));
+    infinite->recurrence()->setWeekly(1);
+    QVERIFY(cal->addEvent(infinite));
+
+    auto uids = [&cal](const QDate &from, const QDate &to) {
+        QStringList result;
+        const Event::List events = cal->rawEvents(from, to, QTimeZone::utc());
+        for (const Event::Ptr &event : events) {
+            result << event->uid();
+        }
+        result.sort();
+        return result;
+    };
+
+    QCOMPARE(uids(QDate(2019, 5, 1), QDate(2019, 6, 1)), QStringList());
+    QCOMPARE(uids(QDate(2019, 6, 3), QDate(2019, 6, 3)), QStringList() << QStringLiteral("single"));
+    QCOMPARE(uids(QDate(2019, 6, 15), QDate(2019, 6, 16)), QStringList() << QStringLiteral("finite"));
+    QCOMPARE(uids(QDate(2019, 6, 18), QDate(2019, 6, 19)), QStringList());
+    QCOMPARE(uids(QDate(2019, 6, 1), QDate(2030, 1, 1)),
+             QStringList() << QStringLiteral("finite") << QStringLiteral("infinite") << QStringLiteral("single"));
+    QCOMPARE(uids(QDate(2025, 1, 1), QDate(2025, 1, 2)), QStringList() << QStringLiteral("infinite"));
+
+    // The index has to follow changes of the events
+    single->setDtStart(start.addDays(100));
+    single->setDtEnd(start.addDays(100).addSecs(3600));
+    QCOMPARE(uids(QDate(2019, 6, 3), QDate(2019, 6, 3)), QStringList());
+    QCOMPARE(uids(QDate(2019, 9, 11), QDate(2019, 9, 11)), QStringList() << QStringLiteral("single"));
+
+    finite->recurrence()->setDuration(20);
+    QCOMPARE(uids(QDate(2019, 6, 18), QDate(2019, 6, 19)), QStringList() << QStringLiteral("finite"));
+
+    infinite->recurrence()->clear();
+    QCOMPARE(uids(QDate(2025, 1, 1), QDate(2025, 1, 2)), QStringList());
+
+    QVERIFY(cal->deleteEvent(finite));
+    QCOMPARE(uids(QDate(2019, 6, 15), QDate(2019, 6, 16)), QStringList());
+    cal->close();
+    QCOMPARE(uids(QDate(2019, 6, 1), QDate(2030, 1, 1)), QStringList());
+}
+
+void MemoryCalendarTest::testRawIncidencesForDate()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDate date(2019, 6, 3);
+    const QDateTime start(date, QTime(10, 0), QTimeZone::utc());
+
+    Event::Ptr event = Event::Ptr(new Event());
+    event->setDtStart(start);
+    event->setDtEnd(start.addSecs(3600));
+    QVERIFY(cal->addEvent(event));
+
+    Todo::Ptr todo = Todo::Ptr(new Todo());
+    todo->setDtDue(start);
+    QVERIFY(cal->addTodo(todo));
+
+    Journal::Ptr journal = Journal::Ptr(new Journal());
+    journal->setDtStart(start);
+    QVERIFY(cal->addJournal(journal));
+
+    QCOMPARE(cal->rawEventsForDate(date), Event::List() << event);
+    QCOMPARE(cal->rawTodosForDate(date), Todo::List() << todo);
+    QCOMPARE(cal->rawJournalsForDate(date), Journal::List() << journal);
+    QVERIFY(cal->rawEventsForDate(date.addDays(1)).isEmpty());
+    QVERIFY(cal->rawTodosForDate(date.addDays(1)).isEmpty());
+    QVERIFY(cal->rawJournalsForDate(date.addDays(1)).isEmpty());
+
+    todo->setDtDue(start.addDays(1));
+    journal->setDtStart(start.addDays(1));
+    QVERIFY(cal->rawTodosForDate(date).isEmpty());
+    QVERIFY(cal->rawJournalsForDate(date).isEmpty());
+    QCOMPARE(cal->rawTodosForDate(date.addDays(1)), Todo::List() << todo);
+    QCOMPARE(cal->rawJournalsForDate(date.addDays(1)), Journal::List() << journal);
+
+    // Making the event recur must not leave it behind in the per-date index
+    event->recurrence()->setDaily(1);
+    event->recurrence()->setDuration(2);
+    QCOMPARE(cal->rawEventsForDate(date), Event::List() << event);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(1)), Event::List() << event);
+    QVERIFY(cal->rawEventsForDate(date.addDays(2)).isEmpty());
+
+    QVERIFY(cal->deleteTodo(todo));
+    QVERIFY(cal->deleteJournal(journal));
+    QVERIFY(cal->rawTodosForDate(date.addDays(1)).isEmpty());
+    QVERIFY(cal->rawJournalsForDate(date.addDays(1)).isEmpty());
+}
+
+void MemoryCalendarTest::testRecurringIncidencesForDate()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDate date(2019, 6, 3); // a Monday
+    const QDateTime start(date, QTime(10, 0), QTimeZone::utc());
+
+    Event::Ptr multiDay = Event::Ptr(new Event());
+    multiDay->setDtStart(start);
+    multiDay->setDtEnd(start.addDays(2));
+    QVERIFY(cal->addEvent(multiDay));
+
+    Event::Ptr weekly = Event::Ptr(new Event());
+    weekly->setDtStart(start);
+    weekly->setDtEnd(start.addSecs(3600));
+    weekly->recurrence()->setWeekly(1);
+    weekly->recurrence()->setDuration(3);
+    QVERIFY(cal->addEvent(weekly));
+
+    Todo::Ptr daily = Todo::Ptr(new Todo());
+    daily->setDtStart(start);
+    daily->recurrence()->setDaily(2);
+    QVERIFY(cal->addTodo(daily));
+
+    QCOMPARE(cal->rawEventsForDate(date.addDays(-1)).count(), 0);
+    QCOMPARE(cal->rawEventsForDate(date).count(), 2);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(2)), Event::List() << multiDay);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(3)).count(), 0);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(14)), Event::List() << weekly);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(21)).count(), 0);
+
+    QVERIFY(cal->rawTodosForDate(date.addDays(-2)).isEmpty());
+    QCOMPARE(cal->rawTodosForDate(date.addDays(200)), Todo::List() << daily);
+    QVERIFY(cal->rawTodosForDate(date.addDays(201)).isEmpty());
+
+    // Changes to the recurrence or the duration have to be picked up
+    weekly->recurrence()->setDuration(-1);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(700)), Event::List() << weekly);
+    multiDay->setDtEnd(start.addSecs(3600));
+    QVERIFY(cal->rawEventsForDate(date.addDays(2)).isEmpty());
+    multiDay->setDtEnd(start.addDays(5));
+    QCOMPARE(cal->rawEventsForDate(date.addDays(5)), Event::List() << multiDay);
+    daily->recurrence()->clear();
+    QVERIFY(cal->rawTodosForDate(date.addDays(200)).isEmpty());
+}
+
+void MemoryCalendarTest::testRecurringEventsByDay()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDate date(2019, 6, 3); // a Monday
+
+    // Late enough to be on the next day in New Zealand
+    Event::Ptr weekly = Event::Ptr(new Event());
+    weekly->setDtStart(QDateTime(date, QTime(20, 0), QTimeZone::utc()));
+    weekly->setDtEnd(weekly->dtStart().addSecs(3600));
+    QBitArray days(7);
+    days.setBit(2); // Wednesday
+    days.setBit(4); // Friday
+    weekly->recurrence()->setWeekly(1, days);
+    QVERIFY(cal->addEvent(weekly));
+
+    Event::Ptr lastOfMonth = Event::Ptr(new Event());
+    lastOfMonth->setDtStart(QDateTime(QDate(2019, 5, 31), QTime(10, 0), QTimeZone::utc()));
+    lastOfMonth->setDtEnd(lastOfMonth->dtStart().addSecs(3600));
+    lastOfMonth->recurrence()->setMonthly(1);
+    lastOfMonth->recurrence()->addMonthlyDate(-1);
+    QVERIFY(cal->addEvent(lastOfMonth));
+
+    // Spans from Saturday to Monday
+    Event::Ptr weekend = Event::Ptr(new Event());
+    weekend->setDtStart(QDateTime(date.addDays(-2), QTime(10, 0), QTimeZone::utc()));
+    weekend->setDtEnd(QDateTime(date, QTime(10, 0), QTimeZone::utc()));
+    weekend->recurrence()->setWeekly(1);
+    QVERIFY(cal->addEvent(weekend));
+
+    // The start date is an occurrence, even if the rule doesn't match it
+    Event::List events = cal->rawEventsForDate(date);
+    QCOMPARE(events.count(), 2);
+    QVERIFY(events.contains(weekly) && events.contains(weekend));
+    QVERIFY(cal->rawEventsForDate(date.addDays(1)).isEmpty());
+    QCOMPARE(cal->rawEventsForDate(date.addDays(2)), Event::List() << weekly);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(5)), Event::List() << weekend);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(7)), Event::List() << weekend);
+    QVERIFY(cal->rawEventsForDate(date.addDays(8)).isEmpty());
+    QCOMPARE(cal->rawEventsForDate(QDate(2019, 6, 30)).count(), 2);
+    QCOMPARE(cal->rawEventsForDate(QDate(2019, 10, 31)), Event::List() << lastOfMonth);
+    QCOMPARE(cal->rawEventsForDate(QDate(2020, 2, 29)).count(), 2);
+
+    // Queries in another time zone may hit the day before or after
+    const QTimeZone tz("Pacific/Auckland");
+    QCOMPARE(cal->rawEventsForDate(date.addDays(3), tz), Event::List() << weekly);
+    QVERIFY(cal->rawEventsForDate(date.addDays(2), tz).isEmpty());
+
+    // ... and so does changing the calendar's time zone
+    cal->setTimeZone(tz);
+    QCOMPARE(cal->rawEventsForDate(date.addDays(3)), Event::List() << weekly);
+    QVERIFY(cal->rawEventsForDate(date.addDays(2)).isEmpty());
+    cal->setTimeZone(QTimeZone::utc());
+
+    // Changes to the rules have to be picked up
+    weekly->recurrence()->defaultRRule()->setByDays(QList<RecurrenceRule::WDayPos>()
+                                                    << RecurrenceRule::WDayPos(0, 2));
+    QCOMPARE(cal->rawEventsForDate(date.addDays(8)), Event::List() << weekly);
+    QVERIFY(cal->rawEventsForDate(date.addDays(2)).isEmpty());
+    cal->deleteEvent(weekly);
+    QVERIFY(cal->rawEventsForDate(date.addDays(8)).isEmpty());
+}
+
+void MemoryCalendarTest::testIncidenceByUid()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), QTimeZone::utc());
+
+    Event::Ptr master = Event::Ptr(new Event());
+    master->setDtStart(start);
+    master->recurrence()->setDaily(1);
+    QVERIFY(cal->addEvent(master));
+
+    Event::List exceptions;
+    for (int day : {5, 1, 3}) {
+        Event::Ptr exception(master->clone());
+        exception->clearRecurrence();
+        exception->setRecurrenceId(start.addDays(day));
+        QVERIFY(cal->addEvent(exception));
+        exceptions << exception;
+    }
+
+    Todo::Ptr todo = Todo::Ptr(new Todo());
+    todo->setUid(master->uid());
+    QVERIFY(cal->addTodo(todo));
+
+    QCOMPARE(cal->incidence(master->uid()), Incidence::Ptr(master));
+    QCOMPARE(cal->todo(master->uid()), todo);
+    QVERIFY(!cal->journal(master->uid()));
+    for (const Event::Ptr &exception : qAsConst(exceptions)) {
+        QCOMPARE(cal->incidence(master->uid(), exception->recurrenceId()), Incidence::Ptr(exception));
+    }
+    QVERIFY(!cal->incidence(master->uid(), start.addDays(2)));
+    QVERIFY(!cal->todo(master->uid(), start.addDays(1)));
+
+    // Other time zones denote the same instant
+    const QTimeZone tz("Europe/Berlin");
+    QCOMPARE(cal->event(master->uid(), start.addDays(3).toTimeZone(tz)), exceptions[2]);
+
+    // A changed recurrence id moves the exception
+    exceptions[0]->setRecurrenceId(start.addDays(2));
+    QCOMPARE(cal->event(master->uid(), start.addDays(2)), exceptions[0]);
+    QVERIFY(!cal->event(master->uid(), start.addDays(5)));
+    QCOMPARE(cal->event(master->uid(), start.addDays(1)), exceptions[1]);
+
+    QVERIFY(cal->deleteEvent(exceptions[1]));
+    QVERIFY(!cal->event(master->uid(), start.addDays(1)));
+    QCOMPARE(cal->event(master->uid(), start.addDays(3)), exceptions[2]);
+    QVERIFY(cal->deleteTodo(todo));
+    QVERIFY(!cal->todo(master->uid()));
+    QCOMPARE(cal->event(master->uid()), master);
+}
+
+void MemoryCalendarTest::testSchedulingId()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), QTimeZone::utc());
+
+    Event::Ptr master = Event::Ptr(new Event());
+    master->setDtStart(start);
+    master->recurrence()->setDaily(1);
+    QVERIFY(cal->addEvent(master));
+    Event::Ptr exception(master->clone());
+    exception->clearRecurrence();
+    exception->setRecurrenceId(start.addDays(1));
+    QVERIFY(cal->addEvent(exception));
+
+    Todo::Ptr todo = Todo::Ptr(new Todo());
+    todo->setSchedulingID(QStringLiteral("sid-1"));
+    QVERIFY(cal->addTodo(todo));
+
+    // Without a scheduling ID, the uid is used
+    QCOMPARE(cal->incidencesFromSchedulingID(master->uid()).count(), 2);
+    QCOMPARE(cal->incidenceFromSchedulingID(master->uid()), Incidence::Ptr(master));
+    QCOMPARE(cal->incidenceFromSchedulingID(QStringLiteral("sid-1")), Incidence::Ptr(todo));
+    QVERIFY(cal->incidencesFromSchedulingID(todo->uid()).isEmpty());
+
+    // Changes after adding have to be picked up, without counting as a
+    // modification of the incidence
+    const QDateTime lastModified(QDate(2019, 1, 1), QTime(12, 0), QTimeZone::utc());
+    todo->setLastModified(lastModified);
+    cal->setModified(false);
+    todo->setSchedulingID(QStringLiteral("sid-2"));
+    QVERIFY(cal->incidencesFromSchedulingID(QStringLiteral("sid-1")).isEmpty());
+    QCOMPARE(cal->incidencesFromSchedulingID(QStringLiteral("sid-2")), Incidence::List() << todo);
+    QCOMPARE(todo->lastModified(), lastModified);
+    QVERIFY(!cal->isModified());
+
+    // Falling back to the uid
+    todo->setSchedulingID(QString());
+    QCOMPARE(cal->incidencesFromSchedulingID(todo->uid()), Incidence::List() << todo);
+    QVERIFY(cal->incidencesFromSchedulingID(QStringLiteral("sid-2")).isEmpty());
+    todo->setSchedulingID(QStringLiteral("sid-2"));
+
+    const QString oldUid = todo->uid();
+    todo->setSchedulingID(QStringLiteral("sid-3"), QStringLiteral("new-uid"));
+    QCOMPARE(cal->incidenceFromSchedulingID(QStringLiteral("sid-3")), Incidence::Ptr(todo));
+    QCOMPARE(cal->todo(QStringLiteral("new-uid")), todo);
+    QVERIFY(!cal->todo(oldUid));
+
+    QVERIFY(cal->deleteTodo(todo));
+    QVERIFY(!cal->incidenceFromSchedulingID(QStringLiteral("sid-3")));
+    QVERIFY(cal->deleteEvent(exception));
+    QCOMPARE(cal->incidencesFromSchedulingID(master->uid()), Incidence::List() << master);
+}
+
+void MemoryCalendarTest::testCategories()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+
+    Event::Ptr event = Event::Ptr(new Event());
+    event->setCategories(QStringList() << QStringLiteral("Work") << QStringLiteral("Travel"));
+    QVERIFY(cal->addEvent(event));
+    Todo::Ptr todo = Todo::Ptr(new Todo());
+    todo->setCategories(QStringList() << QStringLiteral("Work") << QStringLiteral("Work"));
+    QVERIFY(cal->addTodo(todo));
+
+    // Sorted, whatever order they were added in
+    QCOMPARE(cal->categories(), QStringList() << QStringLiteral("Travel") << QStringLiteral("Work"));
+    QCOMPARE(cal->incidencesWithCategory(QStringLiteral("Travel")), Incidence::List() << event);
+    QCOMPARE(cal->incidencesWithCategory(QStringLiteral("Work")).count(), 2);
+    QVERIFY(cal->incidencesWithCategory(QStringLiteral("Home")).isEmpty());
+
+    // Changes after adding have to be picked up
+    event->setCategories(QStringLiteral("Home"));
+    QCOMPARE(cal->categories(), QStringList() << QStringLiteral("Home") << QStringLiteral("Work"));
+    QCOMPARE(cal->incidencesWithCategory(QStringLiteral("Work")), Incidence::List() << todo);
+
+    QVERIFY(cal->deleteTodo(todo));
+    QCOMPARE(cal->categories(), QStringList() << QStringLiteral("Home"));
+    cal->close();
+    QVERIFY(cal->categories().isEmpty());
+    QVERIFY(cal->incidencesWithCategory(QStringLiteral("Home")).isEmpty());
+}
+
+void MemoryCalendarTest::testDuplicates()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), QTimeZone::utc());
+    const QString notebook = QStringLiteral("notebook");
+    QVERIFY(cal->addNotebook(notebook, true));
+
+    Event::List events;
+    for (int i = 0; i < 3; ++i) {
+        Event::Ptr event = Event::Ptr(new Event());
+        event->setDtStart(start);
+        event->setSummary(QStringLiteral("Meeting"));
+        QVERIFY(cal->addEvent(event));
+        QVERIFY(cal->setNotebook(event, notebook));
+        events << event;
+    }
+    // Same instant, in another time zone
+    events[1]->setDtStart(start.toTimeZone(QTimeZone("Europe/Berlin")));
+    events[2]->setSummary(QStringLiteral("Lunch"));
+
+    Todo::List todos;
+    for (int i = 0; i < 2; ++i) {
+        Todo::Ptr todo = Todo::Ptr(new Todo());
+        todo->setSummary(QStringLiteral("Meeting"));
+        QVERIFY(cal->addTodo(todo));
+        QVERIFY(cal->setNotebook(todo, notebook));
+        todos << todo;
+    }
+
+    Incidence::List duplicates = cal->duplicates(events[0]);
+    QCOMPARE(duplicates.count(), 2);
+    QVERIFY(duplicates.contains(events[0]) && duplicates.contains(events[1]));
+    QCOMPARE(cal->duplicates(events[2]), Incidence::List() << events[2]);
+    QCOMPARE(cal->duplicates(todos[0]).count(), 2);
+    QCOMPARE(cal->duplicateGroups().count(), 2);
+
+    events[2]->setSummary(QStringLiteral("Meeting"));
+    QCOMPARE(cal->duplicates(events[0]).count(), 3);
+    todos[1]->setDtStart(start);
+    QCOMPARE(cal->duplicates(events[0]).count(), 4);
+    QCOMPARE(cal->duplicateGroups(), QVector<Incidence::List>() << cal->duplicates(events[0]));
+
+    cal->clearNotebookAssociations();
+    QVERIFY(cal->duplicates(events[0]).isEmpty());
+    QVERIFY(cal->duplicateGroups().isEmpty());
+}
+
+void MemoryCalendarTest::testAddIncidences()
+{
+    class Observer : public Calendar::CalendarObserver
+    {
+    public:
+        void calendarModified(bool modified, Calendar *calendar) override
+        {
+            Q_UNUSED(modified);
+            Q_UNUSED(calendar);
+            ++modifications;
+        }
+        void calendarIncidenceAdded(const Incidence::Ptr &incidence) override
+        {
+            Q_UNUSED(incidence);
+            if (additions++ == 0) {
+                seenOnFirstAddition = calendar->rawIncidences().count();
+            }
+        }
+        Calendar *calendar = nullptr;
+        int modifications = 0;
+        int additions = 0;
+        int seenOnFirstAddition = -1;
+    } observer;
+
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    observer.calendar = cal.data();
+    cal->registerObserver(&observer);
+    const QDate date(2019, 6, 3);
+
+    Incidence::List incidences;
+    for (int i = 0; i < 3; ++i) {
+        Event::Ptr event = Event::Ptr(new Event());
+        event->setDtStart(QDateTime(date.addDays(i), QTime(10, 0), QTimeZone::utc()));
+        event->setDtEnd(event->dtStart().addSecs(3600));
+        incidences << event;
+    }
+    // A child coming before its parent
+    Todo::Ptr child = Todo::Ptr(new Todo());
+    Todo::Ptr todo = Todo::Ptr(new Todo());
+    child->setRelatedTo(todo->uid());
+    incidences << child;
+    todo->setDtDue(QDateTime(date, QTime(12, 0), QTimeZone::utc()));
+    incidences << todo;
+    incidences << Journal::Ptr(new Journal());
+
+    QVERIFY(cal->addIncidences(incidences));
+    QVERIFY(cal->isModified());
+    QVERIFY(!cal->batchAdding());
+    QCOMPARE(observer.modifications, 1);
+    QCOMPARE(observer.additions, incidences.count());
+    // All of them are in the calendar before the observers hear about them
+    QCOMPARE(observer.seenOnFirstAddition, incidences.count());
+    QCOMPARE(cal->relations(todo->uid()), Incidence::List() << child);
+    QCOMPARE(cal->relationParent(child->uid()), Incidence::Ptr(todo));
+    QCOMPARE(cal->rawEvents().count(), 3);
+    QCOMPARE(cal->rawTodosForDate(date), Todo::List() << todo);
+    QCOMPARE(cal->rawJournals().count(), 1);
+    for (const Incidence::Ptr &incidence : qAsConst(incidences)) {
+        QCOMPARE(cal->incidence(incidence->uid()), incidence);
+    }
+
+    // Incidences already in the calendar are rejected, the others added
+    Journal::Ptr journal = Journal::Ptr(new Journal());
+    QVERIFY(!cal->addIncidences(Incidence::List() << todo << journal));
+    QCOMPARE(cal->incidence(journal->uid()), Incidence::Ptr(journal));
+    QCOMPARE(cal->rawTodos().count(), 2);
+
+    // The calendar observes the added incidences
+    Event::Ptr event = incidences[0].staticCast<Event>();
+    event->setDtStart(event->dtStart().addDays(7));
+    event->setDtEnd(event->dtStart().addSecs(3600));
+    QCOMPARE(cal->rawEventsForDate(date.addDays(7)), Event::List() << event);
+    QVERIFY(cal->rawEventsForDate(date).isEmpty());
+
+    cal->unregisterObserver(&observer);
+
+    // The indexes built in one go answer like those built one by one, also
+    // when there were incidences before
+    MemoryCalendar::Ptr bulk(new MemoryCalendar(QTimeZone::utc()));
+    MemoryCalendar::Ptr single(new MemoryCalendar(QTimeZone::utc()));
+    Incidence::List events;
+    for (int i = 0; i < 300; ++i) {
+        Event::Ptr candidate = Event::Ptr(new Event());
+        candidate->setDtStart(QDateTime(date.addDays(i % 40), QTime(i % 24, 0), QTimeZone::utc()));
+        candidate->setDtEnd(candidate->dtStart().addSecs(3600 * (1 + i % 50)));
+        if (i % 7 == 0) {
+            QBitArray days(7, false);
+            days.setBit(i % 5);
+            candidate->recurrence()->setWeekly(1, days);
+            candidate->recurrence()->setDuration(i % 3 == 0 ? -1 : 5);
+        } else if (i % 11 == 0) {
+            candidate->recurrence()->setDaily(3);
+        }
+        QVERIFY(single->addEvent(candidate));
+        if (i < 50) {
+            QVERIFY(bulk->addEvent(candidate));
+        } else {
+            events.append(candidate);
+        }
+    }
+    QVERIFY(bulk->addIncidences(events));
+    const auto byPointer = [](const Event::Ptr &a, const Event::Ptr &b) {
+        return std::less<Event *>()(a.data(), b.data());
+    };
+    for (int i = -1; i < 45; i += 3) {
+        const QDate from = date.addDays(i);
+        for (int length : {0, 1, 6}) {
+            Event::List expected = single->rawEvents(from, from.addDays(length));
+            Event::List actual = bulk->rawEvents(from, from.addDays(length));
+            std::sort(expected.begin(), expected.end(), byPointer);
+            std::sort(actual.begin(), actual.end(), byPointer);
+            QCOMPARE(actual, expected);
+        }
+        Event::List expected = single->rawEventsForDate(from);
+        Event::List actual = bulk->rawEventsForDate(from);
+        std::sort(expected.begin(), expected.end(), byPointer);
+        std::sort(actual.begin(), actual.end(), byPointer);
+        QCOMPARE(actual, expected);
+    }
+}
+
+void MemoryCalendarTest::testAlarms()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDate date(2019, 6, 3);
+    auto at = [date](int days, int hours, int minutes) {
+        return QDateTime(date.addDays(days), QTime(hours, minutes), QTimeZone::utc());
+    };
+
+    Event::Ptr event = Event::Ptr(new Event());
+    event->setDtStart(at(0, 10, 0));
+    event->setDtEnd(at(0, 11, 0));
+    Alarm::Ptr eventAlarm = event->newAlarm();
+    eventAlarm->setStartOffset(Duration(-15 * 60));
+    eventAlarm->setEnabled(true);
+    QVERIFY(cal->addEvent(event));
+
+    Event::Ptr daily = Event::Ptr(new Event());
+    daily->setDtStart(at(0, 8, 0));
+    daily->setDtEnd(at(0, 9, 0));
+    daily->recurrence()->setDaily(1);
+    Alarm::Ptr dailyAlarm = daily->newAlarm();
+    dailyAlarm->setStartOffset(Duration(-10 * 60));
+    dailyAlarm->setEnabled(true);
+    QVERIFY(cal->addEvent(daily));
+
+    Todo::Ptr todo = Todo::Ptr(new Todo());
+    todo->setDtDue(at(0, 12, 0));
+    Alarm::Ptr todoAlarm = todo->newAlarm();
+    todoAlarm->setTime(at(0, 11, 0));
+    todoAlarm->setEnabled(true);
+    QVERIFY(cal->addTodo(todo));
+
+    // Poll forward in time, as a reminder daemon does
+    QCOMPARE(cal->alarms(at(0, 7, 45), at(0, 7, 55)), Alarm::List() << dailyAlarm);
+    QCOMPARE(cal->alarms(at(0, 9, 40), at(0, 9, 50)), Alarm::List() << eventAlarm);
+    QVERIFY(cal->alarms(at(0, 10, 0), at(0, 10, 30)).isEmpty());
+    QVERIFY(cal->alarms(at(0, 10, 55), at(0, 11, 5)).contains(todoAlarm));
+    QVERIFY(cal->alarms(at(0, 11, 5), at(0, 11, 10)).isEmpty());
+    QCOMPARE(cal->alarms(at(1, 7, 45), at(1, 7, 55)), Alarm::List() << dailyAlarm);
+    QVERIFY(cal->alarms(at(1, 9, 40), at(1, 9, 50)).isEmpty());
+
+    // Earlier queries still find everything
+    QCOMPARE(cal->alarms(at(0, 7, 45), at(0, 7, 55)), Alarm::List() << dailyAlarm);
+    Alarm::List alarms = cal->alarms(at(0, 7, 0), at(0, 10, 0));
+    QCOMPARE(alarms.count(), 2);
+    QVERIFY(alarms.contains(eventAlarm) && alarms.contains(dailyAlarm));
+
+    // Changes have to be picked up
+    const QDateTime later = at(2, 0, 0);
+    event->setDtStart(later.addSecs(10 * 3600));
+    event->setDtEnd(later.addSecs(11 * 3600));
+    QVERIFY(cal->alarms(at(1, 23, 0), at(2, 7, 0)).isEmpty());
+    QCOMPARE(cal->alarms(at(2, 9, 40), at(2, 9, 50)), Alarm::List() << eventAlarm);
+    dailyAlarm->setEnabled(false);
+    QVERIFY(cal->alarms(at(3, 7, 45), at(3, 7, 55)).isEmpty());
+    todo->setCompleted(true);
+    QVERIFY(cal->alarms(at(0, 10, 55), at(0, 11, 5)).isEmpty());
+}
+
+void MemoryCalendarTest::testSnapshot()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDate date(2019, 6, 3);
+    const QDateTime start(date, QTime(10, 0), QTimeZone::utc());
+
+    Event::Ptr event = Event::Ptr(new Event());
+    event->setSummary(QStringLiteral("single"));
+    event->setDtStart(start);
+    event->setDtEnd(start.addSecs(3600));
+    event->setCategories(QStringList() << QStringLiteral("Work"));
+    QVERIFY(cal->addEvent(event));
+
+    Event::Ptr weekly = Event::Ptr(new Event());
+    weekly->setSummary(QStringLiteral("weekly"));
+    weekly->setDtStart(start.addSecs(3600 * 2));
+    weekly->setDtEnd(start.addSecs(3600 * 3));
+    weekly->recurrence()->setWeekly(1);
+    QVERIFY(cal->addEvent(weekly));
+
+    const MemoryCalendar::Ptr snapshot = cal->snapshot();
+    QCOMPARE(snapshot->rawEvents().count(), 2);
+    QCOMPARE(snapshot->rawEventsForDate(date).count(), 2);
+    QCOMPARE(snapshot->rawEventsForDate(date.addDays(7)), Event::List() << weekly);
+    QCOMPARE(snapshot->incidence(event->uid()), Incidence::Ptr(event));
+    QCOMPARE(snapshot->categories(), QStringList() << QStringLiteral("Work"));
+    QCOMPARE(snapshot->timeZone(), cal->timeZone());
+
+    // Changes to the calendar don't show in the snapshot, and the other way round
+    Event::Ptr added = Event::Ptr(new Event(*event));
+    added->setUid(QStringLiteral("added"));
+    QVERIFY(cal->addEvent(added));
+    QVERIFY(cal->deleteEvent(weekly));
+    QCOMPARE(cal->rawEventsForDate(date).count(), 2);
+    QVERIFY(!cal->rawEventsForDate(date).contains(weekly));
+    QCOMPARE(snapshot->rawEventsForDate(date).count(), 2);
+    QVERIFY(snapshot->rawEventsForDate(date).contains(weekly));
+    QVERIFY(!snapshot->incidence(QStringLiteral("added")));
+    QCOMPARE(snapshot->rawEventsForDate(date.addDays(14)), Event::List() << weekly);
+    QVERIFY(cal->rawEventsForDate(date.addDays(14)).isEmpty());
+
+    QVERIFY(!snapshot->addEvent(Event::Ptr(new Event())));
+    QVERIFY(!snapshot->deleteEvent(event));
+    QCOMPARE(cal->rawEvents().count(), 2);
+    QCOMPARE(snapshot->rawEvents().count(), 2);
+
+    // A reader thread works on its own snapshot while the calendar changes
+    const MemoryCalendar::Ptr readerSnapshot = cal->snapshot();
+    bool consistent = true;
+    QThread *reader = QThread::create([readerSnapshot, date, &consistent]() {
+        for (int i = 0; i < 200; ++i) {
+            if (readerSnapshot->rawEventsForDate(date.addDays(i % 7)).count() != (i % 7 ? 0 : 2)
+                || readerSnapshot->rawEvents().count() != 2) {
+                consistent = false;
+            }
+        }
+    });
+    reader->start();
+    for (int i = 0; i < 200; ++i) {
+        Event::Ptr daily = Event::Ptr(new Event());
+        daily->setDtStart(start.addDays(i));
+        daily->setDtEnd(start.addDays(i).addSecs(1800));
+        daily->recurrence()->setDaily(1);
+        daily->recurrence()->setDuration(10);
+        cal->addEvent(daily);
+    }
+    QVERIFY(reader->wait());
+    delete reader;
+    QVERIFY(consistent);
+    QCOMPARE(cal->rawEvents().count(), 202);
+}
+
+void MemoryCalendarTest::testConcurrentReaders()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDate date(2019, 6, 3);
+    const QDateTime start(date, QTime(10, 0), QTimeZone::utc());
+    for (int i = 0; i < 50; ++i) {
+        Event::Ptr event = Event::Ptr(new Event());
+        event->setDtStart(start);
+        // Every other event ends the next day
+        event->setDtEnd(start.addSecs(i % 2 ? 3600 : 86400));
+        QVERIFY(cal->addEvent(event));
+    }
+
+    // Copies have neither a recurrence nor a cached multi-day state yet,
+    // so the readers below fill them concurrently
+    Event::List shared;
+    const Event::List events = cal->rawEvents();
+    for (const Event::Ptr &event : events) {
+        shared.append(Event::Ptr(event->clone()));
+    }
+
+    const int threadCount = 4;
+    QVector<QVector<Recurrence *>> recurrences(threadCount);
+    QVector<bool> consistent(threadCount, true);
+    QVector<QThread *> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        const MemoryCalendar::Ptr snapshot = cal->snapshot();
+        threads.append(QThread::create([snapshot, shared, date, t, &recurrences, &consistent]() {
+            for (int i = 0; i < shared.count(); ++i) {
+                const Event::Ptr &event = shared.at(i);
+                if (event->isMultiDay() != (event->dtEnd().date() != date)
+                    || event->recurs()) {
+                    consistent[t] = false;
+                }
+                recurrences[t].append(event->recurrence());
+                if (snapshot->rawEventsForDate(date).count() != shared.count()
+                    || snapshot->rawEventsForDate(date.addDays(1)).count() != shared.count() / 2) {
+                    consistent[t] = false;
+                }
+            }
+        }));
+    }
+    for (QThread *thread : qAsConst(threads)) {
+        thread->start();
+    }
+    for (QThread *thread : qAsConst(threads)) {
+        QVERIFY(thread->wait());
+        delete thread;
+    }
+
+    // All readers saw the same recurrence of each incidence
+    for (int t = 0; t < threadCount; ++t) {
+        QVERIFY(consistent.at(t));
+        QCOMPARE(recurrences.at(t).count(), shared.count());
+        for (int i = 0; i < shared.count(); ++i) {
+            QCOMPARE(recurrences.at(t).at(i), shared.at(i)->recurrence());
+        }
+    }
+}
+
+void MemoryCalendarTest::testOrphans()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+
+    // Children whose parent has not been added yet
+    Todo::Ptr child1(new Todo);
+    child1->setUid(QStringLiteral("child1"));
+    child1->setRelatedTo(QStringLiteral("parent"));
+    Todo::Ptr child2(new Todo);
+    child2->setUid(QStringLiteral("child2"));
+    child2->setRelatedTo(QStringLiteral("parent"));
+    Todo::Ptr child3(new Todo);
+    child3->setUid(QStringLiteral("child3"));
+    child3->setRelatedTo(QStringLiteral("parent"));
+    QVERIFY(cal->addTodo(child1));
+    QVERIFY(cal->addTodo(child2));
+    QVERIFY(cal->addTodo(child3));
+    QVERIFY(cal->relations(QStringLiteral("parent")).isEmpty());
+
+    // A deleted orphan is no longer claimed by its parent
+    QVERIFY(cal->deleteTodo(child2));
+
+    Todo::Ptr parent(new Todo);
+    parent->setUid(QStringLiteral("parent"));
+    QVERIFY(cal->addTodo(parent));
+    Incidence::List relations = cal->relations(parent->uid());
+    QCOMPARE(relations.count(), 2);
+    QVERIFY(relations.contains(child1));
+    QVERIFY(relations.contains(child3));
+
+    // Deleting the parent turns its children into orphans again
+    QVERIFY(cal->deleteTodo(parent));
+    QVERIFY(cal->deleteTodo(child1));
+    QVERIFY(cal->addTodo(parent));
+    relations = cal->relations(parent->uid());
+    QVERIFY(!relations.contains(child1));
+    QVERIFY(relations.contains(child3));
+
+    // Children added after their parent are related straight away
+    QVERIFY(cal->addTodo(child2));
+    QVERIFY(cal->relations(parent->uid()).contains(child2));
+    QVERIFY(cal->deleteTodo(child2));
+    QVERIFY(!cal->relations(parent->uid()).contains(child2));
+}
+
+void MemoryCalendarTest::benchmarkDeleteOrphans()
+{
+    TrackingCalendar::Ptr cal(new TrackingCalendar(QTimeZone::utc()));
+    cal->setDeletionTracking(false);
+
+    const int count = 10000;
+    Todo::List todos;
+    todos.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        Todo::Ptr todo(new Todo);
+        todo->setUid(QStringLiteral("orphan%1").arg(i));
+        todo->setRelatedTo(QStringLiteral("parent%1").arg(i % 10));
+        QVERIFY(cal->addTodo(todo));
+        todos.append(todo);
+    }
+
+    QBENCHMARK_ONCE {
+        for (const Todo::Ptr &todo : qAsConst(todos)) {
+            cal->deleteTodo(todo);
+        }
+    }
+    QVERIFY(cal->rawTodos().isEmpty());
+
+    // None of the orphans is waiting for its parent anymore
+    Todo::Ptr parent(new Todo);
+    parent->setUid(QStringLiteral("parent0"));
+    QVERIFY(cal->addTodo(parent));
+    QVERIFY(cal->relations(parent->uid()).isEmpty());
+}
+
+void MemoryCalendarTest::testRelationTree()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDateTime due(QDate(2019, 6, 10), QTime(12, 0), Qt::UTC);
+
+    Todo::Ptr root(new Todo);
+    root->setUid(QStringLiteral("root"));
+    Todo::Ptr child1(new Todo);
+    child1->setUid(QStringLiteral("child1"));
+    child1->setRelatedTo(root->uid());
+    child1->setDtDue(due.addDays(2));
+    child1->setPercentComplete(50);
+    Todo::Ptr child2(new Todo);
+    child2->setUid(QStringLiteral("child2"));
+    child2->setRelatedTo(root->uid());
+    child2->setDtDue(due.addDays(1));
+    Todo::Ptr grandChild(new Todo);
+    grandChild->setUid(QStringLiteral("grandchild"));
+    grandChild->setRelatedTo(child1->uid());
+    grandChild->setDtDue(due);
+    grandChild->setCompleted(true);
+
+    // Children which are added before their parents are linked later on
+    QVERIFY(cal->addTodo(grandChild));
+    QVERIFY(cal->addTodo(child1));
+    QVERIFY(cal->addTodo(root));
+    QVERIFY(cal->addTodo(child2));
+
+    QCOMPARE(cal->relationParent(grandChild->uid()), Incidence::Ptr(child1));
+    QCOMPARE(cal->relationParent(child1->uid()), Incidence::Ptr(root));
+    QVERIFY(!cal->relationParent(root->uid()));
+    QVERIFY(cal->isAncestorOf(root, grandChild));
+    QVERIFY(!cal->isAncestorOf(grandChild, root));
+
+    Calendar::RelationRollup rollup = cal->relationRollup(root->uid());
+    QCOMPARE(rollup.totalTodos, 3);
+    QCOMPARE(rollup.completedTodos, 1);
+    QCOMPARE(rollup.percentComplete, 50);
+    QCOMPARE(rollup.earliestDue, due.addDays(1));
+    rollup = cal->relationRollup(child1->uid());
+    QCOMPARE(rollup.totalTodos, 1);
+    QCOMPARE(rollup.completedTodos, 1);
+    QCOMPARE(rollup.percentComplete, 100);
+    QVERIFY(!rollup.earliestDue.isValid());
+    QCOMPARE(cal->relationRollup(child2->uid()).totalTodos, 0);
+
+    // Changes are rolled up
+    child2->setCompleted(true);
+    rollup = cal->relationRollup(root->uid());
+    QCOMPARE(rollup.completedTodos, 2);
+    QCOMPARE(rollup.percentComplete, 83);
+    QCOMPARE(rollup.earliestDue, due.addDays(2));
+    grandChild->setCompleted(false);
+    rollup = cal->relationRollup(root->uid());
+    QCOMPARE(rollup.completedTodos, 1);
+    QCOMPARE(rollup.earliestDue, due);
+
+    // Deleting a child removes its whole subtree from the rollup
+    QVERIFY(cal->deleteTodo(child1));
+    rollup = cal->relationRollup(root->uid());
+    QCOMPARE(rollup.totalTodos, 1);
+    QCOMPARE(rollup.completedTodos, 1);
+    QVERIFY(!rollup.earliestDue.isValid());
+    QVERIFY(!cal->relationParent(grandChild->uid()));
+
+    QVERIFY(cal->addTodo(child1));
+    rollup = cal->relationRollup(root->uid());
+    QCOMPARE(rollup.totalTodos, 3);
+    QCOMPARE(rollup.earliestDue, due);
+    QCOMPARE(cal->relationParent(grandChild->uid()), Incidence::Ptr(child1));
+}
+
+void MemoryCalendarTest::testTombstones()
+{
+    TrackingCalendar::Ptr cal(new TrackingCalendar(QTimeZone::utc()));
+    QVERIFY(!cal->tombstoneMode());
+
+    Event::Ptr event1(new Event);
+    event1->setUid(QStringLiteral("event1"));
+    event1->setSummary(QStringLiteral("Event 1"));
+    event1->setDtStart(QDateTime(QDate(2019, 6, 3), QTime(10, 0), Qt::UTC));
+    event1->setRevision(3);
+    QVERIFY(cal->addEvent(event1));
+    QVERIFY(cal->deleteEvent(event1));
+    QCOMPARE(cal->deletedEvent(event1->uid()), event1);
+
+    // Deleted incidences kept so far become tombstones
+    const QDateTime before = QDateTime::currentDateTimeUtc().addSecs(-1);
+    cal->setTombstoneMode(true);
+    QVERIFY(cal->tombstoneMode());
+    Event::Ptr deleted = cal->deletedEvent(event1->uid());
+    QVERIFY(deleted);
+    QVERIFY(deleted != event1);
+    QCOMPARE(deleted->uid(), event1->uid());
+    QCOMPARE(deleted->revision(), 3);
+    QVERIFY(deleted->summary().isEmpty());
+    QVERIFY(deleted->lastModified() >= before);
+    QVERIFY(!cal->deletedTodo(event1->uid()));
+    QCOMPARE(cal->deletedEvents().count(), 1);
+    // Tombstones are no live incidences
+    QVERIFY(cal->rawEvents().isEmpty());
+    QVERIFY(cal->rawIncidences().isEmpty());
+
+    Todo::Ptr todo(new Todo);
+    todo->setUid(QStringLiteral("todo"));
+    Todo::Ptr exception(new Todo);
+    exception->setUid(todo->uid());
+    exception->setRecurrenceId(QDateTime(QDate(2019, 6, 4), QTime(10, 0), Qt::UTC));
+    QVERIFY(cal->addTodo(todo));
+    QVERIFY(cal->addTodo(exception));
+    QVERIFY(cal->deleteTodo(exception));
+    QVERIFY(cal->deleteTodo(todo));
+    QVERIFY(cal->deletedTodo(todo->uid()));
+    QVERIFY(!cal->deletedTodo(todo->uid())->hasRecurrenceId());
+    QCOMPARE(cal->deletedTodo(todo->uid(), exception->recurrenceId())->recurrenceId(),
+             exception->recurrenceId());
+    QCOMPARE(cal->deletedTodos().count(), 2);
+    QCOMPARE(cal->deletedEvents().count(), 1);
+    QCOMPARE(cal->deleted(event1->uid())->type(), Incidence::TypeEvent);
+
+    // Deleting the same incidence again replaces its tombstone
+    QVERIFY(cal->addEvent(event1));
+    QVERIFY(cal->deleteEvent(event1));
+    QCOMPARE(cal->deletedEvents().count(), 1);
+
+    // The oldest tombstones are pruned first
+    cal->setTombstoneLimits(2, 0);
+    QCOMPARE(cal->tombstoneMaxCount(), 2);
+    QCOMPARE(cal->deletedTodos().count() + cal->deletedEvents().count(), 2);
+    QVERIFY(!cal->deletedTodo(todo->uid(), exception->recurrenceId()));
+    QVERIFY(cal->deletedTodo(todo->uid()));
+    QVERIFY(cal->deletedEvent(event1->uid()));
+
+    Journal::Ptr journal(new Journal);
+    journal->setUid(QStringLiteral("journal"));
+    QVERIFY(cal->addJournal(journal));
+    QVERIFY(cal->deleteJournal(journal));
+    QVERIFY(cal->deletedJournal(journal->uid()));
+    QVERIFY(!cal->deletedTodo(todo->uid()));
+    QCOMPARE(cal->deletedJournals().count(), 1);
+
+    cal->setTombstoneLimits(0, 3600);
+    QCOMPARE(cal->tombstoneMaxAge(), 3600);
+    QVERIFY(cal->deletedEvent(event1->uid()));
+    cal->pruneTombstones(QDateTime::currentDateTimeUtc().addSecs(7200));
+    QVERIFY(!cal->deletedEvent(event1->uid()));
+    QVERIFY(!cal->deletedJournal(journal->uid()));
+
+    // Tombstones are only kept with deletion tracking enabled
+    cal->setDeletionTracking(false);
+    QVERIFY(cal->addEvent(event1));
+    QVERIFY(cal->deleteEvent(event1));
+    cal->setDeletionTracking(true);
+    QVERIFY(!cal->deletedEvent(event1->uid()));
+}
+
+void MemoryCalendarTest::testMemoryUsage()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    Calendar::MemoryUsage usage = cal->approximateMemoryUsage();
+    QCOMPARE(usage.incidences, qint64(0));
+    QCOMPARE(usage.recurrenceCaches, qint64(0));
+    QCOMPARE(usage.tombstones, qint64(0));
+
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), Qt::UTC);
+    Event::List events;
+    Incidence::List incidences;
+    for (int i = 0; i < 100; ++i) {
+        Event::Ptr event(new Event);
+        event->setUid(QStringLiteral("event%1").arg(i));
+        event->setSummary(QStringLiteral("Event %1").arg(i));
+        event->setDtStart(start.addDays(i));
+        event->setDtEnd(start.addDays(i).addSecs(3600));
+        events.append(event);
+        incidences.append(event);
+    }
+    QVERIFY(cal->addIncidences(incidences));
+    usage = cal->approximateMemoryUsage();
+    QVERIFY(usage.incidences >= 100 * events.first()->approximateMemoryUsage() / 2);
+    QVERIFY(usage.indexes > 0);
+    QCOMPARE(usage.recurrenceCaches, qint64(0));
+    QCOMPARE(usage.total(), usage.incidences + usage.indexes);
+
+    // Larger payloads count
+    const qint64 eventSize = events.first()->approximateMemoryUsage();
+    events.first()->setDescription(QString(1000, QLatin1Char('x')));
+    events.first()->addAttendee(Attendee(QStringLiteral("Attendee"), QStringLiteral("attendee@example.com")));
+    QVERIFY(events.first()->approximateMemoryUsage() >= eventSize + 2000);
+    QVERIFY(cal->approximateMemoryUsage().incidences >= usage.incidences + 2000);
+
+    // Rules with a fixed number of occurrences cache them once looked at
+    Event::Ptr recurring(new Event);
+    recurring->setDtStart(start);
+    recurring->recurrence()->setDaily(1);
+    recurring->recurrence()->setDuration(500);
+    QVERIFY(cal->addEvent(recurring));
+    QCOMPARE(cal->approximateMemoryUsage().recurrenceCaches, qint64(0));
+    QCOMPARE(recurring->recurrence()->endDate(), start.date().addDays(499));
+    usage = cal->approximateMemoryUsage();
+    QVERIFY(usage.recurrenceCaches >= 500 * qint64(sizeof(QDateTime)));
+    QVERIFY(recurring->approximateMemoryUsage() >= usage.recurrenceCaches);
+
+    // Deleted incidences are kept in full, unless only tombstones are kept
+    for (const Event::Ptr &event : qAsConst(events)) {
+        QVERIFY(cal->deleteEvent(event));
+    }
+    const Calendar::MemoryUsage deletedUsage = cal->approximateMemoryUsage();
+    QVERIFY(deletedUsage.tombstones >= usage.incidences - recurring->approximateMemoryUsage());
+    // Each incidence counts once, deleted ones only as tombstones
+    QCOMPARE(deletedUsage.incidences + deletedUsage.recurrenceCaches, recurring->approximateMemoryUsage());
+    cal->setTombstoneMode(true);
+    const Calendar::MemoryUsage tombstoneUsage = cal->approximateMemoryUsage();
+    QVERIFY(tombstoneUsage.tombstones > 0);
+    QVERIFY(tombstoneUsage.tombstones < deletedUsage.tombstones);
+    QCOMPARE(tombstoneUsage.incidences, deletedUsage.incidences);
+    QCOMPARE(tombstoneUsage.recurrenceCaches, deletedUsage.recurrenceCaches);
+
+    cal->close();
+    usage = cal->approximateMemoryUsage();
+    QCOMPARE(usage.incidences, qint64(0));
+    QCOMPARE(usage.tombstones, qint64(0));
+}
+
+void MemoryCalendarTest::testQuery()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QString work = QStringLiteral("Work");
+    const QString home = QStringLiteral("Home");
+    const QString email = QStringLiteral("me@example.com");
+    const QStringList notebooks = QStringList() << QStringLiteral("personal") << QStringLiteral("team");
+    for (const QString &notebook : notebooks) {
+        QVERIFY(cal->addNotebook(notebook, true));
+    }
+
+    const QDateTime start(QDate(2019, 1, 1), QTime(10, 0), Qt::UTC);
+    for (int i = 0; i < 300; ++i) {
+        Incidence::Ptr incidence;
+        const QDateTime dt = start.addDays(i * 7 % 365);
+        switch (i % 3) {
+        case 0: {
+            Event::Ptr event(new Event);
+            event->setDtStart(dt);
+            event->setDtEnd(dt.addSecs(3600 * (i % 50)));
+            if (i % 11 == 0) {
+                event->recurrence()->setWeekly(1);
+                event->recurrence()->setDuration(i % 2 ? 5 : -1);
+            }
+            incidence = event;
+            break;
+        }
+        case 1: {
+            Todo::Ptr todo(new Todo);
+            todo->setDtDue(dt);
+            todo->setCompleted(i % 4 == 1);
+            incidence = todo;
+            break;
+        }
+        default:
+            incidence = Journal::Ptr(new Journal);
+            incidence->setDtStart(dt);
+            break;
+        }
+        incidence->setUid(QStringLiteral("incidence%1").arg(i));
+        if (i % 5 == 0) {
+            incidence->setCategories(work);
+        } else if (i % 7 == 0) {
+            incidence->setCategories(QStringList() << home << work);
+        }
+        if (i % 6 == 0) {
+            incidence->addAttendee(Attendee(QStringLiteral("Me"), email));
+        }
+        QVERIFY(cal->addIncidence(incidence));
+        if (i % 4 != 3) {
+            QVERIFY(cal->setNotebook(incidence, notebooks.at(i % 4 % 2)));
+        }
+    }
+
+    const auto sorted = [](Incidence::List incidences) -> Incidence::List {
+        std::sort(incidences.begin(), incidences.end(), [](const Incidence::Ptr &a, const Incidence::Ptr &b) {
+            return a->uid() < b->uid();
+        });
+        return incidences;
+    };
+    // Looks through all incidences, independently of Calendar::query()
+    const auto expected = [&](const CalendarQuery &query) -> Incidence::List {
+        QSet<Incidence::Ptr> inRange;
+        if (query.startDate().isValid()) {
+            const Event::List events = cal->rawEvents(query.startDate(), query.endDate());
+            for (const Event::Ptr &event : events) {
+                inRange.insert(event);
+            }
+        }
+        Incidence::List incidences;
+        const Incidence::List all = cal->rawIncidences();
+        for (const Incidence::Ptr &incidence : all) {
+            if (!query.includesType(incidence->type())
+                || (!query.category().isEmpty() && !incidence->categories().contains(query.category()))
+                || (!query.notebook().isEmpty() && cal->notebook(incidence) != query.notebook())
+                || (!query.attendeeEmail().isEmpty() && incidence->attendeeByMail(query.attendeeEmail()).isNull())) {
+                continue;
+            }
+            if (incidence->type() == Incidence::TypeTodo && query.completion() != CalendarQuery::CompletionAny
+                && incidence.staticCast<Todo>()->isCompleted() != (query.completion() == CalendarQuery::CompletionCompleted)) {
+                continue;
+            }
+            if (query.startDate().isValid()) {
+                const QDate date = incidence->type() == Incidence::TypeTodo
+                                   ? incidence.staticCast<Todo>()->dtDue().date() : incidence->dtStart().date();
+                if (incidence->type() == Incidence::TypeEvent ? !inRange.contains(incidence)
+                    : date < query.startDate() || date > query.endDate()) {
+                    continue;
+                }
+            }
+            incidences.append(incidence);
+        }
+        return sorted(incidences);
+    };
+
+    QVector<CalendarQuery> queries;
+    for (int types = 0; types < 3; ++types) {
+        for (int criteria = 0; criteria < 32; ++criteria) {
+            CalendarQuery query;
+            if (types == 1) {
+                query.setTypes({Incidence::TypeEvent});
+            } else if (types == 2) {
+                query.setTypes({Incidence::TypeTodo, Incidence::TypeJournal});
+            }
+            if (criteria & 1) {
+                query.setCategory(criteria & 16 ? home : work);
+            }
+            if (criteria & 2) {
+                query.setNotebook(notebooks.at(criteria / 16));
+            }
+            if (criteria & 4) {
+                query.setAttendeeEmail(email);
+            }
+            if (criteria & 8) {
+                query.setDateRange(QDate(2019, 3, 1), QDate(2019, 3, 1).addDays(criteria * 3));
+            }
+            if (criteria & 16) {
+                query.setCompletion(CalendarQuery::CompletionIncomplete);
+            }
+            queries.append(query);
+        }
+    }
+
+    for (const CalendarQuery &query : qAsConst(queries)) {
+        const Incidence::List matching = expected(query);
+        QCOMPARE(sorted(cal->query(query)), matching);
+
+        CalendarQuery limited(query);
+        limited.setLimit(3);
+        const Incidence::List some = cal->query(limited);
+        QCOMPARE(some.count(), qMin(3, matching.count()));
+        for (const Incidence::Ptr &incidence : some) {
+            QVERIFY(matching.contains(incidence));
+        }
+    }
+
+    // Nothing takes place in an empty range
+    CalendarQuery empty;
+    empty.setDateRange(QDate(2019, 3, 2), QDate(2019, 3, 1));
+    QVERIFY(cal->query(empty).isEmpty());
+
+    // The filter of the calendar is applied on request
+    CalendarQuery filtered;
+    filtered.setTypes({Incidence::TypeTodo});
+    filtered.setApplyFilter(true);
+    CalFilter *filter = new CalFilter;
+    filter->setCriteria(CalFilter::HideCompletedTodos);
+    filter->setEnabled(true);
+    cal->setFilter(filter);
+    const Incidence::List open = cal->query(filtered);
+    QVERIFY(!open.isEmpty());
+    for (const Incidence::Ptr &incidence : open) {
+        QVERIFY(!incidence.staticCast<Todo>()->isCompleted());
+    }
+    filtered.setCompletion(CalendarQuery::CompletionIncomplete);
+    QCOMPARE(sorted(open), sorted(cal->query(filtered)));
+    cal->setFilter(nullptr);
+    delete filter;
+}
+
+void MemoryCalendarTest::testFullTextSearch()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QDateTime dt(QDate(2019, 3, 1), QTime(9, 0), Qt::UTC);
+    auto add = [&](const QString &uid, const QString &summary, const QString &location, const QString &description) -> Event::Ptr {
+        Event::Ptr event(new Event);
+        event->setUid(uid);
+        event->setDtStart(dt);
+        event->setSummary(summary);
+        event->setLocation(location);
+        event->setDescription(description);
+        cal->addEvent(event);
+        return event;
+    };
+    add(QStringLiteral("standup"), QStringLiteral("Team stand-up"), QStringLiteral("Room 4"), QStringLiteral("Daily meeting of the team"));
+    const Event::Ptr review = add(QStringLiteral("review"), QStringLiteral("Design review"), QStringLiteral("Meeting room"), QString());
+    const Event::Ptr lunch = add(QStringLiteral("lunch"), QStringLiteral("Lunch"), QStringLiteral("Café Müller"), QStringLiteral("Meet Anna"));
+    Journal::Ptr notes(new Journal);
+    notes->setUid(QStringLiteral("notes"));
+    notes->setSummary(QStringLiteral("MEETING notes"));
+    notes->setDescription(QStringLiteral("The team meeting went well"));
+    cal->addJournal(notes);
+
+    auto uids = [](const Incidence::List &incidences) -> QStringList {
+        QStringList uids;
+        for (const Incidence::Ptr &incidence : incidences) {
+            uids << incidence->uid();
+        }
+        return uids;
+    };
+
+    for (bool indexed : {false, true}) {
+        cal->setFullTextIndexEnabled(indexed);
+        QCOMPARE(cal->isFullTextIndexEnabled(), indexed);
+
+        // Words in the summary count more than in the location or description
+        QCOMPARE(uids(cal->search(QStringLiteral("meeting"))),
+                 QStringList() << QStringLiteral("notes") << QStringLiteral("review") << QStringLiteral("standup"));
+        QCOMPARE(uids(cal->search(QStringLiteral("meeting"), 1)), QStringList() << QStringLiteral("notes"));
+        // All words must match, in any field
+        QCOMPARE(uids(cal->search(QStringLiteral("team MEETING"))),
+                 QStringList() << QStringLiteral("standup") << QStringLiteral("notes"));
+        QCOMPARE(uids(cal->search(QStringLiteral("stand"))), QStringList() << QStringLiteral("standup"));
+        QCOMPARE(uids(cal->search(QStringLiteral("cafe"))), QStringList());
+        QCOMPARE(uids(cal->search(QStringLiteral("müller"))), QStringList() << QStringLiteral("lunch"));
+        QCOMPARE(uids(cal->search(QStringLiteral("meet*"))).count(), 4);
+        QCOMPARE(uids(cal->search(QStringLiteral("meet"))), QStringList() << QStringLiteral("lunch"));
+        QCOMPARE(uids(cal->search(QStringLiteral("rev* room"))), QStringList() << QStringLiteral("review"));
+        QVERIFY(cal->search(QStringLiteral("meeting nothing")).isEmpty());
+        QVERIFY(cal->search(QStringLiteral("  ")).isEmpty());
+    }
+
+    // The index follows changes and deletions
+    review->setSummary(QStringLiteral("Code review"));
+    QVERIFY(cal->search(QStringLiteral("design")).isEmpty());
+    QCOMPARE(uids(cal->search(QStringLiteral("code"))), QStringList() << QStringLiteral("review"));
+    cal->deleteEvent(lunch);
+    QVERIFY(cal->search(QStringLiteral("anna")).isEmpty());
+    QCOMPARE(uids(cal->search(QStringLiteral("meet*"))).count(), 3);
+    add(QStringLiteral("planning"), QStringLiteral("Sprint planning"), QString(), QString());
+    QCOMPARE(uids(cal->search(QStringLiteral("sprint"))), QStringList() << QStringLiteral("planning"));
+
+    const qint64 indexes = cal->approximateMemoryUsage().indexes;
+    cal->setFullTextIndexEnabled(false);
+    QVERIFY(cal->approximateMemoryUsage().indexes < indexes);
+    QCOMPARE(uids(cal->search(QStringLiteral("sprint"))), QStringList() << QStringLiteral("planning"));
+
+    cal->setFullTextIndexEnabled(true);
+    cal->close();
+    QVERIFY(cal->search(QStringLiteral("team")).isEmpty());
+}
+
+void MemoryCalendarTest::testAttendeeIndex()
+{
+    MemoryCalendar::Ptr cal(new MemoryCalendar(QTimeZone::utc()));
+    const QString me = QStringLiteral("me@example.com");
+    const QString other = QStringLiteral("other@example.com");
+    const QDateTime dt(QDate(2019, 5, 6), QTime(10, 0), Qt::UTC);
+
+    Event::Ptr allHands(new Event);
+    allHands->setUid(QStringLiteral("allhands"));
+    allHands->setDtStart(dt);
+    for (int i = 0; i < 2000; ++i) {
+        allHands->addAttendee(Attendee(QString(), QStringLiteral("employee%1@example.com").arg(i)));
+    }
+    allHands->addAttendee(Attendee(QStringLiteral("Me"), me));
+    cal->addEvent(allHands);
+
+    Todo::Ptr todo(new Todo);
+    todo->setUid(QStringLiteral("todo"));
+    todo->addAttendee(Attendee(QStringLiteral("Other"), other));
+    cal->addTodo(todo);
+
+    Event::Ptr noAttendees(new Event);
+    noAttendees->setUid(QStringLiteral("noattendees"));
+    noAttendees->setDtStart(dt);
+    cal->addEvent(noAttendees);
+
+    QCOMPARE(cal->incidencesWithAttendee(me), Incidence::List() << allHands);
+    QCOMPARE(cal->incidencesWithAttendee(QStringLiteral("employee1999@example.com")), Incidence::List() << allHands);
+    QCOMPARE(cal->incidencesWithAttendee(other), Incidence::List() << todo);
+    QVERIFY(cal->incidencesWithAttendee(QStringLiteral("nobody@example.com")).isEmpty());
+
+    // Changes to the attendees are followed
+    todo->addAttendee(Attendee(QStringLiteral("Me"), me));
+    QCOMPARE(cal->incidencesWithAttendee(me).count(), 2);
+    allHands->clearAttendees();
+    allHands->setSummary(QStringLiteral("Cancelled"));
+    QCOMPARE(cal->incidencesWithAttendee(me), Incidence::List() << todo);
+    QVERIFY(cal->incidencesWithAttendee(QStringLiteral("employee0@example.com")).isEmpty());
+
+    // Queries use the index
+    CalendarQuery query;
+    query.setAttendeeEmail(me);
+    QCOMPARE(cal->query(query), Incidence::List() << todo);
+    query.setTypes(QVector<Incidence::IncidenceType>() << Incidence::TypeEvent);
+    QVERIFY(cal->query(query).isEmpty());
+
+    QCOMPARE(cal->snapshot()->incidencesWithAttendee(me), Incidence::List() << todo);
+
+    cal->deleteTodo(todo);
+    QVERIFY(cal->incidencesWithAttendee(me).isEmpty());
+    QVERIFY(cal->incidencesWithAttendee(other).isEmpty());
+}
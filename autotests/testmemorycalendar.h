@@ -34,6 +34,26 @@ private Q_SLOTS:
     void testRelationsCrash();
     void testRecurrenceExceptions();
     void testChangeRecurId();
+    void testRawEventsInRange();
+    void testRawIncidencesForDate();
+    void testRecurringIncidencesForDate();
+    void testRecurringEventsByDay();
+    void testIncidenceByUid();
+    void testSchedulingId();
+    void testCategories();
+    void testDuplicates();
+    void testAddIncidences();
+    void testAlarms();
+    void testSnapshot();
+    void testConcurrentReaders();
+    void testOrphans();
+    void benchmarkDeleteOrphans();
+    void testRelationTree();
+    void testTombstones();
+    void testMemoryUsage();
+    void testQuery();
+    void testFullTextSearch();
+    void testAttendeeIndex();
 };
 
 #endif
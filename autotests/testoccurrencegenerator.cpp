@@ -0,0 +1,152 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testoccurrencegenerator.h"
+#include "icalformat.h"
+#include "recurrence.h"
+
+#include <QTest>
+#include <QTimeZone>
+QTEST_MAIN(OccurrenceGeneratorTest)
+
+using namespace KCalendarCore;
+
+static RecurrenceRule *parseRule(const QString &rrule, const QDateTime &start)
+{
+    ICalFormat format;
+    RecurrenceRule *rule = new RecurrenceRule;
+    if (!format.fromString(rule, rrule)) {
+        delete rule;
+        return nullptr;
+    }
+    rule->setStartDt(start);
+    return rule;
+}
+
+void OccurrenceGeneratorTest::testSameAsGetNextDateTime_data()
+{
+    QTest::addColumn<QStringList>("rrules");
+    QTest::addColumn<QString>("exrule");
+    QTest::addColumn<QDateTime>("start");
+    QTest::addColumn<bool>("allDay");
+
+    const QTimeZone berlin("Europe/Berlin");
+    const QDateTime start(QDate(2019, 3, 20), QTime(9, 30), berlin);
+    const QDateTime day(QDate(2019, 3, 20), QTime(0, 0), berlin);
+
+    QTest::newRow("daily") << QStringList{QStringLiteral("FREQ=DAILY")} << QString() << start << false;
+    QTest::newRow("daily exrule")
+            << QStringList{QStringLiteral("FREQ=DAILY")} << QStringLiteral("FREQ=WEEKLY;BYDAY=SA,SU")
+            << start << false;
+    QTest::newRow("two rules")
+            << QStringList{QStringLiteral("FREQ=WEEKLY;BYDAY=MO"), QStringLiteral("FREQ=MONTHLY;BYMONTHDAY=1,-1")}
+            << QStringLiteral("FREQ=MONTHLY;BYDAY=1MO") << start << false;
+    QTest::newRow("count") << QStringList{QStringLiteral("FREQ=DAILY;INTERVAL=2;COUNT=30")} << QString() << start << false;
+    QTest::newRow("hourly") << QStringList{QStringLiteral("FREQ=HOURLY;INTERVAL=5")}
+                            << QStringLiteral("FREQ=DAILY;BYHOUR=4,14;BYMINUTE=30") << start << false;
+    QTest::newRow("utc") << QStringList{QStringLiteral("FREQ=DAILY")}
+                         << QString() << start.toTimeZone(QTimeZone::utc()) << false;
+    QTest::newRow("all-day") << QStringList{QStringLiteral("FREQ=DAILY")}
+                             << QStringLiteral("FREQ=WEEKLY;BYDAY=WE") << day << true;
+    QTest::newRow("no rules") << QStringList() << QString() << start << false;
+}
+
+void OccurrenceGeneratorTest::testSameAsGetNextDateTime()
+{
+    QFETCH(QStringList, rrules);
+    QFETCH(QString, exrule);
+    QFETCH(QDateTime, start);
+    QFETCH(bool, allDay);
+
+    Recurrence recurrence;
+    recurrence.setStartDateTime(start, allDay);
+    for (const QString &rrule : qAsConst(rrules)) {
+        RecurrenceRule *rule = parseRule(rrule, start);
+        QVERIFY(rule);
+        recurrence.addRRule(rule);
+    }
+    if (!exrule.isEmpty()) {
+        RecurrenceRule *rule = parseRule(exrule, start);
+        QVERIFY(rule);
+        recurrence.addExRule(rule);
+    }
+    recurrence.addRDate(start.date().addDays(9));
+    recurrence.addRDateTime(start.addDays(5).addSecs(3600));
+    recurrence.addRDateTime(QDateTime(start.date().addDays(20), QTime(23, 0), QTimeZone("Asia/Tokyo")));
+    recurrence.addExDate(start.date().addDays(3));
+    recurrence.addExDateTime(start.addDays(2));
+    recurrence.addExDateTime(start.addDays(6));
+
+    for (const QDateTime &from : {start.addSecs(-1), start, start.addDays(4).addSecs(7), start.addDays(-30)}) {
+        Recurrence::OccurrenceGenerator occurrences = recurrence.occurrences(from);
+        QDateTime expected = recurrence.getNextDateTime(from);
+        int count = 0;
+        for (; count < 150 && expected.isValid(); ++count) {
+            QVERIFY(occurrences.hasNext());
+            QCOMPARE(occurrences.next(), expected);
+            expected = recurrence.getNextDateTime(expected);
+        }
+        if (!expected.isValid()) {
+            QVERIFY(!occurrences.hasNext());
+            QVERIFY(!occurrences.next().isValid());
+        }
+        QVERIFY(count > 0);
+    }
+}
+
+void OccurrenceGeneratorTest::testCopy()
+{
+    const QDateTime start(QDate(2019, 1, 1), QTime(8, 0), Qt::UTC);
+    Recurrence recurrence;
+    recurrence.setStartDateTime(start, false);
+    recurrence.setDaily(1);
+
+    Recurrence::OccurrenceGenerator occurrences = recurrence.occurrences(start);
+    QCOMPARE(occurrences.next(), start.addDays(1));
+    Recurrence::OccurrenceGenerator copy = occurrences;
+    QCOMPARE(occurrences.next(), start.addDays(2));
+    QCOMPARE(occurrences.next(), start.addDays(3));
+    QCOMPARE(copy.next(), start.addDays(2));
+    copy = occurrences;
+    QCOMPARE(copy.next(), start.addDays(4));
+    QCOMPARE(occurrences.next(), start.addDays(4));
+}
+
+void OccurrenceGeneratorTest::testExhausted()
+{
+    const QDateTime start(QDate(2019, 1, 1), QTime(8, 0), Qt::UTC);
+    Recurrence recurrence;
+    recurrence.setStartDateTime(start, false);
+    recurrence.setWeekly(1);
+    recurrence.setDuration(3);
+
+    Recurrence::OccurrenceGenerator occurrences = recurrence.occurrences(start.addSecs(-1));
+    QCOMPARE(occurrences.next(), start);
+    QCOMPARE(occurrences.next(), start.addDays(7));
+    QCOMPARE(occurrences.next(), start.addDays(14));
+    QVERIFY(!occurrences.hasNext());
+
+    // An exrule which excludes everything leaves nothing
+    recurrence.setDuration(-1);
+    recurrence.addExRule(parseRule(QStringLiteral("FREQ=WEEKLY"), start));
+    QVERIFY(!recurrence.occurrences(start.addSecs(-1)).hasNext());
+    QVERIFY(!recurrence.getNextDateTime(start.addSecs(-1)).isValid());
+}
@@ -0,0 +1,207 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testrecurrencerule.h"
+#include "icalformat.h"
+#include "recurrencerule.h"
+
+#include <QTest>
+#include <QTimeZone>
+QTEST_MAIN(RecurrenceRuleTest)
+
+using namespace KCalendarCore;
+
+void RecurrenceRuleTest::testSimpleRules_data()
+{
+    QTest::addColumn<QString>("rrule");
+    QTest::addColumn<QDateTime>("start");
+    QTest::addColumn<bool>("allDay");
+
+    const QTimeZone berlin("Europe/Berlin");
+    const QDateTime start(QDate(2019, 1, 31), QTime(9, 30), berlin);
+    // 02:30 doesn't exist in Berlin on 2019-03-31 and 2020-03-29
+    const QDateTime night(QDate(2019, 3, 1), QTime(2, 30), berlin);
+    const QDateTime utc(QDate(2020, 2, 29), QTime(23, 0), Qt::UTC);
+    const QDateTime day(QDate(2019, 2, 3), QTime(0, 0), berlin);
+    // Occurrences at midnight UTC end the days queried in UTC, and in London
+    // on 2019-10-27, when the day there ends at midnight UTC but starts at 23:00
+    const QDateTime midnight(QDate(2019, 10, 20), QTime(0, 0), Qt::UTC);
+
+    QTest::newRow("daily") << QStringLiteral("FREQ=DAILY") << start << false;
+    QTest::newRow("daily interval") << QStringLiteral("FREQ=DAILY;INTERVAL=3") << start << false;
+    QTest::newRow("daily count") << QStringLiteral("FREQ=DAILY;COUNT=20") << start << false;
+    QTest::newRow("daily until") << QStringLiteral("FREQ=DAILY;INTERVAL=2;UNTIL=20190401T000000Z") << start << false;
+    QTest::newRow("daily gap") << QStringLiteral("FREQ=DAILY") << night << false;
+    QTest::newRow("daily gap count") << QStringLiteral("FREQ=DAILY;COUNT=40") << night << false;
+    QTest::newRow("daily all-day") << QStringLiteral("FREQ=DAILY;INTERVAL=4") << day << true;
+    QTest::newRow("daily midnight") << QStringLiteral("FREQ=DAILY;INTERVAL=2") << midnight << false;
+    QTest::newRow("weekly") << QStringLiteral("FREQ=WEEKLY") << start << false;
+    QTest::newRow("weekly by day") << QStringLiteral("FREQ=WEEKLY;BYDAY=MO,WE,FR") << start << false;
+    QTest::newRow("weekly week start") << QStringLiteral("FREQ=WEEKLY;INTERVAL=2;BYDAY=TU,SU;WKST=SU") << start << false;
+    QTest::newRow("weekly count") << QStringLiteral("FREQ=WEEKLY;BYDAY=SA,SU;COUNT=15") << start << false;
+    QTest::newRow("weekly gap") << QStringLiteral("FREQ=WEEKLY;BYDAY=SU") << night << false;
+    QTest::newRow("weekly utc") << QStringLiteral("FREQ=WEEKLY;INTERVAL=3;BYDAY=MO,SA") << utc << false;
+    QTest::newRow("weekly all-day") << QStringLiteral("FREQ=WEEKLY;BYDAY=TH,FR") << day << true;
+    QTest::newRow("weekly midnight") << QStringLiteral("FREQ=WEEKLY;BYDAY=SU,TU") << midnight << false;
+    QTest::newRow("monthly") << QStringLiteral("FREQ=MONTHLY") << start << false;
+    QTest::newRow("monthly by day") << QStringLiteral("FREQ=MONTHLY;BYMONTHDAY=1,15,-1") << start << false;
+    QTest::newRow("monthly from end") << QStringLiteral("FREQ=MONTHLY;INTERVAL=2;BYMONTHDAY=-3,-31") << start << false;
+    QTest::newRow("monthly nth weekday") << QStringLiteral("FREQ=MONTHLY;BYDAY=2TU") << start << false;
+    QTest::newRow("monthly last weekday") << QStringLiteral("FREQ=MONTHLY;BYDAY=-1FR,1MO;COUNT=10") << start << false;
+    QTest::newRow("monthly fifth weekday") << QStringLiteral("FREQ=MONTHLY;BYDAY=5WE") << start << false;
+    QTest::newRow("monthly every weekday") << QStringLiteral("FREQ=MONTHLY;INTERVAL=5;BYDAY=TH,-2SA") << start << false;
+    QTest::newRow("monthly gap") << QStringLiteral("FREQ=MONTHLY;BYDAY=-1SU") << night << false;
+    QTest::newRow("monthly utc") << QStringLiteral("FREQ=MONTHLY;BYMONTHDAY=29,30") << utc << false;
+    QTest::newRow("yearly") << QStringLiteral("FREQ=YEARLY") << start << false;
+    QTest::newRow("yearly leap day") << QStringLiteral("FREQ=YEARLY;COUNT=3") << utc << false;
+    QTest::newRow("yearly by month") << QStringLiteral("FREQ=YEARLY;BYMONTH=3,6,9;BYMONTHDAY=15,-1") << start << false;
+    QTest::newRow("yearly interval") << QStringLiteral("FREQ=YEARLY;INTERVAL=2;BYMONTH=2") << start << false;
+    QTest::newRow("yearly until") << QStringLiteral("FREQ=YEARLY;BYMONTHDAY=31;UNTIL=20300101T000000Z") << start << false;
+    QTest::newRow("yearly all-day") << QStringLiteral("FREQ=YEARLY;BYMONTH=1,2") << day << true;
+}
+
+// Compares the closed-form evaluation of simple rules with the generic one,
+// which a BYHOUR part with the hour of the start turns them over to
+void RecurrenceRuleTest::testSimpleRules()
+{
+    QFETCH(QString, rrule);
+    QFETCH(QDateTime, start);
+    QFETCH(bool, allDay);
+
+    ICalFormat format;
+    RecurrenceRule rule;
+    QVERIFY(format.fromString(&rule, rrule));
+    rule.setStartDt(start);
+    rule.setAllDay(allDay);
+    RecurrenceRule generic(rule);
+    generic.setByHours(QList<int>() << start.time().hour());
+
+    QCOMPARE(rule.endDt(), generic.endDt());
+
+    const QDateTime from = start.addDays(-10);
+    const QDateTime to = start.addYears(3);
+    const QList<QDateTime> times = rule.timesInInterval(from, to);
+    QCOMPARE(times, generic.timesInInterval(from, to));
+    QCOMPARE(rule.timesInInterval(start.addDays(40), start.addDays(70)),
+             generic.timesInInterval(start.addDays(40), start.addDays(70)));
+
+    QDateTime dt = start.addSecs(-1);
+    for (int i = 0; i < 60 && dt.isValid(); ++i) {
+        const QDateTime next = rule.getNextDate(dt);
+        QCOMPARE(next, generic.getNextDate(dt));
+        QCOMPARE(rule.getPreviousDate(dt), generic.getPreviousDate(dt));
+        if (next.isValid()) {
+            QCOMPARE(rule.getPreviousDate(next), generic.getPreviousDate(next));
+            QCOMPARE(rule.recursAt(next), generic.recursAt(next));
+            QCOMPARE(rule.recursAt(next.addSecs(3600)), generic.recursAt(next.addSecs(3600)));
+        }
+        dt = next;
+    }
+    const QDateTime late = start.addYears(20);
+    QCOMPARE(rule.getPreviousDate(late), generic.getPreviousDate(late));
+
+    const QTimeZone tokyo("Asia/Tokyo");
+    const QTimeZone london("Europe/London");
+    for (QDate date = from.date(); date < start.date().addDays(400); date = date.addDays(1)) {
+        QCOMPARE(rule.recursOn(date, start.timeZone()), generic.recursOn(date, start.timeZone()));
+        QCOMPARE(rule.recursOn(date, tokyo), generic.recursOn(date, tokyo));
+        QCOMPARE(rule.recursOn(date, london), generic.recursOn(date, london));
+    }
+    for (QDate date = from.date(); date < start.date().addDays(800); date = date.addDays(11)) {
+        const QDateTime noon(date, QTime(12, 0), start.timeZone());
+        QCOMPARE(rule.durationTo(noon), generic.durationTo(noon));
+        QCOMPARE(rule.durationTo(date), generic.durationTo(date));
+    }
+}
+
+void RecurrenceRuleTest::testTimeZoneTransitions_data()
+{
+    QTest::addColumn<QString>("rrule");
+    QTest::addColumn<QDateTime>("start");
+    QTest::addColumn<int>("step");
+
+    const QTimeZone berlin("Europe/Berlin");
+    const QTimeZone newYork("America/New_York");
+    // BYHOUR keeps these rules on the constraint engine
+    QTest::newRow("spring") << QStringLiteral("FREQ=DAILY;BYHOUR=2;BYMINUTE=30")
+                            << QDateTime(QDate(2019, 3, 1), QTime(2, 30), berlin) << 1;
+    QTest::newRow("autumn") << QStringLiteral("FREQ=DAILY;BYHOUR=2;BYMINUTE=30")
+                            << QDateTime(QDate(2019, 10, 1), QTime(2, 30), berlin) << 1;
+    QTest::newRow("weekly") << QStringLiteral("FREQ=WEEKLY;BYDAY=SU;BYHOUR=2;BYMINUTE=0")
+                            << QDateTime(QDate(2019, 1, 6), QTime(2, 0), newYork) << 7;
+    QTest::newRow("before 1900") << QStringLiteral("FREQ=DAILY;BYHOUR=9;BYMINUTE=15")
+                                 << QDateTime(QDate(1899, 11, 20), QTime(9, 15), berlin) << 1;
+    QTest::newRow("after 2200") << QStringLiteral("FREQ=DAILY;BYHOUR=9;BYMINUTE=15")
+                                << QDateTime(QDate(2199, 11, 20), QTime(9, 15), berlin) << 1;
+    QTest::newRow("utc") << QStringLiteral("FREQ=DAILY;BYHOUR=0;BYMINUTE=0")
+                         << QDateTime(QDate(2019, 3, 1), QTime(0, 0), Qt::UTC) << 1;
+}
+
+// Each period has a single candidate at the time of day of the start, which
+// occurs whenever QDateTime accepts that time on that date
+void RecurrenceRuleTest::testTimeZoneTransitions()
+{
+    QFETCH(QString, rrule);
+    QFETCH(QDateTime, start);
+    QFETCH(int, step);
+
+    ICalFormat format;
+    RecurrenceRule rule;
+    QVERIFY(format.fromString(&rule, rrule));
+    rule.setStartDt(start);
+
+    QList<QDateTime> expected;
+    for (int i = 0; i < 60; ++i) {
+        const QDateTime dt(start.date().addDays(i * step), start.time(), start.timeZone());
+        if (dt.isValid() && dt.time() == start.time()) {
+            expected << dt;
+        }
+    }
+    const QDateTime end(start.date().addDays(59 * step), QTime(23, 59, 59), start.timeZone());
+    QCOMPARE(rule.timesInInterval(start, end), expected);
+
+    QDateTime dt = start.addSecs(-1);
+    for (const QDateTime &occurrence : qAsConst(expected)) {
+        dt = rule.getNextDate(dt);
+        QCOMPARE(dt, occurrence);
+        QVERIFY(rule.recursAt(occurrence));
+        QVERIFY(rule.recursOn(occurrence.date(), start.timeZone()));
+    }
+    QCOMPARE(rule.getPreviousDate(end), expected.last());
+}
+
+void RecurrenceRuleTest::testHourlyAcrossTransition()
+{
+    ICalFormat format;
+    RecurrenceRule rule;
+    QVERIFY(format.fromString(&rule, QStringLiteral("FREQ=HOURLY;BYMINUTE=0")));
+    const QDateTime start(QDate(2019, 3, 30), QTime(12, 0), QTimeZone("Europe/Berlin"));
+    rule.setStartDt(start);
+
+    // The hour from 2:00 to 3:00 is skipped, occurrences are still an hour apart
+    const QList<QDateTime> times = rule.timesInInterval(start, start.addSecs(48 * 3600));
+    QCOMPARE(times.count(), 49);
+    for (int i = 0; i < times.count(); ++i) {
+        QCOMPARE(times[i], start.addSecs(i * 3600));
+    }
+    QCOMPARE(rule.getNextDate(start.addSecs(13 * 3600)), start.addSecs(14 * 3600));
+    QCOMPARE(times[14].time(), QTime(3, 0));
+}
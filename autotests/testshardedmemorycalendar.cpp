@@ -0,0 +1,274 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testshardedmemorycalendar.h"
+#include "shardedmemorycalendar.h"
+
+#include <QAtomicInt>
+#include <QTest>
+#include <QThread>
+#include <QTimeZone>
+QTEST_MAIN(ShardedMemoryCalendarTest)
+
+using namespace KCalendarCore;
+
+namespace {
+class Observer : public Calendar::CalendarObserver
+{
+public:
+    explicit Observer(Calendar *calendar)
+        : mCalendar(calendar)
+    {
+    }
+
+    void calendarIncidenceAdded(const Incidence::Ptr &incidence) override
+    {
+        // Observers may use the calendar
+        if (mCalendar->incidence(incidence->uid(), incidence->recurrenceId()) == incidence) {
+            mAdded.ref();
+        }
+    }
+
+    void calendarIncidenceChanged(const Incidence::Ptr &incidence) override
+    {
+        Q_UNUSED(incidence);
+        mChanged.ref();
+    }
+
+    void calendarIncidenceAboutToBeDeleted(const Incidence::Ptr &incidence) override
+    {
+        Q_UNUSED(incidence);
+        mAboutToBeDeleted.ref();
+    }
+
+    void calendarIncidenceDeleted(const Incidence::Ptr &incidence, const Calendar *calendar) override
+    {
+        Q_UNUSED(calendar);
+        if (!mCalendar->incidence(incidence->uid(), incidence->recurrenceId())) {
+            mDeleted.ref();
+        }
+    }
+
+    Calendar *mCalendar;
+    QAtomicInt mAdded;
+    QAtomicInt mChanged;
+    QAtomicInt mAboutToBeDeleted;
+    QAtomicInt mDeleted;
+};
+}
+
+void ShardedMemoryCalendarTest::testIncidences()
+{
+    ShardedMemoryCalendar::Ptr cal(new ShardedMemoryCalendar(QTimeZone::utc(), 4));
+    QCOMPARE(cal->shardCount(), 4);
+
+    const QDate date(2019, 6, 3);
+    const QDateTime start(date, QTime(10, 0), QTimeZone::utc());
+    for (int i = 0; i < 40; ++i) {
+        Event::Ptr event(new Event());
+        event->setUid(QStringLiteral("event-%1").arg(i));
+        event->setDtStart(start.addDays(i % 4));
+        event->setDtEnd(start.addDays(i % 4).addSecs(3600));
+        event->setCategories(QStringList() << QStringLiteral("Category %1").arg(i % 2));
+        QVERIFY(cal->addEvent(event));
+
+        Todo::Ptr todo(new Todo());
+        todo->setUid(QStringLiteral("todo-%1").arg(i));
+        todo->setDtDue(start.addDays(i % 4));
+        QVERIFY(cal->addTodo(todo));
+    }
+    Journal::Ptr journal(new Journal());
+    journal->setDtStart(start);
+    QVERIFY(cal->addJournal(journal));
+
+    QCOMPARE(cal->rawEvents().count(), 40);
+    QCOMPARE(cal->rawTodos().count(), 40);
+    QCOMPARE(cal->rawJournals().count(), 1);
+    QCOMPARE(cal->rawEventsForDate(date).count(), 10);
+    QCOMPARE(cal->rawEvents(date, date.addDays(1)).count(), 20);
+    QCOMPARE(cal->rawTodosForDate(date).count(), 10);
+    QCOMPARE(cal->rawJournalsForDate(date), Journal::List() << journal);
+    QCOMPARE(cal->categories().count(), 2);
+
+    const Event::List sorted = cal->rawEvents(EventSortStartDate, SortDirectionDescending);
+    QCOMPARE(sorted.count(), 40);
+    QCOMPARE(sorted.first()->dtStart(), start.addDays(3));
+    QCOMPARE(sorted.last()->dtStart(), start);
+
+    const Event::Ptr event = cal->event(QStringLiteral("event-7"));
+    QVERIFY(event);
+    QCOMPARE(cal->incidence(QStringLiteral("todo-7"))->uid(), QStringLiteral("todo-7"));
+    QCOMPARE(cal->incidenceFromSchedulingID(QStringLiteral("event-7")), Incidence::Ptr(event));
+
+    QVERIFY(cal->deleteEvent(event));
+    QVERIFY(!cal->event(QStringLiteral("event-7")));
+    QCOMPARE(cal->deletedEvent(QStringLiteral("event-7")), event);
+    QCOMPARE(cal->rawEvents().count(), 39);
+
+    cal->close();
+    QVERIFY(cal->rawEvents().isEmpty());
+    QVERIFY(cal->rawTodos().isEmpty());
+    QVERIFY(cal->categories().isEmpty());
+}
+
+void ShardedMemoryCalendarTest::testObservers()
+{
+    ShardedMemoryCalendar::Ptr cal(new ShardedMemoryCalendar(QTimeZone::utc(), 4));
+    Observer observer(cal.data());
+    cal->registerObserver(&observer);
+
+    Event::Ptr event(new Event());
+    event->setDtStart(QDateTime(QDate(2019, 6, 3), QTime(10, 0), QTimeZone::utc()));
+    QVERIFY(cal->addEvent(event));
+    QCOMPARE(observer.mAdded.load(), 1);
+    QVERIFY(cal->isModified());
+
+    event->setSummary(QStringLiteral("changed"));
+    QCOMPARE(observer.mChanged.load(), 1);
+
+    // A group of changes is a single one
+    event->startUpdates();
+    event->setSummary(QStringLiteral("changed again"));
+    event->setLocation(QStringLiteral("here"));
+    QVERIFY(cal->incidence(event->uid()));
+    event->endUpdates();
+    QCOMPARE(observer.mChanged.load(), 2);
+
+    QVERIFY(cal->deleteEvent(event));
+    QCOMPARE(observer.mAboutToBeDeleted.load(), 1);
+    QCOMPARE(observer.mDeleted.load(), 1);
+
+    cal->unregisterObserver(&observer);
+}
+
+void ShardedMemoryCalendarTest::testChangeUid()
+{
+    ShardedMemoryCalendar::Ptr cal(new ShardedMemoryCalendar(QTimeZone::utc(), 8));
+
+    Todo::Ptr todo(new Todo());
+    todo->setUid(QStringLiteral("before"));
+    QVERIFY(cal->addTodo(todo));
+
+    // Whichever shard the new uid hashes to, the to-do is still found
+    for (int i = 0; i < 8; ++i) {
+        const QString uid = QStringLiteral("after-%1").arg(i);
+        todo->setUid(uid);
+        QCOMPARE(cal->todo(uid), todo);
+    }
+    QVERIFY(!cal->todo(QStringLiteral("before")));
+    QCOMPARE(cal->rawTodos().count(), 1);
+
+    QVERIFY(cal->deleteTodo(todo));
+    QVERIFY(cal->rawTodos().isEmpty());
+}
+
+void ShardedMemoryCalendarTest::testRelations()
+{
+    ShardedMemoryCalendar::Ptr cal(new ShardedMemoryCalendar(QTimeZone::utc(), 8));
+
+    // Most children end up in another shard than their parent
+    Todo::List children;
+    for (int i = 0; i < 32; ++i) {
+        Todo::Ptr child(new Todo());
+        child->setUid(QStringLiteral("child-%1").arg(i));
+        child->setRelatedTo(QStringLiteral("parent"));
+        QVERIFY(cal->addTodo(child));
+        children.append(child);
+    }
+    Todo::Ptr parent(new Todo());
+    parent->setUid(QStringLiteral("parent"));
+    QVERIFY(cal->addTodo(parent));
+    QCOMPARE(cal->relations(parent->uid()).count(), children.count());
+    for (const Todo::Ptr &child : qAsConst(children)) {
+        QCOMPARE(cal->relationParent(child->uid()), Incidence::Ptr(parent));
+    }
+
+    // Children added after their parent are related straight away
+    Todo::Ptr late(new Todo());
+    late->setUid(QStringLiteral("late"));
+    late->setRelatedTo(parent->uid());
+    QVERIFY(cal->addTodo(late));
+    QCOMPARE(cal->relationParent(late->uid()), Incidence::Ptr(parent));
+
+    // Deleting the parent orphans the children, until it is back
+    QVERIFY(cal->deleteTodo(parent));
+    QVERIFY(cal->relations(parent->uid()).isEmpty());
+    QVERIFY(!cal->relationParent(late->uid()));
+    QVERIFY(cal->addTodo(parent));
+    QCOMPARE(cal->relations(parent->uid()).count(), children.count() + 1);
+
+    QVERIFY(cal->deleteTodo(late));
+    QCOMPARE(cal->relations(parent->uid()).count(), children.count());
+}
+
+void ShardedMemoryCalendarTest::testConcurrentWriters()
+{
+    ShardedMemoryCalendar::Ptr cal(new ShardedMemoryCalendar(QTimeZone::utc()));
+    Observer observer(cal.data());
+    cal->registerObserver(&observer);
+
+    const int threadCount = 4;
+    const int count = 250;
+    const QDateTime start(QDate(2019, 6, 3), QTime(10, 0), QTimeZone::utc());
+    QVector<QThread *> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.append(QThread::create([cal, t, count, start]() {
+            for (int i = 0; i < count; ++i) {
+                Event::Ptr event(new Event());
+                event->setUid(QStringLiteral("thread-%1-event-%2").arg(t).arg(i));
+                event->setDtStart(start.addDays(i % 7));
+                event->setCategories(QStringLiteral("Thread %1").arg(t));
+                if (i > 0) {
+                    event->setRelatedTo(QStringLiteral("thread-%1-event-%2").arg(t).arg((i - 1) / 2));
+                }
+                cal->addEvent(event);
+                event->setSummary(QStringLiteral("changed"));
+                if (i % 5 == 0) {
+                    cal->deleteEvent(event);
+                }
+                // Meanwhile, read everything, including the calendar-wide indexes
+                cal->rawEventsForDate(start.date());
+                cal->categories();
+                cal->incidencesWithCategory(QStringLiteral("Thread %1").arg((t + 1) % threadCount));
+                cal->relations(QStringLiteral("thread-%1-event-%2").arg((t + 1) % threadCount).arg(i / 2));
+                cal->relationParent(event->uid());
+                cal->duplicateGroups();
+            }
+        }));
+    }
+    for (QThread *thread : qAsConst(threads)) {
+        thread->start();
+    }
+    for (QThread *thread : qAsConst(threads)) {
+        QVERIFY(thread->wait());
+        delete thread;
+    }
+
+    const int deleted = threadCount * count / 5;
+    QCOMPARE(cal->rawEvents().count(), threadCount * count - deleted);
+    QCOMPARE(cal->deletedEvents().count(), deleted);
+    QCOMPARE(observer.mAdded.load(), threadCount * count);
+    QCOMPARE(observer.mChanged.load(), threadCount * count);
+    QCOMPARE(observer.mDeleted.load(), deleted);
+    QCOMPARE(cal->categories().count(), threadCount);
+
+    cal->unregisterObserver(&observer);
+}
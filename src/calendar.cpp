@@ -36,8 +36,10 @@
 */
 #include "calendar.h"
 #include "calendar_p.h"
+#include "calendarquery.h"
 #include "calfilter.h"
 #include "icaltimezones_p.h"
+#include "memorysize_p.h"
 #include "sorting.h"
 #include "visitor.h"
 
@@ -50,6 +52,7 @@ extern "C" {
 }
 
 #include <algorithm>  // for std::remove()
+#include <limits>
 
 using namespace KCalendarCore;
 
@@ -136,6 +139,71 @@ public:
 private:
     T *mResource;
 };
+
+/**
+  Calls @p visit for each of @p incidences until it returns false.
+  Returns false if it did.
+*/
+template <typename List, typename Visit>
+static bool visitAll(const List &incidences, const Visit &visit)
+{
+    for (const auto &incidence : incidences) {
+        if (!visit(incidence)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  Returns true if @p incidence takes place at least partly between @p start
+  and @p end, as described for CalendarQuery::setDateRange(). Either bound
+  may be invalid for an open range.
+*/
+static bool occursBetween(const Incidence::Ptr &incidence, const QDateTime &start, const QDateTime &end,
+                          const QTimeZone &timeZone)
+{
+    switch (incidence->type()) {
+    case Incidence::TypeEvent: {
+        // Like MemoryCalendar::rawEvents(start, end)
+        const Event::Ptr event = incidence.staticCast<Event>();
+        if (end.isValid() && end < event->dtStart()) {
+            return false;
+        }
+        if (!event->recurs()) {
+            return !start.isValid() || !(event->dtEnd() < start);
+        }
+        if (event->recurrence()->duration() == -1) {
+            return true;
+        }
+        const QDateTime last(event->recurrence()->endDate(), QTime(23, 59, 59, 999), timeZone);
+        return last.isValid() && (!start.isValid() || !(last < start));
+    }
+    case Incidence::TypeTodo: {
+        const Todo::Ptr todo = incidence.staticCast<Todo>();
+        if (!todo->recurs()) {
+            const QDateTime dt = todo->hasDueDate() ? todo->dtDue() :
+                                 todo->hasStartDate() ? todo->dtStart() : QDateTime();
+            return dt.isValid() && (!start.isValid() || !(dt < start)) && (!end.isValid() || !(end < dt));
+        }
+        const Recurrence *recurrence = todo->recurrence();
+        if (end.isValid() && end < recurrence->startDateTime()) {
+            return false;
+        }
+        if (recurrence->duration() == -1) {
+            return true;
+        }
+        const QDateTime last(recurrence->endDate(), QTime(23, 59, 59, 999), timeZone);
+        return last.isValid() && (!start.isValid() || !(last < start));
+    }
+    case Incidence::TypeJournal: {
+        const QDateTime dt = incidence->dtStart();
+        return dt.isValid() && (!start.isValid() || !(dt < start)) && (!end.isValid() || !(end < dt));
+    }
+    default:
+        return false;
+    }
+}
 //@endcond
 
 Calendar::Calendar(const QTimeZone &timeZone)
@@ -186,6 +254,412 @@ void Calendar::setTimeZoneId(const QByteArray &timeZoneId)
 }
 
 //@cond PRIVATE
+void Calendar::Private::insertCategories(const Incidence::Ptr &incidence)
+{
+    QStringList categories = incidence->categories();
+    categories.removeDuplicates();
+    for (const QString &category : qAsConst(categories)) {
+        ++mCategoryCount[category];
+        mCategoryIncidences.insert(category, incidence);
+    }
+    mIncidenceCategories.insert(incidence, categories);
+    ++mIncidenceCounts[incidence->type()];
+}
+
+void Calendar::Private::removeCategories(const Incidence::Ptr &incidence)
+{
+    // Use the categories we indexed, they may have changed since
+    const auto indexed = mIncidenceCategories.find(incidence);
+    if (indexed == mIncidenceCategories.end()) {
+        return;
+    }
+    const QStringList categories = *indexed;
+    mIncidenceCategories.erase(indexed);
+    --mIncidenceCounts[incidence->type()];
+    for (const QString &category : categories) {
+        mCategoryIncidences.remove(category, incidence);
+        const auto it = mCategoryCount.find(category);
+        if (it != mCategoryCount.end() && --(*it) <= 0) {
+            mCategoryCount.erase(it);
+        }
+    }
+}
+
+// Only updates the index if the emails changed, it is called for every change
+// and incidences may have thousands of attendees
+void Calendar::Private::insertAttendees(const Incidence::Ptr &incidence)
+{
+    QStringList emails;
+    const Attendee::List attendees = incidence->attendees();
+    emails.reserve(attendees.count());
+    for (const Attendee &attendee : attendees) {
+        if (!attendee.email().isEmpty()) {
+            emails.append(attendee.email());
+        }
+    }
+    emails.removeDuplicates();
+    if (emails == mIncidenceAttendees.value(incidence)) {
+        return;
+    }
+
+    removeAttendees(incidence);
+    if (emails.isEmpty()) {
+        return;
+    }
+    for (const QString &email : qAsConst(emails)) {
+        mAttendeeIncidences.insert(email, incidence);
+    }
+    mIncidenceAttendees.insert(incidence, emails);
+}
+
+void Calendar::Private::removeAttendees(const Incidence::Ptr &incidence)
+{
+    const auto indexed = mIncidenceAttendees.find(incidence);
+    if (indexed == mIncidenceAttendees.end()) {
+        return;
+    }
+    for (const QString &email : qAsConst(*indexed)) {
+        mAttendeeIncidences.remove(email, incidence);
+    }
+    mIncidenceAttendees.erase(indexed);
+}
+
+Calendar::Private::DuplicateKey Calendar::Private::duplicateKey(const Incidence::Ptr &incidence)
+{
+    const QDateTime start = incidence->dtStart();
+    return DuplicateKey(start.isValid() ? start.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min(),
+                        incidence->summary());
+}
+
+void Calendar::Private::insertDuplicateKey(const Incidence::Ptr &incidence)
+{
+    removeDuplicateKey(incidence);
+    const DuplicateKey key = duplicateKey(incidence);
+    mDuplicates.insert(key, incidence);
+    mDuplicateKeys.insert(incidence, key);
+}
+
+void Calendar::Private::removeDuplicateKey(const Incidence::Ptr &incidence)
+{
+    // Use the key we indexed, the start date or summary may have changed since
+    const auto it = mDuplicateKeys.find(incidence);
+    if (it != mDuplicateKeys.end()) {
+        mDuplicates.remove(*it, incidence);
+        mDuplicateKeys.erase(it);
+    }
+}
+
+void Calendar::Private::insertOrphan(const QString &parentUid, const Incidence::Ptr &incidence)
+{
+    QSet<Incidence::Ptr> &children = mOrphans[parentUid];
+    if (!children.contains(incidence)) {
+        children.insert(incidence);
+        mOrphanParents[incidence].append(parentUid);
+    }
+}
+
+Incidence::List Calendar::Private::takeOrphans(const QString &parentUid)
+{
+    const QSet<Incidence::Ptr> children = mOrphans.take(parentUid);
+    Incidence::List list;
+    list.reserve(children.count());
+    for (const Incidence::Ptr &child : children) {
+        const auto it = mOrphanParents.find(child);
+        if (it != mOrphanParents.end()) {
+            it->removeOne(parentUid);
+            if (it->isEmpty()) {
+                mOrphanParents.erase(it);
+            }
+        }
+        list.append(child);
+    }
+    return list;
+}
+
+void Calendar::Private::removeOrphan(const Incidence::Ptr &incidence)
+{
+    // Only visit the parent uids this incidence is filed under
+    const QStringList parentUids = mOrphanParents.take(incidence);
+    for (const QString &parentUid : parentUids) {
+        const auto it = mOrphans.find(parentUid);
+        if (it != mOrphans.end()) {
+            it->remove(incidence);
+            if (it->isEmpty()) {
+                mOrphans.erase(it);
+            }
+        }
+    }
+}
+
+static QDateTime earlier(const QDateTime &a, const QDateTime &b)
+{
+    if (!a.isValid()) {
+        return b;
+    }
+    return (b.isValid() && b < a) ? b : a;
+}
+
+Calendar::Private::Rollup Calendar::Private::ownRollup(const Incidence::Ptr &incidence)
+{
+    Rollup rollup;
+    const Todo::Ptr todo = incidence.dynamicCast<Todo>();
+    if (todo) {
+        const bool completed = todo->isCompleted();
+        rollup.total = 1;
+        rollup.completed = completed ? 1 : 0;
+        rollup.percentSum = completed ? 100 : todo->percentComplete();
+        if (!completed && todo->hasDueDate()) {
+            rollup.earliestDue = todo->dtDue();
+        }
+    }
+    return rollup;
+}
+
+void Calendar::Private::linkRelation(const QString &parentUid, const QString &uid)
+{
+    unlinkRelation(uid);
+    mRelationNodes[parentUid]; // make sure the parent is part of the tree
+    RelationNode &node = mRelationNodes[uid];
+    node.parentUid = parentUid;
+
+    Rollup subtree = node.below;
+    subtree.total += node.own.total;
+    subtree.completed += node.own.completed;
+    subtree.percentSum += node.own.percentSum;
+    subtree.earliestDue = earlier(subtree.earliestDue, node.own.earliestDue);
+    adjustRollups(parentUid, subtree, Rollup());
+}
+
+void Calendar::Private::unlinkRelation(const QString &uid)
+{
+    const auto it = mRelationNodes.find(uid);
+    if (it == mRelationNodes.end() || it->parentUid.isEmpty()) {
+        return;
+    }
+
+    Rollup subtree = it->below;
+    subtree.total += it->own.total;
+    subtree.completed += it->own.completed;
+    subtree.percentSum += it->own.percentSum;
+    subtree.earliestDue = earlier(subtree.earliestDue, it->own.earliestDue);
+    const QString parentUid = it->parentUid;
+    it->parentUid.clear(); // so that earliestDueBelow() skips it
+    adjustRollups(parentUid, Rollup(), subtree);
+}
+
+void Calendar::Private::updateRelationRollup(const Incidence::Ptr &incidence)
+{
+    const auto it = mRelationNodes.find(incidence->uid());
+    if (it == mRelationNodes.end() || it->incidence != incidence) {
+        return;
+    }
+
+    const Rollup removed = it->own;
+    const Rollup added = ownRollup(incidence);
+    if (added.total == removed.total && added.completed == removed.completed
+        && added.percentSum == removed.percentSum && added.earliestDue == removed.earliestDue) {
+        return;
+    }
+    it->own = added;
+    adjustRollups(it->parentUid, added, removed);
+}
+
+// Walks up from @p uid, applying the change of a subtree below it
+void Calendar::Private::adjustRollups(QString uid, const Rollup &added, const Rollup &removed)
+{
+    while (!uid.isEmpty()) {
+        const auto it = mRelationNodes.find(uid);
+        if (it == mRelationNodes.end()) {
+            break;
+        }
+        Rollup &below = it->below;
+        below.total += added.total - removed.total;
+        below.completed += added.completed - removed.completed;
+        below.percentSum += added.percentSum - removed.percentSum;
+        if (removed.earliestDue.isValid() && removed.earliestDue == below.earliestDue) {
+            // The minimum might be gone, the children below are already up to date
+            below.earliestDue = earliestDueBelow(uid);
+        } else {
+            below.earliestDue = earlier(below.earliestDue, added.earliestDue);
+        }
+        uid = it->parentUid;
+    }
+}
+
+QDateTime Calendar::Private::earliestDueBelow(const QString &uid) const
+{
+    QDateTime due;
+    const auto relations = mIncidenceRelations.constFind(uid);
+    if (relations == mIncidenceRelations.cend()) {
+        return due;
+    }
+    for (const Incidence::Ptr &child : *relations) {
+        const auto it = mRelationNodes.constFind(child->uid());
+        if (it != mRelationNodes.cend() && it->parentUid == uid) {
+            due = earlier(due, earlier(it->own.earliestDue, it->below.earliestDue));
+        }
+    }
+    return due;
+}
+
+// The keys and values of the indexes are shared with the incidences, only
+// the containers themselves count
+qint64 Calendar::Private::indexMemoryUsage() const
+{
+    using namespace MemorySize;
+    qint64 size = heapSize(mOrphans) + heapSize(mOrphanParents) + heapSize(mOrphanUids)
+                  + heapSize(mNotebookIncidences) + heapSize(mUidToNotebook) + heapSize(mNotebooks)
+                  + heapSize(mIncidenceVisibility) + heapSize(mIncidenceRelations) + heapSize(mRelationNodes)
+                  + heapSize(mCategoryCount) + heapSize(mCategoryIncidences) + heapSize(mIncidenceCategories)
+                  + heapSize(mIncidenceCounts) + heapSize(mAttendeeIncidences) + heapSize(mIncidenceAttendees)
+                  + heapSize(mDuplicates) + heapSize(mDuplicateKeys)
+                  + mStrings.approximateMemoryUsage();
+    for (const QSet<Incidence::Ptr> &orphans : mOrphans) {
+        size += heapSize(orphans);
+    }
+    for (const QStringList &parents : mOrphanParents) {
+        size += heapSize<QString>(parents);
+    }
+    for (const Incidence::List &relations : mIncidenceRelations) {
+        size += heapSize(relations);
+    }
+    for (const QStringList &categories : mIncidenceCategories) {
+        size += heapSize<QString>(categories);
+    }
+    for (const QStringList &emails : mIncidenceAttendees) {
+        size += heapSize<QString>(emails);
+    }
+    return size;
+}
+
+// The date range is passed in as @p start and @p end, converted to date times once per query
+bool Calendar::Private::matchesQuery(const Incidence::Ptr &incidence, const CalendarQuery &query,
+                                     const QDateTime &start, const QDateTime &end) const
+{
+    if (!query.includesType(incidence->type())) {
+        return false;
+    }
+    if (!query.category().isEmpty() && !incidence->categories().contains(query.category())) {
+        return false;
+    }
+    if (!query.notebook().isEmpty() && mUidToNotebook.value(incidence->uid()) != query.notebook()) {
+        return false;
+    }
+    if (!query.attendeeEmail().isEmpty() && incidence->attendeeByMail(query.attendeeEmail()).isNull()) {
+        return false;
+    }
+    if (query.completion() != CalendarQuery::CompletionAny && incidence->type() == Incidence::TypeTodo) {
+        const bool completed = incidence.staticCast<Todo>()->isCompleted();
+        if (completed != (query.completion() == CalendarQuery::CompletionCompleted)) {
+            return false;
+        }
+    }
+    if ((start.isValid() || end.isValid()) && !occursBetween(incidence, start, end, mTimeZone)) {
+        return false;
+    }
+    return !query.applyFilter() || mFilter->filterIncidence(incidence);
+}
+
+// The query of Calendar::query(), run by Calendar::virtual_hook() for the
+// QueryHook so that subclasses can wrap it
+Incidence::List Calendar::Private::query(const Calendar *q, const CalendarQuery &query) const
+{
+    Incidence::List result;
+    const QDate startDate = query.startDate();
+    const QDate endDate = query.endDate();
+    const bool dateRange = startDate.isValid() && endDate.isValid();
+    if (dateRange && endDate < startDate) {
+        return result;
+    }
+    const QDateTime start = startDate.isValid() ? QDateTime(startDate, QTime(0, 0, 0), mTimeZone) : QDateTime();
+    const QDateTime end = endDate.isValid() ? QDateTime(endDate, QTime(23, 59, 59, 999), mTimeZone) : QDateTime();
+
+    // Checks the candidates against the query, returns false once the limit is reached
+    const int limit = query.limit();
+    const auto visit = [&](const Incidence::Ptr &incidence) -> bool {
+        if (matchesQuery(incidence, query, start, end)) {
+            result.append(incidence);
+        }
+        return limit == 0 || result.count() < limit;
+    };
+    const auto visitIndex = [&](const QMultiHash<QString, Incidence::Ptr> &index, const QString &key) {
+        for (auto it = index.constFind(key); it != index.cend() && it.key() == key; ++it) {
+            if (!visit(it.value())) {
+                return;
+            }
+        }
+    };
+
+    // Plan by the number of candidates each way yields. Going by type visits
+    // all incidences of the queried types, except for events in a date range,
+    // which rawEvents(start, end) gets from the subclass' index if it has one.
+    // There is no telling how many events a range holds, so assume it holds
+    // its share of a year's.
+    enum Plan {
+        PlanByType,
+        PlanByCategory,
+        PlanByNotebook,
+        PlanByAttendee
+    };
+    Plan plan = PlanByType;
+    qint64 candidates = 0;
+    for (Incidence::IncidenceType type : {Incidence::TypeEvent, Incidence::TypeTodo, Incidence::TypeJournal}) {
+        if (query.includesType(type)) {
+            qint64 count = mIncidenceCounts.value(type);
+            if (type == Incidence::TypeEvent && dateRange) {
+                count = count * qMin<qint64>(startDate.daysTo(endDate) + 1, 365) / 365;
+            }
+            candidates += count;
+        }
+    }
+    if (!query.category().isEmpty()) {
+        const qint64 count = mCategoryCount.value(query.category());
+        if (count < candidates) {
+            plan = PlanByCategory;
+            candidates = count;
+        }
+    }
+    if (!query.notebook().isEmpty()) {
+        const qint64 count = mNotebookIncidences.count(query.notebook());
+        if (count < candidates) {
+            plan = PlanByNotebook;
+            candidates = count;
+        }
+    }
+    if (!query.attendeeEmail().isEmpty()) {
+        const qint64 count = mAttendeeIncidences.count(query.attendeeEmail());
+        if (count < candidates) {
+            plan = PlanByAttendee;
+            candidates = count;
+        }
+    }
+
+    switch (plan) {
+    case PlanByCategory:
+        visitIndex(mCategoryIncidences, query.category());
+        break;
+    case PlanByNotebook:
+        visitIndex(mNotebookIncidences, query.notebook());
+        break;
+    case PlanByAttendee:
+        visitIndex(mAttendeeIncidences, query.attendeeEmail());
+        break;
+    case PlanByType:
+        if (query.includesType(Incidence::TypeEvent)
+            && !visitAll(dateRange ? q->rawEvents(startDate, endDate, mTimeZone) : q->rawEvents(), visit)) {
+            break;
+        }
+        if (query.includesType(Incidence::TypeTodo) && !visitAll(q->rawTodos(), visit)) {
+            break;
+        }
+        if (query.includesType(Incidence::TypeJournal)) {
+            visitAll(q->rawJournals(), visit);
+        }
+        break;
+    }
+    return result;
+}
+
 QTimeZone Calendar::Private::timeZoneIdSpec(const QByteArray &timeZoneId)
 {
     if (timeZoneId == QByteArrayLiteral("UTC")) {
@@ -242,21 +716,17 @@ CalFilter *Calendar::filter() const
 
 QStringList Calendar::categories() const
 {
-    Incidence::List rawInc(rawIncidences());
-    QStringList cats, thisCats;
-    // @TODO: For now just iterate over all incidences. In the future,
-    // the list of categories should be built when reading the file.
-    for (Incidence::List::ConstIterator i = rawInc.constBegin();
-            i != rawInc.constEnd(); ++i) {
-        thisCats = (*i)->categories();
-        for (QStringList::ConstIterator si = thisCats.constBegin();
-                si != thisCats.constEnd(); ++si) {
-            if (!cats.contains(*si)) {
-                cats.append(*si);
-            }
-        }
-    }
-    return cats;
+    return d->mCategoryCount.keys();
+}
+
+Incidence::List Calendar::incidencesWithCategory(const QString &category) const
+{
+    return values(d->mCategoryIncidences, category);
+}
+
+Incidence::List Calendar::incidencesWithAttendee(const QString &email) const
+{
+    return values(d->mAttendeeIncidences, email);
 }
 
 Incidence::List Calendar::incidences(const QDate &date) const
@@ -274,6 +744,14 @@ Incidence::List Calendar::rawIncidences() const
     return mergeIncidenceList(rawEvents(), rawTodos(), rawJournals());
 }
 
+Incidence::List Calendar::query(const CalendarQuery &query) const
+{
+    QueryHookData data;
+    data.query = &query;
+    const_cast<Calendar *>(this)->virtual_hook(QueryHook, &data);
+    return data.result;
+}
+
 Incidence::List Calendar::instances(const Incidence::Ptr &incidence) const
 {
     if (incidence) {
@@ -297,22 +775,32 @@ Incidence::List Calendar::instances(const Incidence::Ptr &incidence) const
 Incidence::List Calendar::duplicates(const Incidence::Ptr &incidence)
 {
     if (incidence) {
-        Incidence::List list;
-        Incidence::List vals = values(d->mNotebookIncidences);
-        Incidence::List::const_iterator it;
-        for (it = vals.constBegin(); it != vals.constEnd(); ++it) {
-            if (((incidence->dtStart() == (*it)->dtStart()) ||
-                    (!incidence->dtStart().isValid() && !(*it)->dtStart().isValid())) &&
-                    (incidence->summary() == (*it)->summary())) {
-                list.append(*it);
-            }
-        }
-        return list;
+        return values(d->mDuplicates, Private::duplicateKey(incidence));
     } else {
         return Incidence::List();
     }
 }
 
+QVector<Incidence::List> Calendar::duplicateGroups() const
+{
+    // Equal keys are next to each other in a QMultiHash
+    QVector<Incidence::List> groups;
+    Incidence::List group;
+    auto it = d->mDuplicates.constBegin();
+    const auto end = d->mDuplicates.constEnd();
+    while (it != end) {
+        const Private::DuplicateKey &key = it.key();
+        group.clear();
+        for (; it != end && it.key() == key; ++it) {
+            group.append(it.value());
+        }
+        if (group.count() > 1) {
+            groups.append(group);
+        }
+    }
+    return groups;
+}
+
 bool Calendar::addNotebook(const QString &notebook, bool isVisible)
 {
     if (d->mNotebooks.contains(notebook)) {
@@ -382,6 +870,8 @@ bool Calendar::isVisible(const Incidence::Ptr &incidence) const
 void Calendar::clearNotebookAssociations()
 {
     d->mNotebookIncidences.clear();
+    d->mDuplicates.clear();
+    d->mDuplicateKeys.clear();
     d->mUidToNotebook.clear();
     d->mIncidenceVisibility.clear();
 }
@@ -411,15 +901,20 @@ bool Calendar::setNotebook(const Incidence::Ptr &inc, const QString &notebook)
             for (it = list.begin(); it != list.end(); ++it) {
                 d->mNotebookIncidences.remove(old, *it);
                 d->mNotebookIncidences.insert(notebook, *it);
+                d->insertDuplicateKey(*it);
             }
             notifyIncidenceChanged(inc);   // for removing from old notebook
             // don not remove from mUidToNotebook to keep deleted incidences
             d->mNotebookIncidences.remove(old, inc);
+            if (notebook.isEmpty()) {
+                d->removeDuplicateKey(inc);
+            }
         }
     }
     if (!notebook.isEmpty()) {
         d->mUidToNotebook.insert(inc->uid(), notebook);
         d->mNotebookIncidences.insert(notebook, inc);
+        d->insertDuplicateKey(inc);
         qCDebug(KCALCORE_LOG) << "setting notebook" << notebook << "for" << inc->uid();
         notifyIncidenceChanged(inc);   // for inserting into new notebook
     }
@@ -813,20 +1308,28 @@ void Calendar::setupRelations(const Incidence::Ptr &forincidence)
 
     const QString uid = forincidence->uid();
 
+    // The relation tree has one node per uid, which stands for the main incidence
+    if (!forincidence->hasRecurrenceId()) {
+        d->mRelationNodes[uid].incidence = forincidence;
+        d->updateRelationRollup(forincidence);
+    }
+
     // First, go over the list of orphans and see if this is their parent
-    Incidence::List l = values(d->mOrphans, uid);
-    d->mOrphans.remove(uid);
+    const Incidence::List l = d->takeOrphans(uid);
     if (!l.isEmpty()) {
         Incidence::List &relations = d->mIncidenceRelations[uid];
         relations.reserve(relations.count() + l.count());
         for (int i = 0, end = l.count();  i < end;  ++i) {
             relations.append(l[i]);
             d->mOrphanUids.remove(l[i]->uid());
+            if (!l[i]->hasRecurrenceId()) {
+                d->linkRelation(uid, l[i]->uid());
+            }
         }
     }
 
     // Now see about this incidences parent
-    if (forincidence->relatedTo().isEmpty() && !forincidence->relatedTo().isEmpty()) {
+    if (!forincidence->relatedTo().isEmpty()) {
         // Incidence has a uid it is related to but is not registered to it yet.
         // Try to find it
         Incidence::Ptr parent = incidence(forincidence->relatedTo());
@@ -834,20 +1337,22 @@ void Calendar::setupRelations(const Incidence::Ptr &forincidence)
             // Found it
 
             // look for hierarchy loops
-            if (isAncestorOf(forincidence, parent)) {
+            if (parent->uid() == uid || isAncestorOf(forincidence, parent)) {
                 forincidence->setRelatedTo(QString());
                 qCWarning(KCALCORE_LOG) << "hierarchy loop between "
                                         << forincidence->uid()
                                         << " and " << parent->uid();
             } else {
                 d->mIncidenceRelations[parent->uid()].append(forincidence);
+                if (!forincidence->hasRecurrenceId()) {
+                    d->linkRelation(parent->uid(), uid);
+                }
             }
         } else {
             // Not found, put this in the mOrphans list
-            // Note that the mOrphans dict might contain multiple entries with the
-            // same key! which are multiple children that wait for the parent
-            // incidence to be inserted.
-            d->mOrphans.insert(forincidence->relatedTo(), forincidence);
+            // Note that each mOrphans entry holds all the children that wait
+            // for the same parent incidence to be inserted.
+            d->insertOrphan(forincidence->relatedTo(), forincidence);
             d->mOrphanUids.insert(forincidence->uid(), forincidence);
         }
     }
@@ -863,12 +1368,22 @@ void Calendar::removeRelations(const Incidence::Ptr &incidence)
 
     const QString uid = incidence->uid();
 
-    for (const Incidence::Ptr &i : qAsConst(d->mIncidenceRelations[uid])) {
-        if (!d->mOrphanUids.contains(i->uid())) {
-            d->mOrphans.insert(uid, i);
-            d->mOrphanUids.insert(i->uid(), i);
-            i->setRelatedTo(uid);
+    // Exceptions share the uid of their parent, which keeps its children
+    if (!incidence->hasRecurrenceId()) {
+        d->unlinkRelation(uid);
+        const Incidence::List children = d->mIncidenceRelations.take(uid);
+        for (const Incidence::Ptr &i : children) {
+            const auto node = d->mRelationNodes.find(i->uid());
+            if (node != d->mRelationNodes.end() && node->parentUid == uid) {
+                node->parentUid.clear();
+            }
+            if (!d->mOrphanUids.contains(i->uid())) {
+                d->insertOrphan(uid, i);
+                d->mOrphanUids.insert(i->uid(), i);
+                i->setRelatedTo(uid);
+            }
         }
+        d->mRelationNodes.remove(uid);
     }
 
     const QString parentUid = incidence->relatedTo();
@@ -883,45 +1398,11 @@ void Calendar::removeRelations(const Incidence::Ptr &incidence)
 
     // Remove this one from the orphans list
     if (d->mOrphanUids.remove(uid)) {
-        // This incidence is located in the orphans list - it should be removed
-        // Since the mOrphans dict might contain the same key (with different
-        // child incidence pointers!) multiple times, take care that we remove
-        // the correct one. So we need to remove all items with the given
-        // parent UID, and readd those that are not for this item. Also, there
-        // might be other entries with differnet UID that point to this
-        // incidence (this might happen when the relatedTo of the item is
-        // changed before its parent is inserted. This might happen with
-        // groupware servers....). Remove them, too
-        QStringList relatedToUids;
-
-        // First, create a list of all keys in the mOrphans list which point
-        // to the removed item
-        relatedToUids << incidence->relatedTo();
-        for (QMultiHash<QString, Incidence::Ptr>::Iterator it = d->mOrphans.begin();
-                it != d->mOrphans.end(); ++it) {
-            if (it.value()->uid() == uid) {
-                relatedToUids << it.key();
-            }
-        }
-
-        // now go through all uids that have one entry that point to the incidence
-        for (QStringList::const_iterator uidit = relatedToUids.constBegin();
-                uidit != relatedToUids.constEnd(); ++uidit) {
-            Incidence::List tempList;
-            // Remove all to get access to the remaining entries
-            const Incidence::List l = values(d->mOrphans, *uidit);
-            d->mOrphans.remove(*uidit);
-            for (const Incidence::Ptr &i : l) {
-                if (i != incidence) {
-                    tempList.append(i);
-                }
-            }
-            // Readd those that point to a different orphan incidence
-            for (Incidence::List::Iterator incit = tempList.begin();
-                    incit != tempList.end(); ++incit) {
-                d->mOrphans.insert(*uidit, *incit);
-            }
-        }
+        // This incidence is located in the orphans list - it should be removed.
+        // It might be filed under several parent uids (this might happen when
+        // the relatedTo of the item is changed before its parent is inserted,
+        // e.g. with groupware servers), mOrphanParents knows all of them.
+        d->removeOrphan(incidence);
     }
 
     // Make sure the deleted incidence doesn't relate to a non-deleted incidence,
@@ -940,18 +1421,68 @@ void Calendar::removeRelations(const Incidence::Ptr &incidence)
 bool Calendar::isAncestorOf(const Incidence::Ptr &ancestor,
                             const Incidence::Ptr &incidence) const
 {
-    if (!incidence || incidence->relatedTo().isEmpty()) {
+    if (!ancestor || !incidence) {
         return false;
-    } else if (incidence->relatedTo() == ancestor->uid()) {
-        return true;
+    }
+
+    // Incidences in the relation tree are linked to their parent node,
+    // others only know the uid they are related to
+    QString uid;
+    const auto node = d->mRelationNodes.constFind(incidence->uid());
+    if (node != d->mRelationNodes.cend() && node->incidence == incidence
+        && !node->parentUid.isEmpty()) {
+        uid = node->parentUid;
     } else {
-        return isAncestorOf(ancestor, this->incidence(incidence->relatedTo()));
+        uid = incidence->relatedTo();
+    }
+
+    while (!uid.isEmpty()) {
+        if (uid == ancestor->uid()) {
+            return true;
+        }
+        const auto it = d->mRelationNodes.constFind(uid);
+        if (it == d->mRelationNodes.cend()) {
+            break;
+        }
+        uid = it->parentUid;
     }
+    return false;
 }
 
 Incidence::List Calendar::relations(const QString &uid) const
 {
-    return d->mIncidenceRelations[uid];
+    return d->mIncidenceRelations.value(uid);
+}
+
+Incidence::Ptr Calendar::relationParent(const QString &uid) const
+{
+    const auto node = d->mRelationNodes.constFind(uid);
+    if (node == d->mRelationNodes.cend() || node->parentUid.isEmpty()) {
+        return Incidence::Ptr();
+    }
+    const auto parent = d->mRelationNodes.constFind(node->parentUid);
+    return parent != d->mRelationNodes.cend() ? parent->incidence : Incidence::Ptr();
+}
+
+Calendar::RelationRollup Calendar::relationRollup(const QString &uid) const
+{
+    RelationRollup rollup;
+    const auto node = d->mRelationNodes.constFind(uid);
+    if (node != d->mRelationNodes.cend()) {
+        const Private::Rollup &below = node->below;
+        rollup.totalTodos = below.total;
+        rollup.completedTodos = below.completed;
+        rollup.percentComplete = below.total > 0 ? int(below.percentSum / below.total) : 0;
+        rollup.earliestDue = below.earliestDue;
+    }
+    return rollup;
+}
+
+Calendar::MemoryUsage Calendar::approximateMemoryUsage() const
+{
+    MemoryUsage usage;
+    const_cast<Calendar *>(this)->virtual_hook(ApproximateMemoryUsageHook, &usage);
+    return usage;
 }
 
 Calendar::CalendarObserver::~CalendarObserver()
@@ -1047,7 +1578,7 @@ void Calendar::incidenceUpdated(const QString &uid, const QDateTime &recurrenceI
 {
     Incidence::Ptr inc = incidence(uid, recurrenceId);
 
-    if (!inc) {
+    if (!inc || inc->isSchedulingIdUpdate()) {
         return;
     }
 
@@ -1072,6 +1603,10 @@ void Calendar::notifyIncidenceAdded(const Incidence::Ptr &incidence)
         return;
     }
 
+    d->removeCategories(incidence);
+    d->insertCategories(incidence);
+    d->insertAttendees(incidence);
+
     if (!d->mObserversEnabled) {
         return;
     }
@@ -1096,6 +1631,16 @@ void Calendar::notifyIncidenceChanged(const Incidence::Ptr &incidence)
         return;
     }
 
+    if (d->mIncidenceCategories.contains(incidence)) {
+        d->removeCategories(incidence);
+        d->insertCategories(incidence);
+        d->insertAttendees(incidence);
+    }
+    if (d->mDuplicateKeys.contains(incidence)) {
+        d->insertDuplicateKey(incidence);
+    }
+    d->updateRelationRollup(incidence);
+
     if (!d->mObserversEnabled) {
         return;
     }
@@ -1111,13 +1656,15 @@ void Calendar::notifyIncidenceAboutToBeDeleted(const Incidence::Ptr &incidence)
         return;
     }
 
-    if (!d->mObserversEnabled) {
-        return;
+    if (d->mObserversEnabled) {
+        for (CalendarObserver *observer : qAsConst(d->mObservers)) {
+            observer->calendarIncidenceAboutToBeDeleted(incidence);
+        }
     }
 
-    for (CalendarObserver *observer : qAsConst(d->mObservers)) {
-        observer->calendarIncidenceAboutToBeDeleted(incidence);
-    }
+    // Closing a calendar doesn't notify about the deletion itself
+    d->removeCategories(incidence);
+    d->removeAttendees(incidence);
 }
 
 void Calendar::notifyIncidenceDeleted(const Incidence::Ptr &incidence)
@@ -1126,6 +1673,9 @@ void Calendar::notifyIncidenceDeleted(const Incidence::Ptr &incidence)
         return;
     }
 
+    d->removeCategories(incidence);
+    d->removeAttendees(incidence);
+
     if (!d->mObserversEnabled) {
         return;
     }
@@ -1359,10 +1909,70 @@ bool Calendar::deletionTracking() const
     return d->mDeletionTracking;
 }
 
+void Calendar::copyCalendarData(const Calendar &other)
+{
+    d->mProductId = other.d->mProductId;
+    d->mOwner = other.d->mOwner;
+    d->mTimeZone = other.d->mTimeZone;
+    d->mTimeZones = other.d->mTimeZones;
+    d->mModified = other.d->mModified;
+    d->mDeletionTracking = other.d->mDeletionTracking;
+
+    // The filter may be owned by someone else, copy its settings instead
+    if (d->mFilter != d->mDefaultFilter) {
+        delete d->mFilter;
+        d->mFilter = d->mDefaultFilter;
+    }
+    const CalFilter *filter = other.d->mFilter;
+    d->mFilter->setName(filter->name());
+    d->mFilter->setCriteria(filter->criteria());
+    d->mFilter->setCategoryList(filter->categoryList());
+    d->mFilter->setEmailList(filter->emailList());
+    d->mFilter->setCompletedTimeSpan(filter->completedTimeSpan());
+    d->mFilter->setEnabled(filter->isEnabled());
+
+    d->mOrphans = other.d->mOrphans;
+    d->mOrphanUids = other.d->mOrphanUids;
+    d->mOrphanParents = other.d->mOrphanParents;
+    d->mNotebookIncidences = other.d->mNotebookIncidences;
+    d->mUidToNotebook = other.d->mUidToNotebook;
+    d->mNotebooks = other.d->mNotebooks;
+    d->mIncidenceVisibility = other.d->mIncidenceVisibility;
+    d->mDefaultNotebook = other.d->mDefaultNotebook;
+    d->mIncidenceRelations = other.d->mIncidenceRelations;
+    d->mRelationNodes = other.d->mRelationNodes;
+    d->mCategoryCount = other.d->mCategoryCount;
+    d->mCategoryIncidences = other.d->mCategoryIncidences;
+    d->mIncidenceCategories = other.d->mIncidenceCategories;
+    d->mIncidenceCounts = other.d->mIncidenceCounts;
+    d->mAttendeeIncidences = other.d->mAttendeeIncidences;
+    d->mIncidenceAttendees = other.d->mIncidenceAttendees;
+    d->mDuplicates = other.d->mDuplicates;
+    d->mDuplicateKeys = other.d->mDuplicateKeys;
+}
+
 void Calendar::virtual_hook(int id, void *data)
 {
-    Q_UNUSED(id);
-    Q_UNUSED(data);
-    Q_ASSERT(false);
+    switch (id) {
+    case ApproximateMemoryUsageHook: {
+        MemoryUsage *usage = static_cast<MemoryUsage *>(data);
+        const Incidence::List incidences = rawIncidences();
+        for (const Incidence::Ptr &incidence : incidences) {
+            const qint64 cache = incidence->recurs() ? incidence->recurrence()->approximateCacheSize() : 0;
+            usage->incidences += incidence->approximateMemoryUsage() - cache;
+            usage->recurrenceCaches += cache;
+        }
+        usage->indexes += d->indexMemoryUsage();
+        break;
+    }
+    case QueryHook: {
+        QueryHookData *queryData = static_cast<QueryHookData *>(data);
+        queryData->result = d->query(this, *queryData->query);
+        break;
+    }
+    default:
+        Q_ASSERT(false);
+        break;
+    }
 }
 
@@ -64,8 +64,10 @@ namespace KCalendarCore
 {
 
 class CalFilter;
+class CalendarQuery;
 class Person;
 class ICalFormat;
+class ICalFormatImpl;
 
 /**
   Calendar Incidence sort directions.
@@ -310,10 +312,32 @@ public:
     /**
       Returns a list of all categories used by Incidences in this Calendar.
 
-      @return a QStringList containing all the categories.
+      @return a QStringList containing all the categories, sorted.
+      Before 5.13 they were not in any particular order.
     */
     Q_REQUIRED_RESULT QStringList categories() const;
 
+    /**
+      Returns all incidences in this Calendar which are in a category.
+
+      @param category is the category to look for.
+      @see categories(), Incidence::categories()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT Incidence::List incidencesWithCategory(const QString &category) const;
+
+    /**
+      Returns all incidences in this Calendar which have an attendee with
+      the email address @p email. The calendar keeps an index of the
+      attendees' email addresses, so this doesn't look at the attendees of
+      the other incidences.
+
+      @param email is the email address to look for.
+      @see IncidenceBase::attendeeByMail()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT Incidence::List incidencesWithAttendee(const QString &email) const;
+
     // Incidence Specific Methods //
 
     /**
@@ -381,6 +405,26 @@ public:
     */
     virtual Incidence::List rawIncidences() const;
 
+    /**
+      Returns the incidences matching all criteria of @p query, in no
+      particular order.
+
+      Rather than fetching lists of incidences and filtering them afterwards,
+      the query gets its candidates from the most selective index available,
+      i.e. the category or notebook index, or the date index of events kept
+      by subclasses like MemoryCalendar through rawEvents(start, end). The
+      other criteria are checked while going through the candidates, and
+      the query stops once it has reached its limit.
+
+      Subclasses can wrap the query, e.g. to lock the indexes, by handling
+      QueryHook in virtual_hook().
+
+      @param query the criteria to look for.
+      @see CalendarQuery
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT Incidence::List query(const CalendarQuery &query) const;
+
     /**
       Returns an unfiltered list of all exceptions of this recurring incidence.
 
@@ -512,6 +556,16 @@ public:
     */
     virtual Incidence::List duplicates(const Incidence::Ptr &incidence);
 
+    /**
+      List all groups of possible duplicate incidences, i.e. notebook
+      incidences with the same start date and summary.
+
+      @return a list of groups of at least two incidences each.
+      @see duplicates()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT QVector<Incidence::List> duplicateGroups() const;
+
     /**
       Returns the Incidence associated with the given unique identifier.
 
@@ -1167,6 +1221,85 @@ public:
     */
     Incidence::List relations(const QString &uid) const;
 
+    /**
+       Returns the incidence which incidence @p uid is related to as a child,
+       or a null pointer if it is not related to any incidence in this calendar.
+
+       @param uid The child identifier whos parent we want to obtain.
+       @see relations()
+       @since 5.13
+    */
+    Q_REQUIRED_RESULT Incidence::Ptr relationParent(const QString &uid) const;
+
+    /**
+       Values aggregated over all the to-dos below an incidence in the
+       relation tree. Completed to-dos count as 100 percent complete.
+
+       @see relationRollup()
+       @since 5.13
+    */
+    struct RelationRollup {
+        int totalTodos = 0;      ///< Number of to-dos below the incidence
+        int completedTodos = 0;  ///< Number of those to-dos which are completed
+        int percentComplete = 0; ///< Average completion of those to-dos
+        QDateTime earliestDue;   ///< Earliest due date of the open to-dos, or invalid
+    };
+
+    /**
+       Returns the values aggregated over the to-dos below incidence @p uid,
+       i.e. its children, their children and so on.
+
+       These are kept up to date as to-dos are added, changed and deleted,
+       so calling this is cheap even for large hierarchies.
+
+       @param uid The identifier of the root of the subtree.
+       @see relations()
+       @since 5.13
+    */
+    Q_REQUIRED_RESULT RelationRollup relationRollup(const QString &uid) const;
+
+    // Memory Usage Methods //
+
+    /**
+       The memory taken by a calendar, in bytes, broken down by what it is
+       used for.
+
+       @see approximateMemoryUsage()
+       @since 5.13
+    */
+    struct MemoryUsage {
+        qint64 incidences = 0;       ///< The incidences, without their recurrence caches
+        qint64 indexes = 0;          ///< The structures for looking up incidences
+        qint64 recurrenceCaches = 0; ///< The occurrences cached by recurrence rules
+        qint64 tombstones = 0;       ///< What is kept of deleted incidences
+
+        /**
+           Returns the sum of all components.
+        */
+        qint64 total() const
+        {
+            return incidences + indexes + recurrenceCaches + tombstones;
+        }
+    };
+
+    /**
+       Returns an estimate of the memory taken by this calendar.
+
+       The cost is proportional to the number of incidences, not to their
+       size, so this is cheap enough to be called periodically, e.g. for
+       exporting it as a metric. Incidences shared with other calendars,
+       e.g. with snapshots of a MemoryCalendar, are counted for each of them.
+
+       Calendar counts the incidences returned by rawIncidences() and the
+       relation, notebook, category and duplicate indexes it keeps. Subclasses
+       add what they keep themselves by handling ApproximateMemoryUsageHook in
+       virtual_hook().
+
+       @see Incidence::approximateMemoryUsage()
+       @since 5.13
+    */
+    Q_REQUIRED_RESULT MemoryUsage approximateMemoryUsage() const;
+
     // Filter Specific Methods //
 
     /**
@@ -1383,9 +1516,50 @@ protected:
     */
     bool deletionTracking() const;
 
+    /**
+      Copies everything but the incidences and the observers from @p other,
+      i.e. the owner, time zones, filter settings, notebooks, relations and
+      the category and duplicate indexes. The copied containers are implicitly
+      shared, so this is cheap until either calendar changes.
+
+      Meant for subclasses which copy their incidences themselves, see
+      MemoryCalendar::snapshot().
+      @since 5.13
+    */
+    void copyCalendarData(const Calendar &other);
+
+    /**
+      The ids virtual_hook() is called with by functions of Calendar which
+      subclasses may extend. They stand in for virtual functions, which
+      cannot be added without breaking binary compatibility.
+
+      A subclass handling one of them passes it on to the virtual_hook() of
+      its base class first, which fills in the base class' part. Other ids
+      have to be passed on as well.
+
+      @since 5.13
+    */
+    enum VirtualHook {
+        /// approximateMemoryUsage(), @p data is the MemoryUsage to fill in
+        ApproximateMemoryUsageHook = 1,
+        /// query(), @p data is a QueryHookData
+        QueryHook
+    };
+
+    /**
+      The data virtual_hook() is passed for the QueryHook.
+      @since 5.13
+    */
+    struct QueryHookData {
+        const CalendarQuery *query = nullptr; ///< the criteria to look for
+        Incidence::List result;               ///< the incidences found
+    };
+
     /**
       @copydoc
       IncidenceBase::virtual_hook()
+
+      Calendar handles the ids of VirtualHook.
     */
     virtual void virtual_hook(int id, void *data);
 
@@ -1398,6 +1572,7 @@ Q_SIGNALS:
 
 private:
     friend class ICalFormat;
+    friend class ICalFormatImpl;
 
     //@cond PRIVATE
     class Private;
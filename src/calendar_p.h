@@ -26,7 +26,11 @@
 #define KCALCORE_CALENDAR_P_H
 
 #include "calendar.h"
+#include "calendarquery.h"
 #include "calfilter.h"
+#include "stringpool_p.h"
+
+#include <QSet>
 
 namespace KCalendarCore {
 
@@ -62,6 +66,44 @@ public:
         delete mDefaultFilter;
     }
     QTimeZone timeZoneIdSpec(const QByteArray &timeZoneId);
+    void insertCategories(const Incidence::Ptr &incidence);
+    void removeCategories(const Incidence::Ptr &incidence);
+    void insertAttendees(const Incidence::Ptr &incidence);
+    void removeAttendees(const Incidence::Ptr &incidence);
+
+    // Start time in msecs since epoch (the minimum if invalid) and summary
+    typedef QPair<qint64, QString> DuplicateKey;
+    static DuplicateKey duplicateKey(const Incidence::Ptr &incidence);
+    void insertDuplicateKey(const Incidence::Ptr &incidence);
+    void removeDuplicateKey(const Incidence::Ptr &incidence);
+    void insertOrphan(const QString &parentUid, const Incidence::Ptr &incidence);
+    Incidence::List takeOrphans(const QString &parentUid);
+    void removeOrphan(const Incidence::Ptr &incidence);
+
+    // Aggregated values of a subtree, see Calendar::RelationRollup
+    struct Rollup {
+        int total = 0;
+        int completed = 0;
+        qint64 percentSum = 0;
+        QDateTime earliestDue;
+    };
+    // A node of the relation tree, keyed by uid
+    struct RelationNode {
+        Incidence::Ptr incidence; // null until the incidence itself is added
+        QString parentUid; // the node this one is linked below, empty for roots
+        Rollup own; // this to-do alone
+        Rollup below; // the to-dos linked below this one
+    };
+    static Rollup ownRollup(const Incidence::Ptr &incidence);
+    void linkRelation(const QString &parentUid, const QString &uid);
+    void unlinkRelation(const QString &uid);
+    void updateRelationRollup(const Incidence::Ptr &incidence);
+    void adjustRollups(QString uid, const Rollup &added, const Rollup &removed);
+    QDateTime earliestDueBelow(const QString &uid) const;
+    qint64 indexMemoryUsage() const;
+    bool matchesQuery(const Incidence::Ptr &incidence, const CalendarQuery &query,
+                      const QDateTime &start, const QDateTime &end) const;
+    Incidence::List query(const Calendar *q, const CalendarQuery &query) const;
 
     QString mProductId;
     Person mOwner;
@@ -76,7 +118,8 @@ public:
     CalFilter *mFilter = nullptr;
 
     // These lists are used to put together related To-dos
-    QMultiHash<QString, Incidence::Ptr> mOrphans;
+    QHash<QString, QSet<Incidence::Ptr> > mOrphans; // parent uid -> waiting children
+    QHash<Incidence::Ptr, QStringList> mOrphanParents; // child -> its keys in mOrphans
     QMultiHash<QString, Incidence::Ptr> mOrphanUids;
 
     // Lists for associating incidences to notebooks
@@ -86,8 +129,26 @@ public:
     QHash<Incidence::Ptr, bool> mIncidenceVisibility; // incidence -> visibility
     QString mDefaultNotebook; // uid of default notebook
     QMap<QString, Incidence::List > mIncidenceRelations;
+    QHash<QString, RelationNode> mRelationNodes; // relation tree over mIncidenceRelations
+
+    // Category index, kept up to date by the notifyIncidence*() functions
+    QMap<QString, int> mCategoryCount; // number of incidences per category, sorted for categories()
+    QMultiHash<QString, Incidence::Ptr> mCategoryIncidences;
+    QHash<Incidence::Ptr, QStringList> mIncidenceCategories; // categories as indexed, for every incidence
+    QMap<IncidenceBase::IncidenceType, int> mIncidenceCounts; // incidences in mIncidenceCategories by type
+
+    // Attendee index, kept up to date along with the category index
+    QMultiHash<QString, Incidence::Ptr> mAttendeeIncidences; // email -> incidences it attends
+    QHash<Incidence::Ptr, QStringList> mIncidenceAttendees; // emails as indexed, for incidences with attendees
+
+    // Duplicate index over the incidences in mNotebookIncidences
+    QMultiHash<DuplicateKey, Incidence::Ptr> mDuplicates;
+    QHash<Incidence::Ptr, DuplicateKey> mDuplicateKeys; // keys as indexed
     bool batchAddingInProgress = false;
     bool mDeletionTracking = false;
+
+    // Strings shared by the incidences read into this calendar, see ICalFormatImpl::populate()
+    StringPool mStrings;
 };
 
 }
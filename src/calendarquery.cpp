@@ -0,0 +1,155 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the CalendarQuery class.
+ */
+
+#include "calendarquery.h"
+
+using namespace KCalendarCore;
+
+/**
+  Private class that helps to provide binary compatibility between releases.
+  @internal
+*/
+//@cond PRIVATE
+class Q_DECL_HIDDEN KCalendarCore::CalendarQuery::Private : public QSharedData
+{
+public:
+    QVector<IncidenceBase::IncidenceType> mTypes;
+    QDate mStartDate;
+    QDate mEndDate;
+    QString mCategory;
+    QString mAttendeeEmail;
+    QString mNotebook;
+    Completion mCompletion = CompletionAny;
+    int mLimit = 0;
+    bool mApplyFilter = false;
+};
+//@endcond
+
+CalendarQuery::CalendarQuery()
+    : d(new KCalendarCore::CalendarQuery::Private)
+{
+}
+
+CalendarQuery::CalendarQuery(const CalendarQuery &other) = default;
+
+CalendarQuery::~CalendarQuery() = default;
+
+CalendarQuery &CalendarQuery::operator=(const CalendarQuery &other) = default;
+
+void CalendarQuery::setTypes(const QVector<IncidenceBase::IncidenceType> &types)
+{
+    d->mTypes = types;
+}
+
+QVector<IncidenceBase::IncidenceType> CalendarQuery::types() const
+{
+    return d->mTypes;
+}
+
+bool CalendarQuery::includesType(IncidenceBase::IncidenceType type) const
+{
+    if (d->mTypes.isEmpty()) {
+        return type == IncidenceBase::TypeEvent || type == IncidenceBase::TypeTodo
+               || type == IncidenceBase::TypeJournal;
+    }
+    return d->mTypes.contains(type);
+}
+
+void CalendarQuery::setDateRange(const QDate &start, const QDate &end)
+{
+    d->mStartDate = start;
+    d->mEndDate = end;
+}
+
+QDate CalendarQuery::startDate() const
+{
+    return d->mStartDate;
+}
+
+QDate CalendarQuery::endDate() const
+{
+    return d->mEndDate;
+}
+
+void CalendarQuery::setCategory(const QString &category)
+{
+    d->mCategory = category;
+}
+
+QString CalendarQuery::category() const
+{
+    return d->mCategory;
+}
+
+void CalendarQuery::setAttendeeEmail(const QString &email)
+{
+    d->mAttendeeEmail = email;
+}
+
+QString CalendarQuery::attendeeEmail() const
+{
+    return d->mAttendeeEmail;
+}
+
+void CalendarQuery::setNotebook(const QString &notebook)
+{
+    d->mNotebook = notebook;
+}
+
+QString CalendarQuery::notebook() const
+{
+    return d->mNotebook;
+}
+
+void CalendarQuery::setCompletion(Completion completion)
+{
+    d->mCompletion = completion;
+}
+
+CalendarQuery::Completion CalendarQuery::completion() const
+{
+    return d->mCompletion;
+}
+
+void CalendarQuery::setApplyFilter(bool apply)
+{
+    d->mApplyFilter = apply;
+}
+
+bool CalendarQuery::applyFilter() const
+{
+    return d->mApplyFilter;
+}
+
+void CalendarQuery::setLimit(int limit)
+{
+    d->mLimit = qMax(0, limit);
+}
+
+int CalendarQuery::limit() const
+{
+    return d->mLimit;
+}
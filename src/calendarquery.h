@@ -0,0 +1,237 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the CalendarQuery class.
+ */
+#ifndef KCALCORE_CALENDARQUERY_H
+#define KCALCORE_CALENDARQUERY_H
+
+#include "kcalendarcore_export.h"
+#include "incidencebase.h"
+
+#include <QDate>
+#include <QSharedDataPointer>
+#include <QString>
+#include <QVector>
+
+namespace KCalendarCore
+{
+
+/**
+  @brief
+  Describes which incidences to look for with Calendar::query().
+
+  A query combines any number of criteria, an incidence has to meet all of
+  them to match. Criteria which are not set match every incidence, so a
+  default constructed query matches all events, to-dos and journals.
+
+  @code
+  CalendarQuery query;
+  query.setTypes({Incidence::TypeTodo});
+  query.setCategory(QStringLiteral("Work"));
+  query.setCompletion(CalendarQuery::CompletionIncomplete);
+  query.setLimit(20);
+  const Incidence::List todos = calendar->query(query);
+  @endcode
+
+  @see Calendar::query()
+  @since 5.13
+*/
+class KCALENDARCORE_EXPORT CalendarQuery
+{
+public:
+    /**
+      The completion states to-dos can be looked for by.
+    */
+    enum Completion {
+        CompletionAny = 0,     /**< Completed and incomplete to-dos */
+        CompletionCompleted,   /**< Completed to-dos only */
+        CompletionIncomplete   /**< Incomplete to-dos only */
+    };
+
+    /**
+      Constructs a query which matches all events, to-dos and journals.
+    */
+    CalendarQuery();
+
+    /**
+      Constructs a copy of @p other.
+    */
+    CalendarQuery(const CalendarQuery &other);
+
+    /**
+      Destroys the query.
+    */
+    ~CalendarQuery();
+
+    /**
+      Assigns @p other to this query.
+    */
+    CalendarQuery &operator=(const CalendarQuery &other);
+
+    /**
+      Sets the types of incidences to look for. An empty list, the default,
+      stands for events, to-dos and journals.
+
+      @param types the incidence types.
+      @see types(), includesType()
+    */
+    void setTypes(const QVector<IncidenceBase::IncidenceType> &types);
+
+    /**
+      Returns the types of incidences to look for, or an empty list for
+      events, to-dos and journals.
+      @see setTypes()
+    */
+    Q_REQUIRED_RESULT QVector<IncidenceBase::IncidenceType> types() const;
+
+    /**
+      Returns true if incidences of @p type are looked for.
+      @see setTypes()
+    */
+    Q_REQUIRED_RESULT bool includesType(IncidenceBase::IncidenceType type) const;
+
+    /**
+      Restricts the query to incidences taking place between the dates
+      @p start and @p end inclusive, in the time zone of the calendar.
+      Either date may be invalid, which leaves the range open on that side.
+
+      Events match as for Calendar::rawEvents(start, end): if they, or any
+      of their recurrences, take place at least partly in the range.
+      To-dos match if their due date, or their start date if they have no
+      due date, lies in the range; recurring to-dos match as long as they
+      recur, until their last recurrence. Journals match by their date.
+
+      @see startDate(), endDate()
+    */
+    void setDateRange(const QDate &start, const QDate &end);
+
+    /**
+      Returns the first date of the range, or an invalid date if the range
+      is open at the start.
+      @see setDateRange()
+    */
+    Q_REQUIRED_RESULT QDate startDate() const;
+
+    /**
+      Returns the last date of the range, or an invalid date if the range
+      is open at the end.
+      @see setDateRange()
+    */
+    Q_REQUIRED_RESULT QDate endDate() const;
+
+    /**
+      Restricts the query to incidences which are in the category @p category.
+      An empty string, the default, matches all incidences.
+      @see category(), Incidence::categories()
+    */
+    void setCategory(const QString &category);
+
+    /**
+      Returns the category incidences must be in, or an empty string.
+      @see setCategory()
+    */
+    Q_REQUIRED_RESULT QString category() const;
+
+    /**
+      Restricts the query to incidences having an attendee with the email
+      address @p email. An empty string, the default, matches all incidences.
+      @see attendeeEmail(), IncidenceBase::attendeeByMail()
+    */
+    void setAttendeeEmail(const QString &email);
+
+    /**
+      Returns the email address of the attendee incidences must have,
+      or an empty string.
+      @see setAttendeeEmail()
+    */
+    Q_REQUIRED_RESULT QString attendeeEmail() const;
+
+    /**
+      Restricts the query to the incidences associated with the notebook
+      @p notebook. An empty string, the default, matches all incidences.
+      @see notebook(), Calendar::setNotebook()
+    */
+    void setNotebook(const QString &notebook);
+
+    /**
+      Returns the notebook incidences must be associated with, or an empty string.
+      @see setNotebook()
+    */
+    Q_REQUIRED_RESULT QString notebook() const;
+
+    /**
+      Restricts the query to completed or incomplete to-dos. This only
+      applies to to-dos, incidences of other types are not affected.
+      Default is CompletionAny.
+      @see completion(), Todo::isCompleted()
+    */
+    void setCompletion(Completion completion);
+
+    /**
+      Returns the completion state to-dos must have.
+      @see setCompletion()
+    */
+    Q_REQUIRED_RESULT Completion completion() const;
+
+    /**
+      Sets whether incidences must also pass the filter of the calendar,
+      see Calendar::filter(). Default is false, like for the raw functions
+      of Calendar.
+      @see applyFilter()
+    */
+    void setApplyFilter(bool apply);
+
+    /**
+      Returns whether incidences must also pass the filter of the calendar.
+      @see setApplyFilter()
+    */
+    Q_REQUIRED_RESULT bool applyFilter() const;
+
+    /**
+      Sets the maximum number of incidences to return. The query stops once
+      it has found as many. 0, the default, means no limit.
+
+      As the incidences are returned in no particular order, which of the
+      matching incidences are returned is not defined.
+
+      @see limit()
+    */
+    void setLimit(int limit);
+
+    /**
+      Returns the maximum number of incidences to return, or 0 for no limit.
+      @see setLimit()
+    */
+    Q_REQUIRED_RESULT int limit() const;
+
+private:
+    //@cond PRIVATE
+    class Private;
+    QSharedDataPointer<Private> d;
+    //@endcond
+};
+
+}
+
+#endif
@@ -154,20 +154,9 @@ bool CalFilter::filterIncidence(const Incidence::Ptr &incidence) const
         }
 
         if (d->mCriteria & HideNoMatchingAttendeeTodos) {
-            bool iAmOneOfTheAttendees = false;
-            const Attendee::List &attendees = todo->attendees();
-            if (!todo->attendees().isEmpty()) {
-                Attendee::List::ConstIterator it;
-                for (it = attendees.begin(); it != attendees.end(); ++it) {
-                    if (d->mEmailList.contains((*it).email())) {
-                        iAmOneOfTheAttendees = true;
-                        break;
-                    }
-                }
-            } else {
-                // no attendees, must be me only
-                iAmOneOfTheAttendees = true;
-            }
+            // no attendees, must be me only
+            const bool iAmOneOfTheAttendees = todo->attendeeCount() == 0
+                                              || !todo->attendeeByMails(d->mEmailList).isNull();
             if (!iAmOneOfTheAttendees) {
                 return false;
             }
@@ -34,6 +34,7 @@
 #include "utils_p.h"
 #include "kcalendarcore_debug.h"
 
+#include <QAtomicInt>
 #include <QDate>
 
 using namespace KCalendarCore;
@@ -46,22 +47,25 @@ using namespace KCalendarCore;
 class Q_DECL_HIDDEN KCalendarCore::Event::Private
 {
 public:
+    enum MultiDayCache {
+        MultiDayUnknown = -1,
+        MultiDayNo = 0,
+        MultiDayYes = 1
+    };
+
     Private()
         : mTransparency(Opaque),
-          mMultiDayValid(false),
-          mMultiDay(false)
+          mMultiDay(MultiDayUnknown)
     {}
     Private(const KCalendarCore::Event::Private &other)
         : mDtEnd(other.mDtEnd),
           mTransparency(other.mTransparency),
-          mMultiDayValid(false),
-          mMultiDay(false)
+          mMultiDay(MultiDayUnknown)
     {}
 
     QDateTime mDtEnd;
     Transparency mTransparency;
-    bool mMultiDayValid = false;
-    bool mMultiDay = false;
+    mutable QAtomicInt mMultiDay;    // filled by const isMultiDay(), which may run concurrently
 };
 //@endcond
 
@@ -127,7 +131,7 @@ QByteArray Event::typeStr() const
 
 void Event::setDtStart(const QDateTime &dt)
 {
-    d->mMultiDayValid = false;
+    d->mMultiDay.storeRelease(Private::MultiDayUnknown);
     Incidence::setDtStart(dt);
 }
 
@@ -140,7 +144,7 @@ void Event::setDtEnd(const QDateTime &dtEnd)
     if (d->mDtEnd != dtEnd || hasDuration() == dtEnd.isValid()) {
         update();
         d->mDtEnd = dtEnd;
-        d->mMultiDayValid = false;
+        d->mMultiDay.storeRelease(Private::MultiDayUnknown);
         setHasDuration(!dtEnd.isValid());
         setFieldDirty(FieldDtEnd);
         updated();
@@ -186,8 +190,11 @@ bool Event::hasEndDate() const
 bool Event::isMultiDay(const QTimeZone &zone) const
 {
     // First off, if spec's not valid, we can check for cache
-    if (!zone.isValid() && d->mMultiDayValid) {
-        return d->mMultiDay;
+    if (!zone.isValid()) {
+        const int cached = d->mMultiDay.loadAcquire();
+        if (cached != Private::MultiDayUnknown) {
+            return cached == Private::MultiDayYes;
+        }
     }
 
     // Not in cache -> do it the hard way
@@ -212,8 +219,8 @@ bool Event::isMultiDay(const QTimeZone &zone) const
 
     // Update the cache
     // Also update Cache if spec is invalid
-    d->mMultiDayValid = true;
-    d->mMultiDay = multi;
+    // Concurrent readers compute the same value, so whichever store wins is right
+    d->mMultiDay.storeRelease(multi ? Private::MultiDayYes : Private::MultiDayNo);
     return multi;
 }
 
@@ -334,7 +341,9 @@ void Event::serialize(QDataStream &out) const
 {
     Incidence::serialize(out);
     serializeQDateTimeAsKDateTime(out, d->mDtEnd);
-    out << hasEndDate() << static_cast<quint32>(d->mTransparency) << d->mMultiDayValid << d->mMultiDay;
+    const int multiDay = d->mMultiDay.loadAcquire();
+    out << hasEndDate() << static_cast<quint32>(d->mTransparency)
+        << (multiDay != Private::MultiDayUnknown) << (multiDay == Private::MultiDayYes);
 }
 
 void Event::deserialize(QDataStream &in)
@@ -346,7 +355,11 @@ void Event::deserialize(QDataStream &in)
     quint32 transp;
     in >> transp;
     d->mTransparency = static_cast<Transparency>(transp);
-    in >> d->mMultiDayValid >> d->mMultiDay;
+    bool multiDayValid = false;
+    bool multiDay = false;
+    in >> multiDayValid >> multiDay;
+    d->mMultiDay.storeRelease(multiDayValid ? (multiDay ? Private::MultiDayYes : Private::MultiDayNo)
+                              : Private::MultiDayUnknown);
 }
 
 bool Event::supportsGroupwareCommunication() const
@@ -35,6 +35,7 @@
 */
 
 #include "icalformat_p.h"
+#include "calendar_p.h"
 #include "compat_p.h"
 #include "event.h"
 #include "freebusy.h"
@@ -43,6 +44,7 @@
 #include "incidencebase.h"
 #include "journal.h"
 #include "memorycalendar.h"
+#include "pendingincidences_p.h"
 #include "todo.h"
 #include "visitor.h"
 
@@ -160,12 +162,19 @@ public:
     void writeCustomProperties(icalcomponent *parent, CustomProperties *);
     void readCustomProperties(icalcomponent *parent, CustomProperties *);
 
+    template <typename T>
+    T intern(const T &string)
+    {
+        return mStrings ? mStrings->intern(string) : string;
+    }
+
     ICalFormatImpl *mImpl = nullptr;
     ICalFormat *mParent = nullptr;
     QString mLoadedProductId;         // PRODID string loaded from calendar file
     Event::List mEventsRelate;        // events with relations
     Todo::List  mTodosRelate;         // todos with relations
     Compat *mCompat = nullptr;
+    StringPool *mStrings = nullptr;   // of the calendar being populated
 };
 //@endcond
 
@@ -1435,7 +1444,7 @@ Attendee ICalFormatImpl::readAttendee(icalproperty *attendee)
     QString uid;
     p = icalproperty_get_first_parameter(attendee, ICAL_CN_PARAMETER);
     if (p) {
-        name = QString::fromUtf8(icalparameter_get_cn(p));
+        name = d->intern(QString::fromUtf8(icalparameter_get_cn(p)));
     } else {
     }
 
@@ -1533,23 +1542,23 @@ Attendee ICalFormatImpl::readAttendee(icalproperty *attendee)
         if (xname == QLatin1String("X-UID")) {
             uid = xvalue;
         } else {
-            custom[xname.toUtf8()] = xvalue;
+            custom[d->intern(xname.toUtf8())] = d->intern(xvalue);
         }
         p = icalproperty_get_next_parameter(attendee, ICAL_X_PARAMETER);
     }
 
-    Attendee a(name, email, rsvp, status, role, uid);
+    Attendee a(name, d->intern(email), rsvp, status, role, uid);
     a.setCuType(cuType);
     a.customProperties().setCustomProperties(custom);
 
     p = icalproperty_get_first_parameter(attendee, ICAL_DELEGATEDTO_PARAMETER);
     if (p) {
-        a.setDelegate(QLatin1String(icalparameter_get_delegatedto(p)));
+        a.setDelegate(d->intern(QString(QLatin1String(icalparameter_get_delegatedto(p)))));
     }
 
     p = icalproperty_get_first_parameter(attendee, ICAL_DELEGATEDFROM_PARAMETER);
     if (p) {
-        a.setDelegator(QLatin1String(icalparameter_get_delegatedfrom(p)));
+        a.setDelegator(d->intern(QString(QLatin1String(icalparameter_get_delegatedfrom(p)))));
     }
 
     return a;
@@ -1566,9 +1575,9 @@ Person ICalFormatImpl::readOrganizer(icalproperty *organizer)
     icalparameter *p = icalproperty_get_first_parameter(organizer, ICAL_CN_PARAMETER);
 
     if (p) {
-        cn = QString::fromUtf8(icalparameter_get_cn(p));
+        cn = d->intern(QString::fromUtf8(icalparameter_get_cn(p)));
     }
-    Person org(cn, email);
+    Person org(cn, d->intern(email));
     // TODO: Treat sent-by, dir and language here, too
     return org;
 }
@@ -1770,7 +1779,7 @@ void ICalFormatImpl::readIncidence(icalcomponent *parent, const Incidence::Ptr &
                 break;
             case ICAL_STATUS_X:
                 incidence->setCustomStatus(
-                    QString::fromUtf8(icalvalue_get_x(icalproperty_get_value(p))));
+                    d->intern(QString::fromUtf8(icalvalue_get_x(icalproperty_get_value(p)))));
                 stat = Incidence::StatusX;
                 break;
             case ICAL_STATUS_NONE:
@@ -1814,7 +1823,7 @@ void ICalFormatImpl::readIncidence(icalcomponent *parent, const Incidence::Ptr &
             for (const QString &cat : lstVal) {
                 // ensure no duplicates
                 if (!categories.contains(cat)) {
-                    categories.append(cat);
+                    categories.append(d->intern(cat));
                 }
             }
             break;
@@ -2024,7 +2033,7 @@ void ICalFormatImpl::Private::readCustomProperties(icalcomponent *parent,
         if (property != nproperty) {
             // New property
             if (!property.isEmpty()) {
-                properties->setNonKDECustomProperty(property, value, parameters);
+                properties->setNonKDECustomProperty(intern(property), intern(value), intern(parameters));
             }
             property = name;
             value = nvalue;
@@ -2043,7 +2052,7 @@ void ICalFormatImpl::Private::readCustomProperties(icalcomponent *parent,
         p = icalcomponent_get_next_property(parent, ICAL_X_PROPERTY);
     }
     if (!property.isEmpty()) {
-        properties->setNonKDECustomProperty(property, value, parameters);
+        properties->setNonKDECustomProperty(intern(property), intern(value), intern(parameters));
     }
 }
 //@endcond
@@ -2278,9 +2287,9 @@ void ICalFormatImpl::readAlarm(icalcomponent *alarm, const Incidence::Ptr &incid
             QString name;
             icalparameter *param = icalproperty_get_first_parameter(p, ICAL_CN_PARAMETER);
             if (param) {
-                name = QString::fromUtf8(icalparameter_get_cn(param));
+                name = d->intern(QString::fromUtf8(icalparameter_get_cn(param)));
             }
-            ialarm->addMailAddress(Person(name, email));
+            ialarm->addMailAddress(Person(name, d->intern(email)));
             break;
         }
 
@@ -2815,6 +2824,10 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
     ICalTimeZoneParser parser(&timeZoneCache);
     parser.parse(calendar);
 
+    // Let the incidences share repeated strings with those already in the calendar
+    cal->d->mStrings.squeeze();
+    d->mStrings = &cal->d->mStrings;
+
     // custom properties
     d->readCustomProperties(calendar, cal.data());
 
@@ -2823,10 +2836,16 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
     d->mTodosRelate.clear();
     // TODO: make sure that only actually added events go to this lists.
 
+    // New incidences are added in one go at the end, if the calendar allows it
+    PendingIncidences pending(cal.data());
+
     icalcomponent *c = icalcomponent_get_first_component(calendar, ICAL_VTODO_COMPONENT);
     while (c) {
         Todo::Ptr todo = readTodo(c, &timeZoneCache);
         if (todo) {
+            if (pending.contains(todo)) {
+                pending.flush();
+            }
             // qCDebug(KCALCORE_LOG) << "todo is not zero and deleted is " << deleted;
             Todo::Ptr old = cal->todo(todo->uid(), todo->recurrenceId());
             if (old) {
@@ -2855,7 +2874,7 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
                 }
             } else {
                 // qCDebug(KCALCORE_LOG) << "Adding todo " << todo.data() << todo->uid();
-                cal->addTodo(todo);   // just add this one
+                pending.add(todo);   // just add this one
             }
         }
         c = icalcomponent_get_next_component(calendar, ICAL_VTODO_COMPONENT);
@@ -2866,6 +2885,9 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
     while (c) {
         Event::Ptr event = readEvent(c, &timeZoneCache);
         if (event) {
+            if (pending.contains(event)) {
+                pending.flush();
+            }
             // qCDebug(KCALCORE_LOG) << "event is not zero and deleted is " << deleted;
             Event::Ptr old = cal->event(event->uid(), event->recurrenceId());
             if (old) {
@@ -2895,7 +2917,7 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
                 }
             } else {
                 // qCDebug(KCALCORE_LOG) << "Adding event " << event.data() << event->uid();
-                cal->addEvent(event);   // just add this one
+                pending.add(event);   // just add this one
             }
         }
         c = icalcomponent_get_next_component(calendar, ICAL_VEVENT_COMPONENT);
@@ -2906,6 +2928,9 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
     while (c) {
         Journal::Ptr journal = readJournal(c, &timeZoneCache);
         if (journal) {
+            if (pending.contains(journal)) {
+                pending.flush();
+            }
             Journal::Ptr old = cal->journal(journal->uid(), journal->recurrenceId());
             if (old) {
                 if (deleted) {
@@ -2921,14 +2946,17 @@ bool ICalFormatImpl::populate(const Calendar::Ptr &cal, icalcomponent *calendar,
                     cal->deleteJournal(journal);   // and move it to deleted
                 }
             } else {
-                cal->addJournal(journal);   // just add this one
+                pending.add(journal);   // just add this one
             }
         }
         c = icalcomponent_get_next_component(calendar, ICAL_VJOURNAL_COMPONENT);
     }
 
+    pending.flush();
+
     // TODO: Remove any previous time zones no longer referenced in the calendar
 
+    d->mStrings = nullptr;
     return true;
 }
 
@@ -35,7 +35,9 @@
 #include "incidence.h"
 #include "calformat.h"
 #include "utils_p.h"
+#include "memorysize_p.h"
 
+#include <QAtomicPointer>
 #include <QTextDocument> // for .toHtmlEscaped() and Qt::mightBeRichText()
 #include <QStringList>
 #include <QTime>
@@ -77,7 +79,8 @@ public:
         , mResources(p.mResources)
         , mStatusString(p.mStatusString)
         , mSchedulingID(p.mSchedulingID)
-        , mRelatedToUid(p.mRelatedToUid)
+        , mRelatedToParent(p.mRelatedToParent)
+        , mRelatedToOther(p.mRelatedToOther)
         , mRecurrenceId(p.mRecurrenceId)
         , mGeoLatitude(p.mGeoLatitude)
         , mGeoLongitude(p.mGeoLongitude)
@@ -99,8 +102,7 @@ public:
     {
         mAlarms.clear();
         mAttachments.clear();
-        delete mRecurrence;
-        mRecurrence = nullptr;
+        delete mRecurrence.fetchAndStoreOrdered(nullptr);
     }
 
     void init(Incidence *dest, const Incidence &src)
@@ -110,7 +112,8 @@ public:
         mDescription = src.d->mDescription;
         mSummary = src.d->mSummary;
         mCategories = src.d->mCategories;
-        mRelatedToUid = src.d->mRelatedToUid;
+        mRelatedToParent = src.d->mRelatedToParent;
+        mRelatedToOther = src.d->mRelatedToOther;
         mResources = src.d->mResources;
         mStatusString = src.d->mStatusString;
         mStatus = src.d->mStatus;
@@ -135,14 +138,20 @@ public:
         }
 
         mAttachments = src.d->mAttachments;
-        if (src.d->mRecurrence) {
-            mRecurrence = new Recurrence(*(src.d->mRecurrence));
-            mRecurrence->addObserver(dest);
+        if (Recurrence *srcRecurrence = src.d->recurrence()) {
+            Recurrence *recurrence = new Recurrence(*srcRecurrence);
+            recurrence->addObserver(dest);
+            mRecurrence.storeRelease(recurrence);
         } else {
-            mRecurrence = nullptr;
+            mRecurrence.storeRelease(nullptr);
         }
     }
 
+    Recurrence *recurrence() const
+    {
+        return mRecurrence.loadAcquire();
+    }
+
     QDateTime mCreated;                 // creation datetime
     QString mDescription;               // description string
     QString mSummary;                   // summary string
@@ -153,12 +162,13 @@ public:
     QStringList mResources;             // resources list (not calendar resources)
     QString mStatusString;              // status string, for custom status
     QString mSchedulingID;              // ID for scheduling mails
-    QMap<RelType, QString> mRelatedToUid; // incidence uid this is related to, for each relType
+    QString mRelatedToParent;           // incidence uid this is related to as a child
+    QMap<RelType, QString> mRelatedToOther; // the same for the other, rarely used, relTypes
     QDateTime mRecurrenceId;            // recurrenceId
 
     float mGeoLatitude;                 // Specifies latitude in decimal degrees
     float mGeoLongitude;                // Specifies longitude in decimal degrees
-    mutable Recurrence *mRecurrence;    // recurrence
+    mutable QAtomicPointer<Recurrence> mRecurrence;    // recurrence, created by const recurrence()
     int mRevision;                      // revision number
     int mPriority;                      // priority: 1 = highest, 2 = less, etc.
     Status mStatus;                     // status
@@ -196,7 +206,7 @@ Incidence::~Incidence()
     for (const Alarm::Ptr &alarm : qAsConst(d->mAlarms)) {
         alarm->setParent(nullptr);
     }
-    delete d->mRecurrence;
+    delete d->recurrence();
     delete d;
 }
 
@@ -266,13 +276,13 @@ bool Incidence::equals(const IncidenceBase &incidence) const
         }
     }
 
-    bool recurrenceEqual = (d->mRecurrence == nullptr && i2->d->mRecurrence == nullptr);
+    bool recurrenceEqual = (d->recurrence() == nullptr && i2->d->recurrence() == nullptr);
     if (!recurrenceEqual) {
         recurrence(); // create if doesn't exist
         i2->recurrence(); // create if doesn't exist
-        recurrenceEqual = d->mRecurrence != nullptr &&
-                          i2->d->mRecurrence != nullptr &&
-                          *d->mRecurrence == *i2->d->mRecurrence;
+        recurrenceEqual = d->recurrence() != nullptr &&
+                          i2->d->recurrence() != nullptr &&
+                          *d->recurrence() == *i2->d->recurrence();
     }
 
     if (d->mHasGeo == i2->d->mHasGeo) {
@@ -330,8 +340,8 @@ void Incidence::setLastModified(const QDateTime &lm)
 void Incidence::setReadOnly(bool readOnly)
 {
     IncidenceBase::setReadOnly(readOnly);
-    if (d->mRecurrence) {
-        d->mRecurrence->setRecurReadOnly(readOnly);
+    if (d->recurrence()) {
+        d->recurrence()->setRecurReadOnly(readOnly);
     }
 }
 
@@ -353,8 +363,8 @@ void Incidence::setAllDay(bool allDay)
     if (mReadOnly) {
         return;
     }
-    if (d->mRecurrence) {
-        d->mRecurrence->setAllDay(allDay);
+    if (d->recurrence()) {
+        d->recurrence()->setAllDay(allDay);
     }
     IncidenceBase::setAllDay(allDay);
 }
@@ -401,16 +411,16 @@ int Incidence::revision() const
 void Incidence::setDtStart(const QDateTime &dt)
 {
     IncidenceBase::setDtStart(dt);
-    if (d->mRecurrence && dirtyFields().contains(FieldDtStart)) {
-        d->mRecurrence->setStartDateTime(dt, allDay());
+    if (d->recurrence() && dirtyFields().contains(FieldDtStart)) {
+        d->recurrence()->setStartDateTime(dt, allDay());
     }
 }
 
 void Incidence::shiftTimes(const QTimeZone &oldZone, const QTimeZone &newZone)
 {
     IncidenceBase::shiftTimes(oldZone, newZone);
-    if (d->mRecurrence) {
-        d->mRecurrence->shiftTimes(oldZone, newZone);
+    if (d->recurrence()) {
+        d->recurrence()->shiftTimes(oldZone, newZone);
     }
     for (int i = 0, end = d->mAlarms.count(); i < end; ++i) {
         d->mAlarms[i]->shiftTimes(oldZone, newZone);
@@ -542,9 +552,15 @@ void Incidence::setRelatedTo(const QString &relatedToUid, RelType relType)
     // TODO: RFC says that an incidence can have more than one related-to field
     // even for the same relType.
 
-    if (d->mRelatedToUid[relType] != relatedToUid) {
+    if (relatedTo(relType) != relatedToUid) {
         update();
-        d->mRelatedToUid[relType] = relatedToUid;
+        if (relType == RelTypeParent) {
+            d->mRelatedToParent = relatedToUid;
+        } else if (relatedToUid.isEmpty()) {
+            d->mRelatedToOther.remove(relType);
+        } else {
+            d->mRelatedToOther.insert(relType, relatedToUid);
+        }
         setFieldDirty(FieldRelatedTo);
         updated();
     }
@@ -552,34 +568,40 @@ void Incidence::setRelatedTo(const QString &relatedToUid, RelType relType)
 
 QString Incidence::relatedTo(RelType relType) const
 {
-    return d->mRelatedToUid.value(relType);
+    return relType == RelTypeParent ? d->mRelatedToParent : d->mRelatedToOther.value(relType);
 }
 
 // %%%%%%%%%%%%  Recurrence-related methods %%%%%%%%%%%%%%%%%%%%
 
 Recurrence *Incidence::recurrence() const
 {
-    if (!d->mRecurrence) {
-        d->mRecurrence = new Recurrence();
-        d->mRecurrence->setStartDateTime(dateTime(RoleRecurrenceStart), allDay());
-        d->mRecurrence->setAllDay(allDay());
-        d->mRecurrence->setRecurReadOnly(mReadOnly);
-        d->mRecurrence->addObserver(const_cast<KCalendarCore::Incidence *>(this));
+    Recurrence *recurrence = d->recurrence();
+    if (!recurrence) {
+        // Readers of a shared incidence may get here concurrently: the first
+        // one to publish its recurrence wins and the others use that one
+        recurrence = new Recurrence();
+        recurrence->setStartDateTime(dateTime(RoleRecurrenceStart), allDay());
+        recurrence->setAllDay(allDay());
+        recurrence->setRecurReadOnly(mReadOnly);
+        recurrence->addObserver(const_cast<KCalendarCore::Incidence *>(this));
+        if (!d->mRecurrence.testAndSetOrdered(nullptr, recurrence)) {
+            delete recurrence;
+            recurrence = d->recurrence();
+        }
     }
 
-    return d->mRecurrence;
+    return recurrence;
 }
 
 void Incidence::clearRecurrence()
 {
-    delete d->mRecurrence;
-    d->mRecurrence = nullptr;
+    delete d->mRecurrence.fetchAndStoreOrdered(nullptr);
 }
 
 ushort Incidence::recurrenceType() const
 {
-    if (d->mRecurrence) {
-        return d->mRecurrence->recurrenceType();
+    if (d->recurrence()) {
+        return d->recurrence()->recurrenceType();
     } else {
         return Recurrence::rNone;
     }
@@ -587,8 +609,8 @@ ushort Incidence::recurrenceType() const
 
 bool Incidence::recurs() const
 {
-    if (d->mRecurrence) {
-        return d->mRecurrence->recurs();
+    if (d->recurrence()) {
+        return d->recurrence()->recurs();
     } else {
         return false;
     }
@@ -596,12 +618,12 @@ bool Incidence::recurs() const
 
 bool Incidence::recursOn(const QDate &date, const QTimeZone &timeZone) const
 {
-    return d->mRecurrence && d->mRecurrence->recursOn(date, timeZone);
+    return d->recurrence() && d->recurrence()->recursOn(date, timeZone);
 }
 
 bool Incidence::recursAt(const QDateTime &qdt) const
 {
-    return d->mRecurrence && d->mRecurrence->recursAt(qdt);
+    return d->recurrence() && d->recurrence()->recursAt(qdt);
 }
 
 QList<QDateTime> Incidence::startDateTimesForDate(const QDate &date, const QTimeZone &timeZone) const
@@ -931,8 +953,18 @@ void Incidence::setSchedulingID(const QString &sid, const QString &uid)
         setUid(uid);
     }
     if (sid != d->mSchedulingID) {
+        // Observers may index incidences by scheduling ID, which falls back
+        // to the uid. The scheduling ID is no property of its own in iCalendar
+        // data, so calendars don't take the change for a modification.
+        const bool reindex = (sid.isNull() ? this->uid() : sid) != schedulingID();
+        if (reindex) {
+            update();
+        }
         d->mSchedulingID = sid;
         setFieldDirty(FieldSchedulingId);
+        if (reindex) {
+            schedulingIdUpdated();
+        }
     }
 }
 
@@ -945,6 +977,38 @@ QString Incidence::schedulingID() const
     return d->mSchedulingID;
 }
 
+qint64 Incidence::approximateMemoryUsage() const
+{
+    using namespace MemorySize;
+    // Alarms and attachments keep their values in private classes of their
+    // own, which are about this large
+    static const qint64 alarmSize = 32 * sizeof(void *);
+    static const qint64 attachmentSize = 8 * sizeof(void *);
+
+    qint64 size = sizeof(Private) + approximateBaseMemoryUsage()
+                  + heapSize(d->mCreated) + heapSize(d->mRecurrenceId)
+                  + heapSize(d->mDescription) + heapSize(d->mSummary) + heapSize(d->mLocation)
+                  + heapSize(d->mCategories) + heapSize(d->mResources)
+                  + heapSize(d->mStatusString) + heapSize(d->mSchedulingID)
+                  + heapSize(d->mRelatedToParent) + heapSize(d->mRelatedToOther)
+                  + heapSize(d->mAttachments) + heapSize(d->mAlarms);
+    for (const QString &uid : qAsConst(d->mRelatedToOther)) {
+        size += heapSize(uid);
+    }
+    for (const Attachment &attachment : qAsConst(d->mAttachments)) {
+        size += attachmentSize + heapSize(attachment.uri()) + heapSize(attachment.data())
+                + heapSize(attachment.mimeType()) + heapSize(attachment.label());
+    }
+    for (const Alarm::Ptr &alarm : qAsConst(d->mAlarms)) {
+        size += alarmSize + heapSize(alarm->text()) + heapSize(alarm->mailSubject())
+                + heapSize(alarm->mailText()) + heapSize(alarm->mailAttachments());
+    }
+    if (d->recurrence()) {
+        size += d->recurrence()->approximateMemoryUsage();
+    }
+    return size;
+}
+
 bool Incidence::hasGeo() const
 {
     return d->mHasGeo;
@@ -1034,7 +1098,7 @@ void Incidence::setRecurrenceId(const QDateTime &recurrenceId)
     belongs to. */
 void Incidence::recurrenceUpdated(Recurrence *recurrence)
 {
-    if (recurrence == d->mRecurrence) {
+    if (recurrence == d->recurrence()) {
         update();
         setFieldDirty(FieldRecurrence);
         updated();
@@ -1092,11 +1156,17 @@ void Incidence::serialize(QDataStream &out) const
         << d->mGeoLatitude << d->mGeoLongitude << d->mHasGeo;
     serializeQDateTimeAsKDateTime(out, d->mRecurrenceId);
     out << d->mThisAndFuture
-        << d->mLocalOnly << d->mStatus << d->mSecrecy << (d->mRecurrence ? true : false)
-        << d->mAttachments.count() << d->mAlarms.count() << d->mRelatedToUid;
+        << d->mLocalOnly << d->mStatus << d->mSecrecy << (d->recurrence() ? true : false)
+        << d->mAttachments.count() << d->mAlarms.count();
 
-    if (d->mRecurrence) {
-        out << d->mRecurrence;
+    QMap<RelType, QString> relatedToUid = d->mRelatedToOther;
+    if (!d->mRelatedToParent.isEmpty()) {
+        relatedToUid.insert(RelTypeParent, d->mRelatedToParent);
+    }
+    out << relatedToUid;
+
+    if (d->recurrence()) {
+        out << d->recurrence();
     }
 
     for (const Attachment &attachment : qAsConst(d->mAttachments)) {
@@ -1125,9 +1195,10 @@ void Incidence::deserialize(QDataStream &in)
     >> relatedToUid;
 
     if (hasRecurrence) {
-        d->mRecurrence = new Recurrence();
-        d->mRecurrence->addObserver(const_cast<KCalendarCore::Incidence *>(this));
-        in >> d->mRecurrence;
+        Recurrence *recurrence = new Recurrence();
+        recurrence->addObserver(const_cast<KCalendarCore::Incidence *>(this));
+        in >> recurrence;
+        delete d->mRecurrence.fetchAndStoreOrdered(recurrence);
     }
 
     d->mAttachments.clear();
@@ -1150,11 +1221,17 @@ void Incidence::deserialize(QDataStream &in)
     d->mStatus = static_cast<Incidence::Status>(status);
     d->mSecrecy = static_cast<Incidence::Secrecy>(secrecy);
 
-    d->mRelatedToUid.clear();
+    d->mRelatedToParent.clear();
+    d->mRelatedToOther.clear();
 
     auto it = relatedToUid.cbegin(), end = relatedToUid.cend();
     for (; it != end; ++it) {
-        d->mRelatedToUid.insert(static_cast<Incidence::RelType>(it.key()), it.value());
+        const auto relType = static_cast<Incidence::RelType>(it.key());
+        if (relType == RelTypeParent) {
+            d->mRelatedToParent = it.value();
+        } else if (!it.value().isEmpty()) {
+            d->mRelatedToOther.insert(relType, it.value());
+        }
     }
 }
 
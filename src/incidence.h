@@ -438,6 +438,9 @@ public:
     /**
       Returns the recurrence rule associated with this incidence. If there is
       none, returns an appropriate (non-0) object.
+
+      Since 5.13 it is safe to call this from several threads reading the
+      same incidence, like readers of MemoryCalendar snapshots.
     */
     Recurrence *recurrence() const;
 
@@ -784,6 +787,20 @@ public:
     */
     Q_REQUIRED_RESULT QString schedulingID() const;
 
+    /**
+      Returns the approximate number of bytes this incidence takes in memory,
+      including its alarms, attachments and recurrence. Strings shared with
+      other incidences are counted for each of them.
+
+      The cost is proportional to the number of attendees, alarms, custom
+      properties and the like, not to the size of the strings, so this is
+      cheap enough to call for every incidence of a calendar.
+
+      @see Recurrence::approximateMemoryUsage(), Calendar::approximateMemoryUsage()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT qint64 approximateMemoryUsage() const;
+
     /**
       Observer interface for the recurrence class. If the recurrence is
       changed, this method will be called for the incidence the recurrence
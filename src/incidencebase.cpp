@@ -38,12 +38,17 @@
 #include "calformat.h"
 #include "visitor.h"
 #include "utils_p.h"
+#include "memorysize_p.h"
 
 #include <QTime>
 #include "kcalendarcore_debug.h"
 #include <QUrl>
 
+#include <QHash>
 #include <QStringList>
+#include <QVarLengthArray>
+
+#include <algorithm>
 
 #define KCALCORE_MAGIC_NUMBER 0xCA1C012E
 #define KCALCORE_SERIALIZATION_VERSION 1
@@ -55,48 +60,112 @@ using namespace KCalendarCore;
   @internal
 */
 //@cond PRIVATE
+// Shared by all incidences without an organizer, so that they don't each
+// allocate an empty one
+Q_GLOBAL_STATIC(KCalendarCore::Person, sEmptyOrganizer)
+
 class Q_DECL_HIDDEN KCalendarCore::IncidenceBase::Private
 {
 public:
     Private()
-        : mUpdateGroupLevel(0)
-        , mUpdatedPending(false)
-        , mAllDay(false)
-        , mHasDuration(false)
+        : mOrganizer(*sEmptyOrganizer())
     {
     }
 
     Private(const Private &other)
-        : mUpdateGroupLevel(0)
-        , mUpdatedPending(false)
+        : mOrganizer(other.mOrganizer)
         , mAllDay(true)
-        , mHasDuration(false)
     {
         init(other);
     }
 
     ~Private()
     {
+        delete mExtra;
+        delete mAttendeesByEmail;
     }
 
     void init(const Private &other);
 
+    // Properties most incidences don't have, allocated on first use
+    struct Extra {
+        QStringList mComments;   // list of incidence comments
+        QStringList mContacts;   // list of incidence contacts
+        QUrl mUrl;               // incidence url property
+    };
+
+    Extra *extra()
+    {
+        if (!mExtra) {
+            mExtra = new Extra;
+        }
+        return mExtra;
+    }
+
+    void setFieldDirty(Field field)
+    {
+        mDirtyFields |= quint64(1) << field;
+    }
+
+    // Incidences with this many attendees look them up by email in mAttendeesByEmail
+    enum { AttendeeIndexThreshold = 16 };
+
+    // Adds the attendee at index @p i of mAttendees to mAttendeesByEmail,
+    // creating it once there are enough attendees
+    void indexAttendee(int i)
+    {
+        if (mAttendeesByEmail) {
+            const QString email = mAttendees.at(i).email();
+            if (!mAttendeesByEmail->contains(email)) {
+                mAttendeesByEmail->insert(email, i);
+            }
+        } else if (mAttendees.count() >= AttendeeIndexThreshold) {
+            mAttendeesByEmail = new QHash<QString, int>;
+            mAttendeesByEmail->reserve(mAttendees.count());
+            for (int j = mAttendees.count() - 1; j >= 0; --j) {
+                mAttendeesByEmail->insert(mAttendees.at(j).email(), j);
+            }
+        }
+    }
+
+    void clearAttendeeIndex()
+    {
+        delete mAttendeesByEmail;
+        mAttendeesByEmail = nullptr;
+    }
+
+    // Returns the index in mAttendees of the first attendee with @p email, or -1
+    int attendeeIndex(const QString &email) const
+    {
+        if (mAttendeesByEmail) {
+            return mAttendeesByEmail->value(email, -1);
+        }
+        for (int i = 0, count = mAttendees.count(); i < count; ++i) {
+            if (mAttendees.at(i).email() == email) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
     QDateTime mLastModified;     // incidence last modified date
     QDateTime mDtStart;          // incidence start time
     Person mOrganizer;           // incidence person (owner)
     QString mUid;                // incidence unique id
-    Duration mDuration;          // incidence duration
-    int mUpdateGroupLevel;       // if non-zero, suppresses update() calls
+    Attendee::List mAttendees;   // list of incidence attendees
+    QVarLengthArray<IncidenceObserver *, 1> mObservers; // list of incidence observers,
+    // usually just the calendar
+    Extra *mExtra = nullptr;
+    QHash<QString, int> *mAttendeesByEmail = nullptr; // email -> index of its first attendee
+    quint64 mDirtyFields = 0;    // bit n is set if Field n changed since the incidence
+    // was created or since resetDirtyFlags() was called
+    int mDuration = 0;           // incidence duration, in days if mDurationIsDaily
+    int mUpdateGroupLevel = 0;   // if non-zero, suppresses update() calls
+    bool mDurationIsDaily = false;
     bool mUpdatedPending = false;        // true if an update has occurred since startUpdates()
+    bool mSchedulingIdUpdate = false;    // true while updated() reports a scheduling ID change only
     bool mAllDay = false;                // true if the incidence is all-day
     bool mHasDuration = false;           // true if the incidence has a duration
-    Attendee::List mAttendees;   // list of incidence attendees
-    QStringList mComments;       // list of incidence comments
-    QStringList mContacts;       // list of incidence contacts
-    QList<IncidenceObserver *> mObservers; // list of incidence observers
-    QSet<Field> mDirtyFields;    // Fields that changed since last time the incidence was created
-    // or since resetDirtyFlags() was called
-    QUrl mUrl;                   // incidence url property
 };
 
 void IncidenceBase::Private::init(const Private &other)
@@ -106,15 +175,19 @@ void IncidenceBase::Private::init(const Private &other)
     mOrganizer = other.mOrganizer;
     mUid = other.mUid;
     mDuration = other.mDuration;
+    mDurationIsDaily = other.mDurationIsDaily;
     mAllDay = other.mAllDay;
     mHasDuration = other.mHasDuration;
 
-    mComments = other.mComments;
-    mContacts = other.mContacts;
+    delete mExtra;
+    mExtra = other.mExtra ? new Extra(*other.mExtra) : nullptr;
 
     mAttendees = other.mAttendees;
     mAttendees.reserve(other.mAttendees.count());
-    mUrl = other.mUrl;
+    clearAttendeeIndex();
+    if (other.mAttendeesByEmail) {
+        mAttendeesByEmail = new QHash<QString, int>(*other.mAttendeesByEmail);
+    }
 }
 
 //@endcond
@@ -155,8 +228,8 @@ IncidenceBase &IncidenceBase::assign(const IncidenceBase &other)
     CustomProperties::operator=(other);
     d->init(*other.d);
     mReadOnly = other.mReadOnly;
-    d->mDirtyFields.clear();
-    d->mDirtyFields.insert(FieldUnknown);
+    d->mDirtyFields = 0;
+    d->setFieldDirty(FieldUnknown);
     return *this;
 }
 
@@ -228,7 +301,7 @@ void IncidenceBase::setUid(const QString &uid)
     if (d->mUid != uid) {
         update();
         d->mUid = uid;
-        d->mDirtyFields.insert(FieldUid);
+        d->setFieldDirty(FieldUid);
         updated();
     }
 }
@@ -243,7 +316,7 @@ void IncidenceBase::setLastModified(const QDateTime &lm)
     // DON'T! updated() because we call this from
     // Calendar::updateEvent().
 
-    d->mDirtyFields.insert(FieldLastModified);
+    d->setFieldDirty(FieldLastModified);
 
     // Convert to UTC and remove milliseconds part.
     QDateTime current = lm.toUTC();
@@ -267,7 +340,7 @@ void IncidenceBase::setOrganizer(const Person &organizer)
     // the event's readonly status...
     d->mOrganizer = organizer;
 
-    d->mDirtyFields.insert(FieldOrganizer);
+    d->setFieldDirty(FieldOrganizer);
 
     updated();
 }
@@ -310,7 +383,7 @@ void IncidenceBase::setDtStart(const QDateTime &dtStart)
     if (d->mDtStart != dtStart) {
         update();
         d->mDtStart = dtStart;
-        d->mDirtyFields.insert(FieldDtStart);
+        d->setFieldDirty(FieldDtStart);
         updated();
     }
 }
@@ -333,7 +406,7 @@ void IncidenceBase::setAllDay(bool f)
     update();
     d->mAllDay = f;
     if (d->mDtStart.isValid()) {
-        d->mDirtyFields.insert(FieldDtStart);
+        d->setFieldDirty(FieldDtStart);
     }
     updated();
 }
@@ -343,14 +416,15 @@ void IncidenceBase::shiftTimes(const QTimeZone &oldZone, const QTimeZone &newZon
     update();
     d->mDtStart = d->mDtStart.toTimeZone(oldZone);
     d->mDtStart.setTimeZone(newZone);
-    d->mDirtyFields.insert(FieldDtStart);
-    d->mDirtyFields.insert(FieldDtEnd);
+    d->setFieldDirty(FieldDtStart);
+    d->setFieldDirty(FieldDtEnd);
     updated();
 }
 
 void IncidenceBase::addComment(const QString &comment)
 {
-    d->mComments += comment;
+    d->extra()->mComments += comment;
+    d->setFieldDirty(FieldComment);
 }
 
 bool IncidenceBase::removeComment(const QString &comment)
@@ -358,15 +432,18 @@ bool IncidenceBase::removeComment(const QString &comment)
     bool found = false;
     QStringList::Iterator i;
 
-    for (i = d->mComments.begin(); !found && i != d->mComments.end(); ++i) {
+    if (!d->mExtra) {
+        return false;
+    }
+    for (i = d->mExtra->mComments.begin(); !found && i != d->mExtra->mComments.end(); ++i) {
         if ((*i) == comment) {
             found = true;
-            d->mComments.erase(i);
+            d->mExtra->mComments.erase(i);
         }
     }
 
     if (found) {
-        d->mDirtyFields.insert(FieldComment);
+        d->setFieldDirty(FieldComment);
     }
 
     return found;
@@ -374,20 +451,22 @@ bool IncidenceBase::removeComment(const QString &comment)
 
 void IncidenceBase::clearComments()
 {
-    d->mDirtyFields.insert(FieldComment);
-    d->mComments.clear();
+    d->setFieldDirty(FieldComment);
+    if (d->mExtra) {
+        d->mExtra->mComments.clear();
+    }
 }
 
 QStringList IncidenceBase::comments() const
 {
-    return d->mComments;
+    return d->mExtra ? d->mExtra->mComments : QStringList();
 }
 
 void IncidenceBase::addContact(const QString &contact)
 {
     if (!contact.isEmpty()) {
-        d->mContacts += contact;
-        d->mDirtyFields.insert(FieldContact);
+        d->extra()->mContacts += contact;
+        d->setFieldDirty(FieldContact);
     }
 }
 
@@ -396,15 +475,18 @@ bool IncidenceBase::removeContact(const QString &contact)
     bool found = false;
     QStringList::Iterator i;
 
-    for (i = d->mContacts.begin(); !found && i != d->mContacts.end(); ++i) {
+    if (!d->mExtra) {
+        return false;
+    }
+    for (i = d->mExtra->mContacts.begin(); !found && i != d->mExtra->mContacts.end(); ++i) {
         if ((*i) == contact) {
             found = true;
-            d->mContacts.erase(i);
+            d->mExtra->mContacts.erase(i);
         }
     }
 
     if (found) {
-        d->mDirtyFields.insert(FieldContact);
+        d->setFieldDirty(FieldContact);
     }
 
     return found;
@@ -412,13 +494,15 @@ bool IncidenceBase::removeContact(const QString &contact)
 
 void IncidenceBase::clearContacts()
 {
-    d->mDirtyFields.insert(FieldContact);
-    d->mContacts.clear();
+    d->setFieldDirty(FieldContact);
+    if (d->mExtra) {
+        d->mExtra->mContacts.clear();
+    }
 }
 
 QStringList IncidenceBase::contacts() const
 {
-    return d->mContacts;
+    return d->mExtra ? d->mExtra->mContacts : QStringList();
 }
 
 void IncidenceBase::addAttendee(const Attendee &a, bool doupdate)
@@ -433,8 +517,9 @@ void IncidenceBase::addAttendee(const Attendee &a, bool doupdate)
     }
 
     d->mAttendees.append(a);
+    d->indexAttendee(d->mAttendees.count() - 1);
     if (doupdate) {
-        d->mDirtyFields.insert(FieldAttendees);
+        d->setFieldDirty(FieldAttendees);
         updated();
     }
 }
@@ -467,7 +552,7 @@ void IncidenceBase::setAttendees(const Attendee::List &attendees, bool doUpdate)
     }
 
     if (doUpdate) {
-        d->mDirtyFields.insert(FieldAttendees);
+        d->setFieldDirty(FieldAttendees);
         updated();
     }
 }
@@ -477,20 +562,15 @@ void IncidenceBase::clearAttendees()
     if (mReadOnly) {
         return;
     }
-    d->mDirtyFields.insert(FieldAttendees);
+    d->setFieldDirty(FieldAttendees);
     d->mAttendees.clear();
+    d->clearAttendeeIndex();
 }
 
 Attendee IncidenceBase::attendeeByMail(const QString &email) const
 {
-    Attendee::List::ConstIterator it;
-    for (it = d->mAttendees.constBegin(); it != d->mAttendees.constEnd(); ++it) {
-        if ((*it).email() == email) {
-            return *it;
-        }
-    }
-
-    return {};
+    const int i = d->attendeeIndex(email);
+    return i < 0 ? Attendee() : d->mAttendees.at(i);
 }
 
 Attendee IncidenceBase::attendeeByMails(const QStringList &emails, const QString &email) const
@@ -500,6 +580,18 @@ Attendee IncidenceBase::attendeeByMails(const QStringList &emails, const QString
         mails.append(email);
     }
 
+    if (d->mAttendeesByEmail) {
+        // The first attendee with any of the emails
+        int first = -1;
+        for (const QString &mail : qAsConst(mails)) {
+            const int i = d->mAttendeesByEmail->value(mail, -1);
+            if (i >= 0 && (first < 0 || i < first)) {
+                first = i;
+            }
+        }
+        return first < 0 ? Attendee() : d->mAttendees.at(first);
+    }
+
     Attendee::List::ConstIterator itA;
     for (itA = d->mAttendees.constBegin(); itA != d->mAttendees.constEnd(); ++itA) {
         for (QStringList::const_iterator it = mails.constBegin(); it != mails.constEnd(); ++it) {
@@ -527,15 +619,16 @@ Attendee IncidenceBase::attendeeByUid(const QString &uid) const
 void IncidenceBase::setDuration(const Duration &duration)
 {
     update();
-    d->mDuration = duration;
+    d->mDurationIsDaily = duration.isDaily();
+    d->mDuration = duration.value();
     setHasDuration(true);
-    d->mDirtyFields.insert(FieldDuration);
+    d->setFieldDirty(FieldDuration);
     updated();
 }
 
 Duration IncidenceBase::duration() const
 {
-    return d->mDuration;
+    return Duration(d->mDuration, d->mDurationIsDaily ? Duration::Days : Duration::Seconds);
 }
 
 void IncidenceBase::setHasDuration(bool hasDuration)
@@ -550,25 +643,28 @@ bool IncidenceBase::hasDuration() const
 
 void IncidenceBase::setUrl(const QUrl &url)
 {
-    d->mDirtyFields.insert(FieldUrl);
-    d->mUrl = url;
+    d->setFieldDirty(FieldUrl);
+    if (d->mExtra || !url.isEmpty()) {
+        d->extra()->mUrl = url;
+    }
 }
 
 QUrl IncidenceBase::url() const
 {
-    return d->mUrl;
+    return d->mExtra ? d->mExtra->mUrl : QUrl();
 }
 
 void IncidenceBase::registerObserver(IncidenceBase::IncidenceObserver *observer)
 {
-    if (observer && !d->mObservers.contains(observer)) {
+    if (observer && std::find(d->mObservers.cbegin(), d->mObservers.cend(), observer) == d->mObservers.cend()) {
         d->mObservers.append(observer);
     }
 }
 
 void IncidenceBase::unRegisterObserver(IncidenceBase::IncidenceObserver *observer)
 {
-    d->mObservers.removeAll(observer);
+    const auto end = std::remove(d->mObservers.begin(), d->mObservers.end(), observer);
+    d->mObservers.resize(end - d->mObservers.begin());
 }
 
 void IncidenceBase::update()
@@ -594,6 +690,21 @@ void IncidenceBase::updated()
     }
 }
 
+//@cond PRIVATE
+void IncidenceBase::schedulingIdUpdated()
+{
+    // Within startUpdates() and endUpdates() it is one of the grouped changes
+    d->mSchedulingIdUpdate = !d->mUpdateGroupLevel;
+    updated();
+    d->mSchedulingIdUpdate = false;
+}
+
+bool IncidenceBase::isSchedulingIdUpdate() const
+{
+    return d->mSchedulingIdUpdate;
+}
+//@endcond
+
 void IncidenceBase::startUpdates()
 {
     update();
@@ -627,17 +738,62 @@ QDateTime IncidenceBase::recurrenceId() const
 
 void IncidenceBase::resetDirtyFields()
 {
-    d->mDirtyFields.clear();
+    d->mDirtyFields = 0;
 }
 
 QSet<IncidenceBase::Field> IncidenceBase::dirtyFields() const
 {
-    return d->mDirtyFields;
+    QSet<Field> fields;
+    for (int field = 0; field <= FieldUrl; ++field) {
+        if (d->mDirtyFields & (quint64(1) << field)) {
+            fields.insert(static_cast<Field>(field));
+        }
+    }
+    return fields;
 }
 
 void IncidenceBase::setFieldDirty(IncidenceBase::Field field)
 {
-    d->mDirtyFields.insert(field);
+    d->setFieldDirty(field);
+}
+
+qint64 IncidenceBase::approximateBaseMemoryUsage() const
+{
+    using namespace MemorySize;
+    // Persons and attendees keep their values in private classes of their own,
+    // which are about this large
+    static const qint64 personSize = 4 * sizeof(void *);
+    static const qint64 attendeeSize = 16 * sizeof(void *);
+
+    qint64 size = sizeof(Private)
+                  + heapSize(d->mLastModified) + heapSize(d->mDtStart)
+                  + heapSize(d->mUid) + heapSize(d->mAttendees);
+    if (!d->mOrganizer.isEmpty()) {
+        size += personSize + heapSize(d->mOrganizer.name()) + heapSize(d->mOrganizer.email());
+    }
+    for (const Attendee &attendee : qAsConst(d->mAttendees)) {
+        size += attendeeSize
+                + heapSize(attendee.name()) + heapSize(attendee.email()) + heapSize(attendee.uid())
+                + heapSize(attendee.delegate()) + heapSize(attendee.delegator());
+    }
+    if (d->mObservers.capacity() > 1) {    // beyond the preallocated entry
+        size += d->mObservers.capacity() * sizeof(IncidenceObserver *);
+    }
+    if (d->mAttendeesByEmail) {    // the emails are shared with the attendees
+        size += sizeof(QHash<QString, int>) + heapSize(*d->mAttendeesByEmail);
+    }
+    if (d->mExtra) {
+        size += sizeof(Private::Extra)
+                + heapSize(d->mExtra->mComments) + heapSize(d->mExtra->mContacts)
+                + heapSize(d->mExtra->mUrl.toString());
+    }
+
+    const QMap<QByteArray, QString> properties = customProperties();
+    size += heapSize(properties);
+    for (auto it = properties.cbegin(), end = properties.cend(); it != end; ++it) {
+        size += heapSize(it.key()) + heapSize(it.value());
+    }
+    return size;
 }
 
 QUrl IncidenceBase::uri() const
@@ -647,7 +803,10 @@ QUrl IncidenceBase::uri() const
 
 void IncidenceBase::setDirtyFields(const QSet<IncidenceBase::Field> &dirtyFields)
 {
-    d->mDirtyFields = dirtyFields;
+    d->mDirtyFields = 0;
+    for (Field field : dirtyFields) {
+        d->setFieldDirty(field);
+    }
 }
 
 void IncidenceBase::serialize(QDataStream &out) const
@@ -679,9 +838,9 @@ QDataStream &KCalendarCore::operator<<(QDataStream &out, const KCalendarCore::In
     out << *(static_cast<CustomProperties *>(i.data()));
     serializeQDateTimeAsKDateTime(out, i->d->mLastModified);
     serializeQDateTimeAsKDateTime(out, i->d->mDtStart);
-    out << i->organizer() << i->d->mUid << i->d->mDuration
-        << i->d->mAllDay << i->d->mHasDuration << i->d->mComments << i->d->mContacts
-        << i->d->mAttendees.count() << i->d->mUrl;
+    out << i->organizer() << i->d->mUid << i->duration()
+        << i->d->mAllDay << i->d->mHasDuration << i->comments() << i->contacts()
+        << i->d->mAttendees.count() << i->url();
 
     for (const Attendee &attendee : qAsConst(i->d->mAttendees)) {
         out << attendee;
@@ -721,16 +880,30 @@ QDataStream &KCalendarCore::operator>>(QDataStream &in, KCalendarCore::Incidence
     in >> *(static_cast<CustomProperties *>(i.data()));
     deserializeKDateTimeAsQDateTime(in, i->d->mLastModified);
     deserializeKDateTimeAsQDateTime(in, i->d->mDtStart);
-    in >> i->d->mOrganizer >> i->d->mUid >> i->d->mDuration
-    >> i->d->mAllDay >> i->d->mHasDuration >> i->d->mComments >> i->d->mContacts >> attendeeCount
-    >> i->d->mUrl;
+    Duration duration;
+    QStringList comments, contacts;
+    QUrl url;
+    in >> i->d->mOrganizer >> i->d->mUid >> duration
+    >> i->d->mAllDay >> i->d->mHasDuration >> comments >> contacts >> attendeeCount
+    >> url;
+    i->d->mDuration = duration.value();
+    i->d->mDurationIsDaily = duration.isDaily();
+    delete i->d->mExtra;
+    i->d->mExtra = nullptr;
+    if (!comments.isEmpty() || !contacts.isEmpty() || !url.isEmpty()) {
+        i->d->extra()->mComments = comments;
+        i->d->mExtra->mContacts = contacts;
+        i->d->mExtra->mUrl = url;
+    }
 
     i->d->mAttendees.clear();
+    i->d->clearAttendeeIndex();
     i->d->mAttendees.reserve(attendeeCount);
     for (int it = 0; it < attendeeCount; it++) {
         Attendee attendee;
         in >> attendee;
         i->d->mAttendees.append(attendee);
+        i->d->indexAttendee(i->d->mAttendees.count() - 1);
     }
 
     // Deserialize the sub-class data.
@@ -542,6 +542,9 @@ public:
 
       @param email is a QString containing an email address of the
       form "FirstName LastName <emailaddress>".
+
+      Incidences with many attendees keep them hashed by email, so this
+      takes constant time however long the list of attendees is.
       @see attendeeByMails(), attendeesByUid().
     */
     Attendee attendeeByMail(const QString &email) const;
@@ -694,6 +697,15 @@ protected:
     */
     void setFieldDirty(IncidenceBase::Field field);
 
+    /**
+      Returns the approximate number of bytes taken by the properties which
+      are common to all incidence types, including the attendees and the
+      custom properties.
+      @see Incidence::approximateMemoryUsage()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT qint64 approximateBaseMemoryUsage() const;
+
     /**
       @copydoc
       CustomProperties::customPropertyUpdate()
@@ -758,6 +770,14 @@ private:
     Private *const d;
 
     Q_DECL_HIDDEN QVariantList attendeesVariant() const;
+    Q_DECL_HIDDEN void schedulingIdUpdated();
+    Q_DECL_HIDDEN bool isSchedulingIdUpdate() const;
+
+    // Incidence::setSchedulingID() lets calendars re-index the incidence
+    // without taking the change for a modification
+    friend class Incidence;
+    friend class Calendar;
+    friend class MemoryCalendar;
     //@endcond
 
     friend KCALENDARCORE_EXPORT QDataStream &operator<<(QDataStream &stream, const KCalendarCore::IncidenceBase::Ptr &);
@@ -0,0 +1,377 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KCALCORE_INTERVALTREE_P_H
+#define KCALCORE_INTERVALTREE_P_H
+
+#include "memorysize_p.h"
+
+#include <QHash>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace KCalendarCore {
+
+/**
+  An augmented interval tree.
+
+  This is a treap ordered by interval start, where every node caches the
+  largest interval end found in its subtree. Overlap and stabbing queries
+  therefore cost O(log n + k) on average.
+
+  Intervals are closed, i.e. [start, end]. Every value is stored at most
+  once: inserting it again replaces its previous interval. The tree remembers
+  where each value lives, so remove() does not need the bounds the value was
+  inserted with. That matters for incidences, which notify their observers
+  only after some of their properties (e.g. the recurrence) already changed.
+
+  Copies of the tree share their nodes, so copying a tree is O(1). A node
+  only owned by one tree is modified in place. A node still shared with a
+  copy is copied before it is modified, along with the nodes on its path, so
+  that the copy stays valid and may be read from another thread while the
+  original is modified. Copies have to be made in the thread modifying the
+  tree.
+
+  @internal
+*/
+template <typename T>
+class IntervalTree
+{
+public:
+    /**
+      An interval for insert(const QVector<Entry> &).
+    */
+    struct Entry {
+        qint64 start;
+        qint64 end;
+        T value;
+    };
+
+    /**
+      Inserts @p value for the interval [@p start, @p end], replacing any
+      interval previously stored for it.
+    */
+    void insert(qint64 start, qint64 end, const T &value)
+    {
+        remove(value);
+        const Key key = {start, mNextSerial++};
+        NodePtr node = makeNode(key, end, value, nextPriority(), NodePtr(), NodePtr());
+        auto parts = split(std::move(mRoot), key);
+        mRoot = merge(merge(std::move(parts.first), std::move(node)), std::move(parts.second));
+        mKeys.insert(value, key);
+    }
+
+    /**
+      Inserts all of @p entries, like insert() for each of them. The values
+      of the entries have to be distinct.
+
+      The entries are built into a tree of their own in linear time (after
+      sorting them), which is then merged with this one. That saves walking
+      the path to every new node, and copying it while the tree is shared,
+      which is what inserting them one by one costs. For an empty tree it is
+      a plain assignment.
+    */
+    void insert(const QVector<Entry> &entries)
+    {
+        if (entries.isEmpty()) {
+            return;
+        }
+        mKeys.reserve(mKeys.count() + entries.count());
+        QVector<Pending> nodes;
+        nodes.reserve(entries.count());
+        for (const Entry &entry : entries) {
+            remove(entry.value);
+            const Key key = {entry.start, mNextSerial++};
+            Q_ASSERT(!mKeys.contains(entry.value));
+            mKeys.insert(entry.value, key);
+            nodes.append({key, entry.end, entry.value, nextPriority(), -1, -1});
+        }
+        std::sort(nodes.begin(), nodes.end(), [](const Pending &a, const Pending &b) {
+            return a.key < b.key;
+        });
+
+        // The usual construction of a Cartesian tree, keeping the right spine
+        // of the tree built so far on a stack. Only the links are worked out
+        // here, the nodes themselves can only be made bottom up.
+        QVector<int> stack;
+        for (int i = 0; i < nodes.count(); ++i) {
+            int last = -1;
+            while (!stack.isEmpty() && nodes.at(stack.last()).priority < nodes.at(i).priority) {
+                last = stack.takeLast();
+            }
+            nodes[i].left = last;
+            if (!stack.isEmpty()) {
+                nodes[stack.last()].right = i;
+            }
+            stack.append(i);
+        }
+        mRoot = unite(std::move(mRoot), build(nodes, stack.first()));
+    }
+
+    /**
+      Removes @p value from the tree. Returns false if it wasn't stored.
+    */
+    bool remove(const T &value)
+    {
+        const auto it = mKeys.constFind(value);
+        if (it == mKeys.constEnd()) {
+            return false;
+        }
+        const Key key = it.value();
+        mKeys.erase(it);
+        auto parts = split(std::move(mRoot), key);
+        const Key next = {key.start, key.serial + 1};
+        mRoot = merge(std::move(parts.first), split(std::move(parts.second), next).second);
+        return true;
+    }
+
+    bool contains(const T &value) const
+    {
+        return mKeys.contains(value);
+    }
+
+    int count() const
+    {
+        return mKeys.count();
+    }
+
+    bool isEmpty() const
+    {
+        return mKeys.isEmpty();
+    }
+
+    void reserve(int size)
+    {
+        mKeys.reserve(size);
+    }
+
+    void clear()
+    {
+        mRoot.reset();
+        mKeys.clear();
+    }
+
+    /**
+      Returns the approximate number of bytes allocated by the tree. Nodes
+      still shared with copies of the tree are counted as well.
+    */
+    qint64 approximateMemoryUsage() const
+    {
+        // std::make_shared allocates each node together with its control block
+        const qint64 nodeSize = sizeof(Node) + sizeof(void *) + 2 * sizeof(int);
+        return count() * nodeSize + MemorySize::heapSize(mKeys);
+    }
+
+    /**
+      Calls @p func for every value whose interval intersects [@p start, @p end].
+    */
+    template <typename Func>
+    void overlapping(qint64 start, qint64 end, Func func) const
+    {
+        overlapping(mRoot.get(), start, end, func);
+    }
+
+    /**
+      Calls @p func for every value whose interval contains @p point.
+    */
+    template <typename Func>
+    void containing(qint64 point, Func func) const
+    {
+        overlapping(mRoot.get(), point, point, func);
+    }
+
+private:
+    // Entries with equal starts are ordered by insertion serial, so that every
+    // entry has a unique position we can find again on removal.
+    struct Key {
+        qint64 start;
+        quint64 serial;
+
+        bool operator<(const Key &other) const
+        {
+            return start < other.start || (start == other.start && serial < other.serial);
+        }
+    };
+
+    struct Node;
+    typedef std::shared_ptr<Node> NodePtr;
+
+    struct Node {
+        Key key;
+        qint64 end;
+        qint64 maxEnd;      // largest end in this subtree
+        T value;
+        quint32 priority;   // heap order, keeps the tree balanced
+        NodePtr left;
+        NodePtr right;
+    };
+
+    quint32 nextPriority()
+    {
+        // xorshift32, deterministic and good enough for balancing
+        mSeed ^= mSeed << 13;
+        mSeed ^= mSeed >> 17;
+        mSeed ^= mSeed << 5;
+        return mSeed;
+    }
+
+    static void updateMaxEnd(Node *node)
+    {
+        node->maxEnd = node->end;
+        if (node->left && node->left->maxEnd > node->maxEnd) {
+            node->maxEnd = node->left->maxEnd;
+        }
+        if (node->right && node->right->maxEnd > node->maxEnd) {
+            node->maxEnd = node->right->maxEnd;
+        }
+    }
+
+    static NodePtr makeNode(const Key &key, qint64 end, const T &value, quint32 priority,
+                            NodePtr left, NodePtr right)
+    {
+        NodePtr node = std::make_shared<Node>(Node{key, end, end, value, priority, std::move(left), std::move(right)});
+        updateMaxEnd(node.get());
+        return node;
+    }
+
+    // Returns @p node if nothing else refers to it, otherwise a copy, which
+    // then shares the children. The functions below take their nodes by value
+    // and detach them before changing them. A caller which moves a child out
+    // of a node it detached gives up its reference, so the child is unique
+    // exactly when no copy of the tree refers to it either.
+    static NodePtr detach(NodePtr node)
+    {
+        if (node.use_count() == 1) {
+            // A copy may just have released it in another thread
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return node;
+        }
+        return std::make_shared<Node>(*node);
+    }
+
+    // Splits @p node into the entries ordered before @p key and the rest.
+    static QPair<NodePtr, NodePtr> split(NodePtr node, const Key &key)
+    {
+        if (!node) {
+            return qMakePair(NodePtr(), NodePtr());
+        }
+        node = detach(std::move(node));
+        if (node->key < key) {
+            auto parts = split(std::move(node->right), key);
+            node->right = std::move(parts.first);
+            updateMaxEnd(node.get());
+            return qMakePair(std::move(node), std::move(parts.second));
+        }
+        auto parts = split(std::move(node->left), key);
+        node->left = std::move(parts.second);
+        updateMaxEnd(node.get());
+        return qMakePair(std::move(parts.first), std::move(node));
+    }
+
+    // Joins two subtrees, all entries of @p a being ordered before those of @p b.
+    static NodePtr merge(NodePtr a, NodePtr b)
+    {
+        if (!a) {
+            return b;
+        }
+        if (!b) {
+            return a;
+        }
+        if (a->priority > b->priority) {
+            a = detach(std::move(a));
+            a->right = merge(std::move(a->right), std::move(b));
+            updateMaxEnd(a.get());
+            return a;
+        }
+        b = detach(std::move(b));
+        b->left = merge(std::move(a), std::move(b->left));
+        updateMaxEnd(b.get());
+        return b;
+    }
+
+    // A node of insert(const QVector<Entry> &) before it is made
+    struct Pending {
+        Key key;
+        qint64 end;
+        T value;
+        quint32 priority;
+        int left;
+        int right;
+    };
+
+    static NodePtr build(const QVector<Pending> &nodes, int i)
+    {
+        if (i < 0) {
+            return NodePtr();
+        }
+        const Pending &node = nodes.at(i);
+        return makeNode(node.key, node.end, node.value, node.priority,
+                        build(nodes, node.left), build(nodes, node.right));
+    }
+
+    // Joins two subtrees whose entries may interleave, but whose keys are distinct.
+    static NodePtr unite(NodePtr a, NodePtr b)
+    {
+        if (!a) {
+            return b;
+        }
+        if (!b) {
+            return a;
+        }
+        if (a->priority < b->priority) {
+            return unite(std::move(b), std::move(a));
+        }
+        a = detach(std::move(a));
+        auto parts = split(std::move(b), a->key);
+        a->left = unite(std::move(a->left), std::move(parts.first));
+        a->right = unite(std::move(a->right), std::move(parts.second));
+        updateMaxEnd(a.get());
+        return a;
+    }
+
+    template <typename Func>
+    static void overlapping(const Node *node, qint64 start, qint64 end, Func &func)
+    {
+        while (node && node->maxEnd >= start) {
+            overlapping(node->left.get(), start, end, func);
+            if (node->key.start > end) {
+                // everything to the right starts even later
+                return;
+            }
+            if (node->end >= start) {
+                func(node->value);
+            }
+            node = node->right.get();
+        }
+    }
+
+    NodePtr mRoot;
+    QHash<T, Key> mKeys;
+    quint64 mNextSerial = 0;
+    quint32 mSeed = 2463534242u;
+};
+
+}
+
+#endif
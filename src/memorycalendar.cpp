@@ -35,9 +35,16 @@
 #include "memorycalendar.h"
 #include "kcalendarcore_debug.h"
 #include "calformat.h"
+#include "intervaltree_p.h"
+#include "memorysize_p.h"
+#include "textindex_p.h"
 
 #include <QDate>
 
+#include <algorithm>
+#include <functional>
+#include <limits>
+
 template <typename K, typename V>
 static QVector<V> values(const QMultiHash<K, V> &c)
 {
@@ -63,6 +70,175 @@ static  QVector<V> values(const QMultiHash<K, V> &c, const K &x)
 
 using namespace KCalendarCore;
 
+//@cond PRIVATE
+/**
+  The days of the week and of the month a recurring event can occur on.
+  @internal
+*/
+struct RecurrenceDays {
+    quint8 weekDays = 0;        // bit n: day n + 1 of the week
+    quint32 monthDays = 0;      // bit n: day n + 1 of the month
+    quint32 lastMonthDays = 0;  // bit n: day n + 1 counted from the end of the month
+};
+
+/**
+  Works out the days @p event can occur on, when looked at in @p timeZone.
+  Returns false if that can't be told by looking at its recurrence rules
+  alone, e.g. because they are too complex or it has recurrence dates.
+  @internal
+*/
+static bool recurrenceDays(const Event::Ptr &event, const QTimeZone &timeZone, RecurrenceDays *days)
+{
+    const Recurrence *recurrence = event->recurrence();
+    if (!recurrence->rDates().isEmpty() || !recurrence->rDateTimes().isEmpty()) {
+        return false;
+    }
+    // Timed events in other time zones may occur on the day before or after
+    if (!recurrence->allDay() && recurrence->startDateTime().timeZone() != timeZone) {
+        return false;
+    }
+    const QDate startDate = recurrence->startDate();
+    if (!startDate.isValid()) {
+        return false;
+    }
+
+    bool weekly = false;
+    const RecurrenceRule::List rules = recurrence->rRules();
+    for (const RecurrenceRule *rule : rules) {
+        if (!rule->bySeconds().isEmpty() || !rule->byMinutes().isEmpty() || !rule->byHours().isEmpty()
+            || !rule->byYearDays().isEmpty() || !rule->byWeekNumbers().isEmpty()
+            || !rule->byMonths().isEmpty() || !rule->bySetPos().isEmpty()) {
+            return false;
+        }
+        const QDate ruleStart = rule->startDt().date();
+        switch (rule->recurrenceType()) {
+        case RecurrenceRule::rWeekly: {
+            if (!rule->byMonthDays().isEmpty()) {
+                return false;
+            }
+            const QList<RecurrenceRule::WDayPos> byDays = rule->byDays();
+            if (byDays.isEmpty()) {
+                days->weekDays |= 1 << (ruleStart.dayOfWeek() - 1);
+            }
+            for (const RecurrenceRule::WDayPos &wdp : byDays) {
+                if (wdp.pos() != 0 || wdp.day() < 1 || wdp.day() > 7) {
+                    return false;
+                }
+                days->weekDays |= 1 << (wdp.day() - 1);
+            }
+            weekly = true;
+            break;
+        }
+        case RecurrenceRule::rMonthly: {
+            if (!rule->byDays().isEmpty()) {
+                return false;
+            }
+            const QList<int> byMonthDays = rule->byMonthDays();
+            if (byMonthDays.isEmpty()) {
+                days->monthDays |= 1u << (ruleStart.day() - 1);
+            }
+            for (int day : byMonthDays) {
+                if (day > 0 && day <= 31) {
+                    days->monthDays |= 1u << (day - 1);
+                } else if (day < 0 && day >= -31) {
+                    days->lastMonthDays |= 1u << (-day - 1);
+                } else {
+                    return false;
+                }
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // recursOn() is true for the start date, whether the rules match it or not
+    if (weekly) {
+        days->weekDays |= 1 << (startDate.dayOfWeek() - 1);
+    } else {
+        days->monthDays |= 1u << (startDate.day() - 1);
+    }
+
+    if (event->isMultiDay()) {
+        // An occurrence also covers the days after the one it starts on
+        const qint64 extraDays = event->dtStart().date().daysTo(event->dtEnd().date());
+        if (days->monthDays || days->lastMonthDays || extraDays >= 6) {
+            return false;
+        }
+        const quint8 weekDays = days->weekDays;
+        for (int i = 1; i <= extraDays; ++i) {
+            days->weekDays |= ((weekDays << i) | (weekDays >> (7 - i))) & 0x7f;
+        }
+    }
+    return true;
+}
+
+/**
+  Returns a lower bound, in msecs since epoch, for the next time after
+  @p preTime at which an alarm of @p incidence triggers, as far as
+  Calendar::appendAlarms() and Calendar::appendRecurringAlarms() are
+  concerned. The bound never decreases for later values of @p preTime.
+  @internal
+*/
+static qint64 nextAlarmTrigger(const Incidence::Ptr &incidence, const QDateTime &preTime)
+{
+    const qint64 preTimeMSecs = preTime.toMSecsSinceEpoch();
+    qint64 next = std::numeric_limits<qint64>::max();
+    const Alarm::List alarms = incidence->alarms();
+    for (const Alarm::Ptr &alarm : alarms) {
+        if (!alarm->enabled()) {
+            continue;
+        }
+        const QDateTime dt = alarm->nextRepetition(preTime);
+        if (dt.isValid()) {
+            next = qMin(next, dt.toMSecsSinceEpoch());
+        }
+        if (!incidence->recurs() || alarm->hasTime()) {
+            continue;
+        }
+
+        // appendRecurringAlarms() works out the alarm times from the recurrences
+        // itself. No alarm can trigger earlier than the one of the first
+        // recurrence whose last repetition isn't over yet.
+        const QDateTime start = incidence->dtStart();
+        const QDateTime first = alarm->time();
+        if (!start.isValid() || !first.isValid()) {
+            return preTimeMSecs + 1;
+        }
+        // Offsets in days are longer or shorter across DST changes
+        const bool daily = (alarm->hasEndOffset() ? alarm->endOffset() : alarm->startOffset()).isDaily()
+                           || alarm->snoozeTime().isDaily()
+                           || (alarm->hasEndOffset()
+                               && Duration(start, incidence->dateTime(Incidence::RoleAlarmEndOffset)).isDaily());
+        const qint64 margin = daily ? 3 * 3600 * 1000 : 0;
+        const qint64 offset = start.msecsTo(first);
+        const qint64 repetitions = alarm->duration().asSeconds() * qint64(1000);
+        const QDateTime recurrence =
+            incidence->recurrence()->getNextDateTime(preTime.addMSecs(-offset - repetitions - margin));
+        if (recurrence.isValid()) {
+            next = qMin(next, qMax(recurrence.toMSecsSinceEpoch() + offset - margin, preTimeMSecs + 1));
+        }
+    }
+    return next;
+}
+
+// The key incidences are ordered by in MemoryCalendar::Private::mIncidencesByUid
+static QDateTime recurrenceIdKey(const Incidence::Ptr &incidence)
+{
+    return incidence->hasRecurrenceId() ? incidence->recurrenceId() : QDateTime();
+}
+
+// Master incidences (null key) go first, exceptions follow by recurrence id
+static bool recurrenceIdLessThan(const QDateTime &a, const QDateTime &b)
+{
+    if (b.isNull()) {
+        return false;
+    }
+    return a.isNull() || a < b;
+}
+//@endcond
+
 /**
   Private class that helps to provide binary compatibility between releases.
   @internal
@@ -81,7 +257,9 @@ public:
 
     MemoryCalendar *q;
     CalFormat *mFormat;                    // calendar format
+    bool mIsSnapshot = false;              // read-only, shares its incidences, see snapshot()
     QString mIncidenceBeingUpdated;        //  Instance identifier of Incidence currently being updated
+    QString mUidBeingUpdated;              //  Its uid before the update
 
     /**
      * List of all incidences.
@@ -94,27 +272,159 @@ public:
      */
     QHash<QString, KCalendarCore::Incidence::Ptr> mIncidencesByIdentifier;
 
+    /**
+     * Has all incidences, indexed by uid regardless of their type.
+     * Each list holds the master incidence first, followed by its exceptions
+     * ordered by recurrence id.
+     */
+    QHash<QString, Incidence::List> mIncidencesByUid;
+
+    /**
+     * Has all incidences, indexed by Incidence::schedulingID().
+     */
+    QMultiHash<QString, Incidence::Ptr> mIncidencesBySchedulingId;
+
     /**
      * List of all deleted incidences.
      * First indexed by incidence->type(), then by incidence->uid();
      */
     QMap<IncidenceBase::IncidenceType, QMultiHash<QString, Incidence::Ptr> > mDeletedIncidences;
 
+    /**
+     * What is left of deleted incidences in tombstone mode, see setTombstoneMode().
+     * Keyed by a serial number, so the oldest tombstones come first.
+     * mTombstoneSerials has the serial numbers by uid.
+     */
+    struct Tombstone {
+        QString uid;
+        QDateTime recurrenceId;    // invalid if the incidence had none
+        QDateTime deleted;
+        int revision;
+        IncidenceBase::IncidenceType type;
+    };
+    QMap<quint64, Tombstone> mTombstones;
+    QMultiHash<QString, quint64> mTombstoneSerials;
+    quint64 mNextTombstone = 0;
+    bool mTombstoneMode = false;
+    int mTombstoneMaxCount = 0;            // 0 for no limit
+    int mTombstoneMaxAge = 0;              // in seconds, 0 for no limit
+
     /**
      * Contains incidences ( to-dos; non-recurring, non-multiday events; journals; )
      * indexed by start/due date.
      *
      * The QMap key is the incidence->type().
-     * The QMultiHash key is the dtStart/dtDue().toString()
+     * The QHash key is the Julian day of dtStart/dtDue(), its value holds all
+     * incidences of that day.
      *
      * Note: We had 3 variables, mJournalsForDate, mTodosForDate and mEventsForDate
      * but i merged them into one (indexed by type) because it simplifies code using
      * it. No need to if else based on type.
      */
-    QMap<IncidenceBase::IncidenceType, QMultiHash<QString, IncidenceBase::Ptr> > mIncidencesForDate;
+    QMap<IncidenceBase::IncidenceType, QHash<qint64, Incidence::List> > mIncidencesForDate;
+
+    /**
+     * Contains all events, indexed by the time span (in UTC msecs since epoch)
+     * in which they, or any of their recurrences, can take place.
+     *
+     * The span is a superset of the real one, rawEvents() still checks each
+     * candidate. It only saves us from looking at every event in the calendar.
+     */
+    IntervalTree<Incidence::Ptr> mEventSpans;
+
+    /**
+     * Contains recurring and multi-day events, and recurring to-dos, indexed
+     * by the range of days (as Julian days) in which they can occur.
+     *
+     * Like mEventSpans, the ranges are generous, the per-day queries still
+     * call recursOn() for the candidates they get from here.
+     *
+     * Events whose rules only match certain days of the week or of the month
+     * (e.g. FREQ=WEEKLY;BYDAY=MO,WE or FREQ=MONTHLY;BYMONTHDAY=-1) are not in
+     * mRecurringEvents, but in the same kind of index for each of those days,
+     * see recurrenceDays(). mRecurringEventDays remembers which ones they are.
+     */
+    IntervalTree<Incidence::Ptr> mRecurringEvents;
+    IntervalTree<Incidence::Ptr> mRecurringTodos;
+    /**
+     * Events and open to-dos with enabled alarms, ordered by a lower bound for
+     * the time of their next alarm (in msecs since epoch), see nextAlarmTrigger().
+     * mAlarmTriggers has each incidence's bound. The incidence pointer is part of
+     * the timeline key, so that entries can be found without keeping iterators,
+     * which would not survive the containers being shared with a snapshot.
+     *
+     * The bounds are computed lazily by alarms(), for the times after
+     * mAlarmTimelineStart. New and changed incidences go to the front, until
+     * the next query finds their next alarm. A query starting earlier than
+     * mAlarmTimelineStart has to look at every incidence with alarms.
+     */
+    typedef QPair<qint64, const Incidence *> AlarmTriggerKey;
+    mutable QMap<AlarmTriggerKey, Incidence::Ptr> mAlarmTimeline;
+    mutable QHash<Incidence::Ptr, qint64> mAlarmTriggers;
+    mutable qint64 mAlarmTimelineStart = std::numeric_limits<qint64>::min();
+
+    IntervalTree<Incidence::Ptr> mEventsByWeekDay[7];
+    IntervalTree<Incidence::Ptr> mEventsByMonthDay[31];
+    IntervalTree<Incidence::Ptr> mEventsByLastMonthDay[31];
+    QHash<Incidence::Ptr, RecurrenceDays> mRecurringEventDays;
+
+    /**
+     * The words in the summary, description and location of all incidences,
+     * if enabled, see setFullTextIndexEnabled().
+     */
+    TextIndex mTextIndex;
+    bool mTextIndexEnabled = false;
+
+    /**
+     * While addIncidences() indexes the incidences, the intervals for the
+     * interval trees above are collected here, to be inserted in one go.
+     */
+    typedef IntervalTree<Incidence::Ptr> SpanIndex;
+    QHash<SpanIndex *, QVector<SpanIndex::Entry> > mPendingSpans;
+    bool mCollectSpans = false;
 
     void insertIncidence(const Incidence::Ptr &incidence);
 
+    // Adds @p incidence to the containers above the indexes, false if it is there already
+    bool storeIncidence(const Incidence::Ptr &incidence);
+
+    void reserve(const Incidence::List &incidences);
+
+    void insertIncidenceByUid(const Incidence::Ptr &incidence);
+
+    void removeIncidenceByUid(const QString &uid, const Incidence::Ptr &incidence);
+
+    /**
+     * Adds @p incidence to, or removes it from, all indexes depending on its
+     * properties. Called when it's added to, changed in or deleted from the calendar.
+     */
+    void indexIncidence(const Incidence::Ptr &incidence);
+    void unindexIncidence(const Incidence::Ptr &incidence);
+
+    void insertIncidenceForDate(const Incidence::Ptr &incidence);
+
+    void removeIncidenceForDate(const Incidence::Ptr &incidence);
+
+    Incidence::List incidencesForDate(IncidenceBase::IncidenceType type, const QDate &date) const;
+
+    void insertSpan(SpanIndex &index, qint64 start, qint64 end, const Incidence::Ptr &incidence);
+
+    void insertPendingSpans();
+
+    void insertEventSpan(const Incidence::Ptr &incidence);
+
+    void insertRecurringSpan(const Incidence::Ptr &incidence);
+
+    void removeRecurringSpan(const Incidence::Ptr &incidence);
+
+    void insertAlarmTrigger(const Incidence::Ptr &incidence);
+
+    void removeAlarmTrigger(const Incidence::Ptr &incidence);
+
+    Incidence::List alarmCandidates(const QDateTime &from, const QDateTime &to) const;
+
+    Incidence::List recurringEvents(const QDate &date, bool exactDay) const;
+
     Incidence::Ptr incidence(const QString &uid,
                              IncidenceBase::IncidenceType type,
                              const QDateTime &recurrenceId = {}) const;
@@ -125,6 +435,18 @@ public:
 
     void deleteAllIncidences(IncidenceBase::IncidenceType type);
 
+    void insertTombstone(const Incidence::Ptr &incidence, const QDateTime &deleted);
+
+    void pruneTombstones(const QDateTime &now);
+
+    Incidence::Ptr tombstoneIncidence(const Tombstone &tombstone) const;
+
+    Incidence::List tombstoneIncidences(IncidenceBase::IncidenceType type) const;
+
+    qint64 indexMemoryUsage() const;
+
+    qint64 tombstoneMemoryUsage() const;
+
 };
 //@endcond
 
@@ -157,7 +479,12 @@ void MemoryCalendar::close()
     d->deleteAllIncidences(Incidence::TypeJournal);
 
     d->mIncidencesByIdentifier.clear();
+    d->mIncidencesByUid.clear();
+    d->mIncidencesBySchedulingId.clear();
+    d->mTextIndex.clear();
     d->mDeletedIncidences.clear();
+    d->mTombstones.clear();
+    d->mTombstoneSerials.clear();
 
     setModified(false);
 
@@ -166,6 +493,11 @@ void MemoryCalendar::close()
 
 bool MemoryCalendar::deleteIncidence(const Incidence::Ptr &incidence)
 {
+    if (d->mIsSnapshot) {
+        qCWarning(KCALCORE_LOG) << "Cannot delete incidences from a snapshot";
+        return false;
+    }
+
     // Handle orphaned children
     // relations is an Incidence's property, not a Todo's, so
     // we remove relations in deleteIncidence, not in deleteTodo.
@@ -179,15 +511,18 @@ bool MemoryCalendar::deleteIncidence(const Incidence::Ptr &incidence)
 
         d->mIncidences[type].remove(uid, incidence);
         d->mIncidencesByIdentifier.remove(incidence->instanceIdentifier());
+        d->removeIncidenceByUid(uid, incidence);
+        d->unindexIncidence(incidence);
+        d->mTextIndex.remove(incidence);
         setModified(true);
         if (deletionTracking()) {
-            d->mDeletedIncidences[type].insert(uid, incidence);
+            if (d->mTombstoneMode) {
+                d->insertTombstone(incidence, QDateTime::currentDateTimeUtc());
+            } else {
+                d->mDeletedIncidences[type].insert(uid, incidence);
+            }
         }
 
-        const QDateTime dt = incidence->dateTime(Incidence::RoleCalendarHashing);
-        if (dt.isValid()) {
-            d->mIncidencesForDate[type].remove(dt.date().toString(), incidence);
-        }
         // Delete child-incidences.
         if (!incidence->hasRecurrenceId()) {
             deleteIncidenceInstances(incidence);
@@ -226,27 +561,47 @@ void MemoryCalendar::Private::deleteAllIncidences(Incidence::IncidenceType incid
     while (i.hasNext()) {
         i.next();
         q->notifyIncidenceAboutToBeDeleted(i.value());
-        i.value()->unRegisterObserver(q);
+        if (!mIsSnapshot) {
+            i.value()->unRegisterObserver(q);
+        }
+        removeAlarmTrigger(i.value());
     }
     mIncidences[incidenceType].clear();
     mIncidencesForDate[incidenceType].clear();
+    if (incidenceType == Incidence::TypeEvent) {
+        mEventSpans.clear();
+        mRecurringEvents.clear();
+        for (auto &index : mEventsByWeekDay) {
+            index.clear();
+        }
+        for (int i = 0; i < 31; ++i) {
+            mEventsByMonthDay[i].clear();
+            mEventsByLastMonthDay[i].clear();
+        }
+        mRecurringEventDays.clear();
+    } else if (incidenceType == Incidence::TypeTodo) {
+        mRecurringTodos.clear();
+    }
 }
 
 Incidence::Ptr MemoryCalendar::Private::incidence(const QString &uid,
         Incidence::IncidenceType type,
         const QDateTime &recurrenceId) const
 {
-    Incidence::List values = ::values(mIncidences[type], uid);
-    for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
-        Incidence::Ptr i = *it;
-        if (recurrenceId.isNull()) {
-            if (!i->hasRecurrenceId()) {
-                return i;
-            }
-        } else {
-            if (i->hasRecurrenceId() && i->recurrenceId() == recurrenceId) {
-                return i;
-            }
+    const auto incidences = mIncidencesByUid.constFind(uid);
+    if (incidences == mIncidencesByUid.constEnd()) {
+        return Incidence::Ptr();
+    }
+
+    const QDateTime key = recurrenceId.isNull() ? QDateTime() : recurrenceId;
+    auto it = std::lower_bound(incidences->cbegin(), incidences->cend(), key,
+    [](const Incidence::Ptr &other, const QDateTime &key) {
+        return recurrenceIdLessThan(recurrenceIdKey(other), key);
+    });
+    // Incidences of different types may share a uid
+    for (; it != incidences->cend() && !recurrenceIdLessThan(key, recurrenceIdKey(*it)); ++it) {
+        if ((*it)->type() == type) {
+            return *it;
         }
     }
     return Incidence::Ptr();
@@ -261,7 +616,7 @@ MemoryCalendar::Private::deletedIncidence(const QString &uid,
         return Incidence::Ptr();
     }
 
-    Incidence::List values = ::values(mDeletedIncidences[type], uid);
+    Incidence::List values = ::values(mDeletedIncidences.value(type), uid);
     for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
         Incidence::Ptr i = *it;
         if (recurrenceId.isNull()) {
@@ -274,33 +629,539 @@ MemoryCalendar::Private::deletedIncidence(const QString &uid,
             }
         }
     }
+
+    for (auto it = mTombstoneSerials.constFind(uid); it != mTombstoneSerials.cend() && it.key() == uid; ++it) {
+        const auto tombstone = mTombstones.constFind(it.value());
+        if (tombstone != mTombstones.cend() && tombstone->type == type
+            && (recurrenceId.isNull() ? !tombstone->recurrenceId.isValid()
+                                      : tombstone->recurrenceId == recurrenceId)) {
+            return tombstoneIncidence(*tombstone);
+        }
+    }
     return Incidence::Ptr();
 }
 
+void MemoryCalendar::Private::insertTombstone(const Incidence::Ptr &incidence, const QDateTime &deleted)
+{
+    Tombstone tombstone;
+    tombstone.uid = incidence->uid();
+    if (incidence->hasRecurrenceId()) {
+        tombstone.recurrenceId = incidence->recurrenceId();
+    }
+    tombstone.deleted = deleted;
+    tombstone.revision = incidence->revision();
+    tombstone.type = incidence->type();
+
+    // Deleting the same incidence again replaces its tombstone
+    const QList<quint64> serials = mTombstoneSerials.values(tombstone.uid);
+    for (quint64 serial : serials) {
+        const auto it = mTombstones.find(serial);
+        if (it != mTombstones.end() && it->type == tombstone.type
+            && it->recurrenceId == tombstone.recurrenceId) {
+            mTombstones.erase(it);
+            mTombstoneSerials.remove(tombstone.uid, serial);
+        }
+    }
+
+    mTombstoneSerials.insert(tombstone.uid, mNextTombstone);
+    mTombstones.insert(mNextTombstone++, tombstone);
+    pruneTombstones(deleted);
+}
+
+void MemoryCalendar::Private::pruneTombstones(const QDateTime &now)
+{
+    const QDateTime oldest = mTombstoneMaxAge > 0 ? now.addSecs(-mTombstoneMaxAge) : QDateTime();
+    while (!mTombstones.isEmpty()) {
+        const auto it = mTombstones.begin();
+        const bool tooMany = mTombstoneMaxCount > 0 && mTombstones.count() > mTombstoneMaxCount;
+        const bool tooOld = oldest.isValid() && it->deleted < oldest;
+        if (!tooMany && !tooOld) {
+            break;
+        }
+        mTombstoneSerials.remove(it->uid, it.key());
+        mTombstones.erase(it);
+    }
+}
+
+Incidence::Ptr MemoryCalendar::Private::tombstoneIncidence(const Tombstone &tombstone) const
+{
+    Incidence::Ptr incidence;
+    switch (tombstone.type) {
+    case Incidence::TypeEvent:
+        incidence = Event::Ptr(new Event);
+        break;
+    case Incidence::TypeTodo:
+        incidence = Todo::Ptr(new Todo);
+        break;
+    case Incidence::TypeJournal:
+        incidence = Journal::Ptr(new Journal);
+        break;
+    default:
+        return Incidence::Ptr();
+    }
+    incidence->setUid(tombstone.uid);
+    if (tombstone.recurrenceId.isValid()) {
+        incidence->setRecurrenceId(tombstone.recurrenceId);
+    }
+    incidence->setRevision(tombstone.revision);
+    incidence->setLastModified(tombstone.deleted);
+    return incidence;
+}
+
+Incidence::List MemoryCalendar::Private::tombstoneIncidences(IncidenceBase::IncidenceType type) const
+{
+    Incidence::List list;
+    for (const Tombstone &tombstone : mTombstones) {
+        if (tombstone.type == type) {
+            list.append(tombstoneIncidence(tombstone));
+        }
+    }
+    return list;
+}
+
+// Apart from the identifiers, the keys and values of the indexes are shared
+// with the incidences, only the containers themselves count
+qint64 MemoryCalendar::Private::indexMemoryUsage() const
+{
+    using namespace MemorySize;
+    qint64 size = heapSize(mIncidences) + heapSize(mIncidencesByIdentifier) + heapSize(mIncidencesByUid)
+                  + heapSize(mIncidencesBySchedulingId) + heapSize(mIncidencesForDate)
+                  + mEventSpans.approximateMemoryUsage()
+                  + mRecurringEvents.approximateMemoryUsage() + mRecurringTodos.approximateMemoryUsage()
+                  + heapSize(mAlarmTimeline) + heapSize(mAlarmTriggers) + heapSize(mRecurringEventDays)
+                  + mTextIndex.approximateMemoryUsage();
+    for (const auto &incidences : mIncidences) {
+        size += heapSize(incidences);
+    }
+    for (auto it = mIncidencesByIdentifier.cbegin(), end = mIncidencesByIdentifier.cend(); it != end; ++it) {
+        size += heapSize(it.key());
+    }
+    for (const Incidence::List &incidences : mIncidencesByUid) {
+        size += heapSize(incidences);
+    }
+    for (const auto &days : mIncidencesForDate) {
+        size += heapSize(days);
+        for (const Incidence::List &incidences : days) {
+            size += heapSize(incidences);
+        }
+    }
+    for (int i = 0; i < 7; ++i) {
+        size += mEventsByWeekDay[i].approximateMemoryUsage();
+    }
+    for (int i = 0; i < 31; ++i) {
+        size += mEventsByMonthDay[i].approximateMemoryUsage() + mEventsByLastMonthDay[i].approximateMemoryUsage();
+    }
+    return size;
+}
+
+qint64 MemoryCalendar::Private::tombstoneMemoryUsage() const
+{
+    using namespace MemorySize;
+    qint64 size = heapSize(mDeletedIncidences) + heapSize(mTombstones) + heapSize(mTombstoneSerials);
+    for (const auto &incidences : mDeletedIncidences) {
+        size += heapSize(incidences);
+        for (const Incidence::Ptr &incidence : incidences) {
+            size += incidence->approximateMemoryUsage();
+        }
+    }
+    // The tombstones hold the only reference to their uid once the incidence is gone
+    for (const Tombstone &tombstone : mTombstones) {
+        size += heapSize(tombstone.uid) + heapSize(tombstone.recurrenceId) + heapSize(tombstone.deleted);
+    }
+    return size;
+}
+
 void MemoryCalendar::Private::insertIncidence(const Incidence::Ptr &incidence)
+{
+    if (storeIncidence(incidence)) {
+        indexIncidence(incidence);
+    }
+}
+
+bool MemoryCalendar::Private::storeIncidence(const Incidence::Ptr &incidence)
 {
     const QString uid = incidence->uid();
     const Incidence::IncidenceType type = incidence->type();
     if (!mIncidences[type].contains(uid, incidence)) {
         mIncidences[type].insert(uid, incidence);
         mIncidencesByIdentifier.insert(incidence->instanceIdentifier(), incidence);
-        const QDateTime dt = incidence->dateTime(Incidence::RoleCalendarHashing);
-        if (dt.isValid()) {
-            mIncidencesForDate[type].insert(dt.date().toString(), incidence);
-        }
-
+        insertIncidenceByUid(incidence);
+        return true;
     } else {
 #ifndef NDEBUG
         // if we already have an to-do with this UID, it must be the same incidence,
         // otherwise something's really broken
         Q_ASSERT(mIncidences[type].value(uid) == incidence);
 #endif
+        return false;
     }
 }
+
+void MemoryCalendar::Private::reserve(const Incidence::List &incidences)
+{
+    int events = 0;
+    int todos = 0;
+    int journals = 0;
+    for (const Incidence::Ptr &incidence : incidences) {
+        switch (incidence->type()) {
+        case Incidence::TypeEvent:
+            ++events;
+            break;
+        case Incidence::TypeTodo:
+            ++todos;
+            break;
+        case Incidence::TypeJournal:
+            ++journals;
+            break;
+        default:
+            break;
+        }
+    }
+
+    QMultiHash<QString, Incidence::Ptr> &eventHash = mIncidences[Incidence::TypeEvent];
+    eventHash.reserve(eventHash.size() + events);
+    QMultiHash<QString, Incidence::Ptr> &todoHash = mIncidences[Incidence::TypeTodo];
+    todoHash.reserve(todoHash.size() + todos);
+    QMultiHash<QString, Incidence::Ptr> &journalHash = mIncidences[Incidence::TypeJournal];
+    journalHash.reserve(journalHash.size() + journals);
+
+    const int count = incidences.count();
+    mIncidencesByIdentifier.reserve(mIncidencesByIdentifier.size() + count);
+    mIncidencesByUid.reserve(mIncidencesByUid.size() + count);
+    mIncidencesBySchedulingId.reserve(mIncidencesBySchedulingId.size() + count);
+    mEventSpans.reserve(mEventSpans.count() + events);
+}
+
+void MemoryCalendar::Private::insertIncidenceByUid(const Incidence::Ptr &incidence)
+{
+    Incidence::List &incidences = mIncidencesByUid[incidence->uid()];
+    const QDateTime key = recurrenceIdKey(incidence);
+    const auto it = std::upper_bound(incidences.begin(), incidences.end(), key,
+    [](const QDateTime &key, const Incidence::Ptr &other) {
+        return recurrenceIdLessThan(key, recurrenceIdKey(other));
+    });
+    incidences.insert(it, incidence);
+}
+
+void MemoryCalendar::Private::removeIncidenceByUid(const QString &uid, const Incidence::Ptr &incidence)
+{
+    const auto it = mIncidencesByUid.find(uid);
+    if (it != mIncidencesByUid.end()) {
+        it->removeOne(incidence);
+        if (it->isEmpty()) {
+            mIncidencesByUid.erase(it);
+        }
+    }
+}
+
+void MemoryCalendar::Private::indexIncidence(const Incidence::Ptr &incidence)
+{
+    mIncidencesBySchedulingId.insert(incidence->schedulingID(), incidence);
+    insertIncidenceForDate(incidence);
+    insertEventSpan(incidence);
+    insertRecurringSpan(incidence);
+    insertAlarmTrigger(incidence);
+    if (mTextIndexEnabled) {
+        mTextIndex.insert(incidence);
+    }
+}
+
+void MemoryCalendar::Private::unindexIncidence(const Incidence::Ptr &incidence)
+{
+    mIncidencesBySchedulingId.remove(incidence->schedulingID(), incidence);
+    removeIncidenceForDate(incidence);
+    mEventSpans.remove(incidence);
+    removeRecurringSpan(incidence);
+    removeAlarmTrigger(incidence);
+}
+
+void MemoryCalendar::Private::insertAlarmTrigger(const Incidence::Ptr &incidence)
+{
+    const Incidence::IncidenceType type = incidence->type();
+    if ((type != Incidence::TypeEvent && type != Incidence::TypeTodo) || !incidence->hasEnabledAlarms()) {
+        return;
+    }
+    if (type == Incidence::TypeTodo && incidence.staticCast<Todo>()->isCompleted()) {
+        return;
+    }
+
+    removeAlarmTrigger(incidence);
+    const qint64 trigger = std::numeric_limits<qint64>::min();
+    mAlarmTimeline.insert(qMakePair(trigger, incidence.data()), incidence);
+    mAlarmTriggers.insert(incidence, trigger);
+}
+
+void MemoryCalendar::Private::removeAlarmTrigger(const Incidence::Ptr &incidence)
+{
+    const auto it = mAlarmTriggers.constFind(incidence);
+    if (it != mAlarmTriggers.constEnd()) {
+        mAlarmTimeline.remove(qMakePair(it.value(), incidence.data()));
+        mAlarmTriggers.erase(it);
+    }
+}
+
+/**
+ * Returns the incidences which may have alarms between @p from and @p to,
+ * moving the others along the alarm timeline on the way.
+ */
+Incidence::List MemoryCalendar::Private::alarmCandidates(const QDateTime &from, const QDateTime &to) const
+{
+    Incidence::List candidates;
+    // appendAlarms() looks for alarms after this
+    const QDateTime preTime = from.addSecs(-1);
+    if (!preTime.isValid() || preTime.toMSecsSinceEpoch() < mAlarmTimelineStart) {
+        candidates.reserve(mAlarmTriggers.count());
+        for (auto it = mAlarmTriggers.cbegin(), end = mAlarmTriggers.cend(); it != end; ++it) {
+            candidates.append(it.key());
+        }
+        return candidates;
+    }
+
+    const qint64 fromMSecs = from.toMSecsSinceEpoch();
+    const qint64 toMSecs = to.isValid() ? to.toMSecsSinceEpoch() : std::numeric_limits<qint64>::max();
+    Incidence::List passed;
+    auto it = mAlarmTimeline.begin();
+    while (it != mAlarmTimeline.end() && it.key().first <= toMSecs) {
+        if (it.key().first >= fromMSecs) {
+            candidates.append(it.value());
+            ++it;
+        } else {
+            passed.append(it.value());
+            it = mAlarmTimeline.erase(it);
+        }
+    }
+
+    if (!passed.isEmpty()) {
+        mAlarmTimelineStart = preTime.toMSecsSinceEpoch();
+    }
+    for (const Incidence::Ptr &incidence : qAsConst(passed)) {
+        const qint64 next = nextAlarmTrigger(incidence, preTime);
+        mAlarmTimeline.insert(qMakePair(next, incidence.data()), incidence);
+        mAlarmTriggers[incidence] = next;
+        if (next <= toMSecs) {
+            candidates.append(incidence);
+        }
+    }
+    return candidates;
+}
+
+void MemoryCalendar::Private::insertIncidenceForDate(const Incidence::Ptr &incidence)
+{
+    const QDateTime dt = incidence->dateTime(Incidence::RoleCalendarHashing);
+    if (dt.isValid()) {
+        Incidence::List &incidences = mIncidencesForDate[incidence->type()][dt.date().toJulianDay()];
+        if (!incidences.contains(incidence)) {
+            incidences.append(incidence);
+        }
+    }
+}
+
+void MemoryCalendar::Private::removeIncidenceForDate(const Incidence::Ptr &incidence)
+{
+    QDateTime dt = incidence->dateTime(Incidence::RoleCalendarHashing);
+    if (!dt.isValid()) {
+        // The incidence may have just started to recur, which we only learn
+        // about after the fact. It was hashed by its start date until then.
+        dt = incidence->dtStart();
+    }
+    if (!dt.isValid()) {
+        return;
+    }
+
+    QHash<qint64, Incidence::List> &incidencesForDate = mIncidencesForDate[incidence->type()];
+    const auto it = incidencesForDate.find(dt.date().toJulianDay());
+    if (it != incidencesForDate.end()) {
+        it->removeOne(incidence);
+        if (it->isEmpty()) {
+            incidencesForDate.erase(it);
+        }
+    }
+}
+
+Incidence::List MemoryCalendar::Private::incidencesForDate(IncidenceBase::IncidenceType type,
+        const QDate &date) const
+{
+    const auto it = mIncidencesForDate.constFind(type);
+    if (it == mIncidencesForDate.constEnd()) {
+        return Incidence::List();
+    }
+    return it->value(date.toJulianDay());
+}
+
+void MemoryCalendar::Private::insertSpan(SpanIndex &index, qint64 start, qint64 end,
+                                         const Incidence::Ptr &incidence)
+{
+    if (mCollectSpans) {
+        mPendingSpans[&index].append({start, end, incidence});
+    } else {
+        index.insert(start, end, incidence);
+    }
+}
+
+void MemoryCalendar::Private::insertPendingSpans()
+{
+    for (auto it = mPendingSpans.begin(), end = mPendingSpans.end(); it != end; ++it) {
+        it.key()->insert(it.value());
+    }
+    mPendingSpans.clear();
+    mCollectSpans = false;
+}
+
+void MemoryCalendar::Private::insertEventSpan(const Incidence::Ptr &incidence)
+{
+    if (incidence->type() != Incidence::TypeEvent) {
+        return;
+    }
+
+    const Event::Ptr event = incidence.staticCast<Event>();
+    const QDateTime start = event->dtStart();
+    if (!start.isValid()) {
+        // Leave it to rawEvents() to decide what to do with those.
+        insertSpan(mEventSpans, std::numeric_limits<qint64>::min(),
+                   std::numeric_limits<qint64>::max(), incidence);
+        return;
+    }
+
+    qint64 end = std::numeric_limits<qint64>::max();
+    if (!event->recurs()) {
+        end = event->dtEnd().toMSecsSinceEpoch();
+    } else if (event->recurrence()->duration() != -1) {
+        // rawEvents() interprets the end date in the time zone of the query,
+        // one extra day covers all of them.
+        const QDate endDate = event->recurrence()->endDate();
+        if (endDate.isValid()) {
+            end = QDateTime(endDate.addDays(1), QTime(23, 59, 59, 999), Qt::UTC).toMSecsSinceEpoch();
+        }
+    }
+    insertSpan(mEventSpans, start.toMSecsSinceEpoch(), end, incidence);
+}
+
+void MemoryCalendar::Private::insertRecurringSpan(const Incidence::Ptr &incidence)
+{
+    const Incidence::IncidenceType type = incidence->type();
+    if (type != Incidence::TypeEvent && type != Incidence::TypeTodo) {
+        return;
+    }
+    IntervalTree<Incidence::Ptr> &index = type == Incidence::TypeEvent ? mRecurringEvents : mRecurringTodos;
+
+    if (!incidence->recurs()) {
+        // Only multi-day events need to be looked at outside of their start date
+        if (type == Incidence::TypeEvent) {
+            const Event::Ptr event = incidence.staticCast<Event>();
+            if (event->isMultiDay()) {
+                insertSpan(index, event->dtStart().date().toJulianDay(), event->dtEnd().date().toJulianDay(),
+                           incidence);
+                return;
+            }
+        }
+        return;
+    }
+
+    // The queries may be made in any time zone, so allow for one day on both
+    // sides. Multi-day events also last until their last day after the end.
+    const Recurrence *recurrence = incidence->recurrence();
+    const QDate startDate = recurrence->startDate();
+    const QDate endDate = recurrence->endDate();
+    qint64 start = std::numeric_limits<qint64>::min();
+    qint64 end = std::numeric_limits<qint64>::max();
+    if (startDate.isValid()) {
+        start = startDate.toJulianDay() - 1;
+    }
+    if (endDate.isValid()) {
+        end = endDate.toJulianDay() + 1;
+        if (type == Incidence::TypeEvent) {
+            const Event::Ptr event = incidence.staticCast<Event>();
+            if (event->isMultiDay()) {
+                end += qMax<qint64>(0, event->dtStart().date().daysTo(event->dtEnd().date()));
+            }
+        }
+    }
+
+    RecurrenceDays days;
+    if (type == Incidence::TypeTodo
+        || !recurrenceDays(incidence.staticCast<Event>(), q->timeZone(), &days)) {
+        insertSpan(index, start, end, incidence);
+        return;
+    }
+    for (int i = 0; i < 7; ++i) {
+        if (days.weekDays & (1 << i)) {
+            insertSpan(mEventsByWeekDay[i], start, end, incidence);
+        }
+    }
+    for (int i = 0; i < 31; ++i) {
+        if (days.monthDays & (1u << i)) {
+            insertSpan(mEventsByMonthDay[i], start, end, incidence);
+        }
+        if (days.lastMonthDays & (1u << i)) {
+            insertSpan(mEventsByLastMonthDay[i], start, end, incidence);
+        }
+    }
+    mRecurringEventDays.insert(incidence, days);
+}
+
+void MemoryCalendar::Private::removeRecurringSpan(const Incidence::Ptr &incidence)
+{
+    mRecurringEvents.remove(incidence);
+    mRecurringTodos.remove(incidence);
+
+    const auto it = mRecurringEventDays.find(incidence);
+    if (it == mRecurringEventDays.end()) {
+        return;
+    }
+    for (int i = 0; i < 7; ++i) {
+        if (it->weekDays & (1 << i)) {
+            mEventsByWeekDay[i].remove(incidence);
+        }
+    }
+    for (int i = 0; i < 31; ++i) {
+        if (it->monthDays & (1u << i)) {
+            mEventsByMonthDay[i].remove(incidence);
+        }
+        if (it->lastMonthDays & (1u << i)) {
+            mEventsByLastMonthDay[i].remove(incidence);
+        }
+    }
+    mRecurringEventDays.erase(it);
+}
+
+/**
+ * Returns the recurring and multi-day events which may occur on @p date.
+ * If @p exactDay is false, the query is made in another time zone than the
+ * calendar's, and the date may be the day before or after in the events' time zone.
+ */
+Incidence::List MemoryCalendar::Private::recurringEvents(const QDate &date, bool exactDay) const
+{
+    Incidence::List events;
+    const auto collect = [&events](const Incidence::Ptr &incidence) {
+        events.append(incidence);
+    };
+
+    const qint64 day = date.toJulianDay();
+    mRecurringEvents.containing(day, collect);
+    const int slack = exactDay ? 0 : 1;
+    for (int i = -slack; i <= slack; ++i) {
+        const QDate probe = date.addDays(i);
+        mEventsByWeekDay[probe.dayOfWeek() - 1].containing(day, collect);
+        mEventsByMonthDay[probe.day() - 1].containing(day, collect);
+        mEventsByLastMonthDay[probe.daysInMonth() - probe.day()].containing(day, collect);
+    }
+
+    // Events may be in several of the above
+    std::sort(events.begin(), events.end(), [](const Incidence::Ptr &a, const Incidence::Ptr &b) {
+        return std::less<Incidence *>()(a.data(), b.data());
+    });
+    events.erase(std::unique(events.begin(), events.end()), events.end());
+    return events;
+}
 //@endcond
 
 bool MemoryCalendar::addIncidence(const Incidence::Ptr &incidence)
 {
+    if (d->mIsSnapshot) {
+        qCWarning(KCALCORE_LOG) << "Cannot add incidences to a snapshot";
+        return false;
+    }
+
     d->insertIncidence(incidence);
 
     notifyIncidenceAdded(incidence);
@@ -314,6 +1175,54 @@ bool MemoryCalendar::addIncidence(const Incidence::Ptr &incidence)
     return true;
 }
 
+bool MemoryCalendar::addIncidences(const Incidence::List &incidences)
+{
+    if (incidences.isEmpty()) {
+        return true;
+    }
+    if (d->mIsSnapshot) {
+        qCWarning(KCALCORE_LOG) << "Cannot add incidences to a snapshot";
+        return false;
+    }
+
+    const bool batch = !batchAdding();
+    if (batch) {
+        startBatchAdding();
+    }
+
+    d->reserve(incidences);
+
+    // All incidences are in the calendar before any is indexed, notified or
+    // related, so parents are found straight away, whatever their order
+    Incidence::List added;
+    added.reserve(incidences.count());
+    for (const Incidence::Ptr &incidence : incidences) {
+        if (d->storeIncidence(incidence)) {
+            added.append(incidence);
+        }
+    }
+
+    d->mCollectSpans = true;
+    for (const Incidence::Ptr &incidence : qAsConst(added)) {
+        d->indexIncidence(incidence);
+    }
+    d->insertPendingSpans();
+
+    for (const Incidence::Ptr &incidence : qAsConst(added)) {
+        notifyIncidenceAdded(incidence);
+        incidence->registerObserver(this);
+    }
+    for (const Incidence::Ptr &incidence : qAsConst(added)) {
+        setupRelations(incidence);
+    }
+    setModified(true);
+
+    if (batch) {
+        endBatchAdding();
+    }
+    return added.count() == incidences.count();
+}
+
 bool MemoryCalendar::addEvent(const Event::Ptr &event)
 {
     return addIncidence(event);
@@ -371,8 +1280,8 @@ Todo::List MemoryCalendar::rawTodos(TodoSortField sortField,
                                     SortDirection sortDirection) const
 {
     Todo::List todoList;
-    todoList.reserve(d->mIncidences[Incidence::TypeTodo].count());
-    QHashIterator<QString, Incidence::Ptr>i(d->mIncidences[Incidence::TypeTodo]);
+    todoList.reserve(d->mIncidences.value(Incidence::TypeTodo).count());
+    QHashIterator<QString, Incidence::Ptr>i(d->mIncidences.value(Incidence::TypeTodo));
     while (i.hasNext()) {
         i.next();
         todoList.append(i.value().staticCast<Todo>());
@@ -388,12 +1297,16 @@ Todo::List MemoryCalendar::deletedTodos(TodoSortField sortField,
     }
 
     Todo::List todoList;
-    todoList.reserve(d->mDeletedIncidences[Incidence::TypeTodo].count());
-    QHashIterator<QString, Incidence::Ptr >i(d->mDeletedIncidences[Incidence::TypeTodo]);
+    todoList.reserve(d->mDeletedIncidences.value(Incidence::TypeTodo).count());
+    QHashIterator<QString, Incidence::Ptr >i(d->mDeletedIncidences.value(Incidence::TypeTodo));
     while (i.hasNext()) {
         i.next();
         todoList.append(i.value().staticCast<Todo>());
     }
+    const Incidence::List tombstones = d->tombstoneIncidences(Incidence::TypeTodo);
+    for (const Incidence::Ptr &tombstone : tombstones) {
+        todoList.append(tombstone.staticCast<Todo>());
+    }
     return Calendar::sortTodos(todoList, sortField, sortDirection);
 }
 
@@ -403,7 +1316,7 @@ Todo::List MemoryCalendar::todoInstances(const Incidence::Ptr &todo,
 {
     Todo::List list;
 
-    Incidence::List values = ::values(d->mIncidences[Incidence::TypeTodo], todo->uid());
+    Incidence::List values = ::values(d->mIncidences.value(Incidence::TypeTodo), todo->uid());
     for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
         Todo::Ptr t = (*it).staticCast<Todo>();
         if (t->hasRecurrenceId()) {
@@ -418,26 +1331,18 @@ Todo::List MemoryCalendar::rawTodosForDate(const QDate &date) const
     Todo::List todoList;
     Todo::Ptr t;
 
-    const QString dateStr = date.toString();
-    QMultiHash<QString, IncidenceBase::Ptr >::const_iterator it =
-        d->mIncidencesForDate[Incidence::TypeTodo].constFind(dateStr);
-    while (it != d->mIncidencesForDate[Incidence::TypeTodo].constEnd() && it.key() == dateStr) {
-        t = it.value().staticCast<Todo>();
-        todoList.append(t);
-        ++it;
+    const Incidence::List todosForDate = d->incidencesForDate(Incidence::TypeTodo, date);
+    for (const Incidence::Ptr &incidence : todosForDate) {
+        todoList.append(incidence.staticCast<Todo>());
     }
 
-    // Iterate over all todos. Look for recurring todoss that occur on this date
-    QHashIterator<QString, Incidence::Ptr >i(d->mIncidences[Incidence::TypeTodo]);
-    while (i.hasNext()) {
-        i.next();
-        t = i.value().staticCast<Todo>();
-        if (t->recurs()) {
-            if (t->recursOn(date, timeZone())) {
-                todoList.append(t);
-            }
+    // Look for recurring to-dos that occur on this date
+    d->mRecurringTodos.containing(date.toJulianDay(), [&](const Incidence::Ptr &incidence) {
+        t = incidence.staticCast<Todo>();
+        if (t->recursOn(date, timeZone())) {
+            todoList.append(t);
         }
-    }
+    });
 
     return todoList;
 }
@@ -455,7 +1360,7 @@ Todo::List MemoryCalendar::rawTodos(const QDate &start,
     QDateTime nd(end, QTime(23, 59, 59, 999), ts);
 
     // Get todos
-    QHashIterator<QString, Incidence::Ptr >i(d->mIncidences[Incidence::TypeTodo]);
+    QHashIterator<QString, Incidence::Ptr >i(d->mIncidences.value(Incidence::TypeTodo));
     Todo::Ptr todo;
     while (i.hasNext()) {
         i.next();
@@ -509,24 +1414,20 @@ Alarm::List MemoryCalendar::alarms(const QDateTime &from, const QDateTime &to, b
 {
     Q_UNUSED(excludeBlockedAlarms);
     Alarm::List alarmList;
-    QHashIterator<QString, Incidence::Ptr>ie(d->mIncidences[Incidence::TypeEvent]);
-    Event::Ptr e;
-    while (ie.hasNext()) {
-        ie.next();
-        e = ie.value().staticCast<Event>();
-        if (e->recurs()) {
-            appendRecurringAlarms(alarmList, e, from, to);
-        } else {
-            appendAlarms(alarmList, e, from, to);
-        }
-    }
 
-    QHashIterator<QString, Incidence::Ptr>it(d->mIncidences[Incidence::TypeTodo]);
-    Todo::Ptr t;
-    while (it.hasNext()) {
-        it.next();
-        t = it.value().staticCast<Todo>();
+    // Only look at the incidences whose next alarm may be due
+    const Incidence::List incidences = d->alarmCandidates(from, to);
+    for (const Incidence::Ptr &incidence : incidences) {
+        if (incidence->type() == Incidence::TypeEvent) {
+            if (incidence->recurs()) {
+                appendRecurringAlarms(alarmList, incidence, from, to);
+            } else {
+                appendAlarms(alarmList, incidence, from, to);
+            }
+            continue;
+        }
 
+        const Todo::Ptr t = incidence.staticCast<Todo>();
         if (!t->isCompleted()) {
             appendAlarms(alarmList, t, from, to);
             if (t->recurs()) {
@@ -551,18 +1452,20 @@ void MemoryCalendar::incidenceUpdate(const QString &uid, const QDateTime &recurr
 
         // Save it so we can detect changes to uid or recurringId.
         d->mIncidenceBeingUpdated = inc->instanceIdentifier();
+        d->mUidBeingUpdated = inc->uid();
 
-        const QDateTime dt = inc->dateTime(Incidence::RoleCalendarHashing);
-        if (dt.isValid()) {
-            const Incidence::IncidenceType type = inc->type();
-            d->mIncidencesForDate[type].remove(dt.date().toString(), inc);
-        }
+        d->unindexIncidence(inc);
     }
 }
 
 void MemoryCalendar::incidenceUpdated(const QString &uid, const QDateTime &recurrenceId)
 {
-    Incidence::Ptr inc = incidence(uid, recurrenceId);
+    // Look it up by its previous identifier first, the uid index doesn't
+    // know about a changed recurrence id yet.
+    Incidence::Ptr inc = d->mIncidencesByIdentifier.value(d->mIncidenceBeingUpdated);
+    if (!inc) {
+        inc = incidence(uid, recurrenceId);
+    }
 
     if (inc) {
 
@@ -572,20 +1475,30 @@ void MemoryCalendar::incidenceUpdated(const QString &uid, const QDateTime &recur
             // Instance identifier changed, update our hash table
             d->mIncidencesByIdentifier.remove(d->mIncidenceBeingUpdated);
             d->mIncidencesByIdentifier.insert(inc->instanceIdentifier(), inc);
+            if (inc->uid() != d->mUidBeingUpdated) {
+                QMultiHash<QString, Incidence::Ptr> &incidences = d->mIncidences[inc->type()];
+                incidences.remove(d->mUidBeingUpdated, inc);
+                incidences.insert(inc->uid(), inc);
+            }
+            d->removeIncidenceByUid(d->mUidBeingUpdated, inc);
+            d->insertIncidenceByUid(inc);
         }
 
         d->mIncidenceBeingUpdated = QString();
+        d->mUidBeingUpdated = QString();
+
+        // A new scheduling ID only needs the incidence to be re-indexed
+        if (inc->isSchedulingIdUpdate()) {
+            d->indexIncidence(inc);
+            return;
+        }
 
         inc->setLastModified(QDateTime::currentDateTimeUtc());
         // we should probably update the revision number here,
         // or internally in the Event itself when certain things change.
         // need to verify with ical documentation.
 
-        const QDateTime dt = inc->dateTime(Incidence::RoleCalendarHashing);
-        if (dt.isValid()) {
-            const Incidence::IncidenceType type = inc->type();
-            d->mIncidencesForDate[type].insert(dt.date().toString(), inc);
-        }
+        d->indexIncidence(inc);
 
         notifyIncidenceChanged(inc);
 
@@ -607,14 +1520,11 @@ Event::List MemoryCalendar::rawEventsForDate(const QDate &date,
 
     Event::Ptr ev;
 
-    // Find the hash for the specified date
-    const QString dateStr = date.toString();
-    QMultiHash<QString, IncidenceBase::Ptr >::const_iterator it =
-        d->mIncidencesForDate[Incidence::TypeEvent].constFind(dateStr);
     // Iterate over all non-recurring, single-day events that start on this date
     const auto ts = timeZone.isValid() ? timeZone : this->timeZone();
-    while (it != d->mIncidencesForDate[Incidence::TypeEvent].constEnd() && it.key() == dateStr) {
-        ev = it.value().staticCast<Event>();
+    const Incidence::List eventsForDate = d->incidencesForDate(Incidence::TypeEvent, date);
+    for (const Incidence::Ptr &incidence : eventsForDate) {
+        ev = incidence.staticCast<Event>();
         QDateTime end(ev->dtEnd().toTimeZone(ev->dtStart().timeZone()));
         if (ev->allDay()) {
             end.setTime(QTime());
@@ -624,14 +1534,12 @@ Event::List MemoryCalendar::rawEventsForDate(const QDate &date,
         if (end.date() >= date) {
             eventList.append(ev);
         }
-        ++it;
     }
 
-    // Iterate over all events. Look for recurring events that occur on this date
-    QHashIterator<QString, Incidence::Ptr>i(d->mIncidences[Incidence::TypeEvent]);
-    while (i.hasNext()) {
-        i.next();
-        ev = i.value().staticCast<Event>();
+    // Look for recurring and multi-day events that occur on this date
+    const Incidence::List recurringEvents = d->recurringEvents(date, ts == this->timeZone());
+    for (const Incidence::Ptr &incidence : recurringEvents) {
+        ev = incidence.staticCast<Event>();
         if (ev->recurs()) {
             if (ev->isMultiDay()) {
                 int extraDays = ev->dtStart().date().daysTo(ev->dtEnd().date());
@@ -668,53 +1576,53 @@ Event::List MemoryCalendar::rawEvents(const QDate &start,
     QDateTime st(start, QTime(0, 0, 0), ts);
     QDateTime nd(end, QTime(23, 59, 59, 999), ts);
 
-    // Get non-recurring events
-    QHashIterator<QString, Incidence::Ptr>i(d->mIncidences[Incidence::TypeEvent]);
-    Event::Ptr event;
-    while (i.hasNext()) {
-        i.next();
-        event = i.value().staticCast<Event>();
+    // Only look at events whose span overlaps the requested one, the
+    // exact checks follow below.
+    const qint64 stMSecs = st.isValid() ? st.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min();
+    const qint64 ndMSecs = nd.isValid() ? nd.toMSecsSinceEpoch() : std::numeric_limits<qint64>::max();
+    d->mEventSpans.overlapping(stMSecs, ndMSecs, [&](const Incidence::Ptr &incidence) {
+        const Event::Ptr event = incidence.staticCast<Event>();
         QDateTime rStart = event->dtStart();
         if (nd < rStart) {
-            continue;
+            return;
         }
         if (inclusive && rStart < st) {
-            continue;
+            return;
         }
 
         if (!event->recurs()) {   // non-recurring events
             QDateTime rEnd = event->dtEnd();
             if (rEnd < st) {
-                continue;
+                return;
             }
             if (inclusive && nd < rEnd) {
-                continue;
+                return;
             }
         } else { // recurring events
             switch (event->recurrence()->duration()) {
             case -1: // infinite
                 if (inclusive) {
-                    continue;
+                    return;
                 }
                 break;
             case 0: // end date given
             default: // count given
                 QDateTime rEnd(event->recurrence()->endDate(), QTime(23, 59, 59, 999), ts);
                 if (!rEnd.isValid()) {
-                    continue;
+                    return;
                 }
                 if (rEnd < st) {
-                    continue;
+                    return;
                 }
                 if (inclusive && nd < rEnd) {
-                    continue;
+                    return;
                 }
                 break;
             } // switch(duration)
         } //if(recurs)
 
         eventList.append(event);
-    }
+    });
 
     return eventList;
 }
@@ -728,8 +1636,8 @@ Event::List MemoryCalendar::rawEvents(EventSortField sortField,
                                       SortDirection sortDirection) const
 {
     Event::List eventList;
-    eventList.reserve(d->mIncidences[Incidence::TypeEvent].count());
-    QHashIterator<QString, Incidence::Ptr> i(d->mIncidences[Incidence::TypeEvent]);
+    eventList.reserve(d->mIncidences.value(Incidence::TypeEvent).count());
+    QHashIterator<QString, Incidence::Ptr> i(d->mIncidences.value(Incidence::TypeEvent));
     while (i.hasNext()) {
         i.next();
         eventList.append(i.value().staticCast<Event>());
@@ -745,12 +1653,16 @@ Event::List MemoryCalendar::deletedEvents(EventSortField sortField,
     }
 
     Event::List eventList;
-    eventList.reserve(d->mDeletedIncidences[Incidence::TypeEvent].count());
-    QHashIterator<QString, Incidence::Ptr>i(d->mDeletedIncidences[Incidence::TypeEvent]);
+    eventList.reserve(d->mDeletedIncidences.value(Incidence::TypeEvent).count());
+    QHashIterator<QString, Incidence::Ptr>i(d->mDeletedIncidences.value(Incidence::TypeEvent));
     while (i.hasNext()) {
         i.next();
         eventList.append(i.value().staticCast<Event>());
     }
+    const Incidence::List tombstones = d->tombstoneIncidences(Incidence::TypeEvent);
+    for (const Incidence::Ptr &tombstone : tombstones) {
+        eventList.append(tombstone.staticCast<Event>());
+    }
     return Calendar::sortEvents(eventList, sortField, sortDirection);
 }
 
@@ -760,7 +1672,7 @@ Event::List MemoryCalendar::eventInstances(const Incidence::Ptr &event,
 {
     Event::List list;
 
-    Incidence::List values = ::values(d->mIncidences[Incidence::TypeEvent], event->uid());
+    Incidence::List values = ::values(d->mIncidences.value(Incidence::TypeEvent), event->uid());
     for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
         Event::Ptr ev = (*it).staticCast<Event>();
         if (ev->hasRecurrenceId()) {
@@ -800,7 +1712,7 @@ Journal::List MemoryCalendar::rawJournals(JournalSortField sortField,
         SortDirection sortDirection) const
 {
     Journal::List journalList;
-    QHashIterator<QString, Incidence::Ptr>i(d->mIncidences[Incidence::TypeJournal]);
+    QHashIterator<QString, Incidence::Ptr>i(d->mIncidences.value(Incidence::TypeJournal));
     while (i.hasNext()) {
         i.next();
         journalList.append(i.value().staticCast<Journal>());
@@ -816,12 +1728,16 @@ Journal::List MemoryCalendar::deletedJournals(JournalSortField sortField,
     }
 
     Journal::List journalList;
-    journalList.reserve(d->mDeletedIncidences[Incidence::TypeJournal].count());
-    QHashIterator<QString, Incidence::Ptr>i(d->mDeletedIncidences[Incidence::TypeJournal]);
+    journalList.reserve(d->mDeletedIncidences.value(Incidence::TypeJournal).count());
+    QHashIterator<QString, Incidence::Ptr>i(d->mDeletedIncidences.value(Incidence::TypeJournal));
     while (i.hasNext()) {
         i.next();
         journalList.append(i.value().staticCast<Journal>());
     }
+    const Incidence::List tombstones = d->tombstoneIncidences(Incidence::TypeJournal);
+    for (const Incidence::Ptr &tombstone : tombstones) {
+        journalList.append(tombstone.staticCast<Journal>());
+    }
     return Calendar::sortJournals(journalList, sortField, sortDirection);
 }
 
@@ -831,7 +1747,7 @@ Journal::List MemoryCalendar::journalInstances(const Incidence::Ptr &journal,
 {
     Journal::List list;
 
-    Incidence::List values = ::values(d->mIncidences[Incidence::TypeJournal], journal->uid());
+    Incidence::List values = ::values(d->mIncidences.value(Incidence::TypeJournal), journal->uid());
     for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
         Journal::Ptr j = (*it).staticCast<Journal>();
         if (j->hasRecurrenceId()) {
@@ -844,16 +1760,11 @@ Journal::List MemoryCalendar::journalInstances(const Incidence::Ptr &journal,
 Journal::List MemoryCalendar::rawJournalsForDate(const QDate &date) const
 {
     Journal::List journalList;
-    Journal::Ptr j;
 
-    QString dateStr = date.toString();
-    QMultiHash<QString, IncidenceBase::Ptr >::const_iterator it =
-        d->mIncidencesForDate[Incidence::TypeJournal].constFind(dateStr);
-
-    while (it != d->mIncidencesForDate[Incidence::TypeJournal].constEnd() && it.key() == dateStr) {
-        j = it.value().staticCast<Journal>();
-        journalList.append(j);
-        ++it;
+    const Incidence::List journalsForDate = d->incidencesForDate(Incidence::TypeJournal, date);
+    journalList.reserve(journalsForDate.count());
+    for (const Incidence::Ptr &incidence : journalsForDate) {
+        journalList.append(incidence.staticCast<Journal>());
     }
     return journalList;
 }
@@ -863,9 +1774,154 @@ Incidence::Ptr MemoryCalendar::instance(const QString &identifier) const
     return d->mIncidencesByIdentifier.value(identifier);
 }
 
+Incidence::Ptr MemoryCalendar::incidenceFromSchedulingID(const QString &sid) const
+{
+    // Prefer the master incidence over its exceptions, which share its uid
+    Incidence::Ptr incidence;
+    auto it = d->mIncidencesBySchedulingId.constFind(sid);
+    for (; it != d->mIncidencesBySchedulingId.constEnd() && it.key() == sid; ++it) {
+        incidence = it.value();
+        if (!incidence->hasRecurrenceId()) {
+            break;
+        }
+    }
+    return incidence;
+}
+
+Incidence::List MemoryCalendar::incidencesFromSchedulingID(const QString &sid) const
+{
+    return ::values(d->mIncidencesBySchedulingId, sid);
+}
+
+MemoryCalendar::Ptr MemoryCalendar::snapshot() const
+{
+    MemoryCalendar::Ptr snapshot(new MemoryCalendar(timeZone()));
+    snapshot->copyCalendarData(*this);
+
+    // The containers are implicitly shared and the interval trees share their
+    // nodes, so this copies a few pointers. Whichever side changes first detaches.
+    // The incidences themselves stay shared, see the documentation.
+    *snapshot->d = *d;
+    snapshot->d->q = snapshot.data();
+    snapshot->d->mIsSnapshot = true;
+    snapshot->d->mIncidenceBeingUpdated.clear();
+    snapshot->d->mUidBeingUpdated.clear();
+    return snapshot;
+}
+
+void MemoryCalendar::setTombstoneMode(bool enable)
+{
+    if (d->mTombstoneMode == enable) {
+        return;
+    }
+    d->mTombstoneMode = enable;
+    if (enable) {
+        // We don't know when these were deleted, so they start aging now
+        const QDateTime now = QDateTime::currentDateTimeUtc();
+        for (auto type = d->mDeletedIncidences.cbegin(); type != d->mDeletedIncidences.cend(); ++type) {
+            for (const Incidence::Ptr &incidence : *type) {
+                d->insertTombstone(incidence, now);
+            }
+        }
+        d->mDeletedIncidences.clear();
+    }
+}
+
+bool MemoryCalendar::tombstoneMode() const
+{
+    return d->mTombstoneMode;
+}
+
+void MemoryCalendar::setTombstoneLimits(int maxCount, int maxAge)
+{
+    d->mTombstoneMaxCount = qMax(0, maxCount);
+    d->mTombstoneMaxAge = qMax(0, maxAge);
+    d->pruneTombstones(QDateTime::currentDateTimeUtc());
+}
+
+int MemoryCalendar::tombstoneMaxCount() const
+{
+    return d->mTombstoneMaxCount;
+}
+
+int MemoryCalendar::tombstoneMaxAge() const
+{
+    return d->mTombstoneMaxAge;
+}
+
+void MemoryCalendar::pruneTombstones()
+{
+    d->pruneTombstones(QDateTime::currentDateTimeUtc());
+}
+
+void MemoryCalendar::pruneTombstones(const QDateTime &now)
+{
+    d->pruneTombstones(now);
+}
+
+void MemoryCalendar::setFullTextIndexEnabled(bool enable)
+{
+    if (d->mTextIndexEnabled == enable) {
+        return;
+    }
+    d->mTextIndexEnabled = enable;
+    if (enable) {
+        for (const Incidence::Ptr &incidence : qAsConst(d->mIncidencesByIdentifier)) {
+            d->mTextIndex.insert(incidence);
+        }
+    } else {
+        d->mTextIndex.clear();
+    }
+}
+
+bool MemoryCalendar::isFullTextIndexEnabled() const
+{
+    return d->mTextIndexEnabled;
+}
+
+Incidence::List MemoryCalendar::search(const QString &text, int limit) const
+{
+    QVector<TextIndex::Match> matches;
+    if (d->mTextIndexEnabled) {
+        matches = d->mTextIndex.search(text);
+    } else {
+        // The ranking depends on all incidences, so there is no shortcut
+        TextIndex index;
+        for (const Incidence::Ptr &incidence : qAsConst(d->mIncidencesByIdentifier)) {
+            index.insert(incidence);
+        }
+        matches = index.search(text);
+    }
+
+    Incidence::List incidences;
+    const int count = limit > 0 ? qMin(limit, matches.count()) : matches.count();
+    incidences.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        incidences.append(matches.at(i).incidence);
+    }
+    return incidences;
+}
+
+void MemoryCalendar::doSetTimeZone(const QTimeZone &timeZone)
+{
+    Q_UNUSED(timeZone);
+
+    // Which days timed events can occur on depends on the calendar's time zone
+    const Incidence::List events = ::values(d->mIncidences[Incidence::TypeEvent]);
+    for (const Incidence::Ptr &event : events) {
+        if (event->recurs()) {
+            d->removeRecurringSpan(event);
+            d->insertRecurringSpan(event);
+        }
+    }
+}
+
 void MemoryCalendar::virtual_hook(int id, void *data)
 {
-    Q_UNUSED(id);
-    Q_UNUSED(data);
-    Q_ASSERT(false);
+    Calendar::virtual_hook(id, data);
+    if (id == ApproximateMemoryUsageHook) {
+        MemoryUsage *usage = static_cast<MemoryUsage *>(data);
+        usage->indexes += d->indexMemoryUsage();
+        usage->tombstones += d->tombstoneMemoryUsage();
+    }
 }
@@ -86,6 +86,160 @@ public:
     */
     bool addIncidence(const Incidence::Ptr &incidence) override;
 
+    /**
+      Inserts a list of Incidences into the calendar.
+
+      This has the same result as calling addIncidence() for each of them,
+      within startBatchAdding() and endBatchAdding(). But all of them are put
+      into the calendar first, and only then indexed in one pass, announced
+      to the observers and related to each other. The observers therefore
+      already find all of them in the calendar, and children are related to
+      their parents straight away, whatever order they come in. The calendar
+      is reported as modified only once.
+
+      The incidences don't go through addIncidence() or the type specific
+      add functions, so overrides of these in subclasses don't see them.
+      The calendar formats only use this for plain MemoryCalendar objects.
+
+      @param incidences is the list of Incidences to insert.
+      @return true if all Incidences were successfully inserted; false otherwise.
+      @see addIncidence()
+      @since 5.13
+    */
+    bool addIncidences(const Incidence::List &incidences);
+
+    /**
+      Returns a read-only copy of this calendar as it is now.
+
+      The snapshot shares its incidences and the storage of its indexes with
+      this calendar, so taking one costs next to nothing. Later changes to
+      this calendar don't show in the snapshot, the shared parts are copied
+      on the first write instead.
+
+      This allows reading from other threads without locking: take the
+      snapshot in the thread which modifies the calendar and hand it over.
+      A snapshot must only be used by one thread at a time, but snapshots
+      are cheap enough to take one for each.
+
+      Only which incidences the calendar holds is isolated, the incidences
+      themselves are not copied. The modifying thread may keep adding and
+      deleting incidences, but it must not change an incidence in place,
+      e.g. through its setters, while a snapshot may still see it: that
+      changes it for the snapshot too, and races with the snapshot's reader.
+      There is no operation replacing an incidence in place either. To
+      change such an incidence, delete it and add a modified clone instead.
+
+      Adding incidences to or deleting them from a snapshot fails.
+
+      @since 5.13
+    */
+    MemoryCalendar::Ptr snapshot() const;
+
+    /**
+      Sets whether deleted incidences are only kept as tombstones.
+
+      With deletion tracking enabled, deleted incidences are kept in full by
+      default. In tombstone mode only their uid, recurrence id, type, revision
+      and deletion time are kept, which takes a fraction of the memory.
+      deletedEvent(), deletedTodo(), deletedJournal() and the lists of deleted
+      incidences then return new incidences carrying just these, with the
+      deletion time as their last modification time.
+
+      Enabling tombstone mode turns the deleted incidences kept so far into
+      tombstones. Default is false.
+
+      @see setTombstoneLimits(), Calendar::setDeletionTracking()
+      @since 5.13
+    */
+    void setTombstoneMode(bool enable);
+
+    /**
+      Returns if deleted incidences are only kept as tombstones.
+      @see setTombstoneMode()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT bool tombstoneMode() const;
+
+    /**
+      Limits the number of tombstones kept. The oldest tombstones are dropped
+      once there are more than @p maxCount of them, or once they are older
+      than @p maxAge seconds. A limit of 0 means no limit, which is the default.
+
+      Tombstones are pruned whenever an incidence is deleted, and by
+      pruneTombstones().
+
+      @see setTombstoneMode()
+      @since 5.13
+    */
+    void setTombstoneLimits(int maxCount, int maxAge);
+
+    /**
+      Returns the maximum number of tombstones kept, or 0 for no limit.
+      @see setTombstoneLimits()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT int tombstoneMaxCount() const;
+
+    /**
+      Returns the age in seconds after which tombstones are dropped, or 0
+      for no limit.
+      @see setTombstoneLimits()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT int tombstoneMaxAge() const;
+
+    /**
+      Drops the tombstones which are older than tombstoneMaxAge().
+      Long running applications should call this now and then.
+      @see setTombstoneLimits()
+      @since 5.13
+    */
+    void pruneTombstones();
+
+    /**
+      Drops the tombstones which are older than tombstoneMaxAge() at @p now.
+      @see setTombstoneLimits()
+      @since 5.13
+    */
+    void pruneTombstones(const QDateTime &now);
+
+    /**
+      Sets whether the calendar keeps a full-text index over the summary,
+      description and location of its incidences, which makes search()
+      fast. The index is kept up to date as incidences are added, changed
+      and deleted. Default is false.
+
+      @see search()
+      @since 5.13
+    */
+    void setFullTextIndexEnabled(bool enable);
+
+    /**
+      Returns if the calendar keeps a full-text index.
+      @see setFullTextIndexEnabled()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT bool isFullTextIndexEnabled() const;
+
+    /**
+      Returns the incidences containing all words of @p text in their
+      summary, description or location, the most relevant first.
+
+      Words are runs of letters and digits, and are compared ignoring case.
+      A word of @p text ending with '*' matches all words starting with it,
+      e.g. "meet*" matches "meeting" and "meets". Incidences rank higher for
+      words found in their summary than in their location or description,
+      and for words which few incidences contain.
+
+      Without the full-text index, each search looks through all incidences.
+
+      @param text the words to search for.
+      @param limit the maximum number of results, or 0 for all of them.
+      @see setFullTextIndexEnabled()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT Incidence::List search(const QString &text, int limit = 0) const;
+
     // Event Specific Methods //
 
     /**
@@ -145,6 +299,16 @@ public:
      */
     Incidence::Ptr instance(const QString &identifier) const;
 
+    /**
+      @copydoc Calendar::incidenceFromSchedulingID()
+    */
+    Q_REQUIRED_RESULT Incidence::Ptr incidenceFromSchedulingID(const QString &sid) const override;
+
+    /**
+      @copydoc Calendar::incidencesFromSchedulingID()
+    */
+    Q_REQUIRED_RESULT Incidence::List incidencesFromSchedulingID(const QString &sid) const override;
+
     /**
       @copydoc Calendar::event()
     */
@@ -314,8 +478,18 @@ public:
     using QObject::event;   // prevent warning about hidden virtual method
 
 protected:
+    /**
+      @copydoc Calendar::doSetTimeZone(const QTimeZone &)
+    */
+    void doSetTimeZone(const QTimeZone &timeZone) override;
+
     /**
       @copydoc IncidenceBase::virtual_hook()
+
+      For Calendar::approximateMemoryUsage(), the indexes include the
+      per-date, time span, alarm and scheduling ID indexes of MemoryCalendar,
+      and the full-text index. The tombstones are the deleted incidences kept
+      while deletion tracking is enabled, see setTombstoneMode().
     */
     void virtual_hook(int id, void *data) override;
 
@@ -0,0 +1,129 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KCALCORE_MEMORYSIZE_P_H
+#define KCALCORE_MEMORYSIZE_P_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace KCalendarCore {
+
+/**
+  Estimates of the heap memory taken by Qt values and containers, for the
+  approximateMemoryUsage() functions.
+
+  Each function returns the bytes allocated for the value or container
+  itself, not counting its own size, which is part of whatever holds it.
+  The elements of containers are counted as far as they are stored in the
+  container; memory they point to, e.g. the data of QString elements, is
+  left out. This is what index containers need, whose keys and values are
+  implicitly shared with the incidences. Only sizes and capacities are
+  looked at, so all of these are O(1).
+
+  @internal
+*/
+namespace MemorySize {
+
+// QDateTimePrivate, allocated for date times with a time zone
+static const qint64 dateTimePrivateSize = 48;
+
+inline qint64 heapSize(const QString &string)
+{
+    // Null, empty and literal strings have no allocated data
+    return string.capacity() > 0 ? qint64(sizeof(QArrayData)) + (string.capacity() + 1) * qint64(sizeof(QChar)) : 0;
+}
+
+inline qint64 heapSize(const QByteArray &bytes)
+{
+    return bytes.capacity() > 0 ? qint64(sizeof(QArrayData)) + bytes.capacity() + 1 : 0;
+}
+
+inline qint64 heapSize(const QDateTime &dateTime)
+{
+    return dateTime.timeSpec() == Qt::TimeZone ? dateTimePrivateSize : 0;
+}
+
+template <typename T>
+inline qint64 heapSize(const QVector<T> &vector)
+{
+    return vector.capacity() > 0 ? qint64(sizeof(QArrayData)) + vector.capacity() * qint64(sizeof(T)) : 0;
+}
+
+template <typename T>
+inline qint64 heapSize(const QList<T> &list)
+{
+    if (list.isEmpty()) {
+        return 0;
+    }
+    // Large and static types get a heap node for each element
+    const qint64 node = QTypeInfo<T>::isLarge || QTypeInfo<T>::isStatic ? sizeof(T) : 0;
+    return qint64(sizeof(QListData::Data)) + list.size() * (qint64(sizeof(void *)) + node);
+}
+
+// The strings of @p list are counted too
+inline qint64 heapSize(const QStringList &list)
+{
+    qint64 size = heapSize<QString>(list);
+    for (const QString &string : list) {
+        size += heapSize(string);
+    }
+    return size;
+}
+
+template <typename K, typename V>
+inline qint64 heapSize(const QHash<K, V> &hash)
+{
+    if (hash.capacity() == 0) {
+        return 0;
+    }
+    return qint64(sizeof(QHashData)) + hash.capacity() * qint64(sizeof(void *))
+           + hash.size() * qint64(sizeof(QHashNode<K, V>));
+}
+
+template <typename T>
+inline qint64 heapSize(const QSet<T> &set)
+{
+    if (set.capacity() == 0) {
+        return 0;
+    }
+    return qint64(sizeof(QHashData)) + set.capacity() * qint64(sizeof(void *))
+           + set.size() * qint64(sizeof(QHashNode<T, QHashDummyValue>));
+}
+
+template <typename K, typename V>
+inline qint64 heapSize(const QMap<K, V> &map)
+{
+    return map.isEmpty() ? 0 : qint64(sizeof(QMapDataBase)) + map.size() * qint64(sizeof(QMapNode<K, V>));
+}
+
+}
+
+}
+
+#endif
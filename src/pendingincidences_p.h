@@ -0,0 +1,136 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KCALCORE_PENDINGINCIDENCES_P_H
+#define KCALCORE_PENDINGINCIDENCES_P_H
+
+#include "calendar.h"
+#include "memorycalendar.h"
+#include "shardedmemorycalendar.h"
+
+#include <QPair>
+#include <QSet>
+
+#include <typeinfo>
+
+namespace KCalendarCore {
+
+/**
+  Collects the incidences a calendar format reads, so that they are added
+  to the calendar in one go by MemoryCalendar::addIncidences() or
+  ShardedMemoryCalendar::addIncidences().
+
+  That bypasses addIncidence() and the type specific add functions, which
+  subclasses may override. So the incidences are only collected for a plain
+  MemoryCalendar or ShardedMemoryCalendar. For any other calendar, add()
+  passes each incidence to Calendar::addEvent(), addTodo() or addJournal()
+  straight away, like the formats always did.
+
+  The formats look for an incidence with the same identifier in the
+  calendar before adding one. If a pending incidence has it, flush() has
+  to add the pending ones first, see contains().
+
+  @internal
+*/
+class PendingIncidences
+{
+public:
+    explicit PendingIncidences(Calendar *calendar)
+        : mCalendar(calendar)
+        , mMemoryCalendar(typeid(*calendar) == typeid(MemoryCalendar)
+                          ? static_cast<MemoryCalendar *>(calendar) : nullptr)
+        , mShardedCalendar(typeid(*calendar) == typeid(ShardedMemoryCalendar)
+                           ? static_cast<ShardedMemoryCalendar *>(calendar) : nullptr)
+    {
+    }
+
+    ~PendingIncidences()
+    {
+        flush();
+    }
+
+    /**
+      Returns whether an incidence of the same type and with the same
+      identifier as @p incidence is waiting to be added.
+    */
+    bool contains(const Incidence::Ptr &incidence) const
+    {
+        return mKeys.contains(key(incidence));
+    }
+
+    void add(const Incidence::Ptr &incidence)
+    {
+        if (!mMemoryCalendar && !mShardedCalendar) {
+            switch (incidence->type()) {
+            case Incidence::TypeEvent:
+                mCalendar->addEvent(incidence.staticCast<Event>());
+                break;
+            case Incidence::TypeTodo:
+                mCalendar->addTodo(incidence.staticCast<Todo>());
+                break;
+            case Incidence::TypeJournal:
+                mCalendar->addJournal(incidence.staticCast<Journal>());
+                break;
+            default:
+                mCalendar->addIncidence(incidence);
+                break;
+            }
+            return;
+        }
+        mKeys.insert(key(incidence));
+        mIncidences.append(incidence);
+    }
+
+    /**
+      Adds the incidences collected so far to the calendar.
+    */
+    void flush()
+    {
+        if (mIncidences.isEmpty()) {
+            return;
+        }
+        if (mMemoryCalendar) {
+            mMemoryCalendar->addIncidences(mIncidences);
+        } else {
+            mShardedCalendar->addIncidences(mIncidences);
+        }
+        mIncidences.clear();
+        mKeys.clear();
+    }
+
+private:
+    typedef QPair<int, QString> Key;
+
+    static Key key(const Incidence::Ptr &incidence)
+    {
+        return qMakePair(int(incidence->type()), incidence->instanceIdentifier());
+    }
+
+    Calendar *const mCalendar;
+    MemoryCalendar *const mMemoryCalendar;
+    ShardedMemoryCalendar *const mShardedCalendar;
+    Incidence::List mIncidences;
+    QSet<Key> mKeys;
+};
+
+}
+
+#endif
@@ -24,13 +24,16 @@
 #include "recurrence.h"
 #include "utils_p.h"
 #include "recurrencehelper_p.h"
+#include "memorysize_p.h"
 
 #include "kcalendarcore_debug.h"
 
+#include <QAtomicInt>
 #include <QDataStream>
 #include <QTimeZone>
 #include <QBitArray>
 #include <QTime>
+#include <QVector>
 
 using namespace KCalendarCore;
 
@@ -51,7 +54,7 @@ public:
           mExDateTimes(p.mExDateTimes),
           mExDates(p.mExDates),
           mStartDateTime(p.mStartDateTime),
-          mCachedType(p.mCachedType),
+          mCachedType(p.mCachedType.loadAcquire()),
           mAllDay(p.mAllDay),
           mRecurReadOnly(p.mRecurReadOnly)
     {
@@ -69,7 +72,7 @@ public:
     QList<RecurrenceObserver *> mObservers;
 
     // Cache the type of the recurrence with the old system (e.g. MonthlyPos)
-    mutable ushort mCachedType;
+    mutable QAtomicInt mCachedType;    // filled by const functions, which may run concurrently
 
     bool mAllDay = false;                // the recurrence has no time, just a date
     bool mRecurReadOnly = false;
@@ -222,7 +225,7 @@ RecurrenceRule *Recurrence::defaultRRuleConst() const
 void Recurrence::updated()
 {
     // recurrenceType() re-calculates the type if it's rMax
-    d->mCachedType = rMax;
+    d->mCachedType.storeRelease(rMax);
     for (int i = 0, end = d->mObservers.count();  i < end;  ++i) {
         if (d->mObservers[i]) {
             d->mObservers[i]->recurrenceUpdated(this);
@@ -237,10 +240,12 @@ bool Recurrence::recurs() const
 
 ushort Recurrence::recurrenceType() const
 {
-    if (d->mCachedType == rMax) {
-        d->mCachedType = recurrenceType(defaultRRuleConst());
+    int type = d->mCachedType.loadAcquire();
+    if (type == rMax) {
+        type = recurrenceType(defaultRRuleConst());
+        d->mCachedType.storeRelease(type);
     }
-    return d->mCachedType;
+    return type;
 }
 
 ushort Recurrence::recurrenceType(const RecurrenceRule *rrule)
@@ -576,7 +581,7 @@ void Recurrence::clear()
     d->mRDateTimes.clear();
     d->mExDates.clear();
     d->mExDateTimes.clear();
-    d->mCachedType = rMax;
+    d->mCachedType.storeRelease(rMax);
     updated();
 }
 
@@ -1257,6 +1262,202 @@ QDateTime Recurrence::getPreviousDateTime(const QDateTime &afterDateTime) const
     return QDateTime();
 }
 
+Recurrence::OccurrenceGenerator Recurrence::occurrences(const QDateTime &from) const
+{
+    return OccurrenceGenerator(this, from);
+}
+
+//@cond PRIVATE
+/*
+  Merges the streams which make up a recurrence: the start date/time, the
+  RDATE lists and the RRULEs. Each stream keeps its own position, so only the
+  streams which produced an occurrence move on to their next date/time.
+  EXDATEs and EXRULEs are checked the same way, against positions which only
+  ever move forward.
+*/
+class Q_DECL_HIDDEN KCalendarCore::Recurrence::OccurrenceGenerator::Private
+{
+public:
+    Private(const Recurrence *recurrence, const QDateTime &from);
+
+    void advance();
+    QDateTime nextCandidate();
+    bool isExcluded(const QDateTime &dt);
+    QDateTime rDateAt(int i) const;
+
+    const Recurrence *mRecurrence;
+    QDateTime mStart;               // the start date/time, until it is passed
+    QVector<QDateTime> mRuleNext;   // next occurrence of each RRULE
+    QVector<QDateTime> mExRuleNext; // next occurrence of each EXRULE, not before the last candidate
+    int mRDateTime;                 // next entry in mRDateTimes
+    int mRDate;                     // next entry in mRDates
+    int mExDateTime;                // first entry in mExDateTimes not before the last candidate
+    QDateTime mNext;                // the next occurrence, invalid if there is none
+};
+
+Recurrence::OccurrenceGenerator::Private::Private(const Recurrence *recurrence, const QDateTime &from)
+    : mRecurrence(recurrence)
+{
+    const Recurrence::Private *r = recurrence->d;
+    if (from < r->mStartDateTime) {
+        mStart = r->mStartDateTime;
+    }
+    mRDateTime = std::upper_bound(r->mRDateTimes.constBegin(), r->mRDateTimes.constEnd(), from)
+                 - r->mRDateTimes.constBegin();
+    mRDate = 0;
+    while (mRDate < r->mRDates.count() && rDateAt(mRDate) <= from) {
+        ++mRDate;
+    }
+    mExDateTime = std::upper_bound(r->mExDateTimes.constBegin(), r->mExDateTimes.constEnd(), from)
+                  - r->mExDateTimes.constBegin();
+    mRuleNext.reserve(r->mRRules.count());
+    for (const RecurrenceRule *rule : qAsConst(r->mRRules)) {
+        mRuleNext.append(rule->getNextDate(from));
+    }
+    mExRuleNext.reserve(r->mExRules.count());
+    for (const RecurrenceRule *rule : qAsConst(r->mExRules)) {
+        mExRuleNext.append(rule->getNextDate(from));
+    }
+    advance();
+}
+
+// The date/time of an RDATE, at the time of the start
+QDateTime Recurrence::OccurrenceGenerator::Private::rDateAt(int i) const
+{
+    QDateTime dt(mRecurrence->d->mStartDateTime);
+    dt.setDate(mRecurrence->d->mRDates[i]);
+    return dt;
+}
+
+void Recurrence::OccurrenceGenerator::Private::advance()
+{
+    // Like getNextDateTime(), give up if 1000 candidates in a row are excluded,
+    // e.g. when an exrule extinguishes an rrule
+    for (int loop = 0; loop < 1000; ++loop) {
+        const QDateTime candidate = nextCandidate();
+        if (!candidate.isValid() || !isExcluded(candidate)) {
+            mNext = candidate;
+            return;
+        }
+    }
+    mNext = QDateTime();
+}
+
+// Take the earliest date/time of all streams, and move every stream past it
+QDateTime Recurrence::OccurrenceGenerator::Private::nextCandidate()
+{
+    const Recurrence::Private *r = mRecurrence->d;
+    QDateTime candidate = mStart;
+    const auto consider = [&candidate](const QDateTime &dt) {
+        if (dt.isValid() && (!candidate.isValid() || dt < candidate)) {
+            candidate = dt;
+        }
+    };
+    if (mRDateTime < r->mRDateTimes.count()) {
+        consider(r->mRDateTimes[mRDateTime]);
+    }
+    if (mRDate < r->mRDates.count()) {
+        consider(rDateAt(mRDate));
+    }
+    for (const QDateTime &dt : qAsConst(mRuleNext)) {
+        consider(dt);
+    }
+    if (!candidate.isValid()) {
+        return candidate;
+    }
+
+    if (mStart.isValid() && mStart <= candidate) {
+        mStart = QDateTime();
+    }
+    while (mRDateTime < r->mRDateTimes.count() && r->mRDateTimes[mRDateTime] <= candidate) {
+        ++mRDateTime;
+    }
+    while (mRDate < r->mRDates.count() && rDateAt(mRDate) <= candidate) {
+        ++mRDate;
+    }
+    for (int i = 0, iend = mRuleNext.count(); i < iend; ++i) {
+        if (mRuleNext[i].isValid() && mRuleNext[i] <= candidate) {
+            mRuleNext[i] = r->mRRules[i]->getNextDate(candidate);
+        }
+    }
+    return candidate;
+}
+
+bool Recurrence::OccurrenceGenerator::Private::isExcluded(const QDateTime &dt)
+{
+    const Recurrence::Private *r = mRecurrence->d;
+    // Dates are looked up rather than walked, since the date of a later
+    // occurrence can be earlier if it is in a different time zone
+    if (std::binary_search(r->mExDates.constBegin(), r->mExDates.constEnd(), dt.date())) {
+        return true;
+    }
+    while (mExDateTime < r->mExDateTimes.count() && r->mExDateTimes[mExDateTime] < dt) {
+        ++mExDateTime;
+    }
+    if (mExDateTime < r->mExDateTimes.count() && r->mExDateTimes[mExDateTime] == dt) {
+        return true;
+    }
+    for (int i = 0, iend = mExRuleNext.count(); i < iend; ++i) {
+        const RecurrenceRule *rule = r->mExRules[i];
+        if (rule->allDay()) {
+            // All-day exrules exclude whole dates
+            if (rule->recursAt(dt)) {
+                return true;
+            }
+            continue;
+        }
+        QDateTime &next = mExRuleNext[i];
+        if (next.isValid() && next < dt) {
+            next = rule->getNextDate(dt.addMSecs(-1));
+        }
+        if (next.isValid() && next == dt) {
+            return true;
+        }
+    }
+    return false;
+}
+//@endcond
+
+Recurrence::OccurrenceGenerator::OccurrenceGenerator(const Recurrence *recurrence, const QDateTime &from)
+    : d(new Private(recurrence, from))
+{
+}
+
+Recurrence::OccurrenceGenerator::OccurrenceGenerator(const OccurrenceGenerator &other)
+    : d(new Private(*other.d))
+{
+}
+
+Recurrence::OccurrenceGenerator::~OccurrenceGenerator()
+{
+    delete d;
+}
+
+Recurrence::OccurrenceGenerator &Recurrence::OccurrenceGenerator::operator=(const OccurrenceGenerator &other)
+{
+    // check for self assignment
+    if (&other == this) {
+        return *this;
+    }
+
+    *d = *other.d;
+    return *this;
+}
+
+bool Recurrence::OccurrenceGenerator::hasNext() const
+{
+    return d->mNext.isValid();
+}
+
+QDateTime Recurrence::OccurrenceGenerator::next()
+{
+    const QDateTime next = d->mNext;
+    if (next.isValid()) {
+        d->advance();
+    }
+    return next;
+}
+
 /***************************** PROTECTED FUNCTIONS ***************************/
 
 RecurrenceRule::List Recurrence::rRules() const
@@ -1451,6 +1652,41 @@ void Recurrence::recurrenceChanged(RecurrenceRule *)
 
 // %%%%%%%%%%%%%%%%%% end:Recurrencerule %%%%%%%%%%%%%%%%%%
 
+qint64 Recurrence::approximateMemoryUsage() const
+{
+    using namespace MemorySize;
+    qint64 size = sizeof(Private)
+                  + heapSize(d->mExRules) + heapSize(d->mRRules)
+                  + heapSize(d->mRDateTimes) + heapSize(d->mRDates)
+                  + heapSize(d->mExDateTimes) + heapSize(d->mExDates)
+                  + heapSize(d->mStartDateTime) + heapSize(d->mObservers);
+    for (const RecurrenceRule *rule : qAsConst(d->mRRules)) {
+        size += rule->approximateMemoryUsage();
+    }
+    for (const RecurrenceRule *rule : qAsConst(d->mExRules)) {
+        size += rule->approximateMemoryUsage();
+    }
+    for (const QDateTime &dt : qAsConst(d->mRDateTimes)) {
+        size += heapSize(dt);
+    }
+    for (const QDateTime &dt : qAsConst(d->mExDateTimes)) {
+        size += heapSize(dt);
+    }
+    return size;
+}
+
+qint64 Recurrence::approximateCacheSize() const
+{
+    qint64 size = 0;
+    for (const RecurrenceRule *rule : qAsConst(d->mRRules)) {
+        size += rule->approximateCacheSize();
+    }
+    for (const RecurrenceRule *rule : qAsConst(d->mExRules)) {
+        size += rule->approximateCacheSize();
+    }
+    return size;
+}
+
 void Recurrence::dump() const
 {
     int i;
@@ -1503,7 +1739,7 @@ KCALENDARCORE_EXPORT QDataStream &KCalendarCore::operator<<(QDataStream &out, KC
     serializeQDateTimeList(out, r->d->mExDateTimes);
     out << r->d->mRDates;
     serializeQDateTimeAsKDateTime(out, r->d->mStartDateTime);
-    out << r->d->mCachedType
+    out << static_cast<ushort>(r->d->mCachedType.loadAcquire())
         << r->d->mAllDay << r->d->mRecurReadOnly << r->d->mExDates
         << r->d->mExRules.count() << r->d->mRRules.count();
 
@@ -1525,14 +1761,16 @@ KCALENDARCORE_EXPORT QDataStream &KCalendarCore::operator>>(QDataStream &in, KCa
     }
 
     int rruleCount, exruleCount;
+    ushort cachedType;
 
     deserializeQDateTimeList(in, r->d->mRDateTimes);
     deserializeQDateTimeList(in, r->d->mExDateTimes);
     in >> r->d->mRDates;
     deserializeKDateTimeAsQDateTime(in, r->d->mStartDateTime);
-    in >> r->d->mCachedType
+    in >> cachedType
        >> r->d->mAllDay >> r->d->mRecurReadOnly >> r->d->mExDates
        >> exruleCount >> rruleCount;
+    r->d->mCachedType.storeRelease(cachedType);
 
     r->d->mExRules.clear();
     r->d->mRRules.clear();
@@ -97,6 +97,64 @@ public:
         virtual void recurrenceUpdated(Recurrence *r) = 0;
     };
 
+    /**
+      Forward-only generator of the date/times at which a recurrence occurs,
+      as returned by Recurrence::occurrences().
+
+      @code
+      Recurrence::OccurrenceGenerator occurrences = recurrence->occurrences(from);
+      while (occurrences.hasNext()) {
+          const QDateTime occurrence = occurrences.next();
+          ...
+      }
+      @endcode
+
+      The generator refers to its recurrence and that recurrence's rules, which
+      must neither be changed nor deleted while the generator is in use.
+      @since 5.13
+    */
+    class KCALENDARCORE_EXPORT OccurrenceGenerator
+    {
+    public:
+        /**
+          Copy constructor. The copy continues independently from the same position.
+          @param other instance to copy from
+        */
+        OccurrenceGenerator(const OccurrenceGenerator &other);
+
+        /**
+          Destructor.
+        */
+        ~OccurrenceGenerator();
+
+        /**
+          Assignment operator.
+          @param other instance to assign from
+        */
+        OccurrenceGenerator &operator=(const OccurrenceGenerator &other);
+
+        /**
+          Returns true if there is another occurrence.
+        */
+        Q_REQUIRED_RESULT bool hasNext() const;
+
+        /**
+          Returns the next occurrence and advances the generator, or an invalid
+          date/time if there are no more occurrences.
+        */
+        QDateTime next();
+
+    private:
+        OccurrenceGenerator(const Recurrence *recurrence, const QDateTime &from);
+
+        //@cond PRIVATE
+        class Private;
+        Private *const d;
+        //@endcond
+
+        friend class Recurrence;
+    };
+
     /** enumeration for describing how an event recurs, if at all. */
     enum {
         rNone = 0,
@@ -264,6 +322,20 @@ public:
      */
     Q_REQUIRED_RESULT QDateTime getPreviousDateTime(const QDateTime &afterDateTime) const;
 
+    /**
+      Returns a generator for the date/times of the recurrence strictly later
+      than @p from, in chronological order. The generator yields the same
+      date/times as calling getNextDateTime() again and again.
+
+      The generator keeps its position in every rule and in the date lists, so
+      each step only advances the rules which produced the occurrence. Use it
+      instead of getNextDateTime() to walk through many occurrences.
+
+      @param from the date/time after which to start
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT OccurrenceGenerator occurrences(const QDateTime &from) const;
+
     /** Returns frequency of recurrence, in terms of the recurrence time period type. */
     Q_REQUIRED_RESULT int frequency() const;
 
@@ -565,6 +637,21 @@ public:
     /** Upper date limit for recurrences */
     static const QDate MAX_DATE;
 
+    /**
+      Returns the approximate number of bytes this recurrence takes in memory,
+      including its rules and approximateCacheSize().
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT qint64 approximateMemoryUsage() const;
+
+    /**
+      Returns the approximate number of bytes taken by the occurrences cached
+      by the recurrence rules.
+      @see RecurrenceRule::approximateCacheSize()
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT qint64 approximateCacheSize() const;
+
     /**
       Debug output.
     */
@@ -23,18 +23,30 @@
 #include "utils_p.h"
 #include "kcalendarcore_debug.h"
 #include "recurrencehelper_p.h"
+#include "memorysize_p.h"
 
 #include <QDataStream>
+#include <QGlobalStatic>
+#include <QHash>
+#include <QMutex>
 #include <QStringList>
 #include <QTime>
 #include <QTimeZone>
+#include <QVarLengthArray>
 #include <QVector>
 
+#include <limits>
+
 using namespace KCalendarCore;
 
 // Maximum number of intervals to process
 const int LOOP_LIMIT = 10000;
 
+// Occurrences found by expanding constraints, as milliseconds since the epoch.
+// The expansion only converts to QDateTime at the public API, and callers
+// reuse one buffer for all the intervals they look at.
+typedef QVarLengthArray<qint64, 64> DateTimeBuffer;
+
 #ifndef NDEBUG
 static QString dumpTime(const QDateTime &dt, bool allDay);     // for debugging
 #endif
@@ -47,7 +59,8 @@ static QString dumpTime(const QDateTime &dt, bool allDay);     // for debugging
 = recurrences. For example, if getNextDate() is called repeatedly to      =
 = check all consecutive occurrences over a few years, on a slow machine   =
 = this could take many seconds to complete in the worst case. Simple      =
-= sub-daily recurrences are optimised by use of mTimedRepetition.         =
+= sub-daily recurrences are optimised by use of mTimedRepetition, the     =
+= common daily, weekly, monthly and yearly ones by SimpleRule.            =
 =                                                                         =
 ==========================================================================*/
 
@@ -170,6 +183,205 @@ int DateHelper::getWeekNumberNeg(const QDate &date, short weekstart, int *year)
 }
 //@endcond
 
+/**************************************************************************
+ *                               ZoneOffsets                              *
+ **************************************************************************/
+
+//@cond PRIVATE
+/**
+  Converts between UTC, as milliseconds since the epoch, and local times in a
+  time zone, as a date (which is a Julian day number) and seconds since
+  midnight. The offsets come from a table of the zone's transitions, so the
+  recurrence engine doesn't need QDateTime to step through intervals.
+
+  Local times near a transition, which are missing or ambiguous, and times
+  outside of the table are converted by QDateTime. Results are therefore
+  always the same as QDateTime's. Tables are built once per time zone and
+  shared by all rules.
+*/
+class ZoneOffsets
+{
+public:
+    static const ZoneOffsets *forZone(const QTimeZone &zone);
+
+    const QTimeZone &zone() const
+    {
+        return mZone;
+    }
+
+    // The local time at a UTC time
+    void toLocal(qint64 msecs, QDate *date, int *secs) const;
+    // The UTC time of a local time, the same as QDateTime(...).toMSecsSinceEpoch()
+    qint64 toMSecs(const QDate &date, int secs) const;
+    // The UTC time of a local time. Returns false if the local time doesn't exist.
+    bool toExactMSecs(const QDate &date, int secs, qint64 *msecs) const;
+
+private:
+    explicit ZoneOffsets(const QTimeZone &zone);
+    bool localOffset(qint64 local, int *offset) const;
+    static qint64 localMSecs(const QDate &date, int secs);
+    QDateTime localDateTime(const QDate &date, int secs) const;
+
+    struct Transition {
+        qint64 atMSecs;     // UTC time of the transition
+        int offsetBefore;   // seconds
+        int offsetAfter;    // seconds
+    };
+
+    QTimeZone mZone;
+    QVector<Transition> mTransitions;
+    qint64 mFirstMSecs;     // the table covers UTC times from mFirstMSecs
+    qint64 mLastMSecs;      // up to, but excluding, mLastMSecs
+    int mInitialOffset;     // offset before the first transition
+};
+
+namespace {
+struct ZoneOffsetsCache {
+    ~ZoneOffsetsCache()
+    {
+        qDeleteAll(tables);
+    }
+
+    QMutex mutex;
+    QHash<QByteArray, const ZoneOffsets *> tables;
+};
+}
+
+Q_GLOBAL_STATIC(ZoneOffsetsCache, sZoneOffsets)
+
+static const qint64 EpochJulianDay = 2440588;   // Jan 1, 1970
+static const qint64 MSecsPerDay = 86400000;
+
+ZoneOffsets::ZoneOffsets(const QTimeZone &zone)
+    : mZone(zone),
+      mFirstMSecs(0),
+      mLastMSecs(0),
+      mInitialOffset(0)
+{
+    if (!zone.isValid()) {
+        return;     // leave everything to QDateTime
+    }
+    const QDateTime first(QDate(1900, 1, 1), QTime(0, 0), Qt::UTC);
+    const QDateTime last(QDate(2200, 1, 1), QTime(0, 0), Qt::UTC);
+    mInitialOffset = zone.offsetFromUtc(first);
+    int offset = mInitialOffset;
+    if (zone.hasTransitions()) {
+        const QTimeZone::OffsetDataList transitions = zone.transitions(first, last);
+        mTransitions.reserve(transitions.count());
+        for (const QTimeZone::OffsetData &data : transitions) {
+            // Some transitions only change the abbreviation or the daylight time flag
+            if (data.offsetFromUtc != offset) {
+                const Transition transition = { data.atUtc.toMSecsSinceEpoch(), offset, data.offsetFromUtc };
+                mTransitions.append(transition);
+                offset = data.offsetFromUtc;
+            }
+        }
+    }
+    mFirstMSecs = first.toMSecsSinceEpoch();
+    // Backends may not know transitions far in the future. Only trust the table
+    // up to its end if the last offset really stays in effect.
+    if (zone.offsetFromUtc(last) == offset && zone.offsetFromUtc(last.addMonths(-6)) == offset) {
+        mLastMSecs = last.toMSecsSinceEpoch();
+    } else {
+        mLastMSecs = mTransitions.isEmpty() ? mFirstMSecs : mTransitions.last().atMSecs;
+    }
+}
+
+const ZoneOffsets *ZoneOffsets::forZone(const QTimeZone &zone)
+{
+    ZoneOffsetsCache *cache = sZoneOffsets();
+    QMutexLocker locker(&cache->mutex);
+    const ZoneOffsets *&offsets = cache->tables[zone.id()];
+    if (!offsets) {
+        offsets = new ZoneOffsets(zone);
+    }
+    return offsets;
+}
+
+qint64 ZoneOffsets::localMSecs(const QDate &date, int secs)
+{
+    return (date.toJulianDay() - EpochJulianDay) * MSecsPerDay + 1000LL * secs;
+}
+
+QDateTime ZoneOffsets::localDateTime(const QDate &date, int secs) const
+{
+    return QDateTime(date, QTime::fromMSecsSinceStartOfDay(1000 * secs), mZone);
+}
+
+// Find the offset in effect at a local time. Returns false if the table
+// doesn't tell, because the time is outside of it or close to a transition.
+bool ZoneOffsets::localOffset(qint64 local, int *offset) const
+{
+    // Local times are less than a day away from UTC
+    if (local < mFirstMSecs + MSecsPerDay || local >= mLastMSecs - MSecsPerDay) {
+        return false;
+    }
+    // Around a transition, local times between the old and the new offset are
+    // missing (if the offset increases) or repeated (if it decreases).
+    const auto it = std::upper_bound(mTransitions.constBegin(), mTransitions.constEnd(), local,
+    [](qint64 l, const Transition &t) {
+        return l < t.atMSecs + 1000LL * qMin(t.offsetBefore, t.offsetAfter);
+    });
+    if (it == mTransitions.constBegin()) {
+        *offset = mInitialOffset;
+        return true;
+    }
+    const Transition &transition = *(it - 1);
+    if (local < transition.atMSecs + 1000LL * qMax(transition.offsetBefore, transition.offsetAfter)) {
+        return false;
+    }
+    *offset = transition.offsetAfter;
+    return true;
+}
+
+void ZoneOffsets::toLocal(qint64 msecs, QDate *date, int *secs) const
+{
+    if (msecs < mFirstMSecs || msecs >= mLastMSecs) {
+        const QDateTime dt = QDateTime::fromMSecsSinceEpoch(msecs, mZone);
+        *date = dt.date();
+        *secs = dt.time().msecsSinceStartOfDay() / 1000;
+        return;
+    }
+    const auto it = std::upper_bound(mTransitions.constBegin(), mTransitions.constEnd(), msecs,
+    [](qint64 m, const Transition &t) {
+        return m < t.atMSecs;
+    });
+    const int offset = (it == mTransitions.constBegin()) ? mInitialOffset : (it - 1)->offsetAfter;
+    const qint64 local = msecs + 1000LL * offset;
+    // Round the day down, even before the epoch
+    const qint64 day = (local >= 0 ? local : local - MSecsPerDay + 1) / MSecsPerDay;
+    *date = QDate::fromJulianDay(EpochJulianDay + day);
+    *secs = static_cast<int>((local - day * MSecsPerDay) / 1000);
+}
+
+qint64 ZoneOffsets::toMSecs(const QDate &date, int secs) const
+{
+    const qint64 local = localMSecs(date, secs);
+    int offset;
+    if (localOffset(local, &offset)) {
+        return local - 1000LL * offset;
+    }
+    return localDateTime(date, secs).toMSecsSinceEpoch();
+}
+
+bool ZoneOffsets::toExactMSecs(const QDate &date, int secs, qint64 *msecs) const
+{
+    const qint64 local = localMSecs(date, secs);
+    int offset;
+    if (localOffset(local, &offset)) {
+        *msecs = local - 1000LL * offset;
+        return true;
+    }
+    // QDateTime moves times in a gap, if it accepts them at all
+    const QDateTime dt = localDateTime(date, secs);
+    if (!dt.isValid() || dt.time().msecsSinceStartOfDay() != 1000 * secs) {
+        return false;
+    }
+    *msecs = dt.toMSecsSinceEpoch();
+    return true;
+}
+//@endcond
+
 /**************************************************************************
  *                               WDayPos                                  *
  **************************************************************************/
@@ -194,8 +406,9 @@ public:
     typedef QVector<Constraint> List;
 
     Constraint() {}
-    explicit Constraint(const QTimeZone &, int wkst = 1);
-    Constraint(const QDateTime &dt, RecurrenceRule::PeriodType type, int wkst);
+    explicit Constraint(const ZoneOffsets *offsets, int wkst = 1);
+    Constraint(const ZoneOffsets *offsets, const QDate &date, int secs,
+               RecurrenceRule::PeriodType type, int wkst);
     void clear();
     void setYear(int n)
     {
@@ -264,37 +477,45 @@ public:
     int weeknumber; //  0 means unspecified
     int yearday;    //  0 means unspecified
     int weekstart;  //  first day of week (1=monday, 7=sunday, 0=unspec.)
-    QTimeZone timeZone;   // time zone etc. to use
+    const ZoneOffsets *offsets;   // time zone to use
 
-    bool readDateTime(const QDateTime &dt, RecurrenceRule::PeriodType type);
+    bool readDateTime(const QDate &date, int secs, RecurrenceRule::PeriodType type);
     bool matches(const QDate &dt, RecurrenceRule::PeriodType type) const;
     bool matches(const QDateTime &dt, RecurrenceRule::PeriodType type) const;
     bool merge(const Constraint &interval);
     bool isConsistent(RecurrenceRule::PeriodType period) const;
     bool increase(RecurrenceRule::PeriodType type, int freq);
     QDateTime intervalDateTime(RecurrenceRule::PeriodType type) const;
-    QList<QDateTime> dateTimes(RecurrenceRule::PeriodType type) const;
-    void appendDateTime(const QDate &date, const QTime &time, QList<QDateTime> &list) const;
+    qint64 intervalMSecs(RecurrenceRule::PeriodType type) const;
+    void dateTimes(RecurrenceRule::PeriodType type, DateTimeBuffer &buffer) const;
+    void appendDateTime(const QDate &date, int secs, RecurrenceRule::PeriodType type,
+                        DateTimeBuffer &buffer) const;
     void dump() const;
 
 private:
+    QDate intervalStart(RecurrenceRule::PeriodType type, int *secs) const;
+
     mutable bool useCachedDt;
-    mutable QDateTime cachedDt;
+    mutable qint64 cachedDt;    // start of the interval, milliseconds since the epoch
 };
 
-Constraint::Constraint(const QTimeZone &timeZone, int wkst)
+// intervalMSecs() of an interval without a valid start
+static const qint64 InvalidMSecs = std::numeric_limits<qint64>::max();
+
+Constraint::Constraint(const ZoneOffsets *offsets, int wkst)
     : weekstart(wkst),
-      timeZone(timeZone)
+      offsets(offsets)
 {
     clear();
 }
 
-Constraint::Constraint(const QDateTime &dt, RecurrenceRule::PeriodType type, int wkst)
+Constraint::Constraint(const ZoneOffsets *offsets, const QDate &date, int secs,
+                       RecurrenceRule::PeriodType type, int wkst)
     : weekstart(wkst),
-      timeZone(dt.timeZone())
+      offsets(offsets)
 {
     clear();
-    readDateTime(dt, type);
+    readDateTime(date, secs, type);
 }
 
 void Constraint::clear()
@@ -317,32 +538,34 @@ bool Constraint::matches(const QDate &dt, RecurrenceRule::PeriodType type) const
     // If the event recurs in week 53 or 1, the day might not belong to the same
     // year as the week it is in. E.g. Jan 1, 2005 is in week 53 of year 2004.
     // So we can't simply check the year in that case!
+    int y, m, d;
+    dt.getDate(&y, &m, &d);
     if (weeknumber == 0) {
-        if (year > 0 && year != dt.year()) {
+        if (year > 0 && year != y) {
             return false;
         }
     } else {
-        int y = 0;
+        int weekYear = 0;
         if (weeknumber > 0 &&
-                weeknumber != DateHelper::getWeekNumber(dt, weekstart, &y)) {
+                weeknumber != DateHelper::getWeekNumber(dt, weekstart, &weekYear)) {
             return false;
         }
         if (weeknumber < 0 &&
-                weeknumber != DateHelper::getWeekNumberNeg(dt, weekstart, &y)) {
+                weeknumber != DateHelper::getWeekNumberNeg(dt, weekstart, &weekYear)) {
             return false;
         }
-        if (year > 0 && year != y) {
+        if (year > 0 && year != weekYear) {
             return false;
         }
     }
 
-    if (month > 0 && month != dt.month()) {
+    if (month > 0 && month != m) {
         return false;
     }
-    if (day > 0 && day != dt.day()) {
+    if (day > 0 && day != d) {
         return false;
     }
-    if (day < 0 && dt.day() != (dt.daysInMonth() + day + 1)) {
+    if (day < 0 && d != (dt.daysInMonth() + day + 1)) {
         return false;
     }
     if (weekday > 0) {
@@ -356,11 +579,11 @@ bool Constraint::matches(const QDate &dt, RecurrenceRule::PeriodType type) const
                     (type == RecurrenceRule::rYearly && month > 0)) {
                 // Monthly
                 if (weekdaynr > 0 &&
-                        weekdaynr != (dt.day() - 1) / 7 + 1) {
+                        weekdaynr != (d - 1) / 7 + 1) {
                     return false;
                 }
                 if (weekdaynr < 0 &&
-                        weekdaynr != -((dt.daysInMonth() - dt.day()) / 7 + 1)) {
+                        weekdaynr != -((dt.daysInMonth() - d) / 7 + 1)) {
                     return false;
                 }
             } else {
@@ -405,51 +628,52 @@ bool Constraint::isConsistent(RecurrenceRule::PeriodType /*period*/) const
     return true;
 }
 
-// Return a date/time set to the constraint values, but with those parts less
-// significant than the given period type set to 1 (for dates) or 0 (for times).
-QDateTime Constraint::intervalDateTime(RecurrenceRule::PeriodType type) const
+// Return the local date and time set to the constraint values, but with those parts
+// less significant than the given period type set to 1 (for dates) or 0 (for times).
+QDate Constraint::intervalStart(RecurrenceRule::PeriodType type, int *secs) const
 {
-    if (useCachedDt) {
-        return cachedDt;
-    }
-    QDate d;
-    QTime t(0, 0, 0);
-    bool subdaily = true;
+    *secs = 0;
     switch (type) {
     case RecurrenceRule::rSecondly:
-        t.setHMS(hour, minute, second);
+        *secs = 3600 * hour + 60 * minute + second;
         break;
     case RecurrenceRule::rMinutely:
-        t.setHMS(hour, minute, 0);
+        *secs = 3600 * hour + 60 * minute;
         break;
     case RecurrenceRule::rHourly:
-        t.setHMS(hour, 0, 0);
-        break;
-    case RecurrenceRule::rDaily:
+        *secs = 3600 * hour;
         break;
     case RecurrenceRule::rWeekly:
-        d = DateHelper::getNthWeek(year, weeknumber, weekstart);
-        subdaily = false;
-        break;
+        return DateHelper::getNthWeek(year, weeknumber, weekstart);
     case RecurrenceRule::rMonthly:
-        d.setDate(year, month, 1);
-        subdaily = false;
-        break;
+        return QDate(year, month, 1);
     case RecurrenceRule::rYearly:
-        d.setDate(year, 1, 1);
-        subdaily = false;
-        break;
+        return QDate(year, 1, 1);
     default:
         break;
     }
-    if (subdaily) {
-        d = DateHelper::getDate(year, (month > 0) ? month : 1, day ? day : 1);
+    return DateHelper::getDate(year, (month > 0) ? month : 1, day ? day : 1);
+}
+
+// Return the start of the interval in milliseconds since the epoch, or
+// InvalidMSecs if the constraint values don't give a valid date.
+qint64 Constraint::intervalMSecs(RecurrenceRule::PeriodType type) const
+{
+    if (!useCachedDt) {
+        int secs;
+        const QDate date = intervalStart(type, &secs);
+        cachedDt = date.isValid() ? offsets->toMSecs(date, secs) : InvalidMSecs;
+        useCachedDt = true;
     }
-    cachedDt = QDateTime(d, t, timeZone);
-    useCachedDt = true;
     return cachedDt;
 }
 
+QDateTime Constraint::intervalDateTime(RecurrenceRule::PeriodType type) const
+{
+    const qint64 msecs = intervalMSecs(type);
+    return msecs == InvalidMSecs ? QDateTime() : QDateTime::fromMSecsSinceEpoch(msecs, offsets->zone());
+}
+
 bool Constraint::merge(const Constraint &interval)
 {
 #define mergeConstraint( name, cmparison ) \
@@ -496,19 +720,22 @@ bool Constraint::merge(const Constraint &interval)
 //           x       | x  x  x |  x  ?  | (-)| (-)
 // 5) All possiblecases have already been treated, so this must be an error!
 
-QList<QDateTime> Constraint::dateTimes(RecurrenceRule::PeriodType type) const
+// Append the date/times matching the constraint to the buffer, unsorted.
+void Constraint::dateTimes(RecurrenceRule::PeriodType type, DateTimeBuffer &buffer) const
 {
-    QList<QDateTime> result;
     if (!isConsistent(type)) {
-        return result;
+        return;
     }
 
     // TODO_Recurrence: Handle all-day
-    QTime tm(hour, minute, second);
+    if (hour < 0 || minute < 0 || second < 0) {
+        return;
+    }
+    const int tm = 3600 * hour + 60 * minute + second;
 
     bool done = false;
     if (day && month > 0) {
-        appendDateTime(DateHelper::getDate(year, month, day), tm, result);
+        appendDateTime(DateHelper::getDate(year, month, day), tm, type, buffer);
         done = true;
     }
 
@@ -530,7 +757,7 @@ QList<QDateTime> Constraint::dateTimes(RecurrenceRule::PeriodType type) const
             }
             uint d = dstart;
             for (QDate dt(year, m, dstart);; dt = dt.addDays(1)) {
-                appendDateTime(dt, tm, result);
+                appendDateTime(dt, tm, type, buffer);
                 if (++d > dend) {
                     break;
                 }
@@ -545,7 +772,7 @@ QList<QDateTime> Constraint::dateTimes(RecurrenceRule::PeriodType type) const
         // yearday < 0 means from end of year, so we'll need Jan 1 of the next year
         QDate d(year + ((yearday > 0) ? 0 : 1), 1, 1);
         d = d.addDays(yearday - ((yearday > 0) ? 1 : 0));
-        appendDateTime(d, tm, result);
+        appendDateTime(d, tm, type, buffer);
         done = true;
     }
 
@@ -554,10 +781,10 @@ QList<QDateTime> Constraint::dateTimes(RecurrenceRule::PeriodType type) const
         QDate wst(DateHelper::getNthWeek(year, weeknumber, weekstart));
         if (weekday != 0) {
             wst = wst.addDays((7 + weekday - weekstart) % 7);
-            appendDateTime(wst, tm, result);
+            appendDateTime(wst, tm, type, buffer);
         } else {
             for (int i = 0; i < 7; ++i) {
-                appendDateTime(wst, tm, result);
+                appendDateTime(wst, tm, type, buffer);
                 wst = wst.addDays(1);
             }
         }
@@ -589,104 +816,107 @@ QList<QDateTime> Constraint::dateTimes(RecurrenceRule::PeriodType type) const
 
         if (weekdaynr > 0) {
             dt = dt.addDays((weekdaynr - 1) * 7);
-            appendDateTime(dt, tm, result);
+            appendDateTime(dt, tm, type, buffer);
         } else if (weekdaynr < 0) {
             dt = dt.addDays(weekdaynr * 7);
-            appendDateTime(dt, tm, result);
+            appendDateTime(dt, tm, type, buffer);
         } else {
             // loop through all possible weeks, non-matching will be filtered later
             for (int i = 0; i < maxloop; ++i) {
-                appendDateTime(dt, tm, result);
+                appendDateTime(dt, tm, type, buffer);
                 dt = dt.addDays(7);
             }
         }
     } // weekday != 0
 
-    // Only use those times that really match all other constraints, too
-    QList<QDateTime> valid;
-    for (int i = 0, iend = result.count();  i < iend;  ++i) {
-        if (matches(result[i], type)) {
-            valid.append(result[i]);
-        }
-    }
-    // Don't sort it here, would be unnecessary work. The results from all
+    // Don't sort here, would be unnecessary work. The results from all
     // constraints will be merged to one big list of the interval. Sort that one!
-    return valid;
 }
 
-void Constraint::appendDateTime(const QDate &date, const QTime &time,
-                                QList<QDateTime> &list) const
+// Append a candidate date/time if it really matches all other constraints, too.
+void Constraint::appendDateTime(const QDate &date, int secs,
+                                RecurrenceRule::PeriodType type, DateTimeBuffer &buffer) const
 {
-    QDateTime dt(date, time, timeZone);
-    if (dt.isValid()) {
-        list.append(dt);
+    // The date is much cheaper to check than the time, which needs the time zone
+    if (!date.isValid() || !matches(date, type)) {
+        return;
+    }
+    qint64 msecs;
+    if (offsets->toExactMSecs(date, secs, &msecs)) {
+        buffer.append(msecs);
     }
 }
 
 bool Constraint::increase(RecurrenceRule::PeriodType type, int freq)
 {
-    // convert the first day of the interval to QDateTime
-    intervalDateTime(type);
-
-    // Now add the intervals
+    // Sub-daily intervals have a fixed length, the others are stepped in local time
+    QDate date;
+    int secs = 0;
     switch (type) {
     case RecurrenceRule::rSecondly:
-        cachedDt = cachedDt.addSecs(freq);
-        break;
     case RecurrenceRule::rMinutely:
-        cachedDt = cachedDt.addSecs(60 * freq);
-        break;
-    case RecurrenceRule::rHourly:
-        cachedDt = cachedDt.addSecs(3600 * freq);
-        break;
+    case RecurrenceRule::rHourly: {
+        const qint64 start = intervalMSecs(type);
+        if (start == InvalidMSecs) {
+            return true;
+        }
+        const int length = (type == RecurrenceRule::rHourly) ? 3600
+                           : (type == RecurrenceRule::rMinutely) ? 60 : 1;
+        const qint64 msecs = start + 1000LL * length * freq;
+        offsets->toLocal(msecs, &date, &secs);
+        readDateTime(date, secs, type);
+        cachedDt = msecs;
+        useCachedDt = true;   // readDateTime() resets this
+        return true;
+    }
     case RecurrenceRule::rDaily:
-        cachedDt = cachedDt.addDays(freq);
+        date = intervalStart(type, &secs).addDays(freq);
         break;
     case RecurrenceRule::rWeekly:
-        cachedDt = cachedDt.addDays(7 * freq);
+        date = intervalStart(type, &secs).addDays(7 * freq);
         break;
     case RecurrenceRule::rMonthly:
-        cachedDt = cachedDt.addMonths(freq);
+        date = QDate(year, month, 1).addMonths(freq);
         break;
     case RecurrenceRule::rYearly:
-        cachedDt = cachedDt.addYears(freq);
+        date = QDate(year, 1, 1).addYears(freq);
         break;
     default:
-        break;
+        return true;
     }
-    // Convert back from QDateTime to the Constraint class
-    readDateTime(cachedDt, type);
-    useCachedDt = true;   // readDateTime() resets this
-
+    // Convert back to the Constraint class
+    readDateTime(date, secs, type);
     return true;
 }
 
-// Set the constraint's value appropriate to 'type', to the value contained in a date/time.
-bool Constraint::readDateTime(const QDateTime &dt, RecurrenceRule::PeriodType type)
+// Set the constraint's value appropriate to 'type', to the value contained in a local date/time.
+bool Constraint::readDateTime(const QDate &date, int secs, RecurrenceRule::PeriodType type)
 {
+    int y, m, d;
+    date.getDate(&y, &m, &d);
     switch (type) {
     // Really fall through! Only weekly needs to be treated differently!
     case RecurrenceRule::rSecondly:
-        second = dt.time().second();
+        second = secs % 60;
         Q_FALLTHROUGH();
     case RecurrenceRule::rMinutely:
-        minute = dt.time().minute();
+        minute = (secs / 60) % 60;
         Q_FALLTHROUGH();
     case RecurrenceRule::rHourly:
-        hour = dt.time().hour();
+        hour = secs / 3600;
         Q_FALLTHROUGH();
     case RecurrenceRule::rDaily:
-        day = dt.date().day();
+        day = d;
         Q_FALLTHROUGH();
     case RecurrenceRule::rMonthly:
-        month = dt.date().month();
+        month = m;
         Q_FALLTHROUGH();
     case RecurrenceRule::rYearly:
-        year = dt.date().year();
+        year = y;
         break;
     case RecurrenceRule::rWeekly:
         // Determine start day of the current week, calculate the week number from that
-        weeknumber = DateHelper::getWeekNumber(dt.date(), weekstart, &year);
+        weeknumber = DateHelper::getWeekNumber(date, weekstart, &year);
         break;
     default:
         break;
@@ -696,6 +926,502 @@ bool Constraint::readDateTime(const QDateTime &dt, RecurrenceRule::PeriodType ty
 }
 //@endcond
 
+/**************************************************************************
+ *                               SimpleRule                               *
+ **************************************************************************/
+
+//@cond PRIVATE
+/**
+  Closed-form evaluation of the most common rule shapes: daily without any
+  BY parts, weekly on some days of the week, monthly on some days of the
+  month or on some n-th weekdays, and yearly on some days of some months.
+  All of them recur at the time of day of the start date/time.
+
+  Each period (day, week, month or year) of such a rule has a small set of
+  candidate dates which can be computed directly, instead of by merging and
+  expanding Constraints. A candidate is an occurrence if its time of day
+  exists on that date in the rule's time zone, which is what
+  Constraint::dateTimes() checks too.
+
+  Periods are numbered from the one containing the start date, only those
+  whose number is a multiple of the frequency have occurrences.
+*/
+class SimpleRule
+{
+public:
+    /**
+      Sets up the evaluation of a rule. Returns false, leaving the object
+      invalid, if the rule doesn't have one of the simple shapes.
+    */
+    bool setRule(RecurrenceRule::PeriodType period, uint frequency, const QDateTime &start,
+                 short weekStart, const QList<RecurrenceRule::WDayPos> &byDays,
+                 const QList<int> &byMonthDays, const QList<int> &byMonths, bool otherByRules);
+
+    bool isValid() const
+    {
+        return mShape != None;
+    }
+
+    /**
+      Returns the occurrence on @p date, a date in the rule's time zone,
+      or an invalid date/time if there is none.
+    */
+    QDateTime occurrence(const QDate &date) const;
+
+    /**
+      Appends the occurrences from @p from on to @p list, up to and including
+      @p to if that is valid, and at most @p maxCount of them if that is not 0.
+      Like the generic code, it looks at no more than LOOP_LIMIT periods.
+    */
+    void occurrences(const QDateTime &from, const QDateTime &to, int maxCount, QList<QDateTime> *list) const;
+
+    /**
+      Returns the first occurrence after @p after.
+    */
+    QDateTime next(const QDateTime &after) const;
+
+    /**
+      Returns the last occurrence before @p before.
+    */
+    QDateTime previous(const QDateTime &before) const;
+
+    /**
+      Returns the number of occurrences up to and including @p to.
+    */
+    int count(const QDateTime &to) const;
+
+    qint64 approximateMemoryUsage() const
+    {
+        return MemorySize::heapSize(mWeekDays) + MemorySize::heapSize(mMonthDays)
+               + MemorySize::heapSize(mWeekDayPositions) + MemorySize::heapSize(mMonths);
+    }
+
+private:
+    typedef QVarLengthArray<QDate, 32> Dates;
+
+    enum Shape {
+        None,
+        Daily,
+        Weekly,
+        MonthlyByDay,
+        MonthlyByWeekday,
+        Yearly
+    };
+
+    qint64 weekStartDay(const QDate &date) const
+    {
+        return date.toJulianDay() - (7 + date.dayOfWeek() - mWeekStart) % 7;
+    }
+    qint64 periodOf(const QDate &date) const;
+    QDate lastDayOfPeriod(qint64 period) const;
+    void periodDates(qint64 period, Dates *dates) const;
+    static void appendMonthDays(const QDate &first, const QVector<int> &days, Dates *dates);
+    bool isCandidate(const QDate &date) const;
+    QDateTime dateTime(const QDate &date) const;
+    qint64 candidatesBefore(const QDate &date) const;
+    qint64 missingBefore(const QDate &date) const;
+
+    Shape mShape = None;
+    qint64 mFrequency = 0;
+    QDateTime mStart;
+    QDate mStartDate;
+    QTime mTime;
+    QTimeZone mTimeZone;
+    qint64 mFirstPeriod = 0;          // day, week start day, month (12 * year + month - 1) or year of the start
+    short mWeekStart = 1;
+    QVector<int> mWeekDays;           // weekly: days since the start of the week, sorted
+    QVector<int> mMonthDays;          // monthly and yearly: 1 to 31, or -31 to -1 from the end of the month
+    QVector<RecurrenceRule::WDayPos> mWeekDayPositions; // monthly by weekday
+    QVector<int> mMonths;             // yearly: 1 to 12, sorted
+};
+
+bool SimpleRule::setRule(RecurrenceRule::PeriodType period, uint frequency, const QDateTime &start,
+                         short weekStart, const QList<RecurrenceRule::WDayPos> &byDays,
+                         const QList<int> &byMonthDays, const QList<int> &byMonths, bool otherByRules)
+{
+    mShape = None;
+    mWeekDays.clear();
+    mMonthDays.clear();
+    mWeekDayPositions.clear();
+    mMonths.clear();
+    // Occurrences are at whole seconds, a start with milliseconds isn't one
+    if (otherByRules || frequency == 0 || !start.isValid() || start.time().msec() != 0
+            || weekStart < 1 || weekStart > 7) {
+        return false;
+    }
+
+    for (int day : byMonthDays) {
+        if (day == 0 || day < -31 || day > 31) {
+            return false;
+        }
+        mMonthDays.append(day);
+    }
+    if (mMonthDays.isEmpty()) {
+        mMonthDays.append(start.date().day());
+    }
+
+    Shape shape = None;
+    switch (period) {
+    case RecurrenceRule::rDaily:
+        if (!byDays.isEmpty() || !byMonthDays.isEmpty() || !byMonths.isEmpty()) {
+            return false;
+        }
+        shape = Daily;
+        mFirstPeriod = start.date().toJulianDay();
+        break;
+    case RecurrenceRule::rWeekly:
+        if (!byMonthDays.isEmpty() || !byMonths.isEmpty()) {
+            return false;
+        }
+        for (const RecurrenceRule::WDayPos &day : byDays) {
+            if (day.pos() != 0 || day.day() < 1 || day.day() > 7) {
+                return false;
+            }
+            mWeekDays.append((7 + day.day() - weekStart) % 7);
+        }
+        if (mWeekDays.isEmpty()) {
+            mWeekDays.append((7 + start.date().dayOfWeek() - weekStart) % 7);
+        }
+        sortAndRemoveDuplicates(mWeekDays);
+        shape = Weekly;
+        mWeekStart = weekStart;
+        mFirstPeriod = weekStartDay(start.date());
+        break;
+    case RecurrenceRule::rMonthly:
+        if (!byMonths.isEmpty() || (!byDays.isEmpty() && !byMonthDays.isEmpty())) {
+            return false;
+        }
+        for (const RecurrenceRule::WDayPos &day : byDays) {
+            if (day.day() < 1 || day.day() > 7) {
+                return false;
+            }
+            mWeekDayPositions.append(day);
+        }
+        shape = byDays.isEmpty() ? MonthlyByDay : MonthlyByWeekday;
+        mFirstPeriod = 12 * start.date().year() + start.date().month() - 1;
+        break;
+    case RecurrenceRule::rYearly:
+        if (!byDays.isEmpty()) {
+            return false;
+        }
+        for (int month : byMonths) {
+            if (month < 1 || month > 12) {
+                return false;
+            }
+            mMonths.append(month);
+        }
+        if (mMonths.isEmpty()) {
+            mMonths.append(start.date().month());
+        }
+        sortAndRemoveDuplicates(mMonths);
+        shape = Yearly;
+        mFirstPeriod = start.date().year();
+        break;
+    default:
+        return false;
+    }
+
+    mShape = shape;
+    mFrequency = frequency;
+    mStart = start;
+    mStartDate = start.date();
+    mTime = start.time();
+    mTimeZone = start.timeZone();
+    return true;
+}
+
+qint64 SimpleRule::periodOf(const QDate &date) const
+{
+    switch (mShape) {
+    case Daily:
+        return date.toJulianDay() - mFirstPeriod;
+    case Weekly:
+        return (weekStartDay(date) - mFirstPeriod) / 7;
+    case MonthlyByDay:
+    case MonthlyByWeekday:
+        return 12 * date.year() + date.month() - 1 - mFirstPeriod;
+    case Yearly:
+        return date.year() - mFirstPeriod;
+    default:
+        return -1;
+    }
+}
+
+QDate SimpleRule::lastDayOfPeriod(qint64 period) const
+{
+    switch (mShape) {
+    case Daily:
+        return QDate::fromJulianDay(mFirstPeriod + period);
+    case Weekly:
+        return QDate::fromJulianDay(mFirstPeriod + 7 * period + 6);
+    case MonthlyByDay:
+    case MonthlyByWeekday: {
+        const qint64 month = mFirstPeriod + period;
+        const QDate first(int(month / 12), int(month % 12) + 1, 1);
+        return first.addDays(first.daysInMonth() - 1);
+    }
+    case Yearly:
+        return QDate(int(mFirstPeriod + period), 12, 31);
+    default:
+        return QDate();
+    }
+}
+
+void SimpleRule::appendMonthDays(const QDate &first, const QVector<int> &days, Dates *dates)
+{
+    const int daysInMonth = first.daysInMonth();
+    for (int day : days) {
+        if (day < 0) {
+            day += daysInMonth + 1;
+        }
+        if (day >= 1 && day <= daysInMonth) {
+            dates->append(first.addDays(day - 1));
+        }
+    }
+}
+
+// The candidate dates of a period, sorted
+void SimpleRule::periodDates(qint64 period, Dates *dates) const
+{
+    dates->clear();
+    switch (mShape) {
+    case Daily:
+        dates->append(QDate::fromJulianDay(mFirstPeriod + period));
+        return;
+    case Weekly: {
+        const qint64 first = mFirstPeriod + 7 * period;
+        for (int day : mWeekDays) {
+            dates->append(QDate::fromJulianDay(first + day));
+        }
+        return;
+    }
+    case MonthlyByDay: {
+        const qint64 month = mFirstPeriod + period;
+        appendMonthDays(QDate(int(month / 12), int(month % 12) + 1, 1), mMonthDays, dates);
+        break;
+    }
+    case MonthlyByWeekday: {
+        const qint64 month = mFirstPeriod + period;
+        const QDate first(int(month / 12), int(month % 12) + 1, 1);
+        const int daysInMonth = first.daysInMonth();
+        for (const RecurrenceRule::WDayPos &position : mWeekDayPositions) {
+            // Days since the first of the month of the first and the last such weekday
+            const int firstDay = (7 + position.day() - first.dayOfWeek()) % 7;
+            const int lastDay = firstDay + (daysInMonth - 1 - firstDay) / 7 * 7;
+            if (position.pos() == 0) {
+                for (int day = firstDay; day <= lastDay; day += 7) {
+                    dates->append(first.addDays(day));
+                }
+            } else {
+                const int day = position.pos() > 0 ? firstDay + 7 * (position.pos() - 1)
+                                                   : lastDay + 7 * (position.pos() + 1);
+                if (day >= 0 && day < daysInMonth) {
+                    dates->append(first.addDays(day));
+                }
+            }
+        }
+        break;
+    }
+    case Yearly: {
+        const int year = int(mFirstPeriod + period);
+        for (int month : mMonths) {
+            appendMonthDays(QDate(year, month, 1), mMonthDays, dates);
+        }
+        break;
+    }
+    default:
+        return;
+    }
+    if (dates->count() > 1) {
+        sortAndRemoveDuplicates(*dates);
+    }
+}
+
+bool SimpleRule::isCandidate(const QDate &date) const
+{
+    const qint64 period = periodOf(date);
+    if (date < mStartDate || period < 0 || period % mFrequency) {
+        return false;
+    }
+    Dates dates;
+    periodDates(period, &dates);
+    return std::binary_search(dates.cbegin(), dates.cend(), date);
+}
+
+QDateTime SimpleRule::dateTime(const QDate &date) const
+{
+    const QDateTime dt(date, mTime, mTimeZone);
+    return dt.isValid() && dt.time() == mTime ? dt : QDateTime();
+}
+
+QDateTime SimpleRule::occurrence(const QDate &date) const
+{
+    return isCandidate(date) ? dateTime(date) : QDateTime();
+}
+
+void SimpleRule::occurrences(const QDateTime &from, const QDateTime &to, int maxCount,
+                             QList<QDateTime> *list) const
+{
+    const QDate fromDate = qMax(from.toTimeZone(mTimeZone).date(), mStartDate);
+    const QDate toDate = to.isValid() ? to.toTimeZone(mTimeZone).date() : QDate();
+    qint64 period = periodOf(fromDate);
+    period += (mFrequency - period % mFrequency) % mFrequency;
+    int count = 0;
+    Dates dates;
+    for (int loop = 0; loop < LOOP_LIMIT; ++loop, period += mFrequency) {
+        periodDates(period, &dates);
+        for (const QDate &date : qAsConst(dates)) {
+            if (date < fromDate) {
+                continue;
+            }
+            const QDateTime dt = dateTime(date);
+            if (!dt.isValid() || dt < from || dt < mStart) {
+                continue;
+            }
+            if (to.isValid() && dt > to) {
+                return;
+            }
+            list->append(dt);
+            if (++count == maxCount) {
+                return;
+            }
+        }
+        if (toDate.isValid() && lastDayOfPeriod(period) >= toDate) {
+            return;
+        }
+    }
+}
+
+QDateTime SimpleRule::next(const QDateTime &after) const
+{
+    QList<QDateTime> list;
+    occurrences(after.addMSecs(1), QDateTime(), 1, &list);
+    return list.isEmpty() ? QDateTime() : list.first();
+}
+
+QDateTime SimpleRule::previous(const QDateTime &before) const
+{
+    const QDate beforeDate = before.toTimeZone(mTimeZone).date();
+    if (beforeDate < mStartDate) {
+        return QDateTime();
+    }
+    qint64 period = periodOf(beforeDate);
+    period -= period % mFrequency;
+    Dates dates;
+    for (int loop = 0; period >= 0 && loop < LOOP_LIMIT; ++loop, period -= mFrequency) {
+        periodDates(period, &dates);
+        for (int i = dates.count() - 1; i >= 0; --i) {
+            const QDate &date = dates.at(i);
+            if (date > beforeDate) {
+                continue;
+            }
+            if (date < mStartDate) {
+                return QDateTime();
+            }
+            const QDateTime dt = dateTime(date);
+            if (dt.isValid() && dt < before) {
+                return dt;
+            }
+        }
+    }
+    return QDateTime();
+}
+
+int SimpleRule::count(const QDateTime &to) const
+{
+    const QDate toDate = to.toTimeZone(mTimeZone).date();
+    if (toDate < mStartDate) {
+        return 0;
+    }
+    qint64 count = candidatesBefore(toDate) - missingBefore(toDate);
+    const QDateTime last = occurrence(toDate);
+    if (last.isValid() && last <= to) {
+        ++count;
+    }
+    return int(qMin<qint64>(count, std::numeric_limits<int>::max()));
+}
+
+// The number of candidates from the start date up to, not including, @p date
+qint64 SimpleRule::candidatesBefore(const QDate &date) const
+{
+    switch (mShape) {
+    case Daily: {
+        const qint64 days = date.toJulianDay() - mFirstPeriod;
+        return (days + mFrequency - 1) / mFrequency;
+    }
+    case Weekly: {
+        const qint64 week = periodOf(date);
+        const int startDay = int(mStartDate.toJulianDay() - mFirstPeriod);
+        const int dateDay = int(date.toJulianDay() - weekStartDay(date));
+        qint64 count = 0;
+        if (week > 0) {
+            // All candidates of the weeks before, except for those before the start
+            count = ((week - 1) / mFrequency + 1) * mWeekDays.count();
+            for (int day : mWeekDays) {
+                if (day < startDay) {
+                    --count;
+                }
+            }
+        }
+        if (week % mFrequency == 0) {
+            for (int day : mWeekDays) {
+                if (day < dateDay && (week > 0 || day >= startDay)) {
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+    default: {
+        // The number of candidates varies from month to month, count them
+        const qint64 last = periodOf(date);
+        qint64 count = 0;
+        Dates dates;
+        for (qint64 period = 0; period <= last; period += mFrequency) {
+            periodDates(period, &dates);
+            for (const QDate &candidate : qAsConst(dates)) {
+                if (candidate >= mStartDate && candidate < date) {
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+    }
+}
+
+// The number of candidates from the start date up to, not including, @p date,
+// whose time of day falls into a gap when the clocks go forward
+qint64 SimpleRule::missingBefore(const QDate &date) const
+{
+    if (!mTimeZone.hasTransitions()) {
+        return 0;
+    }
+    const QTimeZone::OffsetDataList transitions =
+        mTimeZone.transitions(QDateTime(mStartDate.addDays(-1), QTime(0, 0), Qt::UTC),
+                              QDateTime(date.addDays(1), QTime(0, 0), Qt::UTC));
+    qint64 missing = 0;
+    QDate counted;
+    for (const QTimeZone::OffsetData &transition : transitions) {
+        const int offsetBefore = mTimeZone.offsetFromUtc(transition.atUtc.addSecs(-1));
+        if (transition.offsetFromUtc <= offsetBefore) {
+            continue;
+        }
+        // The local dates of the start and the end of the gap
+        const QDate gapStart = transition.atUtc.addSecs(offsetBefore).date();
+        const QDate gapEnd = transition.atUtc.addSecs(transition.offsetFromUtc - 1).date();
+        for (QDate day = gapStart; day <= gapEnd; day = day.addDays(1)) {
+            if ((!counted.isValid() || day > counted) && day < date
+                    && isCandidate(day) && !dateTime(day).isValid()) {
+                ++missing;
+                counted = day;
+            }
+        }
+    }
+    return missing;
+}
+//@endcond
+
 /**************************************************************************
  *                        RecurrenceRule::Private                         *
  **************************************************************************/
@@ -724,9 +1450,18 @@ public:
     void setDirty();
     void buildConstraints();
     bool buildCache() const;
+    bool ensureCache() const;
     Constraint getNextValidDateInterval(const QDateTime &preDate, PeriodType type) const;
     Constraint getPreviousValidDateInterval(const QDateTime &afterDate, PeriodType type) const;
-    QList<QDateTime> datesForInterval(const Constraint &interval, PeriodType type) const;
+    void datesForInterval(const Constraint &interval, PeriodType type, DateTimeBuffer &buffer) const;
+    QDateTime toDateTime(qint64 msecs) const;
+
+    // Whether mSimpleRule can answer queries. Rules with a count need their
+    // end, if not enough occurrences are found the generic code takes over.
+    bool useSimpleRule() const
+    {
+        return mSimpleRule.isValid() && (mDuration <= 0 || mParent->endDt().isValid());
+    }
 
     RecurrenceRule *mParent;
     QString mRRule;            // RRULE string
@@ -756,16 +1491,25 @@ public:
     Constraint::List mConstraints;
     QList<RuleObserver *> mObservers;
 
-    // Cache for duration
+    // Cache for duration. It is filled lazily by const functions, which may run
+    // concurrently, e.g. on incidences shared by MemoryCalendar snapshots.
     mutable QList<QDateTime> mCachedDates;
     mutable QDateTime mCachedDateEnd;
     mutable QDateTime mCachedLastDate;   // when mCachedDateEnd invalid, last date checked
-    mutable bool mCached;
+    mutable QAtomicInt mCached;
+    mutable QMutex mCacheMutex;
 
     bool mIsReadOnly;
     bool mAllDay;
     bool mNoByRules;        // no BySeconds, ByMinutes, ... rules exist
     uint mTimedRepetition;  // repeats at a regular number of seconds interval, or 0
+    SimpleRule mSimpleRule; // closed-form evaluation, valid for the common super-daily rules
+
+    // mDateStart as seen by the constraint engine, updated by buildConstraints()
+    const ZoneOffsets *mZoneOffsets = nullptr;
+    qint64 mStartMSecs = 0;
+    QDate mStartDate;
+    int mStartSecs = 0;
 };
 
 RecurrenceRule::Private::Private(RecurrenceRule *parent, const Private &p)
@@ -878,7 +1622,7 @@ void RecurrenceRule::Private::clear()
 void RecurrenceRule::Private::setDirty()
 {
     buildConstraints();
-    mCached = false;
+    mCached.storeRelease(0);
     mCachedDates.clear();
     for (int i = 0, iend = mObservers.count();  i < iend;  ++i) {
         if (mObservers[i]) {
@@ -964,11 +1708,9 @@ QDateTime RecurrenceRule::endDt(bool *result) const
     }
 
     // N occurrences. Check if we have a full cache. If so, return the cached end date.
-    if (!d->mCached) {
-        // If not enough occurrences can be found (i.e. inconsistent constraints)
-        if (!d->buildCache()) {
-            return QDateTime();
-        }
+    // If not enough occurrences can be found (i.e. inconsistent constraints)
+    if (!d->ensureCache()) {
+        return QDateTime();
     }
     if (result) {
         *result = true;
@@ -1197,7 +1939,14 @@ void RecurrenceRule::Private::buildConstraints()
     mTimedRepetition = 0;
     mNoByRules = mBySetPos.isEmpty();
     mConstraints.clear();
-    Constraint con(mDateStart.timeZone());
+    const QTimeZone timeZone = mDateStart.timeZone();
+    if (!mZoneOffsets || mZoneOffsets->zone() != timeZone) {
+        mZoneOffsets = ZoneOffsets::forZone(timeZone);
+    }
+    mStartMSecs = mDateStart.toMSecsSinceEpoch();
+    mStartDate = mDateStart.date();
+    mStartSecs = mDateStart.time().msecsSinceStartOfDay() / 1000;
+    Constraint con(mZoneOffsets);
     if (mWeekStart > 0) {
         con.setWeekstart(mWeekStart);
     }
@@ -1304,6 +2053,10 @@ void RecurrenceRule::Private::buildConstraints()
     }
 #undef fixConstraint
 
+    mSimpleRule.setRule(mPeriod, mFrequency, mDateStart, mWeekStart, mByDays, mByMonthDays, mByMonths,
+                        !mBySeconds.isEmpty() || !mByMinutes.isEmpty() || !mByHours.isEmpty()
+                        || !mByYearDays.isEmpty() || !mByWeekNumbers.isEmpty() || !mBySetPos.isEmpty());
+
     if (mNoByRules) {
         switch (mPeriod) {
         case rHourly:
@@ -1335,30 +2088,44 @@ void RecurrenceRule::Private::buildConstraints()
 bool RecurrenceRule::Private::buildCache() const
 {
     Q_ASSERT(mDuration > 0);
+    if (mSimpleRule.isValid()) {
+        QList<QDateTime> dts;
+        mSimpleRule.occurrences(mDateStart, QDateTime(), mDuration, &dts);
+        if (dts.count() == mDuration) {
+            mCachedDates = dts;
+            mCachedDateEnd = dts.last();
+            mCached.storeRelease(1);
+            return true;
+        }
+        // Not all occurrences were found, let the generic code find out how far it gets
+    }
+
     // Build the list of all occurrences of this event (we need that to determine
     // the end date!)
     Constraint interval(getNextValidDateInterval(mDateStart, mPeriod));
 
-    auto dts = datesForInterval(interval, mPeriod);
+    const QTimeZone &zone = mZoneOffsets->zone();
+    QList<QDateTime> dts;
+    DateTimeBuffer buffer;
+    datesForInterval(interval, mPeriod, buffer);
     // Only use dates after the event has started (start date is only included
     // if it matches)
-    const auto it = strictLowerBound(dts.begin(), dts.end(), mDateStart);
-    if (it != dts.end()) {
-        dts.erase(dts.begin(), it + 1);
-    }
+    auto it = std::lower_bound(buffer.constBegin(), buffer.constEnd(), mStartMSecs);
 
     // some validity checks to avoid infinite loops (i.e. if we have
     // done this loop already 10000 times, bail out )
-    for (int loopnr = 0; loopnr < LOOP_LIMIT && dts.count() < mDuration; ++loopnr) {
+    for (int loopnr = 0; ; ) {
+        // The buffer is already sorted!
+        for (; it != buffer.constEnd() && dts.count() < mDuration; ++it) {
+            dts.append(QDateTime::fromMSecsSinceEpoch(*it, zone));
+        }
+        if (dts.count() >= mDuration || ++loopnr > LOOP_LIMIT) {
+            break;
+        }
         interval.increase(mPeriod, mFrequency);
-        // The returned date list is already sorted!
-        dts += datesForInterval(interval, mPeriod);
-    }
-    if (dts.count() > mDuration) {
-        // we have picked up more occurrences than necessary, remove them
-        dts.erase(dts.begin() + mDuration, dts.end());
+        datesForInterval(interval, mPeriod, buffer);
+        it = buffer.constBegin();
     }
-    mCached = true;
     mCachedDates = dts;
 
 // it = dts.begin();
@@ -1366,15 +2133,32 @@ bool RecurrenceRule::Private::buildCache() const
 //   qCDebug(KCALCORE_LOG) << "            -=>" << dumpTime(*it);
 //   ++it;
 // }
+    bool complete;
     if (int(dts.count()) == mDuration) {
         mCachedDateEnd = dts.last();
-        return true;
+        complete = true;
     } else {
         // The cached date list is incomplete
         mCachedDateEnd = QDateTime();
         mCachedLastDate = interval.intervalDateTime(mPeriod);
-        return false;
+        complete = false;
+    }
+    mCached.storeRelease(1);
+    return complete;
+}
+
+// Builds the cache unless that was done already. Returns false only if it was
+// just built and turned out incomplete, like buildCache().
+bool RecurrenceRule::Private::ensureCache() const
+{
+    if (mCached.loadAcquire()) {
+        return true;
+    }
+    QMutexLocker locker(&mCacheMutex);
+    if (mCached.loadAcquire()) {
+        return true;
     }
+    return buildCache();
 }
 //@endcond
 
@@ -1413,6 +2197,10 @@ bool RecurrenceRule::recursOn(const QDate &qd, const QTimeZone &timeZone) const
             }
         }
 
+        if (d->useSimpleRule()) {
+            return d->mSimpleRule.occurrence(qd).isValid();
+        }
+
         // The date must be in an appropriate interval (getNextValidDateInterval),
         // Plus it must match at least one of the constraints
         bool match = false;
@@ -1433,16 +2221,20 @@ bool RecurrenceRule::recursOn(const QDate &qd, const QTimeZone &timeZone) const
         // We really need to obtain the list of dates in this interval, since
         // otherwise BYSETPOS will not work (i.e. the date will match the interval,
         // but BYSETPOS selects only one of these matching dates!
-        QDateTime end = start.addDays(1);
+        const qint64 end = start.addDays(1).toMSecsSinceEpoch();
+        DateTimeBuffer dts;
         do {
-            auto dts = d->datesForInterval(interval, recurrenceType());
+            d->datesForInterval(interval, recurrenceType(), dts);
             for (i = 0, iend = dts.count();  i < iend;  ++i) {
-                if (dts[i].date() >= qd) {
-                    return dts[i].date() == qd;
+                QDate date;
+                int secs;
+                d->mZoneOffsets->toLocal(dts[i], &date, &secs);
+                if (date >= qd) {
+                    return date == qd;
                 }
             }
             interval.increase(recurrenceType(), frequency());
-        } while (interval.intervalDateTime(recurrenceType()) < end);
+        } while (interval.intervalMSecs(recurrenceType()) < end);
         return false;
     }
 
@@ -1476,6 +2268,16 @@ bool RecurrenceRule::recursOn(const QDate &qd, const QTimeZone &timeZone) const
         return start.addSecs(d->mTimedRepetition - n) < end;
     }
 
+    if (d->useSimpleRule()) {
+        // The general path below finds occurrences up to and including the end
+        // of the day, but only on the dates up to end.addSecs(-1). So if the day
+        // ends at midnight in the rule's time zone, an occurrence exactly at the
+        // end is on the next date and doesn't count. Otherwise it does.
+        QList<QDateTime> dts;
+        d->mSimpleRule.occurrences(start, end, 1, &dts);
+        return !dts.isEmpty() && dts.first().date() <= end.addSecs(-1).date();
+    }
+
     // Find the start and end dates in the time spec for the rule
     QDate startDay = start.date();
     QDate endDay = end.addSecs(-1).date();
@@ -1497,6 +2299,8 @@ bool RecurrenceRule::recursOn(const QDate &qd, const QTimeZone &timeZone) const
     Constraint interval(d->getNextValidDateInterval(start, recurrenceType()));
     // Constraint::matches is quite efficient, so first check if it can occur at
     // all before we calculate all actual dates.
+    const qint64 startMSecs = start.toMSecsSinceEpoch();
+    const qint64 endMSecs = end.toMSecsSinceEpoch();
     Constraint intervalm = interval;
     do {
         match = intervalm.matches(startDay, recurrenceType());
@@ -1507,8 +2311,7 @@ bool RecurrenceRule::recursOn(const QDate &qd, const QTimeZone &timeZone) const
             break;
         }
         intervalm.increase(recurrenceType(), frequency());
-    } while (intervalm.intervalDateTime(recurrenceType()).isValid() &&
-             intervalm.intervalDateTime(recurrenceType()) < end);
+    } while (intervalm.intervalMSecs(recurrenceType()) < endMSecs);
     if (!match) {
         return false;
     }
@@ -1516,15 +2319,15 @@ bool RecurrenceRule::recursOn(const QDate &qd, const QTimeZone &timeZone) const
     // We really need to obtain the list of dates in this interval, since
     // otherwise BYSETPOS will not work (i.e. the date will match the interval,
     // but BYSETPOS selects only one of these matching dates!
+    DateTimeBuffer dts;
     do {
-        auto dts = d->datesForInterval(interval, recurrenceType());
-        const auto it = std::lower_bound(dts.constBegin(), dts.constEnd(), start);
+        d->datesForInterval(interval, recurrenceType(), dts);
+        const auto it = std::lower_bound(dts.constBegin(), dts.constEnd(), startMSecs);
         if (it != dts.constEnd()) {
-            return *it <= end;
+            return *it <= endMSecs;
         }
         interval.increase(recurrenceType(), frequency());
-    } while (interval.intervalDateTime(recurrenceType()).isValid() &&
-             interval.intervalDateTime(recurrenceType()) < end);
+    } while (interval.intervalMSecs(recurrenceType()) < endMSecs);
 
     return false;
 }
@@ -1550,6 +2353,12 @@ bool RecurrenceRule::recursAt(const QDateTime &kdt) const
         return !(d->mDateStart.secsTo(dt) % d->mTimedRepetition);
     }
 
+    if (d->useSimpleRule()) {
+        const QDateTime occurrence = d->mSimpleRule.occurrence(dt.date());
+        const QTime time = dt.time();
+        return occurrence.isValid() && occurrence.time() == QTime(time.hour(), time.minute(), time.second());
+    }
+
     // The date must be in an appropriate interval (getNextValidDateInterval),
     // Plus it must match at least one of the constraints
     if (!dateMatchesRules(dt)) {
@@ -1600,6 +2409,13 @@ int RecurrenceRule::durationTo(const QDateTime &dt) const
         return static_cast<int>(d->mDateStart.secsTo(toDate) / d->mTimedRepetition);
     }
 
+    if (d->useSimpleRule()) {
+        if (d->mDuration == 0 && endDt().isValid() && toDate > endDt()) {
+            toDate = endDt();
+        }
+        return d->mSimpleRule.count(toDate);
+    }
+
     return timesInInterval(d->mDateStart, toDate).count();
 }
 
@@ -1632,11 +2448,17 @@ QDateTime RecurrenceRule::getPreviousDate(const QDateTime &afterDate) const
         return prev >= d->mDateStart ? prev : QDateTime();
     }
 
+    if (d->useSimpleRule()) {
+        QDateTime before = toDate;
+        if (d->mDuration >= 0 && endDt().isValid() && toDate > endDt()) {
+            before = endDt().addSecs(1);
+        }
+        return d->mSimpleRule.previous(before);
+    }
+
     // If we have a cache (duration given), use that
     if (d->mDuration > 0) {
-        if (!d->mCached) {
-            d->buildCache();
-        }
+        d->ensureCache();
         const auto it = strictLowerBound(d->mCachedDates.constBegin(), d->mCachedDates.constEnd(), toDate);
         if (it != d->mCachedDates.constEnd()) {
             return *it;
@@ -1649,26 +2471,23 @@ QDateTime RecurrenceRule::getPreviousDate(const QDateTime &afterDate) const
         prev = endDt().addSecs(1).toTimeZone(d->mDateStart.timeZone());
     }
 
+    const qint64 start = d->mStartMSecs;
     Constraint interval(d->getPreviousValidDateInterval(prev, recurrenceType()));
-    const auto dts = d->datesForInterval(interval, recurrenceType());
-    const auto it = strictLowerBound(dts.begin(), dts.end(), prev);
-    if (it != dts.end()) {
-        return ((*it) >= d->mDateStart) ? (*it) : QDateTime();
+    DateTimeBuffer dts;
+    d->datesForInterval(interval, recurrenceType(), dts);
+    const auto it = strictLowerBound(dts.constBegin(), dts.constEnd(), prev.toMSecsSinceEpoch());
+    if (it != dts.constEnd()) {
+        return ((*it) >= start) ? d->toDateTime(*it) : QDateTime();
     }
 
     // Previous interval. As soon as we find an occurrence, we're done.
-    while (interval.intervalDateTime(recurrenceType()) > d->mDateStart) {
+    for (qint64 msecs = interval.intervalMSecs(recurrenceType());
+            msecs != InvalidMSecs && msecs > start; msecs = interval.intervalMSecs(recurrenceType())) {
         interval.increase(recurrenceType(), -int(frequency()));
-        // The returned date list is sorted
-        auto dts = d->datesForInterval(interval, recurrenceType());
-        // The list is sorted, so take the last one.
+        // The returned date list is sorted, so take the last one.
+        d->datesForInterval(interval, recurrenceType(), dts);
         if (!dts.isEmpty()) {
-            prev = dts.last();
-            if (prev.isValid() && prev >= d->mDateStart) {
-                return prev;
-            } else {
-                return QDateTime();
-            }
+            return dts.last() >= start ? d->toDateTime(dts.last()) : QDateTime();
         }
     }
     return QDateTime();
@@ -1695,25 +2514,30 @@ QDateTime RecurrenceRule::getNextDate(const QDateTime &preDate) const
         return d->mDuration < 0 || !endDt().isValid() || next <= endDt() ? next : QDateTime();
     }
 
+    if (d->useSimpleRule()) {
+        const QDateTime next = d->mSimpleRule.next(fromDate);
+        return d->mDuration < 0 || !endDt().isValid() || next <= endDt() ? next : QDateTime();
+    }
+
     if (d->mDuration > 0) {
-        if (!d->mCached) {
-            d->buildCache();
-        }
+        d->ensureCache();
         const auto it = std::upper_bound(d->mCachedDates.constBegin(), d->mCachedDates.constEnd(), fromDate);
         if (it != d->mCachedDates.constEnd()) {
             return *it;
         }
     }
 
-    QDateTime end = endDt();
+    const QDateTime end = endDt();
+    const qint64 endMSecs = end.isValid() ? end.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min();
     Constraint interval(d->getNextValidDateInterval(fromDate, recurrenceType()));
-    const auto dts = d->datesForInterval(interval, recurrenceType());
-    const auto it = std::upper_bound(dts.begin(), dts.end(), fromDate);
-    if (it != dts.end()) {
-        return (d->mDuration < 0 || *it <= end) ? *it : QDateTime();
+    DateTimeBuffer dts;
+    d->datesForInterval(interval, recurrenceType(), dts);
+    const auto it = std::upper_bound(dts.constBegin(), dts.constEnd(), fromDate.toMSecsSinceEpoch());
+    if (it != dts.constEnd()) {
+        return (d->mDuration < 0 || *it <= endMSecs) ? d->toDateTime(*it) : QDateTime();
     }
     interval.increase(recurrenceType(), frequency());
-    if (d->mDuration >= 0 && interval.intervalDateTime(recurrenceType()) > end) {
+    if (d->mDuration >= 0 && interval.intervalMSecs(recurrenceType()) > endMSecs) {
         return QDateTime();
     }
 
@@ -1722,18 +2546,17 @@ QDateTime RecurrenceRule::getNextDate(const QDateTime &preDate) const
     // TODO: some validity checks to avoid infinite loops for contradictory constraints
     int loop = 0;
     do {
-        auto dts = d->datesForInterval(interval, recurrenceType());
+        d->datesForInterval(interval, recurrenceType(), dts);
         if (!dts.isEmpty()) {
-            QDateTime ret(dts[0]);
-            if (d->mDuration >= 0 && ret > end) {
+            if (d->mDuration >= 0 && dts[0] > endMSecs) {
                 return QDateTime();
             } else {
-                return ret;
+                return d->toDateTime(dts[0]);
             }
         }
         interval.increase(recurrenceType(), frequency());
     } while (++loop < LOOP_LIMIT &&
-             (d->mDuration < 0 || interval.intervalDateTime(recurrenceType()) < end));
+             (d->mDuration < 0 || interval.intervalMSecs(recurrenceType()) < endMSecs));
     return QDateTime();
 }
 
@@ -1785,12 +2608,15 @@ QList<QDateTime> RecurrenceRule::timesInInterval(const QDateTime &dtStart,
         return result;
     }
 
+    if (d->useSimpleRule()) {
+        d->mSimpleRule.occurrences(start, enddt, 0, &result);
+        return result;
+    }
+
     QDateTime st = start;
     bool done = false;
     if (d->mDuration > 0) {
-        if (!d->mCached) {
-            d->buildCache();
-        }
+        d->ensureCache();
         if (d->mCachedDateEnd.isValid() && start > d->mCachedDateEnd) {
             return result;    // beyond end of recurrence
         }
@@ -1815,24 +2641,29 @@ QList<QDateTime> RecurrenceRule::timesInInterval(const QDateTime &dtStart,
         st = d->mCachedLastDate.addSecs(1);
     }
 
+    const QTimeZone &zone = d->mZoneOffsets->zone();
+    const qint64 endMSecs = enddt.toMSecsSinceEpoch();
+    const qint64 intervalEnd = end.toMSecsSinceEpoch();
     Constraint interval(d->getNextValidDateInterval(st, recurrenceType()));
+    DateTimeBuffer dts;
     int loop = 0;
     do {
-        auto dts = d->datesForInterval(interval, recurrenceType());
-        auto it = dts.begin();
-        auto itEnd = dts.end();
+        d->datesForInterval(interval, recurrenceType(), dts);
+        auto it = dts.constBegin();
         if (loop == 0) {
-            it = std::lower_bound(dts.begin(), dts.end(), st);
+            it = std::lower_bound(dts.constBegin(), dts.constEnd(), st.toMSecsSinceEpoch());
         }
-        itEnd = std::upper_bound(it, dts.end(), enddt);
-        if (itEnd != dts.end()) {
+        const auto itEnd = std::upper_bound(it, dts.constEnd(), endMSecs);
+        if (itEnd != dts.constEnd()) {
             loop = LOOP_LIMIT;
         }
-        std::copy(it, itEnd, std::back_inserter(result));
+        for (; it != itEnd; ++it) {
+            result += QDateTime::fromMSecsSinceEpoch(*it, zone);
+        }
         // Increase the interval.
         interval.increase(recurrenceType(), frequency());
     } while (++loop < LOOP_LIMIT &&
-             interval.intervalDateTime(recurrenceType()) < end);
+             interval.intervalMSecs(recurrenceType()) < intervalEnd);
     return result;
 }
 
@@ -1845,10 +2676,16 @@ Constraint RecurrenceRule::Private::getPreviousValidDateInterval(const QDateTime
                                                                  PeriodType type) const
 {
     long periods = 0;
-    QDateTime start = mDateStart;
-    QDateTime nextValid(start);
+    QDate start = mStartDate;
+    QDate nextValid = start;
+    int nextSecs = mStartSecs;
     int modifier = 1;
-    QDateTime toDate(dt.toTimeZone(start.timeZone()));
+    // Work on local dates in the rule's time zone, only sub-daily periods are
+    // counted in real time
+    const qint64 toMSecs = dt.toMSecsSinceEpoch();
+    QDate toDate;
+    int toSecs;
+    mZoneOffsets->toLocal(toMSecs, &toDate, &toSecs);
     // for super-daily recurrences, don't care about the time part
 
     // Find the #intervals since the dtstart and round to the next multiple of
@@ -1863,16 +2700,16 @@ Constraint RecurrenceRule::Private::getPreviousValidDateInterval(const QDateTime
         modifier *= 60;
         Q_FALLTHROUGH();
     case rSecondly:
-        periods = static_cast<int>(start.secsTo(toDate) / modifier);
+        periods = static_cast<int>((toMSecs - mStartMSecs) / 1000 / modifier);
         // round it down to the next lower multiple of frequency:
         if (mFrequency > 0) {
             periods = (periods / mFrequency) * mFrequency;
         }
-        nextValid = start.addSecs(modifier * periods);
+        mZoneOffsets->toLocal(mStartMSecs + 1000LL * modifier * periods, &nextValid, &nextSecs);
         break;
     case rWeekly:
-        toDate = toDate.addDays(-(7 + toDate.date().dayOfWeek() - mWeekStart) % 7);
-        start = start.addDays(-(7 + start.date().dayOfWeek() - mWeekStart) % 7);
+        toDate = toDate.addDays(-(7 + toDate.dayOfWeek() - mWeekStart) % 7);
+        start = start.addDays(-(7 + start.dayOfWeek() - mWeekStart) % 7);
         modifier *= 7;
         Q_FALLTHROUGH();
     case rDaily:
@@ -1884,31 +2721,30 @@ Constraint RecurrenceRule::Private::getPreviousValidDateInterval(const QDateTime
         nextValid = start.addDays(modifier * periods);
         break;
     case rMonthly: {
-        periods = 12 * (toDate.date().year() - start.date().year()) +
-                  (toDate.date().month() - start.date().month());
+        periods = 12 * (toDate.year() - start.year()) +
+                  (toDate.month() - start.month());
         // round it down to the next lower multiple of frequency:
         if (mFrequency > 0) {
             periods = (periods / mFrequency) * mFrequency;
         }
         // set the day to the first day of the month, so we don't have problems
         // with non-existent days like Feb 30 or April 31
-        start.setDate(QDate(start.date().year(), start.date().month(), 1));
-        nextValid.setDate(start.date().addMonths(periods));
+        nextValid = QDate(start.year(), start.month(), 1).addMonths(periods);
         break;
     }
     case rYearly:
-        periods = (toDate.date().year() - start.date().year());
+        periods = (toDate.year() - start.year());
         // round it down to the next lower multiple of frequency:
         if (mFrequency > 0) {
             periods = (periods / mFrequency) * mFrequency;
         }
-        nextValid.setDate(start.date().addYears(periods));
+        nextValid = start.addYears(periods);
         break;
     default:
         break;
     }
 
-    return Constraint(nextValid, type, mWeekStart);
+    return Constraint(mZoneOffsets, nextValid, nextSecs, type, mWeekStart);
 }
 
 // Find the date/time of the next occurrence at or after a date/time,
@@ -1920,10 +2756,16 @@ Constraint RecurrenceRule::Private::getNextValidDateInterval(const QDateTime &dt
 {
     // TODO: Simplify this!
     long periods = 0;
-    QDateTime start = mDateStart;
-    QDateTime nextValid(start);
+    QDate start = mStartDate;
+    QDate nextValid = start;
+    int nextSecs = mStartSecs;
     int modifier = 1;
-    QDateTime toDate(dt.toTimeZone(start.timeZone()));
+    // Work on local dates in the rule's time zone, only sub-daily periods are
+    // counted in real time
+    const qint64 toMSecs = dt.toMSecsSinceEpoch();
+    QDate toDate;
+    int toSecs;
+    mZoneOffsets->toLocal(toMSecs, &toDate, &toSecs);
     // for super-daily recurrences, don't care about the time part
 
     // Find the #intervals since the dtstart and round to the next multiple of
@@ -1938,17 +2780,17 @@ Constraint RecurrenceRule::Private::getNextValidDateInterval(const QDateTime &dt
         modifier *= 60;
         Q_FALLTHROUGH();
     case rSecondly:
-        periods = static_cast<int>(start.secsTo(toDate) / modifier);
+        periods = static_cast<int>((toMSecs - mStartMSecs) / 1000 / modifier);
         periods = qMax(0L, periods);
         if (periods > 0 && mFrequency > 0) {
             periods += (mFrequency - 1 - ((periods - 1) % mFrequency));
         }
-        nextValid = start.addSecs(modifier * periods);
+        mZoneOffsets->toLocal(mStartMSecs + 1000LL * modifier * periods, &nextValid, &nextSecs);
         break;
     case rWeekly:
         // correct both start date and current date to start of week
-        toDate = toDate.addDays(-(7 + toDate.date().dayOfWeek() - mWeekStart) % 7);
-        start = start.addDays(-(7 + start.date().dayOfWeek() - mWeekStart) % 7);
+        toDate = toDate.addDays(-(7 + toDate.dayOfWeek() - mWeekStart) % 7);
+        start = start.addDays(-(7 + start.dayOfWeek() - mWeekStart) % 7);
         modifier *= 7;
         Q_FALLTHROUGH();
     case rDaily:
@@ -1960,35 +2802,35 @@ Constraint RecurrenceRule::Private::getNextValidDateInterval(const QDateTime &dt
         nextValid = start.addDays(modifier * periods);
         break;
     case rMonthly: {
-        periods = 12 * (toDate.date().year() - start.date().year()) +
-                  (toDate.date().month() - start.date().month());
+        periods = 12 * (toDate.year() - start.year()) +
+                  (toDate.month() - start.month());
         periods = qMax(0L, periods);
         if (periods > 0 && mFrequency > 0) {
             periods += (mFrequency - 1 - ((periods - 1) % mFrequency));
         }
         // set the day to the first day of the month, so we don't have problems
         // with non-existent days like Feb 30 or April 31
-        start.setDate(QDate(start.date().year(), start.date().month(), 1));
-        nextValid.setDate(start.date().addMonths(periods));
+        nextValid = QDate(start.year(), start.month(), 1).addMonths(periods);
         break;
     }
     case rYearly:
-        periods = (toDate.date().year() - start.date().year());
+        periods = (toDate.year() - start.year());
         periods = qMax(0L, periods);
         if (periods > 0 && mFrequency > 0) {
             periods += (mFrequency - 1 - ((periods - 1) % mFrequency));
         }
-        nextValid.setDate(start.date().addYears(periods));
+        nextValid = start.addYears(periods);
         break;
     default:
         break;
     }
 
-    return Constraint(nextValid, type, mWeekStart);
+    return Constraint(mZoneOffsets, nextValid, nextSecs, type, mWeekStart);
 }
 
-QList<QDateTime> RecurrenceRule::Private::datesForInterval(const Constraint &interval,
-                                                                  PeriodType type) const
+// Fill the buffer with the sorted occurrences in the interval.
+void RecurrenceRule::Private::datesForInterval(const Constraint &interval, PeriodType type,
+                                               DateTimeBuffer &buffer) const
 {
     /* -) Loop through constraints,
        -) merge interval with each constraint
@@ -1996,53 +2838,74 @@ QList<QDateTime> RecurrenceRule::Private::datesForInterval(const Constraint &int
        -) if complete => add that one date to the date list
        -) Loop through all missing fields => For each add the resulting
     */
-    QList<QDateTime> lst;
+    buffer.clear();
     for (int i = 0, iend = mConstraints.count(); i < iend; ++i) {
         Constraint merged(interval);
         if (merged.merge(mConstraints[i])) {
             // If the information is incomplete, we can't use this constraint
             if (merged.year > 0 && merged.hour >= 0 && merged.minute >= 0 && merged.second >= 0) {
-                // We have a valid constraint, so get all datetimes that match it andd
-                // append it to all date/times of this interval
-                QList<QDateTime> lstnew = merged.dateTimes(type);
-                lst += lstnew;
+                // We have a valid constraint, so append all datetimes that match it
+                // to all date/times of this interval
+                merged.dateTimes(type, buffer);
             }
         }
     }
     // Sort it so we can apply the BySetPos. Also some logic relies on this being sorted
-    sortAndRemoveDuplicates(lst);
+    sortAndRemoveDuplicates(buffer);
 
-    /*if ( lst.isEmpty() ) {
-      qCDebug(KCALCORE_LOG) << "         No Dates in Interval";
-    } else {
-      qCDebug(KCALCORE_LOG) << "         Dates:";
-      for ( int i = 0, iend = lst.count();  i < iend;  ++i ) {
-        qCDebug(KCALCORE_LOG)<< "              -)" << dumpTime(lst[i]);
-      }
-      qCDebug(KCALCORE_LOG) << "       ---------------------";
-    }*/
     if (!mBySetPos.isEmpty()) {
-        auto tmplst = lst;
-        lst.clear();
+        const DateTimeBuffer all(buffer);
+        buffer.clear();
         for (int i = 0, iend = mBySetPos.count();  i < iend;  ++i) {
             int pos = mBySetPos[i];
             if (pos > 0) {
                 --pos;
             }
             if (pos < 0) {
-                pos += tmplst.count();
+                pos += all.count();
             }
-            if (pos >= 0 && pos < tmplst.count()) {
-                lst.append(tmplst[pos]);
+            if (pos >= 0 && pos < all.count()) {
+                buffer.append(all[pos]);
             }
         }
-        sortAndRemoveDuplicates(lst);
+        sortAndRemoveDuplicates(buffer);
     }
+}
 
-    return lst;
+QDateTime RecurrenceRule::Private::toDateTime(qint64 msecs) const
+{
+    return QDateTime::fromMSecsSinceEpoch(msecs, mZoneOffsets->zone());
 }
 //@endcond
 
+qint64 RecurrenceRule::approximateMemoryUsage() const
+{
+    using namespace MemorySize;
+    return sizeof(Private)
+           + heapSize(d->mRRule)
+           + heapSize(d->mDateStart) + heapSize(d->mDateEnd)
+           + heapSize(d->mBySeconds) + heapSize(d->mByMinutes) + heapSize(d->mByHours)
+           + heapSize(d->mByDays) + heapSize(d->mByMonthDays) + heapSize(d->mByYearDays)
+           + heapSize(d->mByWeekNumbers) + heapSize(d->mByMonths) + heapSize(d->mBySetPos)
+           + heapSize(d->mConstraints) + heapSize(d->mObservers) + d->mSimpleRule.approximateMemoryUsage()
+           + approximateCacheSize();
+}
+
+qint64 RecurrenceRule::approximateCacheSize() const
+{
+    // The cache is only written before mCached is set, and cleared by setDirty()
+    if (!d->mCached.loadAcquire()) {
+        return 0;
+    }
+    qint64 size = MemorySize::heapSize(d->mCachedDates)
+                  + MemorySize::heapSize(d->mCachedDateEnd) + MemorySize::heapSize(d->mCachedLastDate);
+    if (!d->mCachedDates.isEmpty()) {
+        // The dates all have the time spec of the start date
+        size += d->mCachedDates.count() * MemorySize::heapSize(d->mCachedDates.first());
+    }
+    return size;
+}
+
 void RecurrenceRule::dump() const
 {
 #ifndef NDEBUG
@@ -2261,7 +3124,7 @@ QDataStream &operator<<(QDataStream &out, const Constraint &c)
 {
     out << c.year << c.month << c.day << c.hour << c.minute << c.second
         << c.weekday << c.weekdaynr << c.weeknumber << c.yearday << c.weekstart;
-    serializeQTimeZoneAsSpec(out, c.timeZone);
+    serializeQTimeZoneAsSpec(out, c.offsets->zone());
     out << false; // for backwards compatibility
 
     return out;
@@ -2272,7 +3135,9 @@ QDataStream &operator>>(QDataStream &in, Constraint &c)
     bool secondOccurrence; // no longer used
     in >> c.year >> c.month >> c.day >> c.hour >> c.minute >> c.second
        >> c.weekday >> c.weekdaynr >> c.weeknumber >> c.yearday >> c.weekstart;
-    deserializeSpecAsQTimeZone(in, c.timeZone);
+    QTimeZone timeZone;
+    deserializeSpecAsQTimeZone(in, timeZone);
+    c.offsets = ZoneOffsets::forZone(timeZone);
     in >> secondOccurrence;
     return in;
 }
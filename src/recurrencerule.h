@@ -314,6 +314,21 @@ public:
     */
     void removeObserver(RuleObserver *observer);
 
+    /**
+      Returns the approximate number of bytes this rule takes in memory,
+      including approximateCacheSize().
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT qint64 approximateMemoryUsage() const;
+
+    /**
+      Returns the approximate number of bytes taken by the occurrences cached
+      for a rule with a fixed number of them, see duration(). The cache is
+      filled the first time occurrences of such a rule are looked for.
+      @since 5.13
+    */
+    Q_REQUIRED_RESULT qint64 approximateCacheSize() const;
+
     /**
       Debug output.
     */
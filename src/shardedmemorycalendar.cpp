@@ -0,0 +1,794 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the ShardedMemoryCalendar class.
+ */
+
+#include "shardedmemorycalendar.h"
+#include "memorycalendar.h"
+#include "memorysize_p.h"
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QThread>
+
+using namespace KCalendarCore;
+
+//@cond PRIVATE
+/**
+  A part of the calendar, with its own lock.
+
+  The write lock is recursive: changing an incidence may change others (e.g.
+  through relations) in the same thread. The shard observes itself, and
+  queues the notifications until the outermost write lock is released.
+*/
+class Q_DECL_HIDDEN KCalendarCore::ShardedMemoryCalendar::Shard
+    : public MemoryCalendar, public Calendar::CalendarObserver
+{
+public:
+    // What the shard told its observer while it was locked
+    struct Notification {
+        enum Type {
+            Added,
+            Changed,
+            AboutToBeDeleted,
+            Deleted,
+            Modified
+        };
+
+        Type type;
+        Incidence::Ptr incidence;
+        bool modified;
+    };
+
+    Shard(ShardedMemoryCalendar::Private *owner, const QTimeZone &timeZone)
+        : MemoryCalendar(timeZone),
+          mOwner(owner)
+    {
+        registerObserver(this);
+    }
+
+    ~Shard() override
+    {
+        unregisterObserver(this);
+    }
+
+    bool holdsWriteLock() const
+    {
+        return mWriter.loadAcquire() == QThread::currentThreadId();
+    }
+
+    void lockForWrite()
+    {
+        if (holdsWriteLock()) {
+            ++mWriteDepth;
+            return;
+        }
+        mLock.lockForWrite();
+        mWriter.storeRelease(QThread::currentThreadId());
+        mWriteDepth = 1;
+    }
+
+    // Releases the write lock, and delivers the notifications if it was the last one
+    void unlockAndNotify();
+
+    using Calendar::setDeletionTracking;
+
+    // Parents and children may live in different shards, so the relations
+    // are only kept by the ShardedMemoryCalendar, see Private::deliver()
+    void setupRelations(const Incidence::Ptr &incidence) override
+    {
+        Q_UNUSED(incidence);
+    }
+
+    void removeRelations(const Incidence::Ptr &incidence) override
+    {
+        Q_UNUSED(incidence);
+    }
+
+    /**
+      Locks the shard for reading, unless the thread is writing to it already.
+    */
+    class ReadLocker
+    {
+    public:
+        explicit ReadLocker(const Shard *shard)
+            : mShard(shard),
+              mLocked(!shard->holdsWriteLock())
+        {
+            if (mLocked) {
+                mShard->mLock.lockForRead();
+            }
+        }
+
+        ~ReadLocker()
+        {
+            if (mLocked) {
+                mShard->mLock.unlock();
+            }
+        }
+
+    private:
+        const Shard *const mShard;
+        const bool mLocked;
+    };
+
+    // Changes to incidences keep the shard locked from update() to updated()
+    void incidenceUpdate(const QString &uid, const QDateTime &recurrenceId) override
+    {
+        lockForWrite();
+        ++mOpenUpdates;
+        MemoryCalendar::incidenceUpdate(uid, recurrenceId);
+    }
+
+    void incidenceUpdated(const QString &uid, const QDateTime &recurrenceId) override;
+
+    void calendarModified(bool modified, Calendar *calendar) override
+    {
+        Q_UNUSED(calendar);
+        mPending.append({Notification::Modified, Incidence::Ptr(), modified});
+    }
+
+    void calendarIncidenceAdded(const Incidence::Ptr &incidence) override
+    {
+        mPending.append({Notification::Added, incidence, false});
+    }
+
+    void calendarIncidenceChanged(const Incidence::Ptr &incidence) override
+    {
+        mPending.append({Notification::Changed, incidence, false});
+    }
+
+    void calendarIncidenceAboutToBeDeleted(const Incidence::Ptr &incidence) override
+    {
+        mPending.append({Notification::AboutToBeDeleted, incidence, false});
+    }
+
+    void calendarIncidenceDeleted(const Incidence::Ptr &incidence, const Calendar *calendar) override
+    {
+        Q_UNUSED(calendar);
+        mPending.append({Notification::Deleted, incidence, false});
+    }
+
+    ShardedMemoryCalendar::Private *const mOwner;
+    mutable QReadWriteLock mLock;
+    QAtomicPointer<void> mWriter;      // thread holding the write lock
+    int mWriteDepth = 0;               // the members below belong to the writer
+    int mOpenUpdates = 0;              // incidenceUpdate() calls waiting for incidenceUpdated()
+    QVector<Notification> mPending;
+};
+
+class Q_DECL_HIDDEN KCalendarCore::ShardedMemoryCalendar::Private
+{
+public:
+    Private(ShardedMemoryCalendar *qq)
+        : q(qq)
+    {
+    }
+
+    Shard *shard(const QString &uid) const;
+
+    void setShard(const QString &uid, Shard *shard);
+
+    void deliver(const QVector<Shard::Notification> &notifications);
+
+    template <typename List, typename Func>
+    List collect(Func func) const;
+
+    ShardedMemoryCalendar *q;
+    QVector<Shard *> mShards;
+
+    /**
+     * Incidences live in the shard chosen by the hash of their uid when they
+     * were added. If their uid changes later, mMovedUids remembers where they are.
+     */
+    mutable QReadWriteLock mMovedLock;
+    QHash<QString, Shard *> mMovedUids;
+    QAtomicInt mMovedCount;
+
+    // Serializes the notifications, and the calendar-wide data updated with them
+    QMutex mNotifyMutex{QMutex::Recursive};
+};
+
+void ShardedMemoryCalendar::Shard::unlockAndNotify()
+{
+    Q_ASSERT(holdsWriteLock());
+    if (--mWriteDepth > 0) {
+        return;
+    }
+    QVector<Notification> pending;
+    pending.swap(mPending);
+    mWriter.storeRelease(nullptr);
+    mLock.unlock();
+
+    mOwner->deliver(pending);
+}
+
+void ShardedMemoryCalendar::Shard::incidenceUpdated(const QString &uid, const QDateTime &recurrenceId)
+{
+    lockForWrite();
+    MemoryCalendar::incidenceUpdated(uid, recurrenceId);
+    if (mOwner->shard(uid) != this && incidence(uid, recurrenceId)) {
+        mOwner->setShard(uid, this);
+    }
+    if (mOpenUpdates > 0) {
+        --mOpenUpdates;
+        unlockAndNotify();
+    }
+    unlockAndNotify();
+}
+
+ShardedMemoryCalendar::Shard *ShardedMemoryCalendar::Private::shard(const QString &uid) const
+{
+    if (mMovedCount.loadAcquire() > 0) {
+        QReadLocker locker(&mMovedLock);
+        if (Shard *shard = mMovedUids.value(uid)) {
+            return shard;
+        }
+    }
+    return mShards.at(qHash(uid) % uint(mShards.count()));
+}
+
+void ShardedMemoryCalendar::Private::setShard(const QString &uid, Shard *shard)
+{
+    QWriteLocker locker(&mMovedLock);
+    if (shard == mShards.at(qHash(uid) % uint(mShards.count()))) {
+        mMovedUids.remove(uid);
+    } else {
+        mMovedUids.insert(uid, shard);
+    }
+    mMovedCount.storeRelease(mMovedUids.count());
+}
+
+void ShardedMemoryCalendar::Private::deliver(const QVector<Shard::Notification> &notifications)
+{
+    if (notifications.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&mNotifyMutex);
+    for (const Shard::Notification &notification : notifications) {
+        const Incidence::Ptr &incidence = notification.incidence;
+        switch (notification.type) {
+        case Shard::Notification::Added:
+            q->notifyIncidenceAdded(incidence);
+            q->setupRelations(incidence);
+            break;
+        case Shard::Notification::Changed:
+            q->notifyIncidenceChanged(incidence);
+            break;
+        case Shard::Notification::AboutToBeDeleted:
+            q->notifyIncidenceAboutToBeDeleted(incidence);
+            q->removeRelations(incidence);
+            break;
+        case Shard::Notification::Deleted:
+            q->notifyIncidenceDeleted(incidence);
+            break;
+        case Shard::Notification::Modified:
+            q->setModified(notification.modified);
+            break;
+        }
+    }
+}
+
+template <typename List, typename Func>
+List ShardedMemoryCalendar::Private::collect(Func func) const
+{
+    List list;
+    for (const Shard *shard : mShards) {
+        const Shard::ReadLocker locker(shard);
+        list += func(shard);
+    }
+    return list;
+}
+//@endcond
+
+ShardedMemoryCalendar::ShardedMemoryCalendar(const QTimeZone &timeZone, int shardCount)
+    : Calendar(timeZone),
+      d(new KCalendarCore::ShardedMemoryCalendar::Private(this))
+{
+    d->mShards.reserve(qMax(shardCount, 1));
+    for (int i = 0; i < qMax(shardCount, 1); ++i) {
+        d->mShards.append(new Shard(d, timeZone));
+    }
+}
+
+ShardedMemoryCalendar::ShardedMemoryCalendar(const QByteArray &timeZoneId, int shardCount)
+    : Calendar(timeZoneId),
+      d(new KCalendarCore::ShardedMemoryCalendar::Private(this))
+{
+    d->mShards.reserve(qMax(shardCount, 1));
+    for (int i = 0; i < qMax(shardCount, 1); ++i) {
+        d->mShards.append(new Shard(d, timeZone()));
+    }
+}
+
+ShardedMemoryCalendar::~ShardedMemoryCalendar()
+{
+    close(); //NOLINT false clang-analyzer-optin.cplusplus.VirtualCall
+    qDeleteAll(d->mShards);
+    delete d;
+}
+
+int ShardedMemoryCalendar::shardCount() const
+{
+    return d->mShards.count();
+}
+
+void ShardedMemoryCalendar::close()
+{
+    setObserversEnabled(false);
+
+    for (Shard *shard : qAsConst(d->mShards)) {
+        shard->lockForWrite();
+        const Incidence::List incidences = shard->rawIncidences();
+        shard->close();
+        shard->unlockAndNotify();
+
+        // Keep the category index in line, like MemoryCalendar::close()
+        QMutexLocker locker(&d->mNotifyMutex);
+        for (const Incidence::Ptr &incidence : incidences) {
+            notifyIncidenceAboutToBeDeleted(incidence);
+        }
+    }
+
+    {
+        QWriteLocker locker(&d->mMovedLock);
+        d->mMovedUids.clear();
+        d->mMovedCount.storeRelease(0);
+    }
+
+    setModified(false);
+
+    setObserversEnabled(true);
+}
+
+bool ShardedMemoryCalendar::addIncidence(const Incidence::Ptr &incidence)
+{
+    Shard *shard = d->shard(incidence->uid());
+    shard->lockForWrite();
+    const bool added = shard->addIncidence(incidence);
+    shard->unlockAndNotify();
+    return added;
+}
+
+bool ShardedMemoryCalendar::addIncidences(const Incidence::List &incidences)
+{
+    QVector<Incidence::List> batches(d->mShards.count());
+    for (const Incidence::Ptr &incidence : incidences) {
+        batches[d->mShards.indexOf(d->shard(incidence->uid()))].append(incidence);
+    }
+
+    bool added = true;
+    for (int i = 0; i < batches.count(); ++i) {
+        if (batches.at(i).isEmpty()) {
+            continue;
+        }
+        Shard *shard = d->mShards.at(i);
+        shard->lockForWrite();
+        if (!shard->addIncidences(batches.at(i))) {
+            added = false;
+        }
+        shard->unlockAndNotify();
+    }
+    return added;
+}
+
+bool ShardedMemoryCalendar::deleteIncidence(const Incidence::Ptr &incidence)
+{
+    Shard *shard = d->shard(incidence->uid());
+    shard->lockForWrite();
+    shard->setDeletionTracking(deletionTracking());
+    const bool deleted = shard->deleteIncidence(incidence);
+    shard->unlockAndNotify();
+    return deleted;
+}
+
+bool ShardedMemoryCalendar::deleteIncidenceInstances(const Incidence::Ptr &incidence)
+{
+    Shard *shard = d->shard(incidence->uid());
+    shard->lockForWrite();
+    shard->setDeletionTracking(deletionTracking());
+    const bool deleted = shard->deleteIncidenceInstances(incidence);
+    shard->unlockAndNotify();
+    return deleted;
+}
+
+Incidence::Ptr ShardedMemoryCalendar::incidenceFromSchedulingID(const QString &sid) const
+{
+    // Prefer the master incidence over its exceptions, like MemoryCalendar
+    Incidence::Ptr found;
+    for (const Shard *shard : qAsConst(d->mShards)) {
+        const Shard::ReadLocker locker(shard);
+        const Incidence::Ptr incidence = shard->incidenceFromSchedulingID(sid);
+        if (incidence && (!found || !incidence->hasRecurrenceId())) {
+            found = incidence;
+            if (!found->hasRecurrenceId()) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+Incidence::List ShardedMemoryCalendar::incidencesFromSchedulingID(const QString &sid) const
+{
+    return d->collect<Incidence::List>([&sid](const Shard *shard) {
+        return shard->incidencesFromSchedulingID(sid);
+    });
+}
+
+void ShardedMemoryCalendar::clearNotebookAssociations()
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    Calendar::clearNotebookAssociations();
+}
+
+bool ShardedMemoryCalendar::setNotebook(const Incidence::Ptr &incidence, const QString &notebook)
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::setNotebook(incidence, notebook);
+}
+
+QString ShardedMemoryCalendar::notebook(const Incidence::Ptr &incidence) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::notebook(incidence);
+}
+
+QString ShardedMemoryCalendar::notebook(const QString &uid) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::notebook(uid);
+}
+
+QStringList ShardedMemoryCalendar::notebooks() const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::notebooks();
+}
+
+Incidence::List ShardedMemoryCalendar::incidences(const QString &notebook) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::incidences(notebook);
+}
+
+Incidence::List ShardedMemoryCalendar::duplicates(const Incidence::Ptr &incidence)
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::duplicates(incidence);
+}
+
+QStringList ShardedMemoryCalendar::categories() const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::categories();
+}
+
+Incidence::List ShardedMemoryCalendar::incidencesWithCategory(const QString &category) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::incidencesWithCategory(category);
+}
+
+Incidence::List ShardedMemoryCalendar::incidencesWithAttendee(const QString &email) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::incidencesWithAttendee(email);
+}
+
+QVector<Incidence::List> ShardedMemoryCalendar::duplicateGroups() const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::duplicateGroups();
+}
+
+bool ShardedMemoryCalendar::isAncestorOf(const Incidence::Ptr &ancestor, const Incidence::Ptr &incidence) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::isAncestorOf(ancestor, incidence);
+}
+
+Incidence::List ShardedMemoryCalendar::relations(const QString &uid) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::relations(uid);
+}
+
+Incidence::Ptr ShardedMemoryCalendar::relationParent(const QString &uid) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::relationParent(uid);
+}
+
+Calendar::RelationRollup ShardedMemoryCalendar::relationRollup(const QString &uid) const
+{
+    QMutexLocker locker(&d->mNotifyMutex);
+    return Calendar::relationRollup(uid);
+}
+
+bool ShardedMemoryCalendar::addEvent(const Event::Ptr &event)
+{
+    return addIncidence(event);
+}
+
+bool ShardedMemoryCalendar::deleteEvent(const Event::Ptr &event)
+{
+    return deleteIncidence(event);
+}
+
+bool ShardedMemoryCalendar::deleteEventInstances(const Event::Ptr &event)
+{
+    return deleteIncidenceInstances(event);
+}
+
+Event::List ShardedMemoryCalendar::rawEvents(EventSortField sortField, SortDirection sortDirection) const
+{
+    const Event::List events = d->collect<Event::List>([](const Shard *shard) {
+        return shard->rawEvents();
+    });
+    return Calendar::sortEvents(events, sortField, sortDirection);
+}
+
+Event::List ShardedMemoryCalendar::rawEvents(const QDate &start, const QDate &end,
+                                             const QTimeZone &timeZone, bool inclusive) const
+{
+    return d->collect<Event::List>([&](const Shard *shard) {
+        return shard->rawEvents(start, end, timeZone, inclusive);
+    });
+}
+
+Event::List ShardedMemoryCalendar::rawEventsForDate(const QDate &date, const QTimeZone &timeZone,
+                                                    EventSortField sortField,
+                                                    SortDirection sortDirection) const
+{
+    const Event::List events = d->collect<Event::List>([&](const Shard *shard) {
+        return shard->rawEventsForDate(date, timeZone);
+    });
+    return Calendar::sortEvents(events, sortField, sortDirection);
+}
+
+Event::List ShardedMemoryCalendar::rawEventsForDate(const QDateTime &dt) const
+{
+    return d->collect<Event::List>([&dt](const Shard *shard) {
+        return shard->rawEventsForDate(dt);
+    });
+}
+
+Event::Ptr ShardedMemoryCalendar::event(const QString &uid, const QDateTime &recurrenceId) const
+{
+    const Shard *shard = d->shard(uid);
+    const Shard::ReadLocker locker(shard);
+    return shard->event(uid, recurrenceId);
+}
+
+Event::Ptr ShardedMemoryCalendar::deletedEvent(const QString &uid, const QDateTime &recurrenceId) const
+{
+    const Shard *shard = d->shard(uid);
+    const Shard::ReadLocker locker(shard);
+    return shard->deletedEvent(uid, recurrenceId);
+}
+
+Event::List ShardedMemoryCalendar::deletedEvents(EventSortField sortField, SortDirection sortDirection) const
+{
+    const Event::List events = d->collect<Event::List>([](const Shard *shard) {
+        return shard->deletedEvents();
+    });
+    return Calendar::sortEvents(events, sortField, sortDirection);
+}
+
+Event::List ShardedMemoryCalendar::eventInstances(const Incidence::Ptr &event,
+                                                  EventSortField sortField,
+                                                  SortDirection sortDirection) const
+{
+    const Shard *shard = d->shard(event->uid());
+    const Shard::ReadLocker locker(shard);
+    return shard->eventInstances(event, sortField, sortDirection);
+}
+
+bool ShardedMemoryCalendar::addTodo(const Todo::Ptr &todo)
+{
+    return addIncidence(todo);
+}
+
+bool ShardedMemoryCalendar::deleteTodo(const Todo::Ptr &todo)
+{
+    return deleteIncidence(todo);
+}
+
+bool ShardedMemoryCalendar::deleteTodoInstances(const Todo::Ptr &todo)
+{
+    return deleteIncidenceInstances(todo);
+}
+
+Todo::List ShardedMemoryCalendar::rawTodos(TodoSortField sortField, SortDirection sortDirection) const
+{
+    const Todo::List todos = d->collect<Todo::List>([](const Shard *shard) {
+        return shard->rawTodos();
+    });
+    return Calendar::sortTodos(todos, sortField, sortDirection);
+}
+
+Todo::List ShardedMemoryCalendar::rawTodos(const QDate &start, const QDate &end,
+                                           const QTimeZone &timeZone, bool inclusive) const
+{
+    return d->collect<Todo::List>([&](const Shard *shard) {
+        return shard->rawTodos(start, end, timeZone, inclusive);
+    });
+}
+
+Todo::List ShardedMemoryCalendar::rawTodosForDate(const QDate &date) const
+{
+    return d->collect<Todo::List>([&date](const Shard *shard) {
+        return shard->rawTodosForDate(date);
+    });
+}
+
+Todo::Ptr ShardedMemoryCalendar::todo(const QString &uid, const QDateTime &recurrenceId) const
+{
+    const Shard *shard = d->shard(uid);
+    const Shard::ReadLocker locker(shard);
+    return shard->todo(uid, recurrenceId);
+}
+
+Todo::Ptr ShardedMemoryCalendar::deletedTodo(const QString &uid, const QDateTime &recurrenceId) const
+{
+    const Shard *shard = d->shard(uid);
+    const Shard::ReadLocker locker(shard);
+    return shard->deletedTodo(uid, recurrenceId);
+}
+
+Todo::List ShardedMemoryCalendar::deletedTodos(TodoSortField sortField, SortDirection sortDirection) const
+{
+    const Todo::List todos = d->collect<Todo::List>([](const Shard *shard) {
+        return shard->deletedTodos();
+    });
+    return Calendar::sortTodos(todos, sortField, sortDirection);
+}
+
+Todo::List ShardedMemoryCalendar::todoInstances(const Incidence::Ptr &todo,
+                                                TodoSortField sortField,
+                                                SortDirection sortDirection) const
+{
+    const Shard *shard = d->shard(todo->uid());
+    const Shard::ReadLocker locker(shard);
+    return shard->todoInstances(todo, sortField, sortDirection);
+}
+
+bool ShardedMemoryCalendar::addJournal(const Journal::Ptr &journal)
+{
+    return addIncidence(journal);
+}
+
+bool ShardedMemoryCalendar::deleteJournal(const Journal::Ptr &journal)
+{
+    return deleteIncidence(journal);
+}
+
+bool ShardedMemoryCalendar::deleteJournalInstances(const Journal::Ptr &journal)
+{
+    return deleteIncidenceInstances(journal);
+}
+
+Journal::List ShardedMemoryCalendar::rawJournals(JournalSortField sortField, SortDirection sortDirection) const
+{
+    const Journal::List journals = d->collect<Journal::List>([](const Shard *shard) {
+        return shard->rawJournals();
+    });
+    return Calendar::sortJournals(journals, sortField, sortDirection);
+}
+
+Journal::List ShardedMemoryCalendar::rawJournalsForDate(const QDate &date) const
+{
+    return d->collect<Journal::List>([&date](const Shard *shard) {
+        return shard->rawJournalsForDate(date);
+    });
+}
+
+Journal::Ptr ShardedMemoryCalendar::journal(const QString &uid, const QDateTime &recurrenceId) const
+{
+    const Shard *shard = d->shard(uid);
+    const Shard::ReadLocker locker(shard);
+    return shard->journal(uid, recurrenceId);
+}
+
+Journal::Ptr ShardedMemoryCalendar::deletedJournal(const QString &uid, const QDateTime &recurrenceId) const
+{
+    const Shard *shard = d->shard(uid);
+    const Shard::ReadLocker locker(shard);
+    return shard->deletedJournal(uid, recurrenceId);
+}
+
+Journal::List ShardedMemoryCalendar::deletedJournals(JournalSortField sortField, SortDirection sortDirection) const
+{
+    const Journal::List journals = d->collect<Journal::List>([](const Shard *shard) {
+        return shard->deletedJournals();
+    });
+    return Calendar::sortJournals(journals, sortField, sortDirection);
+}
+
+Journal::List ShardedMemoryCalendar::journalInstances(const Incidence::Ptr &journal,
+                                                      JournalSortField sortField,
+                                                      SortDirection sortDirection) const
+{
+    const Shard *shard = d->shard(journal->uid());
+    const Shard::ReadLocker locker(shard);
+    return shard->journalInstances(journal, sortField, sortDirection);
+}
+
+Alarm::List ShardedMemoryCalendar::alarms(const QDateTime &from, const QDateTime &to,
+                                          bool excludeBlockedAlarms) const
+{
+    Alarm::List alarms;
+    for (Shard *shard : qAsConst(d->mShards)) {
+        // Looking for alarms moves the shard's incidences along its alarm timeline
+        shard->lockForWrite();
+        alarms += shard->alarms(from, to, excludeBlockedAlarms);
+        shard->unlockAndNotify();
+    }
+    return alarms;
+}
+
+void ShardedMemoryCalendar::doSetTimeZone(const QTimeZone &timeZone)
+{
+    for (Shard *shard : qAsConst(d->mShards)) {
+        shard->lockForWrite();
+        shard->setTimeZone(timeZone);
+        shard->unlockAndNotify();
+    }
+}
+
+void ShardedMemoryCalendar::virtual_hook(int id, void *data)
+{
+    switch (id) {
+    case ApproximateMemoryUsageHook: {
+        MemoryUsage *usage = static_cast<MemoryUsage *>(data);
+        {
+            QMutexLocker locker(&d->mNotifyMutex);
+            Calendar::virtual_hook(id, data);
+        }
+        // The incidences are counted above already, through rawIncidences()
+        for (const Shard *shard : qAsConst(d->mShards)) {
+            const Shard::ReadLocker locker(shard);
+            const MemoryUsage shardUsage = shard->approximateMemoryUsage();
+            usage->indexes += shardUsage.indexes;
+            usage->tombstones += shardUsage.tombstones;
+        }
+        QReadLocker locker(&d->mMovedLock);
+        usage->indexes += MemorySize::heapSize(d->mShards) + MemorySize::heapSize(d->mMovedUids);
+        break;
+    }
+    case QueryHook: {
+        // The category and notebook indexes are calendar-wide data
+        QMutexLocker locker(&d->mNotifyMutex);
+        Calendar::virtual_hook(id, data);
+        break;
+    }
+    default:
+        Calendar::virtual_hook(id, data);
+        break;
+    }
+}
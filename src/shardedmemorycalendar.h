@@ -0,0 +1,440 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the ShardedMemoryCalendar class.
+
+  An in-memory calendar which can be used from several threads at once.
+ */
+#ifndef KCALCORE_SHARDEDMEMORYCALENDAR_H
+#define KCALCORE_SHARDEDMEMORYCALENDAR_H
+
+#include "kcalendarcore_export.h"
+#include "calendar.h"
+
+namespace KCalendarCore
+{
+/**
+  @brief
+  This class provides a calendar stored in memory which several threads
+  may read and write at the same time.
+
+  The incidences are spread over a number of MemoryCalendar shards by the
+  hash of their uid. Each shard has its own reader-writer lock, so threads
+  working on incidences of different shards don't wait for each other, and
+  any number of threads may read the same shard.
+
+  Changing an incidence of the calendar in place locks its shard for
+  writing from IncidenceBase::update() (or startUpdates()) until the
+  matching IncidenceBase::updated() (or endUpdates()). Don't keep changes
+  to incidences of different shards open at the same time in different
+  threads, that can deadlock. The incidences returned by the calendar are
+  shared: reading them while another thread changes them is not safe.
+
+  Observers are called on the thread which made the change, after the
+  shard has been unlocked, so they may use the calendar. Notifications
+  from different threads are serialized, and so are the changes to the
+  calendar-wide data like categories, relations and notebooks they come
+  with. The functions of this class reading that data are synchronized
+  with them. Some of them are not virtual in Calendar, like categories()
+  or relations(): called through a Calendar pointer or reference, they
+  are not synchronized.
+  CalendarObserver::calendarIncidenceAboutToBeDeleted() is called when the
+  incidence has already been removed from its shard.
+
+  @since 5.13
+*/
+class KCALENDARCORE_EXPORT ShardedMemoryCalendar : public Calendar
+{
+    Q_OBJECT
+public:
+
+    /**
+      A shared pointer to a ShardedMemoryCalendar
+    */
+    typedef QSharedPointer<ShardedMemoryCalendar> Ptr;
+
+    /**
+      Constructs a calendar with a specified time zone @p timeZone, split
+      into @p shardCount shards.
+    */
+    explicit ShardedMemoryCalendar(const QTimeZone &timeZone, int shardCount = 16);
+
+    /**
+      Construct a calendar with a time zone given by its @p timeZoneId,
+      split into @p shardCount shards.
+    */
+    explicit ShardedMemoryCalendar(const QByteArray &timeZoneId, int shardCount = 16);
+
+    /**
+      @copydoc Calendar::~Calendar()
+    */
+    ~ShardedMemoryCalendar() override;
+
+    /**
+      Returns the number of shards.
+    */
+    Q_REQUIRED_RESULT int shardCount() const;
+
+    /**
+      Clears out the current calendar, freeing all used memory etc. etc.
+    */
+    void close() override;
+
+    /**
+      @copydoc Calendar::addIncidence()
+    */
+    bool addIncidence(const Incidence::Ptr &incidence) override;
+
+    /**
+      Inserts a list of Incidences into the calendar.
+
+      Each shard is locked once, for adding all of its incidences with
+      MemoryCalendar::addIncidences(). Like that, this doesn't go through
+      addIncidence() or the type specific add functions.
+
+      @param incidences is the list of Incidences to insert.
+      @return true if all Incidences were successfully inserted; false otherwise.
+    */
+    bool addIncidences(const Incidence::List &incidences);
+
+    /**
+      @copydoc Calendar::deleteIncidence()
+    */
+    bool deleteIncidence(const Incidence::Ptr &incidence) override;
+
+    /**
+       @copydoc Calendar::deleteIncidenceInstances
+    */
+    bool deleteIncidenceInstances(const Incidence::Ptr &incidence) override;
+
+    /**
+      @copydoc Calendar::incidenceFromSchedulingID()
+    */
+    Q_REQUIRED_RESULT Incidence::Ptr incidenceFromSchedulingID(const QString &sid) const override;
+
+    /**
+      @copydoc Calendar::incidencesFromSchedulingID()
+    */
+    Q_REQUIRED_RESULT Incidence::List incidencesFromSchedulingID(const QString &sid) const override;
+
+    // Notebook Specific Methods //
+
+    /**
+      @copydoc Calendar::clearNotebookAssociations()
+    */
+    void clearNotebookAssociations() override;
+
+    /**
+      @copydoc Calendar::setNotebook()
+    */
+    bool setNotebook(const Incidence::Ptr &incidence, const QString &notebook) override;
+
+    /**
+      @copydoc Calendar::notebook(const Incidence::Ptr &)const
+    */
+    Q_REQUIRED_RESULT QString notebook(const Incidence::Ptr &incidence) const override;
+
+    /**
+      @copydoc Calendar::notebook(const QString &)const
+    */
+    Q_REQUIRED_RESULT QString notebook(const QString &uid) const override;
+
+    /**
+      @copydoc Calendar::notebooks()
+    */
+    Q_REQUIRED_RESULT QStringList notebooks() const override;
+
+    /**
+      @copydoc Calendar::incidences(const QString &)const
+    */
+    Q_REQUIRED_RESULT Incidence::List incidences(const QString &notebook) const override;
+
+    /**
+      @copydoc Calendar::duplicates()
+    */
+    Q_REQUIRED_RESULT Incidence::List duplicates(const Incidence::Ptr &incidence) override;
+
+    // Calendar-wide Index Methods //
+    // These hide the functions of Calendar, which are not virtual.
+
+    /**
+      @copydoc Calendar::categories()
+    */
+    Q_REQUIRED_RESULT QStringList categories() const;
+
+    /**
+      @copydoc Calendar::incidencesWithCategory()
+    */
+    Q_REQUIRED_RESULT Incidence::List incidencesWithCategory(const QString &category) const;
+
+    /**
+      @copydoc Calendar::incidencesWithAttendee()
+    */
+    Q_REQUIRED_RESULT Incidence::List incidencesWithAttendee(const QString &email) const;
+
+    /**
+      @copydoc Calendar::duplicateGroups()
+    */
+    Q_REQUIRED_RESULT QVector<Incidence::List> duplicateGroups() const;
+
+    /**
+      @copydoc Calendar::isAncestorOf()
+    */
+    bool isAncestorOf(const Incidence::Ptr &ancestor, const Incidence::Ptr &incidence) const;
+
+    /**
+      @copydoc Calendar::relations()
+    */
+    Incidence::List relations(const QString &uid) const;
+
+    /**
+      @copydoc Calendar::relationParent()
+    */
+    Q_REQUIRED_RESULT Incidence::Ptr relationParent(const QString &uid) const;
+
+    /**
+      @copydoc Calendar::relationRollup()
+    */
+    Q_REQUIRED_RESULT RelationRollup relationRollup(const QString &uid) const;
+
+    // Event Specific Methods //
+
+    /**
+      @copydoc Calendar::addEvent()
+    */
+    bool addEvent(const Event::Ptr &event) override;
+
+    /**
+      @copydoc Calendar::deleteEvent()
+    */
+    bool deleteEvent(const Event::Ptr &event) override;
+
+    /**
+      @copydoc Calendar::deleteEventInstances()
+    */
+    bool deleteEventInstances(const Event::Ptr &event) override;
+
+    /**
+      @copydoc Calendar::rawEvents(EventSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Event::List rawEvents(
+        EventSortField sortField = EventSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+      @copydoc Calendar::rawEvents(const QDate &, const QDate &, const QTimeZone &, bool)const
+    */
+    Q_REQUIRED_RESULT Event::List rawEvents(const QDate &start, const QDate &end,
+                          const QTimeZone &timeZone = {},
+                          bool inclusive = false) const override;
+
+    /**
+      @copydoc Calendar::rawEventsForDate(const QDate &, const QTimeZone &, EventSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Event::List rawEventsForDate(
+        const QDate &date, const QTimeZone &timeZone = {},
+        EventSortField sortField = EventSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+      @copydoc Calendar::rawEventsForDate(const QDateTime &)const
+    */
+    Q_REQUIRED_RESULT Event::List rawEventsForDate(const QDateTime &dt) const override;
+
+    /**
+      @copydoc Calendar::event()
+    */
+    Q_REQUIRED_RESULT Event::Ptr event(const QString &uid, const QDateTime &recurrenceId = {}) const override;
+
+    /**
+      @copydoc Calendar::deletedEvent()
+    */
+    Q_REQUIRED_RESULT Event::Ptr deletedEvent(const QString &uid, const QDateTime &recurrenceId = {}) const override;
+
+    /**
+      @copydoc Calendar::deletedEvents(EventSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Event::List deletedEvents(
+        EventSortField sortField = EventSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+      @copydoc Calendar::eventInstances(const Incidence::Ptr &, EventSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Event::List eventInstances(
+        const Incidence::Ptr &event,
+        EventSortField sortField = EventSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    // To-do Specific Methods //
+
+    /**
+      @copydoc Calendar::addTodo()
+    */
+    bool addTodo(const Todo::Ptr &todo) override;
+
+    /**
+      @copydoc Calendar::deleteTodo()
+    */
+    bool deleteTodo(const Todo::Ptr &todo) override;
+
+    /**
+      @copydoc Calendar::deleteTodoInstances()
+    */
+    bool deleteTodoInstances(const Todo::Ptr &todo) override;
+
+    /**
+      @copydoc Calendar::rawTodos(TodoSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Todo::List rawTodos(
+        TodoSortField sortField = TodoSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+       @copydoc Calendar::rawTodos(const QDate &, const QDate &, const QTimeZone &, bool)const
+    */
+    Q_REQUIRED_RESULT Todo::List rawTodos(
+        const QDate &start, const QDate &end,
+        const QTimeZone &timeZone = {},
+        bool inclusive = false) const override;
+
+    /**
+      @copydoc Calendar::rawTodosForDate()
+    */
+    Q_REQUIRED_RESULT Todo::List rawTodosForDate(const QDate &date) const override;
+
+    /**
+      @copydoc Calendar::todo()
+    */
+    Q_REQUIRED_RESULT Todo::Ptr todo(const QString &uid, const QDateTime &recurrenceId = {}) const override;
+
+    /**
+      @copydoc Calendar::deletedTodo()
+    */
+    Q_REQUIRED_RESULT Todo::Ptr deletedTodo(const QString &uid, const QDateTime &recurrenceId = {}) const override;
+
+    /**
+      @copydoc Calendar::deletedTodos(TodoSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Todo::List deletedTodos(
+        TodoSortField sortField = TodoSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+      @copydoc Calendar::todoInstances(const Incidence::Ptr &, TodoSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Todo::List todoInstances(const Incidence::Ptr &todo,
+                             TodoSortField sortField = TodoSortUnsorted,
+                             SortDirection sortDirection = SortDirectionAscending) const override;
+
+    // Journal Specific Methods //
+
+    /**
+      @copydoc Calendar::addJournal()
+    */
+    bool addJournal(const Journal::Ptr &journal) override;
+
+    /**
+      @copydoc Calendar::deleteJournal()
+    */
+    bool deleteJournal(const Journal::Ptr &journal) override;
+
+    /**
+      @copydoc Calendar::deleteJournalInstances()
+    */
+    bool deleteJournalInstances(const Journal::Ptr &journal) override;
+
+    /**
+      @copydoc Calendar::rawJournals()
+    */
+    Q_REQUIRED_RESULT Journal::List rawJournals(
+        JournalSortField sortField = JournalSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+      @copydoc Calendar::rawJournalsForDate()
+    */
+    Q_REQUIRED_RESULT Journal::List rawJournalsForDate(const QDate &date) const override;
+
+    /**
+      @copydoc Calendar::journal()
+    */
+    Journal::Ptr journal(const QString &uid, const QDateTime &recurrenceId = {}) const override;
+
+    /**
+      @copydoc Calendar::deletedJournal()
+    */
+    Journal::Ptr deletedJournal(const QString &uid, const QDateTime &recurrenceId = {}) const override;
+
+    /**
+      @copydoc Calendar::deletedJournals(JournalSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Journal::List deletedJournals(
+        JournalSortField sortField = JournalSortUnsorted,
+        SortDirection sortDirection = SortDirectionAscending) const override;
+
+    /**
+      @copydoc Calendar::journalInstances(const Incidence::Ptr &,
+                                          JournalSortField, SortDirection)const
+    */
+    Q_REQUIRED_RESULT Journal::List journalInstances(const Incidence::Ptr &journal,
+                                   JournalSortField sortField = JournalSortUnsorted,
+                                   SortDirection sortDirection = SortDirectionAscending) const override;
+
+    // Alarm Specific Methods //
+
+    /**
+      @copydoc Calendar::alarms()
+    */
+    Q_REQUIRED_RESULT Alarm::List alarms(const QDateTime &from, const QDateTime &to,
+                                         bool excludeBlockedAlarms = false) const override;
+
+    using QObject::event;   // prevent warning about hidden virtual method
+
+protected:
+    /**
+      @copydoc Calendar::doSetTimeZone(const QTimeZone &)
+    */
+    void doSetTimeZone(const QTimeZone &timeZone) override;
+
+    /**
+      @copydoc IncidenceBase::virtual_hook()
+
+      Calendar::approximateMemoryUsage() includes the indexes and tombstones
+      of all shards, and Calendar::query() locks the calendar-wide indexes.
+    */
+    void virtual_hook(int id, void *data) override;
+
+private:
+    //@cond PRIVATE
+    class Shard;
+    class Private;
+    Private *const d;
+    //@endcond
+
+    Q_DISABLE_COPY(ShardedMemoryCalendar)
+};
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KCALCORE_STRINGPOOL_P_H
+#define KCALCORE_STRINGPOOL_P_H
+
+#include "memorysize_p.h"
+
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+namespace KCalendarCore {
+
+/**
+  A pool of interned strings.
+
+  Categories, email addresses, custom property names and the like repeat
+  across many incidences. Passing them through intern() makes equal strings
+  share their data instead of each incidence holding its own copy. Two
+  strings interned in the same pool are equal exactly if their constData()
+  pointers are.
+
+  The pool keeps its strings alive until squeeze() drops those which are
+  no longer used anywhere else.
+
+  @internal
+*/
+class StringPool
+{
+public:
+    /**
+      Returns the pooled string equal to @p string, adding it if needed.
+    */
+    QString intern(const QString &string)
+    {
+        if (string.isEmpty()) {
+            return string;
+        }
+        const auto it = mStrings.constFind(string);
+        if (it != mStrings.cend()) {
+            return *it;
+        }
+        mStrings.insert(string);
+        return string;
+    }
+
+    /**
+      Returns the pooled byte array equal to @p bytes, adding it if needed.
+    */
+    QByteArray intern(const QByteArray &bytes)
+    {
+        if (bytes.isEmpty()) {
+            return bytes;
+        }
+        const auto it = mByteArrays.constFind(bytes);
+        if (it != mByteArrays.cend()) {
+            return *it;
+        }
+        mByteArrays.insert(bytes);
+        return bytes;
+    }
+
+    /**
+      Interns each string of @p strings.
+    */
+    QStringList intern(const QStringList &strings)
+    {
+        QStringList list;
+        list.reserve(strings.count());
+        for (const QString &string : strings) {
+            list.append(intern(string));
+        }
+        return list;
+    }
+
+    /**
+      Drops the strings which only the pool refers to.
+    */
+    void squeeze()
+    {
+        for (auto it = mStrings.begin(); it != mStrings.end();) {
+            if (it->isDetached()) {
+                it = mStrings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (auto it = mByteArrays.begin(); it != mByteArrays.end();) {
+            if (it->isDetached()) {
+                it = mByteArrays.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /**
+      Returns the number of strings and byte arrays in the pool.
+    */
+    int count() const
+    {
+        return mStrings.count() + mByteArrays.count();
+    }
+
+    /**
+      Returns the approximate number of bytes taken by the pool itself.
+      The pooled strings are shared with the incidences and not counted.
+    */
+    qint64 approximateMemoryUsage() const
+    {
+        return MemorySize::heapSize(mStrings) + MemorySize::heapSize(mByteArrays);
+    }
+
+    void clear()
+    {
+        mStrings.clear();
+        mByteArrays.clear();
+    }
+
+private:
+    QSet<QString> mStrings;
+    QSet<QByteArray> mByteArrays;
+};
+
+}
+
+#endif
@@ -0,0 +1,264 @@
+/*
+  This file is part of the kcalcore library.
+
+  Copyright (c) 2019 The kcalcore developers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KCALCORE_TEXTINDEX_P_H
+#define KCALCORE_TEXTINDEX_P_H
+
+#include "incidence.h"
+#include "memorysize_p.h"
+
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+
+namespace KCalendarCore {
+
+/**
+  An inverted index over the words in the summary, description and location
+  of incidences.
+
+  Words are the runs of letters and digits, compared case-insensitively.
+  Each incidence has a weight for each of its words: the number of times the
+  word occurs, counting those in the summary four times and those in the
+  location twice, as these say more about the incidence than the description.
+
+  The words are kept in a sorted map, so that searching for all words with a
+  given prefix is a range lookup. insert() only touches the words of an
+  incidence whose weight changed, so keeping the index up to date as
+  incidences change costs little more than splitting their texts into words.
+
+  @internal
+*/
+class TextIndex
+{
+public:
+    /**
+      A search result, with its relevance.
+    */
+    struct Match {
+        Incidence::Ptr incidence;
+        qreal score;
+    };
+
+    /**
+      Splits @p text into case-folded words.
+    */
+    static QStringList words(const QString &text)
+    {
+        QStringList words;
+        const QString folded = text.toCaseFolded();
+        int start = -1;
+        for (int i = 0, count = folded.size(); i <= count; ++i) {
+            if (i < count && folded.at(i).isLetterOrNumber()) {
+                if (start < 0) {
+                    start = i;
+                }
+            } else if (start >= 0) {
+                words.append(folded.mid(start, i - start));
+                start = -1;
+            }
+        }
+        return words;
+    }
+
+    /**
+      Indexes @p incidence, replacing what was indexed for it before.
+    */
+    void insert(const Incidence::Ptr &incidence)
+    {
+        Weights weights;
+        addWords(&weights, incidence->summary(), 4);
+        addWords(&weights, incidence->location(), 2);
+        addWords(&weights, incidence->description(), 1);
+
+        const Weights old = mWeights.value(incidence);
+        for (auto it = old.cbegin(), end = old.cend(); it != end; ++it) {
+            if (!weights.contains(it.key())) {
+                removePosting(it.key(), incidence);
+            }
+        }
+        for (auto it = weights.cbegin(), end = weights.cend(); it != end; ++it) {
+            if (old.value(it.key()) != it.value()) {
+                mPostings[it.key()].insert(incidence, it.value());
+            }
+        }
+        if (weights.isEmpty()) {
+            mWeights.remove(incidence);
+        } else {
+            mWeights.insert(incidence, weights);
+        }
+    }
+
+    /**
+      Removes @p incidence from the index. Returns false if it wasn't indexed.
+    */
+    bool remove(const Incidence::Ptr &incidence)
+    {
+        const auto it = mWeights.find(incidence);
+        if (it == mWeights.end()) {
+            return false;
+        }
+        for (auto word = it->cbegin(), end = it->cend(); word != end; ++word) {
+            removePosting(word.key(), incidence);
+        }
+        mWeights.erase(it);
+        return true;
+    }
+
+    void clear()
+    {
+        mPostings.clear();
+        mWeights.clear();
+    }
+
+    /**
+      Returns the number of indexed incidences.
+    */
+    int count() const
+    {
+        return mWeights.count();
+    }
+
+    /**
+      Returns the incidences containing all words of @p text, the most
+      relevant first. A word ending with '*' stands for all words starting
+      with it.
+
+      The relevance adds up the weights of the words found, each multiplied
+      by how rare the word is among the indexed incidences (its inverse
+      document frequency).
+    */
+    QVector<Match> search(const QString &text) const
+    {
+        QVector<Match> matches;
+        QVector<QHash<Incidence::Ptr, int>> terms;
+        const QStringList parts = text.simplified().split(QLatin1Char(' '), QString::SkipEmptyParts);
+        for (const QString &part : parts) {
+            const QStringList partWords = words(part);
+            for (int i = 0; i < partWords.count(); ++i) {
+                const bool prefix = i == partWords.count() - 1 && part.endsWith(QLatin1Char('*'));
+                terms.append(prefix ? prefixPostings(partWords.at(i)) : mPostings.value(partWords.at(i)));
+                if (terms.last().isEmpty()) {
+                    return matches;
+                }
+            }
+        }
+        if (terms.isEmpty()) {
+            return matches;
+        }
+
+        // Start from the rarest term, the others can only narrow it down
+        std::sort(terms.begin(), terms.end(), [](const QHash<Incidence::Ptr, int> &a, const QHash<Incidence::Ptr, int> &b) {
+            return a.count() < b.count();
+        });
+        QVector<qreal> idfs;
+        idfs.reserve(terms.count());
+        for (const auto &postings : qAsConst(terms)) {
+            idfs.append(std::log(1.0 + qreal(mWeights.count()) / postings.count()));
+        }
+        for (auto it = terms.first().cbegin(), end = terms.first().cend(); it != end; ++it) {
+            qreal score = it.value() * idfs.first();
+            bool found = true;
+            for (int i = 1; i < terms.count() && found; ++i) {
+                const int weight = terms.at(i).value(it.key());
+                found = weight > 0;
+                score += weight * idfs.at(i);
+            }
+            if (found) {
+                matches.append({it.key(), score});
+            }
+        }
+
+        std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+            if (a.score != b.score) {
+                return a.score > b.score;
+            }
+            return a.incidence->uid() < b.incidence->uid();
+        });
+        return matches;
+    }
+
+    /**
+      Returns the approximate number of bytes taken by the index. The words
+      are shared between the postings and the weights, and counted once.
+    */
+    qint64 approximateMemoryUsage() const
+    {
+        using namespace MemorySize;
+        qint64 size = heapSize(mPostings) + heapSize(mWeights);
+        for (auto it = mPostings.cbegin(), end = mPostings.cend(); it != end; ++it) {
+            size += heapSize(it.key()) + heapSize(it.value());
+        }
+        for (const Weights &weights : mWeights) {
+            size += heapSize(weights);
+        }
+        return size;
+    }
+
+private:
+    typedef QHash<QString, int> Weights;
+
+    static void addWords(Weights *weights, const QString &text, int weight)
+    {
+        const QStringList textWords = words(text);
+        for (const QString &word : textWords) {
+            (*weights)[word] += weight;
+        }
+    }
+
+    void removePosting(const QString &word, const Incidence::Ptr &incidence)
+    {
+        const auto it = mPostings.find(word);
+        if (it != mPostings.end()) {
+            it->remove(incidence);
+            if (it->isEmpty()) {
+                mPostings.erase(it);
+            }
+        }
+    }
+
+    // The incidences with a word starting with @p prefix, with the sum of their weights
+    QHash<Incidence::Ptr, int> prefixPostings(const QString &prefix) const
+    {
+        QHash<Incidence::Ptr, int> postings;
+        for (auto it = mPostings.lowerBound(prefix), end = mPostings.cend(); it != end && it.key().startsWith(prefix); ++it) {
+            if (postings.isEmpty()) {
+                postings = it.value();
+                continue;
+            }
+            for (auto posting = it->cbegin(), postingsEnd = it->cend(); posting != postingsEnd; ++posting) {
+                postings[posting.key()] += posting.value();
+            }
+        }
+        return postings;
+    }
+
+    QMap<QString, QHash<Incidence::Ptr, int>> mPostings; // word -> incidences with their weight
+    QHash<Incidence::Ptr, Weights> mWeights;              // the words of each incidence as indexed
+};
+
+}
+
+#endif
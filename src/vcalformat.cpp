@@ -38,6 +38,7 @@
 #include "calendar.h"
 #include "event.h"
 #include "exceptions.h"
+#include "pendingincidences_p.h"
 #include "todo.h"
 
 #include "kcalendarcore_debug.h"
@@ -1475,6 +1476,9 @@ void VCalFormat::populate(VObject *vcal, bool deleted, const QString &notebook)
     d->mEventsRelate.clear();
     d->mTodosRelate.clear();
 
+    // New incidences are added in one go after the loop, if the calendar allows it
+    PendingIncidences pending(d->mCalendar.data());
+
     initPropIterator(&i, vcal);
 
     // go through all the vobjects in the vcal
@@ -1507,6 +1511,9 @@ void VCalFormat::populate(VObject *vcal, bool deleted, const QString &notebook)
                     anEvent->setDtStart(dtStart);
                     anEvent->setDtEnd(dtEnd);
                 }
+                if (pending.contains(anEvent)) {
+                    pending.flush();
+                }
                 Event::Ptr old = !anEvent->hasRecurrenceId() ?
                                  d->mCalendar->event(anEvent->uid()) :
                                  d->mCalendar->event(anEvent->uid(), anEvent->recurrenceId());
@@ -1529,7 +1536,7 @@ void VCalFormat::populate(VObject *vcal, bool deleted, const QString &notebook)
                         d->mCalendar->deleteEvent(anEvent);   // and move it to deleted
                     }
                 } else {
-                    d->mCalendar->addEvent(anEvent);   // just add this one
+                    pending.add(anEvent);   // just add this one
                 }
             }
         } else if (strcmp(vObjectName(curVO), VCTodoProp) == 0) {
@@ -1550,6 +1557,9 @@ void VCalFormat::populate(VObject *vcal, bool deleted, const QString &notebook)
                         aTodo->setDtDue(dtDue);
                     }
                 }
+                if (pending.contains(aTodo)) {
+                    pending.flush();
+                }
                 Todo::Ptr old = !aTodo->hasRecurrenceId() ?
                                 d->mCalendar->todo(aTodo->uid()) :
                                 d->mCalendar->todo(aTodo->uid(), aTodo->recurrenceId());
@@ -1569,7 +1579,7 @@ void VCalFormat::populate(VObject *vcal, bool deleted, const QString &notebook)
                         d->mCalendar->deleteTodo(aTodo);   // and move it to deleted
                     }
                 } else {
-                    d->mCalendar->addTodo(aTodo);   // just add this one
+                    pending.add(aTodo);   // just add this one
                 }
             }
         } else if ((strcmp(vObjectName(curVO), VCVersionProp) == 0) ||
@@ -1587,6 +1597,7 @@ void VCalFormat::populate(VObject *vcal, bool deleted, const QString &notebook)
     SKIP:
         ;
     } // while
+    pending.flush();
 
     // Post-Process list of events with relations, put Event objects in relation
     Event::List::ConstIterator eIt;